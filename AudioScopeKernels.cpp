@@ -0,0 +1,426 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <imgui.h>
+#include "AudioScopeKernels.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCOPE_USE_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SCOPE_USE_NEON 1
+#endif
+
+using namespace std;
+
+namespace MEC
+{
+static const float INT16_TO_FLOAT = 1.f/INT16_MAX;
+// same values as 'AudioVectorScopeMode'
+static const int VECTOR_SCOPE_LISSAJOUS = 0;
+static const int VECTOR_SCOPE_LISSAJOUS_XY = 1;
+
+void AudioScopeWorkspace::Prepare(int iChans, int iSamples)
+{
+    if (iChans == iChannels && iSamples == iFftSize)
+        return;
+    iChannels = iChans;
+    iFftSize = iSamples;
+    aWaves.resize(iChans);
+    aFfts.resize(iChans);
+    aDbs.resize(iChans);
+    aDbShorts.resize(iChans);
+    aDbLongs.resize(iChans);
+    aDbMaxIndices.assign(iChans, -1);
+    aDecibels.assign(iChans, 0.f);
+    aWavePtrs.resize(iChans);
+    for (int i = 0; i < iChans; i++)
+    {
+        aWaves[i].create_type(iSamples, IM_DT_FLOAT32);
+        aFfts[i].create_type(iSamples, IM_DT_FLOAT32);
+        aDbs[i].create_type((iSamples >> 1) + 1, IM_DT_FLOAT32);
+        aDbShorts[i].create_type(20, IM_DT_FLOAT32);
+        aDbLongs[i].create_type(76, IM_DT_FLOAT32);
+        aWavePtrs[i] = (float*)aWaves[i].data;
+    }
+    aVectorOffsets.resize(iSamples);
+}
+
+void VectorScopeImage::Fade(uint8_t u8Amount)
+{
+    if (u8Amount == 0)
+        return;
+    uint32_t* pRgba = (uint32_t*)mImage.data;
+#if defined(SCOPE_USE_SSE2)
+    const __m128i vAmount = _mm_set1_epi8((char)u8Amount);
+#elif defined(SCOPE_USE_NEON)
+    const uint8x8_t vAmount = vdup_n_u8(u8Amount);
+#endif
+    // while the UI doesn't take the images the dark pixels would pile up, copy the whole image instead
+    if (aDarkPixels.size() > aPixelLit.size() / 8)
+    {
+        aDarkPixels.clear();
+        bCopyAll = true;
+    }
+    size_t szLit = 0;
+    for (size_t i = 0; i < aLitPixels.size(); i++)
+    {
+        const int32_t offset = aLitPixels[i];
+#if defined(SCOPE_USE_SSE2)
+        const uint32_t pixel = (uint32_t)_mm_cvtsi128_si32(_mm_subs_epu8(_mm_cvtsi32_si128((int)pRgba[offset]), vAmount));
+#elif defined(SCOPE_USE_NEON)
+        const uint32_t pixel = vget_lane_u32(vreinterpret_u32_u8(vqsub_u8(vreinterpret_u8_u32(vdup_n_u32(pRgba[offset])), vAmount)), 0);
+#else
+        uint32_t pixel = pRgba[offset];
+        uint8_t* pBytes = (uint8_t*)&pixel;
+        for (int j = 0; j < 4; j++)
+            pBytes[j] = pBytes[j] > u8Amount ? pBytes[j] - u8Amount : 0;
+#endif
+        pRgba[offset] = pixel;
+        // keep the lit pixels at the front, without a branch on the random pixel values
+        aLitPixels[szLit] = offset;
+        szLit += pixel != 0;
+        aPixelLit[offset] = pixel != 0;
+        if (pixel == 0 && !bCopyAll)
+            aDarkPixels.push_back(offset);
+    }
+    aLitPixels.resize(szLit);
+}
+
+void VectorScopeImage::Accumulate(const float* pLeft, const float* pRight, int iSamples, int iMode, float fZoom, int iWidth, int iHeight,
+        vector<int32_t>& aOffsets)
+{
+    if (mImage.w != iWidth || mImage.h != iHeight)
+    {
+        mImage.create_type(iWidth, iHeight, 4, IM_DT_INT8);
+        mImage.elempack = 4;
+        memset(mImage.data, 0, (size_t)iWidth * iHeight * 4);
+        aPixelLit.assign((size_t)iWidth * iHeight, 0);
+        aLitPixels.clear();
+        aDarkPixels.clear();
+        bCopyAll = true;
+    }
+    AccumulateVectorScope(pLeft, pRight, iSamples, iMode, fZoom, (uint8_t*)mImage.data, iWidth, iHeight, aOffsets);
+    for (int i = 0; i < iSamples; i++)
+    {
+        const int32_t offset = aOffsets[i];
+        if (!aPixelLit[offset])
+        {
+            aPixelLit[offset] = 1;
+            aLitPixels.push_back(offset);
+        }
+    }
+}
+
+void VectorScopeImage::CopyTo(ImGui::ImMat& mDst)
+{
+    if (mImage.empty())
+        return;
+    if (mDst.empty() || mDst.w != mImage.w || mDst.h != mImage.h || mDst.c != mImage.c || mDst.type != mImage.type)
+        mDst = mImage.clone();
+    else if (bCopyAll)
+        memcpy(mDst.data, mImage.data, (size_t)mImage.w * mImage.h * 4);
+    else
+    {
+        // a pixel changed since the last copy is either lit, or was faded to 0 (a dark one lit again is copied twice)
+        const uint32_t* pSrc = (const uint32_t*)mImage.data;
+        uint32_t* pDst = (uint32_t*)mDst.data;
+        for (auto offset : aLitPixels)
+            pDst[offset] = pSrc[offset];
+        for (auto offset : aDarkPixels)
+            pDst[offset] = pSrc[offset];
+    }
+    aDarkPixels.clear();
+    bCopyAll = false;
+}
+
+void BuildSpectrogramLut(float fLight, uint32_t* pLut)
+{
+    for (int i = 0; i < 256; i++)
+    {
+        // 'value' is the level shifted into [0, 127], as the spectrogram scale bar is drawn
+        const float value = min(i, 254) / 2.f;
+        const float light = value / 127.f;
+        const float hue = ((int)(value + 170) % 255) / 255.f;
+        pLut[i] = ImColor::HSV(hue, 1.0, light * fLight);
+    }
+}
+
+void SpectrogramRing::AddRow(const float* pDb, int iBins, float fOffset, const uint32_t* pLut)
+{
+    if (mImage.w != iBins)
+    {
+        mImage.create_type(iBins, ROWS, 4, IM_DT_INT8);
+        memset(mImage.data, 0, (size_t)iBins * ROWS * 4);
+        iWriteRow = 0;
+        iPendingRows = ROWS;
+    }
+    uint32_t* pRow = (uint32_t*)mImage.data + (size_t)iWriteRow * iBins;
+    const float fBias = 128 + fOffset;
+    for (int n = 0; n < iBins; n++)
+    {
+        // (clamp(db * sqrt2 + 64 + offset, -64, 63) + 64) * 2
+        const float fIdx = (pDb[n] * (float)M_SQRT2 + fBias) * 2;
+        const int idx = fIdx > 0 ? (int)min(fIdx, 254.f) : 0;
+        pRow[n] = pLut[idx];
+    }
+    iWriteRow = (iWriteRow + 1) % ROWS;
+    iPendingRows = min(iPendingRows + 1, ROWS);
+}
+
+void SpectrogramRing::CopyRowsTo(ImGui::ImMat& mDst, int& iDstWriteRow)
+{
+    if (mImage.empty())
+        return;
+    const size_t szRowBytes = (size_t)mImage.w * 4;
+    if (mDst.empty() || mDst.w != mImage.w || mDst.h != mImage.h || mDst.c != mImage.c || mDst.type != mImage.type)
+        mDst = mImage.clone();
+    else if (iPendingRows >= ROWS)
+        memcpy(mDst.data, mImage.data, szRowBytes * ROWS);
+    else
+    {
+        for (int i = 1; i <= iPendingRows; i++)
+        {
+            const int row = (iWriteRow - i + ROWS) % ROWS;
+            memcpy((uint8_t*)mDst.data + row * szRowBytes, (const uint8_t*)mImage.data + row * szRowBytes, szRowBytes);
+        }
+    }
+    iDstWriteRow = iWriteRow;
+    iPendingRows = 0;
+}
+
+static void Int16ToFloat(const int16_t* pSrc, float* pDst, int iSamples)
+{
+    int i = 0;
+#if defined(SCOPE_USE_SSE2)
+    const __m128 vScale = _mm_set1_ps(INT16_TO_FLOAT);
+    for (; i+8 <= iSamples; i += 8)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(pSrc+i));
+        const __m128i vLo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        const __m128i vHi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(pDst+i, _mm_mul_ps(_mm_cvtepi32_ps(vLo), vScale));
+        _mm_storeu_ps(pDst+i+4, _mm_mul_ps(_mm_cvtepi32_ps(vHi), vScale));
+    }
+#elif defined(SCOPE_USE_NEON)
+    for (; i+8 <= iSamples; i += 8)
+    {
+        const int16x8_t v = vld1q_s16(pSrc+i);
+        vst1q_f32(pDst+i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), INT16_TO_FLOAT));
+        vst1q_f32(pDst+i+4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), INT16_TO_FLOAT));
+    }
+#endif
+    for (; i < iSamples; i++)
+        pDst[i] = (float)pSrc[i]*INT16_TO_FLOAT;
+}
+
+static void DeinterleaveStereoInt16(const int16_t* pSrc, float* pLeft, float* pRight, int iSamples)
+{
+    int i = 0;
+#if defined(SCOPE_USE_SSE2)
+    const __m128 vScale = _mm_set1_ps(INT16_TO_FLOAT);
+    for (; i+4 <= iSamples; i += 4)
+    {
+        // each 32-bit lane holds one L/R pair, left in the low half
+        const __m128i v = _mm_loadu_si128((const __m128i*)(pSrc+i*2));
+        const __m128i vL = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+        const __m128i vR = _mm_srai_epi32(v, 16);
+        _mm_storeu_ps(pLeft+i, _mm_mul_ps(_mm_cvtepi32_ps(vL), vScale));
+        _mm_storeu_ps(pRight+i, _mm_mul_ps(_mm_cvtepi32_ps(vR), vScale));
+    }
+#elif defined(SCOPE_USE_NEON)
+    for (; i+4 <= iSamples; i += 4)
+    {
+        const int16x4x2_t v = vld2_s16(pSrc+i*2);
+        vst1q_f32(pLeft+i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(v.val[0])), INT16_TO_FLOAT));
+        vst1q_f32(pRight+i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(v.val[1])), INT16_TO_FLOAT));
+    }
+#endif
+    for (; i < iSamples; i++)
+    {
+        pLeft[i] = (float)pSrc[i*2]*INT16_TO_FLOAT;
+        pRight[i] = (float)pSrc[i*2+1]*INT16_TO_FLOAT;
+    }
+}
+
+static void DeinterleaveStereoFloat(const float* pSrc, float* pLeft, float* pRight, int iSamples)
+{
+    int i = 0;
+#if defined(SCOPE_USE_SSE2)
+    for (; i+4 <= iSamples; i += 4)
+    {
+        const __m128 v0 = _mm_loadu_ps(pSrc+i*2);
+        const __m128 v1 = _mm_loadu_ps(pSrc+i*2+4);
+        _mm_storeu_ps(pLeft+i, _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(pRight+i, _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+#elif defined(SCOPE_USE_NEON)
+    for (; i+4 <= iSamples; i += 4)
+    {
+        const float32x4x2_t v = vld2q_f32(pSrc+i*2);
+        vst1q_f32(pLeft+i, v.val[0]);
+        vst1q_f32(pRight+i, v.val[1]);
+    }
+#endif
+    for (; i < iSamples; i++)
+    {
+        pLeft[i] = pSrc[i*2];
+        pRight[i] = pSrc[i*2+1];
+    }
+}
+
+bool PcmToPlanarFloat(const ImGui::ImMat& mPcm, int iChannels, int iSamples, float* const* ppDst)
+{
+    if (mPcm.type != IM_DT_FLOAT32 && mPcm.type != IM_DT_INT16)
+        return false;
+    iChannels = min(iChannels, mPcm.c);
+    iSamples = min(iSamples, mPcm.w);
+    const bool bInt16 = mPcm.type == IM_DT_INT16;
+    if (mPcm.elempack > 1)
+    {
+        const int iSrcChannels = mPcm.c;
+        if (iSrcChannels == 2 && iChannels == 2)
+        {
+            if (bInt16)
+                DeinterleaveStereoInt16((const int16_t*)mPcm.data, ppDst[0], ppDst[1], iSamples);
+            else
+                DeinterleaveStereoFloat((const float*)mPcm.data, ppDst[0], ppDst[1], iSamples);
+        }
+        else
+        {
+            for (int j = 0; j < iChannels; j++)
+            {
+                float* pDst = ppDst[j];
+                if (bInt16)
+                {
+                    const int16_t* pSrc = (const int16_t*)mPcm.data+j;
+                    for (int i = 0; i < iSamples; i++)
+                        pDst[i] = (float)pSrc[i*iSrcChannels]*INT16_TO_FLOAT;
+                }
+                else
+                {
+                    const float* pSrc = (const float*)mPcm.data+j;
+                    for (int i = 0; i < iSamples; i++)
+                        pDst[i] = pSrc[i*iSrcChannels];
+                }
+            }
+        }
+    }
+    else
+    {
+        for (int j = 0; j < iChannels; j++)
+        {
+            if (bInt16)
+                Int16ToFloat((const int16_t*)mPcm.data+mPcm.w*j, ppDst[j], iSamples);
+            else
+                memcpy(ppDst[j], (const float*)mPcm.data+mPcm.w*j, iSamples*sizeof(float));
+        }
+    }
+    return true;
+}
+
+static inline int32_t VectorScopeOffset(float s1, float s2, int iMode, float fZoom, int iWidth, int iHeight)
+{
+    const float hw = iWidth / 2;
+    const float hh = iHeight / 2;
+    float x, y;
+    if (iMode == VECTOR_SCOPE_LISSAJOUS)
+    {
+        x = ((s2 - s1) * fZoom / 2 + 1) * hw;
+        y = (1.0f - (s1 + s2) * fZoom / 2) * hh;
+    }
+    else if (iMode == VECTOR_SCOPE_LISSAJOUS_XY)
+    {
+        x = (s2 * fZoom + 1) * hw;
+        y = (s1 * fZoom + 1) * hh;
+    }
+    else
+    {
+        const float sx = s2 * fZoom;
+        const float sy = s1 * fZoom;
+        const float cx = sx * sqrtf(1 - 0.5f * sy * sy);
+        const float cy = sy * sqrtf(1 - 0.5f * sx * sx);
+        const float sign = cx + cy < 0 ? -1.f : cx + cy > 0 ? 1.f : 0.f;
+        x = hw + hw * sign * (cx - cy) * .7f;
+        y = iHeight - iHeight * fabsf(cx + cy) * .7f;
+    }
+    // written so that NaN ends up at 0
+    x = x > 0 ? min(x, (float)(iWidth - 1)) : 0;
+    y = y > 0 ? min(y, (float)(iHeight - 1)) : 0;
+    return (int32_t)y * iWidth + (int32_t)x;
+}
+
+void AccumulateVectorScope(const float* pLeft, const float* pRight, int iSamples, int iMode, float fZoom,
+        uint8_t* pRgba, int iWidth, int iHeight, vector<int32_t>& aOffsets)
+{
+    if ((int)aOffsets.size() < iSamples)
+        aOffsets.resize(iSamples);
+    int32_t* pOffsets = aOffsets.data();
+    int i = 0;
+#if defined(SCOPE_USE_SSE2)
+    // map the samples to pixel offsets 4 at a time, the scattered pixel updates below stay scalar
+    const __m128 vZoom = _mm_set1_ps(fZoom);
+    const __m128 vHalf = _mm_set1_ps(0.5f);
+    const __m128 vOne = _mm_set1_ps(1.f);
+    const __m128 vHw = _mm_set1_ps((float)(iWidth / 2));
+    const __m128 vHh = _mm_set1_ps((float)(iHeight / 2));
+    const __m128 vH = _mm_set1_ps((float)iHeight);
+    const __m128 vPolarScale = _mm_set1_ps(.7f);
+    const __m128 vZero = _mm_setzero_ps();
+    const __m128 vMaxX = _mm_set1_ps((float)(iWidth - 1));
+    const __m128 vMaxY = _mm_set1_ps((float)(iHeight - 1));
+    const __m128 vSignMask = _mm_set1_ps(-0.f);
+    const __m128i vWidth = _mm_set1_epi32(iWidth);
+    for (; i+4 <= iSamples; i += 4)
+    {
+        const __m128 s1 = _mm_loadu_ps(pLeft+i);
+        const __m128 s2 = _mm_loadu_ps(pRight+i);
+        __m128 x, y;
+        if (iMode == VECTOR_SCOPE_LISSAJOUS)
+        {
+            const __m128 vHalfZoom = _mm_mul_ps(vZoom, vHalf);
+            x = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(s2, s1), vHalfZoom), vOne), vHw);
+            y = _mm_mul_ps(_mm_sub_ps(vOne, _mm_mul_ps(_mm_add_ps(s1, s2), vHalfZoom)), vHh);
+        }
+        else if (iMode == VECTOR_SCOPE_LISSAJOUS_XY)
+        {
+            x = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(s2, vZoom), vOne), vHw);
+            y = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(s1, vZoom), vOne), vHh);
+        }
+        else
+        {
+            const __m128 sx = _mm_mul_ps(s2, vZoom);
+            const __m128 sy = _mm_mul_ps(s1, vZoom);
+            const __m128 cx = _mm_mul_ps(sx, _mm_sqrt_ps(_mm_sub_ps(vOne, _mm_mul_ps(vHalf, _mm_mul_ps(sy, sy)))));
+            const __m128 cy = _mm_mul_ps(sy, _mm_sqrt_ps(_mm_sub_ps(vOne, _mm_mul_ps(vHalf, _mm_mul_ps(sx, sx)))));
+            const __m128 sum = _mm_add_ps(cx, cy);
+            // sign(sum) * (cx - cy), 0 when sum is 0
+            const __m128 diff = _mm_and_ps(_mm_xor_ps(_mm_sub_ps(cx, cy), _mm_and_ps(sum, vSignMask)), _mm_cmpneq_ps(sum, vZero));
+            x = _mm_add_ps(vHw, _mm_mul_ps(_mm_mul_ps(vHw, diff), vPolarScale));
+            y = _mm_sub_ps(vH, _mm_mul_ps(_mm_mul_ps(vH, _mm_andnot_ps(vSignMask, sum)), vPolarScale));
+        }
+        // '_mm_max_ps' returns the second operand for NaN
+        x = _mm_min_ps(_mm_max_ps(x, vZero), vMaxX);
+        y = _mm_min_ps(_mm_max_ps(y, vZero), vMaxY);
+        const __m128i xi = _mm_cvttps_epi32(x);
+        const __m128i yi = _mm_cvttps_epi32(y);
+        // SSE2 has no 32-bit lane multiply, do the even and the odd lanes with '_mm_mul_epu32' and merge them
+        const __m128i yw02 = _mm_mul_epu32(yi, vWidth);
+        const __m128i yw13 = _mm_mul_epu32(_mm_srli_si128(yi, 4), vWidth);
+        const __m128i yw = _mm_unpacklo_epi32(_mm_shuffle_epi32(yw02, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(yw13, _MM_SHUFFLE(0, 0, 2, 0)));
+        _mm_storeu_si128((__m128i*)(pOffsets+i), _mm_add_epi32(yw, xi));
+    }
+#endif
+    for (; i < iSamples; i++)
+        pOffsets[i] = VectorScopeOffset(pLeft[i], pRight[i], iMode, fZoom, iWidth, iHeight);
+
+    for (i = 0; i < iSamples; i++)
+    {
+        uint8_t* pPixel = pRgba + pOffsets[i] * 4;
+        pPixel[0] = (uint8_t)min(pPixel[0] + 30, 255);
+        pPixel[1] = (uint8_t)min(pPixel[1] + 50, 255);
+        pPixel[2] = (uint8_t)min(pPixel[2] + 30, 255);
+        pPixel[3] = 255;
+    }
+}
+}
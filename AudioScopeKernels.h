@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <immat.h>
+
+namespace MEC
+{
+    // Buffers for analysing one audio block. They are only reallocated when the channel count or the fft size changes,
+    // so the scope analysis, which runs for the main output and every audio track on each block, doesn't allocate.
+    struct AudioScopeWorkspace
+    {
+        int iChannels {0};
+        int iFftSize {0};
+        std::vector<ImGui::ImMat> aWaves;           // planar float samples, one mat of 'iFftSize' per channel
+        std::vector<ImGui::ImMat> aFfts;            // spectrum of the wave, computed in place
+        std::vector<ImGui::ImMat> aDbs;             // 'iFftSize'/2+1 bins
+        std::vector<ImGui::ImMat> aDbShorts;        // 20 bands
+        std::vector<ImGui::ImMat> aDbLongs;         // 76 bands
+        std::vector<int> aDbMaxIndices;
+        std::vector<float> aDecibels;
+        std::vector<float*> aWavePtrs;              // data pointers of 'aWaves', the destination of 'PcmToPlanarFloat()'
+        std::vector<int32_t> aVectorOffsets;        // pixel offsets of the vectorscope points of the block
+
+        void Prepare(int iChans, int iSamples);
+    };
+
+    // Scrolling spectrogram image kept as a ring of rows, so adding a block writes one row instead of moving the image.
+    // 'iWriteRow' is the next row to write, which is also the oldest row shown.
+    struct SpectrogramRing
+    {
+        static constexpr int ROWS = 256;
+        ImGui::ImMat mImage;                        // RGBA8, one row of 'iBins' pixels per block
+        int iWriteRow {0};
+        int iPendingRows {0};                       // rows written since the last 'CopyRowsTo()'
+
+        // Color the dB bins with a LUT from 'BuildSpectrogramLut()', the image is (re)created when the bin count changes
+        void AddRow(const float* pDb, int iBins, float fOffset, const uint32_t* pLut);
+        // Copy the rows written since the last call into 'mDst', the whole image if its shape differs
+        void CopyRowsTo(ImGui::ImMat& mDst, int& iDstWriteRow);
+    };
+
+    // Vectorscope image, faded and plotted on each block. A faded pixel is back to 0 a few blocks after it was last plotted,
+    // so the lit pixels are kept in a list and fading and copying the image only go through them, not the whole image.
+    struct VectorScopeImage
+    {
+        ImGui::ImMat mImage;                        // RGBA8, created by the first 'Accumulate()'
+        std::vector<int32_t> aLitPixels;            // offsets of the pixels which aren't 0
+        std::vector<uint8_t> aPixelLit;             // 1 for the pixels in 'aLitPixels'
+        std::vector<int32_t> aDarkPixels;           // offsets of the pixels faded to 0 since the last 'CopyTo()'
+        bool bCopyAll {true};                       // the next 'CopyTo()' copies the whole image
+
+        // Saturating subtract of 'u8Amount' from the lit pixels
+        void Fade(uint8_t u8Amount);
+        // Plot with 'AccumulateVectorScope()', the image is (re)created and cleared when its size changes
+        void Accumulate(const float* pLeft, const float* pRight, int iSamples, int iMode, float fZoom, int iWidth, int iHeight,
+                std::vector<int32_t>& aOffsets);
+        // Copy the pixels changed since the last call, the lit and the dark ones, into 'mDst', the whole image if its shape differs
+        void CopyTo(ImGui::ImMat& mDst);
+    };
+
+    // Fill the 256 entry spectrogram color LUT, indexed by the level clamped into [0, 127] in half steps
+    void BuildSpectrogramLut(float fLight, uint32_t* pLut);
+
+    // Convert the first 'iSamples' samples of the first 'iChannels' channels of an int16 or float32 pcm mat, interleaved
+    // (elempack > 1) or planar, into planar float. Returns false for an unsupported sample type.
+    bool PcmToPlanarFloat(const ImGui::ImMat& mPcm, int iChannels, int iSamples, float* const* ppDst);
+
+    // Plot the left/right samples onto an RGBA8 vectorscope image of 'iWidth' x 'iHeight', 'iMode' is an 'AudioVectorScopeMode'.
+    // 'aOffsets' is scratch space for the pixel offsets, it's resized as needed.
+    void AccumulateVectorScope(const float* pLeft, const float* pRight, int iSamples, int iMode, float fZoom,
+            uint8_t* pRgba, int iWidth, int iHeight, std::vector<int32_t>& aOffsets);
+}
@@ -9,6 +9,7 @@ namespace MEC
 {
 BackgroundTask::Holder CreateBgtask_Vidstab(const json::value& jnTask, MediaCore::SharedSettings::Holder hSettings, RenderUtils::TextureManager::Holder hTxMgr);
 BackgroundTask::Holder CreateBgtask_SceneDetect(const json::value& jnTask, MediaCore::SharedSettings::Holder hSettings, RenderUtils::TextureManager::Holder hTxMgr);
+BackgroundTask::Holder CreateBgtask_Export(const json::value& jnTask, MediaCore::SharedSettings::Holder hSettings, RenderUtils::TextureManager::Holder hTxMgr);
 
 BackgroundTask::Holder BackgroundTask::CreateBackgroundTask(const json::value& jnTask, MediaCore::SharedSettings::Holder hSettings, RenderUtils::TextureManager::Holder hTxMgr)
 {
@@ -22,6 +23,8 @@ BackgroundTask::Holder BackgroundTask::CreateBackgroundTask(const json::value& j
         return CreateBgtask_Vidstab(jnTask, hSettings, hTxMgr);
     else if (strTaskType == "SceneDetect")
         return CreateBgtask_SceneDetect(jnTask, hSettings, hTxMgr);
+    else if (strTaskType == "Export")
+        return CreateBgtask_Export(jnTask, hSettings, hTxMgr);
     else
     {
         Log(Error) << "FAILED to create 'BackgroundTask'! Unsupported task type '" << strTaskType << "'." << endl;
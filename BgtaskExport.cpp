@@ -0,0 +1,569 @@
+#include <iomanip>
+#include <TimeUtils.h>
+#include <FileSystemUtils.h>
+#include <VideoClip.h>
+#include "BackgroundTask.h"
+#include "MediaTimeline.h"
+
+namespace json = imgui_json;
+using namespace std;
+using namespace Logger;
+
+namespace MEC
+{
+
+class BgtaskExport : public BackgroundTask
+{
+public:
+    BgtaskExport(const string& name) : m_name(name)
+    {
+        m_pLogger = GetLogger(name);
+    }
+
+    ~BgtaskExport()
+    {
+        ReleaseTimeline();
+    }
+
+    bool Initialize(const json::value& jnTask, MediaCore::SharedSettings::Holder hSettings)
+    {
+        string strAttrName;
+        json::value jnProjContent;
+        // read 'task_dir'
+        strAttrName = "task_dir";
+        if (jnTask.contains(strAttrName) && jnTask[strAttrName].is_string())
+        {
+            m_strTaskDir = jnTask[strAttrName].get<json::string>();
+            if (!SysUtils::IsDirectory(m_strTaskDir))
+            {
+                ostringstream oss; oss << "INVALID task json attribute '" << strAttrName << "'! '" << m_strTaskDir << "' is NOT a DIRECTORY.";
+                m_errMsg = oss.str();
+                return false;
+            }
+            strAttrName = "task_hash";
+            if (!jnTask.contains(strAttrName) || !jnTask[strAttrName].is_number())
+            {
+                ostringstream oss; oss << "Task json must has a '" << strAttrName << "' attribute of 'number' type!";
+                m_errMsg = oss.str();
+                return false;
+            }
+            m_szHash = (size_t)jnTask[strAttrName].get<json::number>();
+            m_strProjContentPath = SysUtils::JoinPath(m_strTaskDir, "project_content.json");
+            if (!SysUtils::IsFile(m_strProjContentPath))
+            {
+                ostringstream oss; oss << "Project content snapshot '" << m_strProjContentPath << "' does NOT EXIST!";
+                m_errMsg = oss.str();
+                return false;
+            }
+        }
+        else
+        {
+            strAttrName = "project_dir";
+            if (!jnTask.contains(strAttrName) || !jnTask[strAttrName].is_string())
+            {
+                ostringstream oss; oss << "Task json must has a '" << strAttrName << "' attribute of 'string' type!";
+                m_errMsg = oss.str();
+                return false;
+            }
+            string strAttrValue = jnTask[strAttrName].get<json::string>();
+            if (!SysUtils::IsDirectory(strAttrValue))
+            {
+                ostringstream oss; oss << "INVALID task json attribute '" << strAttrName << "'! '" << strAttrValue << "' is NOT a DIRECTORY.";
+                m_errMsg = oss.str();
+                return false;
+            }
+            // the timeline is snapshotted when the task is created, later editing does not affect this export
+            strAttrName = "project_content";
+            if (!jnTask.contains(strAttrName) || !jnTask[strAttrName].is_object())
+            {
+                ostringstream oss; oss << "Task json must has a '" << strAttrName << "' attribute of 'object' type!";
+                m_errMsg = oss.str();
+                return false;
+            }
+            jnProjContent = jnTask[strAttrName];
+            m_szHash = SysUtils::GetTickHash();
+            ostringstream oss; oss << m_name << "-" << setw(16) << setfill('0') << hex << m_szHash << dec;
+            const auto strWorkDirName = oss.str();
+            m_strTaskDir = SysUtils::JoinPath(strAttrValue, strWorkDirName);
+            if (!SysUtils::IsDirectory(m_strTaskDir))
+                SysUtils::CreateDirectoryAt(m_strTaskDir, true);
+            m_strProjContentPath = SysUtils::JoinPath(m_strTaskDir, "project_content.json");
+            if (!jnProjContent.save(m_strProjContentPath))
+            {
+                ostringstream oss; oss << "FAILED to save project content snapshot at '" << m_strProjContentPath << "'!";
+                m_errMsg = oss.str();
+                return false;
+            }
+        }
+        // read 'output_path'
+        strAttrName = "output_path";
+        if (!jnTask.contains(strAttrName) || !jnTask[strAttrName].is_string())
+        {
+            ostringstream oss; oss << "Task json must has a '" << strAttrName << "' attribute of 'string' type!";
+            m_errMsg = oss.str();
+            return false;
+        }
+        m_strOutputPath = jnTask[strAttrName].get<json::string>();
+        // read export arguments
+        strAttrName = "encoder_params";
+        if (jnTask.contains(strAttrName) && jnTask[strAttrName].is_object())
+            m_jnEncParams = jnTask[strAttrName];
+        strAttrName = "export_start";
+        if (jnTask.contains(strAttrName) && jnTask[strAttrName].is_number())
+            m_i64ExportStart = (int64_t)jnTask[strAttrName].get<json::number>();
+        strAttrName = "export_end";
+        if (jnTask.contains(strAttrName) && jnTask[strAttrName].is_number())
+            m_i64ExportEnd = (int64_t)jnTask[strAttrName].get<json::number>();
+        strAttrName = "segment_count";
+        if (jnTask.contains(strAttrName) && jnTask[strAttrName].is_number())
+            m_iSegmentCount = (int)jnTask[strAttrName].get<json::number>();
+        strAttrName = "smart_render";
+        if (jnTask.contains(strAttrName) && jnTask[strAttrName].is_boolean())
+            m_bSmartRender = jnTask[strAttrName].get<json::boolean>();
+        strAttrName = "use_cache";
+        if (jnTask.contains(strAttrName) && jnTask[strAttrName].is_boolean())
+            m_bUseCache = jnTask[strAttrName].get<json::boolean>();
+        strAttrName = "checkpoint";
+        if (jnTask.contains(strAttrName) && jnTask[strAttrName].is_boolean())
+            m_bCheckpoint = jnTask[strAttrName].get<json::boolean>();
+        m_hHwaMgr = hSettings ? hSettings->GetHwaccelManager() : nullptr;
+
+        // read task status
+        strAttrName = "progress";
+        if (jnTask.contains(strAttrName) && jnTask[strAttrName].is_number())
+            m_fProgress = (float)jnTask[strAttrName].get<json::number>();
+        bool bFailed = false;
+        bool bDone = false;
+        strAttrName = "is_task_failed";
+        if (jnTask.contains(strAttrName) && jnTask[strAttrName].is_boolean())
+            bFailed = jnTask[strAttrName].get<json::boolean>();
+        if (bFailed)
+        {
+            strAttrName = "error_message";
+            if (jnTask.contains(strAttrName) && jnTask[strAttrName].is_string())
+                m_errMsg = jnTask[strAttrName].get<json::string>();
+            SetState(FAILED, true);
+        }
+        else
+        {
+            strAttrName = "is_task_done";
+            if (jnTask.contains(strAttrName) && jnTask[strAttrName].is_boolean())
+                bDone = jnTask[strAttrName].get<json::boolean>();
+            if (bDone)
+            {
+                m_fProgress = 1.f;
+                SetState(DONE, true);
+            }
+        }
+
+        ostringstream oss; oss << "##" << m_name << "-" << setw(16) << setfill('0') << hex << m_szHash << dec;
+        m_strTaskNameWithHash = oss.str();
+
+        m_bInited = true;
+        return true;
+    }
+
+    void SetCallbacks(Callbacks* pCb) override
+    {
+        m_pCb = pCb;
+    }
+
+    bool CanPause()
+    {
+        return m_eState == WAITING || m_eState == PROCESSING;
+    }
+
+    bool Pause() override
+    {
+        if (m_bPause)
+            return true;
+        m_bPauseCheckPointHit = false;
+        m_bPause = true;
+        return true;
+    }
+
+    bool IsPaused() const override
+    {
+        return m_bPause && (m_bPauseCheckPointHit || m_eState == WAITING);
+    }
+
+    bool Resume() override
+    {
+        m_bPause = false;
+        return true;
+    }
+
+    bool DrawContent(const ImVec2& v2ViewSize) override
+    {
+        bool bRemoveThisTask = false;
+        ostringstream oss;
+        auto strLabel = m_strTaskNameWithHash;
+        ImGui::BeginChild(strLabel.c_str(), v2ViewSize, ImGuiChildFlags_Border|ImGuiChildFlags_AutoResizeY);
+        const auto v2AreaPos = ImGui::GetCursorPos();
+        const auto v2AreaAvailSize = ImGui::GetContentRegionAvail();
+        const ImColor tTaskTitleClr(KNOWNIMGUICOLOR_WHITESMOKE);
+        const auto v2TextPadding = ImGui::GetStyle().FramePadding;
+        const auto orgFontScale = ImGui::GetFont()->Scale;
+        ImGui::GetFont()->Scale = 1.2f;
+        ImGui::PushFont(ImGui::GetFont());
+        ImGui::TextColoredWithPadding(tTaskTitleClr, v2TextPadding, "%s", TASK_TYPE_NAME.c_str()); ImGui::SameLine();
+        ImGui::GetFont()->Scale = orgFontScale;
+        ImGui::PopFont();
+
+        // >> draw top right control buttons
+        auto v2CurrPos = ImGui::GetCursorPos();
+        ImGui::SetCursorPos({v2AreaPos.x+v2AreaAvailSize.x-60, v2CurrPos.y});
+        bool bDisableThisWidget;
+        oss << (IsPaused() ? ICON_PLAY_FORWARD : ICON_PAUSE) << m_strTaskNameWithHash;
+        strLabel = oss.str();
+        bDisableThisWidget = !CanPause();
+        ImGui::BeginDisabled(bDisableThisWidget);
+        if (ImGui::Button(strLabel.c_str()))
+        {
+            if (m_bPause)
+                Resume();
+            else
+                Pause();
+        } ImGui::SameLine();
+        ImGui::ShowTooltipOnHover(bDisableThisWidget ? "Task is already stopped." : (m_bPause ? "Resume task" : "Pause task"));
+        ImGui::EndDisabled();
+        oss.str(""); oss << ICON_DELETE << m_strTaskNameWithHash;
+        strLabel = oss.str();
+        oss.str(""); oss << ICON_TRASH << " Task Deletion" << m_strTaskNameWithHash;
+        const auto strDelLabel = oss.str();
+        if (ImGui::Button(strLabel.c_str()))
+        {
+            ImGui::OpenPopup(strDelLabel.c_str());
+        }
+        ImGui::ShowTooltipOnHover("Delete this task.");
+        const ImColor tTagClr(KNOWNIMGUICOLOR_LIGHTGRAY);
+        ImGui::TextColoredWithPadding(tTagClr, v2TextPadding, "Output: "); ImGui::SameLine(0, 10);
+        ImGui::TextColoredWithPadding(ImColor(KNOWNIMGUICOLOR_LIGHTGREEN), v2TextPadding, "%s", SysUtils::ExtractFileName(m_strOutputPath).c_str());
+        ImGui::ShowTooltipOnHover("Path: '%s'", m_strOutputPath.c_str());
+        ImGui::TextColoredWithPadding(tTagClr, v2TextPadding, "State: "); ImGui::SameLine(0, 10);
+        switch (m_eState)
+        {
+        case WAITING:
+            if (m_bPause)
+                ImGui::TextColoredWithPadding(ImColor(0.8f, 0.8f, 0.1f), v2TextPadding, "Paused");
+            else
+                ImGui::TextColoredWithPadding(ImColor(0.8f, 0.8f, 0.1f), v2TextPadding, "Queued");
+            break;
+        case PROCESSING:
+            if (m_bPause)
+                ImGui::TextColoredWithPadding(ImColor(0.8f, 0.8f, 0.1f), v2TextPadding, "Paused");
+            else
+                ImGui::TextColoredWithPadding(ImColor(0.3f, 0.3f, 0.85f), v2TextPadding, "Rendering");
+            break;
+        case DONE:
+            ImGui::TextColoredWithPadding(ImColor(0.3f, 0.85f, 0.3f), v2TextPadding, "Done");
+            break;
+        case FAILED:
+            ImGui::TextColoredWithPadding(ImColor(0.85f, 0.3f, 0.3f), v2TextPadding, "FAILED");
+            ImGui::ShowTooltipOnHover("%s", m_errMsg.c_str());
+            break;
+        case CANCELLED:
+            ImGui::TextColoredWithPadding(ImColor(0.8f, 0.8f, 0.8f), v2TextPadding, "Cancelled");
+            break;
+        default:
+            ImGui::TextColoredWithPadding(ImColor(0.7f, 0.3f, 0.3f), v2TextPadding, "Unknown");
+        }
+        ImGui::TextColoredWithPadding(tTagClr, v2TextPadding, "Progress: "); ImGui::SameLine(0, 10);
+        ImGui::TextColoredWithPadding(ImColor(0.3f, 0.85f, 0.3f), v2TextPadding, "%.02f%%", m_fProgress*100);
+
+        if (ImGui::BeginPopupModal(strDelLabel.c_str(), nullptr, ImGuiWindowFlags_NoMove|ImGuiWindowFlags_NoResize|ImGuiWindowFlags_NoSavedSettings))
+        {
+            bool bClosePopup = false;
+            const ImColor tWarnMsgClr(KNOWNIMGUICOLOR_PALEVIOLETRED);
+            ImGui::TextColoredWithPadding(tWarnMsgClr, {10, 6}, "This task will be removed, an unfinished output file is left as it is!");
+            if (ImGui::Button("  OK  "))
+            {
+                Cancel(); WaitDone();
+                bRemoveThisTask = true;
+                bClosePopup = true;
+            } ImGui::SameLine();
+            if (ImGui::Button("Cancel"))
+                bClosePopup = true;
+            if (bClosePopup)
+                ImGui::CloseCurrentPopup();
+            ImGui::EndPopup();
+        }
+
+        ImGui::EndChild();
+        return bRemoveThisTask;
+    }
+
+    void DrawContentCompact() override
+    {
+
+    }
+
+    bool SaveAsJson(json::value& jnTask) override
+    {
+        jnTask = json::value();
+        // save basic info
+        jnTask["type"] = "Export";
+        jnTask["name"] = m_name;
+        jnTask["task_hash"] = json::number(m_szHash);
+        jnTask["task_dir"] = m_strTaskDir;
+        jnTask["output_path"] = m_strOutputPath;
+        // save export arguments
+        jnTask["encoder_params"] = m_jnEncParams;
+        jnTask["export_start"] = json::number(m_i64ExportStart);
+        jnTask["export_end"] = json::number(m_i64ExportEnd);
+        jnTask["segment_count"] = json::number(m_iSegmentCount);
+        jnTask["smart_render"] = m_bSmartRender;
+        jnTask["use_cache"] = m_bUseCache;
+        jnTask["checkpoint"] = m_bCheckpoint;
+        // save task status
+        jnTask["progress"] = json::number(m_fProgress);
+        jnTask["is_task_done"] = IsDone();
+        jnTask["is_task_failed"] = IsFailed();
+        jnTask["error_message"] = m_errMsg;
+        return true;
+    }
+
+    string Save(const string& _strSavePath) override
+    {
+        json::value jnTask;
+        if (!SaveAsJson(jnTask))
+        {
+            m_pLogger->Log(Error) << "FAILED to save '" << m_name << "' as json!" << endl;
+            return "";
+        }
+        const auto strSavePath = _strSavePath.empty() ? SysUtils::JoinPath(m_strTaskDir, "task.json") : _strSavePath;
+        if (!jnTask.save(strSavePath))
+        {
+            m_pLogger->Log(Error) << "FAILED to save task json of '" << m_name << "' at location '" << strSavePath << "'!" << endl;
+            return "";
+        }
+        return strSavePath;
+    }
+
+    string GetTaskDir() const override
+    {
+        return m_strTaskDir;
+    }
+
+    string GetError() const override
+    {
+        return m_errMsg;
+    }
+
+    void SetLogLevel(Logger::Level l) override
+    {
+        m_pLogger->SetShowLevels(l);
+    }
+
+public:
+    static const string TASK_TYPE_NAME;
+
+protected:
+    bool _TaskProc () override
+    {
+        m_pLogger->Log(INFO) << "Start background task 'Export' for '" << m_strOutputPath << "'." << endl;
+        if (!m_bInited)
+        {
+            ostringstream oss; oss << "Background task 'Export' with name '" << m_name << "' is NOT initialized!";
+            m_errMsg = oss.str(); m_pLogger->Log(Error) << m_errMsg << endl;
+            return false;
+        }
+        // a paused task does not load anything, tasks restored from project file start in paused state
+        while (m_bPause && !IsCancelled())
+        {
+            m_bPauseCheckPointHit = true;
+            this_thread::sleep_for(chrono::milliseconds(THREAD_IDLE_TIME));
+        }
+        if (IsCancelled())
+            return true;
+
+        if (!LoadTimeline())
+        {
+            m_pLogger->Log(Error) << m_errMsg << endl;
+            ReleaseTimeline();
+            Save("");
+            return false;
+        }
+        auto pTl = m_pTimeline;
+        m_fProgress = 0.f;
+        Save("");
+        pTl->StartEncoding();
+        float fSavedProgress = 0.f;
+        while (pTl->mIsEncoding)
+        {
+            if (IsCancelled())
+            {
+                pTl->StopEncoding();
+                break;
+            }
+            pTl->mPauseEncoding = m_bPause;
+            m_bPauseCheckPointHit = m_bPause;
+            m_fProgress = pTl->mEncodingProgress;
+            // persist the progress every 1%, so the task list shows where an interrupted export stopped
+            if (m_fProgress-fSavedProgress >= 0.01f)
+            {
+                Save("");
+                fSavedProgress = m_fProgress;
+            }
+            this_thread::sleep_for(chrono::milliseconds(THREAD_IDLE_TIME));
+        }
+        pTl->StopEncoding();
+        const auto strEncErrMsg = pTl->mEncodeProcErrMsg;
+        ReleaseTimeline();
+        if (IsCancelled())
+        {
+            m_pLogger->Log(INFO) << "Background task 'Export' for '" << m_strOutputPath << "' is cancelled." << endl;
+            return true;
+        }
+        if (!strEncErrMsg.empty())
+        {
+            ostringstream oss; oss << "Export FAILED! " << strEncErrMsg;
+            m_errMsg = oss.str(); m_pLogger->Log(Error) << m_errMsg << endl;
+            Save("");
+            return false;
+        }
+        m_fProgress = 1.f;
+        m_pLogger->Log(INFO) << "Quit background task 'Export' for '" << m_strOutputPath << "'." << endl;
+        return true;
+    }
+
+    bool _AfterTaskProc() override
+    {
+        Save("");
+        return true;
+    }
+
+private:
+    bool LoadTimeline()
+    {
+        const auto tLoadRes = json::value::load(m_strProjContentPath);
+        if (!tLoadRes.second || !tLoadRes.first.is_object())
+        {
+            ostringstream oss; oss << "FAILED to load project content snapshot from '" << m_strProjContentPath << "'!";
+            m_errMsg = oss.str();
+            return false;
+        }
+        const auto& jnProjContent = tLoadRes.first;
+        if (!jnProjContent.contains("TimeLine") || !jnProjContent["TimeLine"].is_object())
+        {
+            m_errMsg = "CANNOT find 'TimeLine' attribute in project content snapshot!";
+            return false;
+        }
+
+        // the export has its own headless timeline instance, so it does not interfere with the one being edited,
+        // nor does it need an audio device
+        MediaTimeline::TimeLine* pTl = nullptr;
+        try
+        {
+            pTl = new MediaTimeline::TimeLine(true);
+            m_pTimeline = pTl;
+            if (m_hHwaMgr)
+                pTl->mhMediaSettings->SetHwaccelManager(m_hHwaMgr);
+            if (jnProjContent.contains("MediaBank") && jnProjContent["MediaBank"].is_array())
+                pTl->LoadMediaBank(jnProjContent["MediaBank"].get<json::array>());
+            pTl->Load(jnProjContent["TimeLine"]);
+        }
+        catch (const std::exception& e)
+        {
+            ostringstream oss; oss << "FAILED to load the timeline! " << e.what();
+            m_errMsg = oss.str();
+            return false;
+        }
+
+        MediaTimeline::TimeLine::VideoEncoderParams vidEncParams;
+        MediaTimeline::TimeLine::AudioEncoderParams audEncParams;
+        string strErrMsg;
+        if (!pTl->LoadEncoderParams(m_jnEncParams, vidEncParams, audEncParams, strErrMsg))
+        {
+            ostringstream oss; oss << "INVALID encoder parameters! " << strErrMsg;
+            m_errMsg = oss.str();
+            return false;
+        }
+        if (m_i64ExportStart >= 0 && m_i64ExportEnd > m_i64ExportStart)
+        {
+            pTl->mark_in = m_i64ExportStart;
+            pTl->mark_out = m_i64ExportEnd;
+            pTl->mEncodingInRange = true;
+        }
+        if (pTl->ValidDuration() <= 0)
+        {
+            m_errMsg = "Export range is EMPTY!";
+            return false;
+        }
+        pTl->mEncodingSegmentCount = m_iSegmentCount > 1 ? m_iSegmentCount : 1;
+        pTl->mEncodingSmartRender = m_bSmartRender;
+        pTl->mEncodingUseCache = m_bUseCache;
+        // a resumable task restarted after a crash or an app restart picks up the segments finished by the previous run
+        pTl->mEncodingCheckpoint = m_bCheckpoint;
+        if (!pTl->ConfigEncoder(m_strOutputPath, vidEncParams, audEncParams, strErrMsg))
+        {
+            ostringstream oss; oss << "FAILED to configure encoder! " << strErrMsg;
+            m_errMsg = oss.str();
+            return false;
+        }
+        return true;
+    }
+
+    void ReleaseTimeline()
+    {
+        if (m_pTimeline)
+        {
+            m_pTimeline->StopEncoding();
+            delete m_pTimeline;
+            m_pTimeline = nullptr;
+        }
+    }
+
+private:
+    string m_name;
+    size_t m_szHash;
+    string m_errMsg;
+    ALogger* m_pLogger;
+    Callbacks* m_pCb{nullptr};
+    bool m_bInited{false};
+    string m_strTaskDir;
+    string m_strProjContentPath;
+    MediaCore::HwaccelManager::Holder m_hHwaMgr;
+    MediaTimeline::TimeLine* m_pTimeline{nullptr};
+    // export arguments
+    string m_strOutputPath;
+    json::value m_jnEncParams;
+    int64_t m_i64ExportStart{-1}, m_i64ExportEnd{-1};
+    int m_iSegmentCount{1};
+    bool m_bSmartRender{false};
+    bool m_bUseCache{false};
+    bool m_bCheckpoint{false};
+    // task control
+    float m_fProgress{0.f};
+    bool m_bPause{false};
+    bool m_bPauseCheckPointHit{false};
+    // ui vars
+    string m_strTaskNameWithHash;
+};
+
+const string BgtaskExport::TASK_TYPE_NAME = "Export";
+
+static const auto _BGTASK_EXPORT_DELETER = [] (BackgroundTask* p) {
+    BgtaskExport* ptr = dynamic_cast<BgtaskExport*>(p);
+    delete ptr;
+};
+
+BackgroundTask::Holder CreateBgtask_Export(const json::value& jnTask, MediaCore::SharedSettings::Holder hSettings, RenderUtils::TextureManager::Holder hTxMgr)
+{
+    string strTaskName;
+    string strAttrName = "name";
+    if (jnTask.contains(strAttrName) && jnTask[strAttrName].is_string())
+        strTaskName = jnTask["name"].get<json::string>();
+    else
+        strTaskName = "BgtskExport";
+    auto p = new BgtaskExport(strTaskName);
+    if (!p->Initialize(jnTask, hSettings))
+    {
+        Log(Error) << "FAILED to create new 'Export' background task! Error is '" << p->GetError() << "'." << endl;
+        delete p;
+        return nullptr;
+    }
+    p->Save("");
+    return BackgroundTask::Holder(p, _BGTASK_EXPORT_DELETER);
+}
+}
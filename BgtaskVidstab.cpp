@@ -514,45 +514,8 @@ public:
                     *tFrameRate.num/(double)tFrameRate.den);
         }
         strAttrName = "videnc_extra_opts";
-        if (jnTask.contains(strAttrName) && jnTask[strAttrName].is_object())
-        {
-            const json::object& jnExtraOpts = jnTask[strAttrName].get<json::object>();
-            for (const auto& item : jnExtraOpts)
-            {
-                const auto& name = item.first;
-                const auto& jval = item.second;
-                MediaCore::MediaEncoder::Option tOpt;
-                switch (jval.type())
-                {
-                case json::type_t::string:
-                {
-                    tOpt = { string(name), MediaCore::Value(string(jval.get<json::string>())) };
-                    break;
-                }
-                case json::type_t::number:
-                {
-                    const double dval = jval.get<json::number>();
-                    double ival;
-                    if (modf(dval, &ival) == 0.0f)
-                        tOpt = { string(name), MediaCore::Value(int64_t(jval.get<json::number>())) };
-                    else
-                        tOpt = { string(name), MediaCore::Value(double(jval.get<json::number>())) };
-                    break;
-                }
-                case json::type_t::boolean:
-                {
-                    tOpt = { string(name), MediaCore::Value(bool(jval.get<json::boolean>())) };
-                    break;
-                }
-                default:
-                    m_pLogger->Log(WARN) << "INVALID json attribute for 'MediaCore::MediaEncoder::Option' -> {'" << name << "' : " << jval.dump()
-                            << "}. Ignore this option." << endl;
-                    break;
-                }
-                if (!tOpt.name.empty())
-                    m_aVidencExtraOpts.push_back(std::move(tOpt));
-            }
-        }
+        if (jnTask.contains(strAttrName))
+            MediaTimeline::LoadEncoderExtraOptions(jnTask[strAttrName], m_aVidencExtraOpts);
         // read task status
         strAttrName = "is_vidstab_detect_done";
         if (jnTask.contains(strAttrName) && jnTask[strAttrName].is_boolean())
@@ -0,0 +1,818 @@
+#include <sys/stat.h>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <Logger.h>
+#include <FileSystemUtils.h>
+#include <imgui_json.h>
+#include "ExportSegments.h"
+#include "HashUtils.h"
+extern "C"
+{
+#include "libavutil/avutil.h"
+#include "libavutil/mathematics.h"
+#include "libavutil/pixdesc.h"
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+}
+
+using namespace std;
+using namespace Logger;
+
+namespace MEC
+{
+// Tell the first difference between two sets of codec parameters, which prevents their packets from being copied into one stream
+static bool CompareCodecParams(const AVCodecParameters* pRef, const AVCodecParameters* pPar, string& strDiff)
+{
+    ostringstream oss;
+    if (pPar->codec_id != pRef->codec_id)
+        oss << "codec '" << avcodec_get_name(pPar->codec_id) << "' vs '" << avcodec_get_name(pRef->codec_id) << "'";
+    else if (pPar->width != pRef->width || pPar->height != pRef->height)
+        oss << "size " << pPar->width << "x" << pPar->height << " vs " << pRef->width << "x" << pRef->height;
+    else if (pPar->format != pRef->format)
+        oss << "format " << pPar->format << " vs " << pRef->format;
+    else if (pPar->profile != pRef->profile || pPar->level != pRef->level)
+        oss << "profile/level " << pPar->profile << "/" << pPar->level << " vs " << pRef->profile << "/" << pRef->level;
+    else if (pPar->extradata_size != pRef->extradata_size ||
+            (pPar->extradata_size > 0 && memcmp(pPar->extradata, pRef->extradata, pPar->extradata_size) != 0))
+        oss << "extradata of " << pPar->extradata_size << " bytes vs " << pRef->extradata_size << " bytes";
+    strDiff = oss.str();
+    return strDiff.empty();
+}
+
+static bool OpenVideoStream(const string& strPath, AVFormatContext** ppFmtCtx, int& iStmIdx, string& strErrMsg)
+{
+    int fferr = avformat_open_input(ppFmtCtx, strPath.c_str(), nullptr, nullptr);
+    if (fferr < 0)
+    {
+        ostringstream oss; oss << "FAILED to open '" << strPath << "'! fferr=" << fferr << ".";
+        strErrMsg = oss.str();
+        return false;
+    }
+    fferr = avformat_find_stream_info(*ppFmtCtx, nullptr);
+    if (fferr < 0)
+    {
+        ostringstream oss; oss << "FAILED to find stream info of '" << strPath << "'! fferr=" << fferr << ".";
+        strErrMsg = oss.str();
+        return false;
+    }
+    iStmIdx = av_find_best_stream(*ppFmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (iStmIdx < 0)
+    {
+        strErrMsg = "'" + strPath + "' does NOT have a video stream!";
+        return false;
+    }
+    return true;
+}
+
+// Read packets of the first stream with the given media type from a list of segment files one by one,
+// and remap their timestamps onto the output timeline.
+class SegmentPacketReader
+{
+public:
+    SegmentPacketReader(const vector<ExportSegment>& aSegs, AVMediaType eMediaType)
+        : m_aSegs(aSegs), m_eMediaType(eMediaType)
+    {}
+
+    ~SegmentPacketReader()
+    {
+        CloseSegment();
+        av_packet_free(&m_pPendingPkt);
+        avcodec_parameters_free(&m_pRefCodecpar);
+    }
+
+    bool Open(string& strErrMsg)
+    {
+        if (m_aSegs.empty())
+        {
+            strErrMsg = "Segment list is EMPTY!";
+            return false;
+        }
+        m_pPendingPkt = av_packet_alloc();
+        m_pRefCodecpar = avcodec_parameters_alloc();
+        if (!ProbeSegmentDelays(strErrMsg))
+            return false;
+        return OpenSegment(0, strErrMsg);
+    }
+
+    const AVCodecParameters* GetCodecParameters() const
+    {
+        return m_pInStream ? m_pInStream->codecpar : nullptr;
+    }
+
+    void SetOutputTimeBase(const AVRational& tOutTb)
+    {
+        m_tOutTb = tOutTb;
+        UpdateTsOffset();
+    }
+
+    // return 1 if a packet is read, 0 if all the segments are exhausted, -1 if error occurs
+    int Peek(AVPacket** ppPkt, string& strErrMsg)
+    {
+        if (!m_bPending)
+        {
+            int ret = ReadPacket(m_pPendingPkt, strErrMsg);
+            if (ret <= 0)
+                return ret;
+            m_bPending = true;
+        }
+        *ppPkt = m_pPendingPkt;
+        return 1;
+    }
+
+    void Consume()
+    {
+        av_packet_unref(m_pPendingPkt);
+        m_bPending = false;
+    }
+
+private:
+    bool OpenSegment(size_t szIdx, string& strErrMsg)
+    {
+        CloseSegment();
+        const auto& tSeg = m_aSegs[szIdx];
+        int fferr = avformat_open_input(&m_pInFmtCtx, tSeg.strPath.c_str(), nullptr, nullptr);
+        if (fferr < 0)
+        {
+            ostringstream oss; oss << "FAILED to open segment '" << tSeg.strPath << "'! fferr=" << fferr << ".";
+            strErrMsg = oss.str();
+            return false;
+        }
+        fferr = avformat_find_stream_info(m_pInFmtCtx, nullptr);
+        if (fferr < 0)
+        {
+            ostringstream oss; oss << "FAILED to find stream info of segment '" << tSeg.strPath << "'! fferr=" << fferr << ".";
+            strErrMsg = oss.str();
+            return false;
+        }
+        m_iStmIdx = av_find_best_stream(m_pInFmtCtx, m_eMediaType, -1, -1, nullptr, 0);
+        if (m_iStmIdx < 0)
+        {
+            ostringstream oss; oss << "Segment '" << tSeg.strPath << "' does NOT have a " << av_get_media_type_string(m_eMediaType) << " stream!";
+            strErrMsg = oss.str();
+            return false;
+        }
+        m_pInStream = m_pInFmtCtx->streams[m_iStmIdx];
+        m_szSegIdx = szIdx;
+        m_i64SegBasePts = m_pInStream->start_time != AV_NOPTS_VALUE ? m_pInStream->start_time : 0;
+        m_bSrcStarted = false;
+        if (tSeg.IsPassthrough())
+        {
+            // copy the source packets between two key frames, the source start time is still counted from stream start
+            m_i64SrcEndPts = m_i64SegBasePts+av_rescale_q(tSeg.i64SrcEndMs, {1, 1000}, m_pInStream->time_base);
+            m_i64SegBasePts += av_rescale_q(tSeg.i64SrcStartMs, {1, 1000}, m_pInStream->time_base);
+            m_i64PtsTolerance = std::max<int64_t>(av_rescale_q(1, {1, 1000}, m_pInStream->time_base), 1);
+            fferr = av_seek_frame(m_pInFmtCtx, m_iStmIdx, m_i64SegBasePts, AVSEEK_FLAG_BACKWARD);
+            if (fferr < 0)
+            {
+                ostringstream oss; oss << "FAILED to seek source '" << tSeg.strPath << "' to " << tSeg.i64SrcStartMs << "ms! fferr=" << fferr << ".";
+                strErrMsg = oss.str();
+                return false;
+            }
+        }
+        UpdateTsOffset();
+        return true;
+    }
+
+    void CloseSegment()
+    {
+        if (m_pInFmtCtx)
+            avformat_close_input(&m_pInFmtCtx);
+        m_pInStream = nullptr;
+        m_iStmIdx = -1;
+    }
+
+    void UpdateTsOffset()
+    {
+        if (!m_pInStream || m_tOutTb.den == 0)
+            return;
+        const auto& tSeg = m_aSegs[m_szSegIdx];
+        m_i64TsOffset = av_rescale_q(tSeg.i64StartMs, {1, 1000}, m_tOutTb)-av_rescale_q(m_i64SegBasePts, m_pInStream->time_base, m_tOutTb);
+        m_i64DtsShift = av_rescale_q(m_i64MaxDelayUs-m_ai64SegDelayUs[m_szSegIdx], {1, AV_TIME_BASE}, m_tOutTb);
+    }
+
+    // Each segment starts with a key frame at its start position, whose dts is earlier than its pts by the delay of
+    // the encoder which produced the segment. The dts of every segment is moved back by the difference between the
+    // largest delay and its own, so the dts of a segment never overlaps the previous one, while pts stay untouched.
+    // The output stream only carries the codec parameters of the first segment, every other one has to match them.
+    bool ProbeSegmentDelays(string& strErrMsg)
+    {
+        m_ai64SegDelayUs.assign(m_aSegs.size(), 0);
+        m_i64MaxDelayUs = 0;
+        for (size_t i = 0; i < m_aSegs.size(); i++)
+        {
+            if (!OpenSegment(i, strErrMsg))
+                return false;
+            string strDiff;
+            if (i == 0)
+            {
+                int fferr = avcodec_parameters_copy(m_pRefCodecpar, m_pInStream->codecpar);
+                if (fferr < 0)
+                {
+                    ostringstream oss; oss << "FAILED to copy codec parameters! fferr=" << fferr << ".";
+                    strErrMsg = oss.str();
+                    return false;
+                }
+            }
+            else if (!CompareCodecParams(m_pRefCodecpar, m_pInStream->codecpar, strDiff))
+            {
+                ostringstream oss; oss << "Segment '" << m_aSegs[i].strPath << "' has different codec parameters from segment '"
+                        << m_aSegs[0].strPath << "': " << strDiff << ".";
+                strErrMsg = oss.str();
+                return false;
+            }
+            int ret = ReadSegmentPacket(m_pPendingPkt, strErrMsg);
+            if (ret < 0)
+                return false;
+            if (ret > 0 && m_pPendingPkt->pts != AV_NOPTS_VALUE && m_pPendingPkt->dts != AV_NOPTS_VALUE && m_pPendingPkt->pts > m_pPendingPkt->dts)
+            {
+                m_ai64SegDelayUs[i] = av_rescale_q(m_pPendingPkt->pts-m_pPendingPkt->dts, m_pInStream->time_base, {1, AV_TIME_BASE});
+                m_i64MaxDelayUs = std::max(m_i64MaxDelayUs, m_ai64SegDelayUs[i]);
+            }
+            av_packet_unref(m_pPendingPkt);
+        }
+        return true;
+    }
+
+    int ReadPacket(AVPacket* pPkt, string& strErrMsg)
+    {
+        while (m_pInFmtCtx)
+        {
+            int ret = ReadSegmentPacket(pPkt, strErrMsg);
+            if (ret < 0)
+                return -1;
+            if (ret == 0)
+            {
+                if (m_szSegIdx+1 >= m_aSegs.size())
+                {
+                    CloseSegment();
+                    return 0;
+                }
+                if (!OpenSegment(m_szSegIdx+1, strErrMsg))
+                    return -1;
+                continue;
+            }
+            av_packet_rescale_ts(pPkt, m_pInStream->time_base, m_tOutTb);
+            if (pPkt->pts != AV_NOPTS_VALUE)
+                pPkt->pts += m_i64TsOffset;
+            if (pPkt->dts != AV_NOPTS_VALUE)
+            {
+                pPkt->dts += m_i64TsOffset-m_i64DtsShift;
+                // rounding of the delays can still leave one tick of overlap, which is only removed if the packet
+                // stays decodable before it is presented
+                if (m_i64LastDts != AV_NOPTS_VALUE && pPkt->dts <= m_i64LastDts)
+                {
+                    if (pPkt->pts != AV_NOPTS_VALUE && m_i64LastDts+1 > pPkt->pts)
+                    {
+                        ostringstream oss; oss << "Segment '" << m_aSegs[m_szSegIdx].strPath << "' has dts " << pPkt->dts
+                                << " overlapped with the previous segment, which ends at dts " << m_i64LastDts << ".";
+                        strErrMsg = oss.str();
+                        av_packet_unref(pPkt);
+                        return -1;
+                    }
+                    pPkt->dts = m_i64LastDts+1;
+                }
+                m_i64LastDts = pPkt->dts;
+            }
+            return 1;
+        }
+        return 0;
+    }
+
+    // return 1 if a packet of the current segment is read, 0 if the segment is exhausted, -1 if error occurs
+    int ReadSegmentPacket(AVPacket* pPkt, string& strErrMsg)
+    {
+        while (m_pInFmtCtx)
+        {
+            int fferr = av_read_frame(m_pInFmtCtx, pPkt);
+            if (fferr >= 0 && pPkt->stream_index == m_iStmIdx && m_aSegs[m_szSegIdx].IsPassthrough())
+            {
+                const bool bKeyFrame = (pPkt->flags&AV_PKT_FLAG_KEY) != 0;
+                if (!m_bSrcStarted)
+                {
+                    // skip the packets before the start key frame
+                    if (!bKeyFrame || pPkt->pts == AV_NOPTS_VALUE || pPkt->pts < m_i64SegBasePts-m_i64PtsTolerance)
+                    {
+                        av_packet_unref(pPkt);
+                        continue;
+                    }
+                    m_bSrcStarted = true;
+                }
+                else if (pPkt->pts != AV_NOPTS_VALUE && pPkt->pts < m_i64SegBasePts-m_i64PtsTolerance)
+                {
+                    // passthrough starts at the key frame of a closed GOP, a leading picture here would leave a hole
+                    ostringstream oss; oss << "Source '" << m_aSegs[m_szSegIdx].strPath << "' has a leading picture at pts " << pPkt->pts
+                            << " before the start key frame at pts " << m_i64SegBasePts << ".";
+                    strErrMsg = oss.str();
+                    av_packet_unref(pPkt);
+                    return -1;
+                }
+                else if (bKeyFrame && pPkt->pts != AV_NOPTS_VALUE && pPkt->pts >= m_i64SrcEndPts-m_i64PtsTolerance)
+                {
+                    // the end key frame belongs to the next segment
+                    av_packet_unref(pPkt);
+                    fferr = AVERROR_EOF;
+                }
+            }
+            if (fferr == AVERROR_EOF)
+                return 0;
+            if (fferr < 0)
+            {
+                ostringstream oss; oss << "FAILED to read packet from segment '" << m_aSegs[m_szSegIdx].strPath << "'! fferr=" << fferr << ".";
+                strErrMsg = oss.str();
+                return -1;
+            }
+            if (pPkt->stream_index != m_iStmIdx)
+            {
+                av_packet_unref(pPkt);
+                continue;
+            }
+            return 1;
+        }
+        return 0;
+    }
+
+private:
+    const vector<ExportSegment>& m_aSegs;
+    AVMediaType m_eMediaType;
+    size_t m_szSegIdx{0};
+    AVFormatContext* m_pInFmtCtx{nullptr};
+    AVStream* m_pInStream{nullptr};
+    int m_iStmIdx{-1};
+    AVRational m_tOutTb{0, 0};
+    int64_t m_i64TsOffset{0};
+    int64_t m_i64SegBasePts{0};
+    int64_t m_i64SrcEndPts{0};
+    int64_t m_i64PtsTolerance{1};
+    bool m_bSrcStarted{false};
+    int64_t m_i64LastDts{AV_NOPTS_VALUE};
+    vector<int64_t> m_ai64SegDelayUs;   // pts-dts of the first packet of each segment
+    int64_t m_i64MaxDelayUs{0};
+    int64_t m_i64DtsShift{0};
+    AVCodecParameters* m_pRefCodecpar{nullptr};     // codec parameters of the first segment
+    AVPacket* m_pPendingPkt{nullptr};
+    bool m_bPending{false};
+};
+
+ExportSegmentCache::Holder ExportSegmentCache::CreateInstance(const string& strCacheDir, string& strErrMsg)
+{
+    if (!SysUtils::IsDirectory(strCacheDir) && !SysUtils::CreateDirectoryAt(strCacheDir, true))
+    {
+        strErrMsg = "FAILED to create export cache directory '" + strCacheDir + "'!";
+        return nullptr;
+    }
+    // exports running at the same time share one instance per directory, so they don't overwrite each other's index
+    static mutex s_mtxInstances;
+    static unordered_map<string, weak_ptr<ExportSegmentCache>> s_aInstances;
+    lock_guard<mutex> lk(s_mtxInstances);
+    auto hCache = s_aInstances[strCacheDir].lock();
+    if (!hCache)
+    {
+        hCache = Holder(new ExportSegmentCache(strCacheDir));
+        hCache->LoadIndex();
+        s_aInstances[strCacheDir] = hCache;
+    }
+    return hCache;
+}
+
+string ExportSegmentCache::GetSourceIdentity(const string& strPath)
+{
+    ostringstream oss; oss << strPath;
+    struct stat tStat;
+    if (stat(strPath.c_str(), &tStat) == 0)
+        oss << "," << (int64_t)tStat.st_size << "," << (int64_t)tStat.st_mtime;
+    return oss.str();
+}
+
+uint64_t ExportSegmentCache::Hash(const string& strData)
+{
+    uint64_t u64Hash = FNV1A_64_OFFSET_BASIS;
+    HashFnv1a(u64Hash, strData.data(), strData.size());
+    return u64Hash;
+}
+
+string ExportSegmentCache::GetSegmentPath(uint64_t u64Key, const string& strFileExt) const
+{
+    ostringstream oss; oss << setw(16) << setfill('0') << hex << u64Key << strFileExt;
+    return SysUtils::JoinPath(m_strCacheDir, oss.str());
+}
+
+bool ExportSegmentCache::Lookup(uint64_t u64Key, const string& strFileExt, string& strPath)
+{
+    const auto strSegPath = GetSegmentPath(u64Key, strFileExt);
+    const auto strFileName = SysUtils::ExtractFileName(strSegPath);
+    lock_guard<mutex> lk(m_mtxEntries);
+    auto iter = m_aEntries.find(strFileName);
+    if (iter == m_aEntries.end())
+        return false;
+    if (!SysUtils::IsFile(strSegPath))
+    {
+        m_aEntries.erase(iter);
+        return false;
+    }
+    iter->second.u64LastUsed = ++m_u64UseSerial;
+    iter->second.iPinCount++;
+    strPath = strSegPath;
+    return true;
+}
+
+bool ExportSegmentCache::Commit(uint64_t u64Key, const string& strFileExt, const string& strEncodedPath, string& strPath)
+{
+    const auto strSegPath = GetSegmentPath(u64Key, strFileExt);
+    if (!SysUtils::RenameFile(strEncodedPath, strSegPath))
+    {
+        Log(WARN) << "FAILED to move encoded segment '" << strEncodedPath << "' into export cache as '" << strSegPath << "'." << endl;
+        return false;
+    }
+    Entry tEntry;
+    ifstream ifs(strSegPath, ios::binary|ios::ate);
+    tEntry.i64Size = ifs.is_open() ? (int64_t)ifs.tellg() : 0;
+    lock_guard<mutex> lk(m_mtxEntries);
+    auto& tStored = m_aEntries[SysUtils::ExtractFileName(strSegPath)];
+    tStored.i64Size = tEntry.i64Size;
+    tStored.u64LastUsed = ++m_u64UseSerial;
+    tStored.iPinCount++;
+    strPath = strSegPath;
+    return true;
+}
+
+void ExportSegmentCache::Unpin(uint64_t u64Key, const string& strFileExt)
+{
+    const auto strFileName = SysUtils::ExtractFileName(GetSegmentPath(u64Key, strFileExt));
+    lock_guard<mutex> lk(m_mtxEntries);
+    auto iter = m_aEntries.find(strFileName);
+    if (iter != m_aEntries.end() && iter->second.iPinCount > 0)
+        iter->second.iPinCount--;
+}
+
+void ExportSegmentCache::Trim(int64_t i64MaxBytes)
+{
+    lock_guard<mutex> lk(m_mtxEntries);
+    int64_t i64TotalBytes = 0;
+    vector<pair<string, Entry>> aEntries(m_aEntries.begin(), m_aEntries.end());
+    for (const auto& item : aEntries)
+        i64TotalBytes += item.second.i64Size;
+    sort(aEntries.begin(), aEntries.end(), [] (const pair<string, Entry>& a, const pair<string, Entry>& b) {
+        return a.second.u64LastUsed < b.second.u64LastUsed;
+    });
+    for (const auto& item : aEntries)
+    {
+        if (i64TotalBytes <= i64MaxBytes)
+            break;
+        // another export is about to concatenate it
+        if (item.second.iPinCount > 0)
+            continue;
+        const auto strSegPath = SysUtils::JoinPath(m_strCacheDir, item.first);
+        if (SysUtils::IsFile(strSegPath) && !SysUtils::DeleteFileAt(strSegPath))
+        {
+            Log(WARN) << "FAILED to evict export cache file '" << strSegPath << "'." << endl;
+            continue;
+        }
+        i64TotalBytes -= item.second.i64Size;
+        m_aEntries.erase(item.first);
+    }
+    SaveIndex();
+}
+
+void ExportSegmentCache::LoadIndex()
+{
+    const auto strIndexPath = SysUtils::JoinPath(m_strCacheDir, "index.json");
+    if (!SysUtils::IsFile(strIndexPath))
+        return;
+    auto res = imgui_json::value::load(strIndexPath);
+    if (!res.second)
+    {
+        Log(WARN) << "FAILED to parse export cache index '" << strIndexPath << "', start with an empty cache." << endl;
+        return;
+    }
+    const auto& jnIndex = res.first;
+    if (jnIndex.contains("use_serial") && jnIndex["use_serial"].is_number())
+        m_u64UseSerial = (uint64_t)jnIndex["use_serial"].get<imgui_json::number>();
+    if (!jnIndex.contains("segments") || !jnIndex["segments"].is_array())
+        return;
+    for (const auto& jnItem : jnIndex["segments"].get<imgui_json::array>())
+    {
+        if (!jnItem.contains("file") || !jnItem["file"].is_string())
+            continue;
+        const string strFileName = jnItem["file"].get<imgui_json::string>();
+        if (!SysUtils::IsFile(SysUtils::JoinPath(m_strCacheDir, strFileName)))
+            continue;
+        Entry tEntry;
+        if (jnItem.contains("size") && jnItem["size"].is_number())
+            tEntry.i64Size = (int64_t)jnItem["size"].get<imgui_json::number>();
+        if (jnItem.contains("last_used") && jnItem["last_used"].is_number())
+            tEntry.u64LastUsed = (uint64_t)jnItem["last_used"].get<imgui_json::number>();
+        m_aEntries[strFileName] = tEntry;
+    }
+}
+
+void ExportSegmentCache::SaveIndex()
+{
+    imgui_json::value jnIndex;
+    jnIndex["use_serial"] = imgui_json::number(m_u64UseSerial);
+    imgui_json::array jnSegments;
+    for (const auto& item : m_aEntries)
+    {
+        imgui_json::value jnItem;
+        jnItem["file"] = item.first;
+        jnItem["size"] = imgui_json::number(item.second.i64Size);
+        jnItem["last_used"] = imgui_json::number(item.second.u64LastUsed);
+        jnSegments.push_back(jnItem);
+    }
+    jnIndex["segments"] = jnSegments;
+    // written aside and renamed, so the index is never found half written
+    const auto strIndexPath = SysUtils::JoinPath(m_strCacheDir, "index.json");
+    const auto strTempPath = strIndexPath+".tmp";
+    if (!jnIndex.save(strTempPath) || !SysUtils::RenameFile(strTempPath, strIndexPath))
+    {
+        Log(WARN) << "FAILED to save export cache index '" << strIndexPath << "'." << endl;
+        SysUtils::DeleteFileAt(strTempPath);
+    }
+}
+
+bool ProbePassthroughSource(const string& strSrcPath, const string& strCodecName, const string& strPixFmt, uint32_t u32Width, uint32_t u32Height,
+        int32_t i32FrameRateNum, int32_t i32FrameRateDen, int64_t i64StartMs, int64_t i64EndMs, vector<int64_t>& aKeyFramesMs, string& strErrMsg)
+{
+    aKeyFramesMs.clear();
+    AVFormatContext* pInFmtCtx = nullptr;
+    AVPacket* pPkt = nullptr;
+    bool bSuccess = false;
+    do {
+        int iStmIdx;
+        if (!OpenVideoStream(strSrcPath, &pInFmtCtx, iStmIdx, strErrMsg))
+            break;
+        const AVStream* pStream = pInFmtCtx->streams[iStmIdx];
+        const AVCodecParameters* pCodecpar = pStream->codecpar;
+        const AVCodec* pEncoder = avcodec_find_encoder_by_name(strCodecName.c_str());
+        if (!pEncoder || pEncoder->id != pCodecpar->codec_id)
+        {
+            ostringstream oss; oss << "Source codec '" << avcodec_get_name(pCodecpar->codec_id) << "' does NOT match output codec '" << strCodecName << "'.";
+            strErrMsg = oss.str();
+            break;
+        }
+        if (!strPixFmt.empty() && pCodecpar->format != av_get_pix_fmt(strPixFmt.c_str()))
+        {
+            const char* pcSrcPixFmt = av_get_pix_fmt_name((AVPixelFormat)pCodecpar->format);
+            ostringstream oss; oss << "Source pixel format '" << (pcSrcPixFmt ? pcSrcPixFmt : "unknown") << "' does NOT match output pixel format '" << strPixFmt << "'.";
+            strErrMsg = oss.str();
+            break;
+        }
+        if ((uint32_t)pCodecpar->width != u32Width || (uint32_t)pCodecpar->height != u32Height)
+        {
+            ostringstream oss; oss << "Source size " << pCodecpar->width << "x" << pCodecpar->height << " does NOT match output size " << u32Width << "x" << u32Height << ".";
+            strErrMsg = oss.str();
+            break;
+        }
+        const AVRational tFrameRate = pStream->avg_frame_rate.num > 0 ? pStream->avg_frame_rate : pStream->r_frame_rate;
+        if (tFrameRate.num <= 0 || tFrameRate.den <= 0 || av_cmp_q(tFrameRate, {i32FrameRateNum, i32FrameRateDen}) != 0)
+        {
+            ostringstream oss; oss << "Source frame rate " << tFrameRate.num << "/" << tFrameRate.den << " does NOT match output frame rate "
+                    << i32FrameRateNum << "/" << i32FrameRateDen << ".";
+            strErrMsg = oss.str();
+            break;
+        }
+
+        // collect key frame positions by reading packets only, nothing is decoded
+        const int64_t i64StartPts = pStream->start_time != AV_NOPTS_VALUE ? pStream->start_time : 0;
+        int fferr = av_seek_frame(pInFmtCtx, iStmIdx, i64StartPts+av_rescale_q(i64StartMs, {1, 1000}, pStream->time_base), AVSEEK_FLAG_BACKWARD);
+        if (fferr < 0)
+        {
+            ostringstream oss; oss << "FAILED to seek source '" << strSrcPath << "' to " << i64StartMs << "ms! fferr=" << fferr << ".";
+            strErrMsg = oss.str();
+            break;
+        }
+        // a key frame followed by packets presented before it starts an open GOP, it is listed only after its GOP is
+        // read through and found closed
+        int64_t i64KeyPts = AV_NOPTS_VALUE;
+        int64_t i64KeyPosMs = 0;
+        bool bOpenGop = false;
+        auto commitKeyFrame = [&] () {
+            if (i64KeyPts != AV_NOPTS_VALUE && !bOpenGop && i64KeyPosMs >= i64StartMs)
+                aKeyFramesMs.push_back(i64KeyPosMs);
+            i64KeyPts = AV_NOPTS_VALUE;
+        };
+        pPkt = av_packet_alloc();
+        bool bHasError = false;
+        while (true)
+        {
+            fferr = av_read_frame(pInFmtCtx, pPkt);
+            if (fferr == AVERROR_EOF)
+                break;
+            if (fferr < 0)
+            {
+                ostringstream oss; oss << "FAILED to read packet from source '" << strSrcPath << "'! fferr=" << fferr << ".";
+                strErrMsg = oss.str();
+                bHasError = true;
+                break;
+            }
+            if (pPkt->stream_index == iStmIdx && pPkt->pts != AV_NOPTS_VALUE)
+            {
+                if (pPkt->flags&AV_PKT_FLAG_KEY)
+                {
+                    commitKeyFrame();
+                    const int64_t i64PosMs = av_rescale_q(pPkt->pts-i64StartPts, pStream->time_base, {1, 1000});
+                    if (i64PosMs > i64EndMs)
+                    {
+                        av_packet_unref(pPkt);
+                        break;
+                    }
+                    i64KeyPts = pPkt->pts;
+                    i64KeyPosMs = i64PosMs;
+                    bOpenGop = false;
+                }
+                else if (i64KeyPts != AV_NOPTS_VALUE && pPkt->pts < i64KeyPts)
+                {
+                    bOpenGop = true;
+                }
+            }
+            av_packet_unref(pPkt);
+        }
+        if (bHasError)
+            break;
+        commitKeyFrame();
+        bSuccess = true;
+    } while (false);
+
+    if (pPkt)
+        av_packet_free(&pPkt);
+    if (pInFmtCtx)
+        avformat_close_input(&pInFmtCtx);
+    return bSuccess;
+}
+
+bool MatchSegmentCodecParams(const string& strRefPath, const string& strPath, bool& bMatched, string& strErrMsg)
+{
+    bMatched = false;
+    AVFormatContext* pRefFmtCtx = nullptr;
+    AVFormatContext* pFmtCtx = nullptr;
+    bool bSuccess = false;
+    do {
+        int iRefStmIdx, iStmIdx;
+        if (!OpenVideoStream(strRefPath, &pRefFmtCtx, iRefStmIdx, strErrMsg) || !OpenVideoStream(strPath, &pFmtCtx, iStmIdx, strErrMsg))
+            break;
+        string strDiff;
+        bMatched = CompareCodecParams(pRefFmtCtx->streams[iRefStmIdx]->codecpar, pFmtCtx->streams[iStmIdx]->codecpar, strDiff);
+        if (!bMatched)
+            Log(DEBUG) << "'" << strPath << "' has different codec parameters from '" << strRefPath << "': " << strDiff << "." << endl;
+        bSuccess = true;
+    } while (false);
+
+    if (pFmtCtx)
+        avformat_close_input(&pFmtCtx);
+    if (pRefFmtCtx)
+        avformat_close_input(&pRefFmtCtx);
+    return bSuccess;
+}
+
+bool ConcatExportSegments(const vector<ExportSegment>& aVideoSegs, const string& strAudioPath, const string& strOutputPath, string& strErrMsg)
+{
+    vector<ExportSegment> aAudioSegs;
+    if (!strAudioPath.empty())
+    {
+        ExportSegment tAudSeg;
+        tAudSeg.strPath = strAudioPath;
+        aAudioSegs.push_back(std::move(tAudSeg));
+    }
+    vector<SegmentPacketReader*> apReaders;
+    if (!aVideoSegs.empty())
+        apReaders.push_back(new SegmentPacketReader(aVideoSegs, AVMEDIA_TYPE_VIDEO));
+    if (!aAudioSegs.empty())
+        apReaders.push_back(new SegmentPacketReader(aAudioSegs, AVMEDIA_TYPE_AUDIO));
+    AVFormatContext* pOutFmtCtx = nullptr;
+    vector<AVStream*> apOutStreams;
+    bool bHeaderWritten = false;
+    bool bSuccess = false;
+    int fferr;
+
+    do {
+        if (apReaders.empty())
+        {
+            strErrMsg = "NO segment to concatenate!";
+            break;
+        }
+        fferr = avformat_alloc_output_context2(&pOutFmtCtx, nullptr, nullptr, strOutputPath.c_str());
+        if (fferr < 0 || !pOutFmtCtx)
+        {
+            ostringstream oss; oss << "FAILED to allocate output context for '" << strOutputPath << "'! fferr=" << fferr << ".";
+            strErrMsg = oss.str();
+            break;
+        }
+        bool bStreamsReady = true;
+        for (auto pReader : apReaders)
+        {
+            if (!pReader->Open(strErrMsg))
+            {
+                bStreamsReady = false;
+                break;
+            }
+            AVStream* pOutStream = avformat_new_stream(pOutFmtCtx, nullptr);
+            if (!pOutStream)
+            {
+                strErrMsg = "FAILED to create new output stream!";
+                bStreamsReady = false;
+                break;
+            }
+            fferr = avcodec_parameters_copy(pOutStream->codecpar, pReader->GetCodecParameters());
+            if (fferr < 0)
+            {
+                ostringstream oss; oss << "FAILED to copy codec parameters! fferr=" << fferr << ".";
+                strErrMsg = oss.str();
+                bStreamsReady = false;
+                break;
+            }
+            pOutStream->codecpar->codec_tag = 0;
+            apOutStreams.push_back(pOutStream);
+        }
+        if (!bStreamsReady)
+            break;
+        if (!(pOutFmtCtx->oformat->flags & AVFMT_NOFILE))
+        {
+            fferr = avio_open(&pOutFmtCtx->pb, strOutputPath.c_str(), AVIO_FLAG_WRITE);
+            if (fferr < 0)
+            {
+                ostringstream oss; oss << "FAILED to open output file '" << strOutputPath << "'! fferr=" << fferr << ".";
+                strErrMsg = oss.str();
+                break;
+            }
+        }
+        fferr = avformat_write_header(pOutFmtCtx, nullptr);
+        if (fferr < 0)
+        {
+            ostringstream oss; oss << "FAILED to write header of '" << strOutputPath << "'! fferr=" << fferr << ".";
+            strErrMsg = oss.str();
+            break;
+        }
+        bHeaderWritten = true;
+        // time base of output streams are determined after the header is written
+        for (int i = 0; i < apReaders.size(); i++)
+            apReaders[i]->SetOutputTimeBase(apOutStreams[i]->time_base);
+
+        // merge the packets from all the readers in dts order
+        bool bHasError = false;
+        while (true)
+        {
+            int iSelIdx = -1;
+            AVPacket* pSelPkt = nullptr;
+            int64_t i64SelTs = AV_NOPTS_VALUE;
+            for (int i = 0; i < apReaders.size(); i++)
+            {
+                AVPacket* pPkt = nullptr;
+                int ret = apReaders[i]->Peek(&pPkt, strErrMsg);
+                if (ret < 0)
+                {
+                    bHasError = true;
+                    break;
+                }
+                if (ret == 0)
+                    continue;
+                const int64_t i64Ts = pPkt->dts != AV_NOPTS_VALUE ? pPkt->dts : pPkt->pts;
+                if (!pSelPkt || av_compare_ts(i64Ts, apOutStreams[i]->time_base, i64SelTs, apOutStreams[iSelIdx]->time_base) < 0)
+                {
+                    iSelIdx = i;
+                    pSelPkt = pPkt;
+                    i64SelTs = i64Ts;
+                }
+            }
+            if (bHasError || !pSelPkt)
+                break;
+            pSelPkt->stream_index = apOutStreams[iSelIdx]->index;
+            pSelPkt->pos = -1;
+            fferr = av_interleaved_write_frame(pOutFmtCtx, pSelPkt);
+            apReaders[iSelIdx]->Consume();
+            if (fferr < 0)
+            {
+                ostringstream oss; oss << "FAILED to write packet into '" << strOutputPath << "'! fferr=" << fferr << ".";
+                strErrMsg = oss.str();
+                bHasError = true;
+                break;
+            }
+        }
+        if (bHasError)
+            break;
+        fferr = av_write_trailer(pOutFmtCtx);
+        if (fferr < 0)
+        {
+            ostringstream oss; oss << "FAILED to write trailer of '" << strOutputPath << "'! fferr=" << fferr << ".";
+            strErrMsg = oss.str();
+            break;
+        }
+        bSuccess = true;
+    } while (false);
+
+    if (pOutFmtCtx)
+    {
+        if (bHeaderWritten && !bSuccess)
+            av_write_trailer(pOutFmtCtx);
+        if (!(pOutFmtCtx->oformat->flags & AVFMT_NOFILE) && pOutFmtCtx->pb)
+            avio_closep(&pOutFmtCtx->pb);
+        avformat_free_context(pOutFmtCtx);
+    }
+    for (auto pReader : apReaders)
+        delete pReader;
+    if (!bSuccess)
+        Log(Error) << "'ConcatExportSegments()' FAILED! " << strErrMsg << endl;
+    return bSuccess;
+}
+}
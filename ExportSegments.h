@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+
+namespace MEC
+{
+    struct ExportSegment
+    {
+        std::string strPath;            // path of the segment file, or the source media file for a passthrough segment
+        int64_t i64StartMs {0};         // segment start position in the output, in milliseconds
+        int64_t i64EndMs {0};           // segment end position in the output, in milliseconds
+        int64_t i64SrcStartMs {-1};     // passthrough only, source position of the key frame where copying starts
+        int64_t i64SrcEndMs {-1};       // passthrough only, source position of the key frame where copying stops
+
+        bool IsPassthrough() const { return i64SrcStartMs >= 0; }
+    };
+
+    // Check whether the video stream of 'strSrcPath' can be copied into an output encoded by 'strCodecName' with the given
+    // pixel format (empty for any), size and frame rate. If so, 'aKeyFramesMs' receives the key frame positions in
+    // [i64StartMs, i64EndMs] of the source. Only key frames starting a closed GOP are listed, the leading pictures of an
+    // open GOP refer to the frames before its key frame, so such a GOP head has to be encoded instead of copied.
+    bool ProbePassthroughSource(const std::string& strSrcPath, const std::string& strCodecName, const std::string& strPixFmt, uint32_t u32Width, uint32_t u32Height,
+            int32_t i32FrameRateNum, int32_t i32FrameRateDen, int64_t i64StartMs, int64_t i64EndMs, std::vector<int64_t>& aKeyFramesMs, std::string& strErrMsg);
+
+    // Check whether the video stream of 'strPath' has the same codec, size, pixel format, profile, level and extradata as
+    // the one of 'strRefPath', which is required to copy them into one output stream. The parameters of an encoder are only
+    // known after it has written a segment, so a passthrough segment is checked against an encoded one before concatenating.
+    // Return false if any of the files can not be read, otherwise 'bMatched' tells the result.
+    bool MatchSegmentCodecParams(const std::string& strRefPath, const std::string& strPath, bool& bMatched, std::string& strErrMsg);
+
+    // Persistent store of encoded export segments. A segment is keyed by the hash of everything that affects its content,
+    // so a re-export only encodes the segments whose key is not found. Least recently used files are evicted by 'Trim()'.
+    // 'CreateInstance()' returns the same instance for the same directory while it is in use. A segment returned by
+    // 'Lookup()' or 'Commit()' is pinned, 'Trim()' keeps its file until the export using it calls 'Unpin()'.
+    class ExportSegmentCache
+    {
+    public:
+        using Holder = std::shared_ptr<ExportSegmentCache>;
+        static Holder CreateInstance(const std::string& strCacheDir, std::string& strErrMsg);
+        static uint64_t Hash(const std::string& strData);
+        // Path, size and modification time of a source file, a key including it changes when the file is replaced
+        static std::string GetSourceIdentity(const std::string& strPath);
+
+        std::string GetSegmentPath(uint64_t u64Key, const std::string& strFileExt) const;
+        bool Lookup(uint64_t u64Key, const std::string& strFileExt, std::string& strPath);
+        bool Commit(uint64_t u64Key, const std::string& strFileExt, const std::string& strEncodedPath, std::string& strPath);
+        void Unpin(uint64_t u64Key, const std::string& strFileExt);
+        void Trim(int64_t i64MaxBytes);
+
+    private:
+        ExportSegmentCache(const std::string& strCacheDir) : m_strCacheDir(strCacheDir) {}
+        void LoadIndex();
+        void SaveIndex();
+
+    private:
+        struct Entry
+        {
+            int64_t i64Size {0};
+            uint64_t u64LastUsed {0};
+            int iPinCount {0};          // exports holding the segment, not saved in the index
+        };
+        std::string m_strCacheDir;
+        std::unordered_map<std::string, Entry> m_aEntries;  // file name -> entry
+        uint64_t m_u64UseSerial {0};
+        std::mutex m_mtxEntries;
+    };
+
+    // Concatenate the video segments, which must share the same codec parameters, and mux them with the
+    // audio file (can be empty) into 'strOutputPath'. Packets are copied as they are, no re-encoding happens,
+    // and the concatenation fails if any segment has different codec parameters from the first one.
+    // Passthrough segments contribute the source packets from 'i64SrcStartMs' up to the key frame at 'i64SrcEndMs'.
+    bool ConcatExportSegments(const std::vector<ExportSegment>& aVideoSegs, const std::string& strAudioPath, const std::string& strOutputPath, std::string& strErrMsg);
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+namespace MEC
+{
+    static const uint64_t FNV1A_64_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+
+    // Feed 'szSize' bytes into a 64-bit FNV-1a hash which starts at 'FNV1A_64_OFFSET_BASIS'. The result is stable across
+    // runs and platforms, the caches use it to name the files kept between sessions.
+    inline void HashFnv1a(uint64_t& u64Hash, const void* pData, size_t szSize)
+    {
+        const uint8_t* pBytes = (const uint8_t*)pData;
+        for (size_t i = 0; i < szSize; i++)
+        {
+            u64Hash ^= pBytes[i];
+            u64Hash *= 0x100000001b3ULL;
+        }
+    }
+}
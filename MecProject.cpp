@@ -411,16 +411,7 @@ Project::ErrorCode Project::SaveTo(const string& projFilePath)
         MediaTimeline::TimeLine* pTl = (MediaTimeline::TimeLine*)m_pTlHandle;
         // save media items
         imgui_json::array aMediaItems;
-        for (auto media : pTl->media_items)
-        {
-            imgui_json::value item;
-            item["id"] = imgui_json::number(media->mID);
-            item["name"] = media->mName;
-            item["path"] = media->mPath;
-            item["type"] = imgui_json::number(media->mMediaType);
-            item["meta_data"] = media->mMetaData;
-            aMediaItems.push_back(item);
-        }
+        pTl->SaveMediaBank(aMediaItems);
         imgui_json::value jnProjContent;
         jnProjContent["MediaBank"] = aMediaItems;
         // save timeline
@@ -405,10 +405,20 @@ struct MediaEditorSettings
     int  MediaBankViewType {0};             // Media bank view type, 0 = Media bank, 1 = embedded browser
 
     bool HardwareCodec {true};              // try HW codec
+    bool LazyMediaInit {true};              // open the media item overviews when they are shown or used, not while loading a project
+    int MediaLoadThreads {0};               // media items opened in parallel while loading a project, 0 for the cpu core count
+    int HistoryMaxRecords {1000};           // undo records kept, the oldest ones are dropped
+    int HistoryMemoryLimit {64};            // MB of undo records kept in memory, older ones are spilled to the cache dir
+    int EncodingVideoQueueSize {8};         // composed video frames waiting for the export encoder
+    int EncodingAudioQueueSize {32};        // mixed audio blocks waiting for the export encoder
+    bool RenderAheadEnabled {false};        // compose preview frames ahead of the playhead in background while playing
+    int RenderAheadWorkers {1};             // render-ahead worker threads, each one holds a clone of the preview reader
+    int RenderAheadMaxMB {256};             // MB of composed frames kept by the render-ahead cache
     bool isCustomVideoFrameSize {false};    // current frame size is custom
     int VideoWidth  {1920};                 // timeline Media Width
     int VideoHeight {1080};                 // timeline Media Height
     float PreviewScale {0.5};               // timeline Media Video Preview scale
+    bool AdaptivePreview {false};           // lower preview resolution while playback can't keep up, and cap it at the preview window size
     bool isCustomVideoFrameRate {false};    // current frame rate is custom
     MediaCore::Ratio VideoFrameRate {25000, 1000};// timeline frame rate
     bool isCustomPixelAspectRatio {false};  // current pixel aspect ratio is custom
@@ -1449,6 +1459,8 @@ static void ShowConfigure(MediaEditorSettings & config)
                 {
                     SetPreviewScale(config, preview_scale_index);
                 }
+                ImGui::Checkbox("Adaptive preview scale", &config.AdaptivePreview);
+                ImGui::ShowTooltipOnHover("Lower the preview resolution while playback can't keep up, and don't compose more pixels than the preview window shows.");
                 if (ImGui::Combo("Pixel Aspect Ratio", &pixel_aspect_index, pixel_aspect_items, IM_ARRAYSIZE(pixel_aspect_items)))
                 {
                     SetPixelAspectRatio(config.PixelAspectRatio, pixel_aspect_index);
@@ -1503,6 +1515,26 @@ static void ShowConfigure(MediaEditorSettings & config)
                 ImGui::Combo("Color Space", &config.ColorSpaceIndex, color_getter, (void *)ColorSpace, IM_ARRAYSIZE(ColorSpace));
                 ImGui::Combo("Color Transfer", &config.ColorTransferIndex, color_getter, (void *)ColorTransfer, IM_ARRAYSIZE(ColorTransfer));
                 ImGui::Checkbox("HW codec if available", &config.HardwareCodec); ImGui::SameLine(); ImGui::TextUnformatted("(Restart Application required)");
+                ImGui::Checkbox("Lazy media loading", &config.LazyMediaInit);
+                ImGui::ShowTooltipOnHover("Only probe the media items while loading a project, their thumbnails and waveforms are made when they are shown or used.");
+                ImGui::SliderInt("Media load threads", &config.MediaLoadThreads, 0, 32, config.MediaLoadThreads > 0 ? "%d" : "Auto");
+                ImGui::ShowTooltipOnHover("Media items opened in parallel while loading a project, 'Auto' uses one thread per cpu core.");
+                ImGui::SliderInt("Undo history records", &config.HistoryMaxRecords, 10, 10000, "%d");
+                ImGui::ShowTooltipOnHover("Oldest undo records beyond this count are dropped.");
+                ImGui::SliderInt("Undo history memory(MB)", &config.HistoryMemoryLimit, 1, 1024, "%d");
+                ImGui::ShowTooltipOnHover("Oldest undo records beyond this size are spilled to a file in the cache directory.");
+                ImGui::SliderInt("Export video queue", &config.EncodingVideoQueueSize, 1, 64, "%d");
+                ImGui::ShowTooltipOnHover("Composed video frames waiting for the encoder while exporting.");
+                ImGui::SliderInt("Export audio queue", &config.EncodingAudioQueueSize, 1, 256, "%d");
+                ImGui::ShowTooltipOnHover("Mixed audio blocks waiting for the encoder while exporting.");
+                ImGui::Checkbox("Render ahead preview", &config.RenderAheadEnabled);
+                ImGui::ShowTooltipOnHover("Compose the frames ahead of the playhead in background while playing, so sections with heavy effects play smoothly after a short pre-roll.");
+                ImGui::BeginDisabled(!config.RenderAheadEnabled);
+                ImGui::SliderInt("Render ahead workers", &config.RenderAheadWorkers, 1, 8, "%d");
+                ImGui::ShowTooltipOnHover("Background threads composing the preview frames, each one decodes the media on its own.");
+                ImGui::SliderInt("Render ahead memory(MB)", &config.RenderAheadMaxMB, 64, 8192, "%d");
+                ImGui::ShowTooltipOnHover("Composed preview frames kept in memory, the ones behind the playhead are dropped first.");
+                ImGui::EndDisabled();
                 ImGui::Separator();
                 ImGui::BulletText(ICON_MEDIA_AUDIO " Audio");
                 if (ImGui::Combo("Audio Sample Rate", &sample_rate_index, audio_sample_rate_items, IM_ARRAYSIZE(audio_sample_rate_items)))
@@ -1681,6 +1713,16 @@ static void NewTimeline()
     timeline->mHardwareCodec = g_media_editor_settings.HardwareCodec;
     timeline->mMaxCachedVideoFrame = g_media_editor_settings.VideoFrameCacheSize > 0 ? g_media_editor_settings.VideoFrameCacheSize : MAX_VIDEO_CACHE_FRAMES;
     timeline->mShowHelpTooltips = g_media_editor_settings.ShowHelpTooltips;
+    timeline->mPreviewAdaptive = g_media_editor_settings.AdaptivePreview;
+    timeline->mMediaLoadThreads = g_media_editor_settings.MediaLoadThreads;
+    timeline->mLazyMediaInit = g_media_editor_settings.LazyMediaInit;
+    timeline->mHistoryMaxRecords = g_media_editor_settings.HistoryMaxRecords;
+    timeline->mHistoryMemoryLimit = g_media_editor_settings.HistoryMemoryLimit;
+    timeline->mEncodingVideoQueueSize = g_media_editor_settings.EncodingVideoQueueSize;
+    timeline->mEncodingAudioQueueSize = g_media_editor_settings.EncodingAudioQueueSize;
+    timeline->mRenderAheadEnabled = g_media_editor_settings.RenderAheadEnabled;
+    timeline->mRenderAheadWorkerCount = g_media_editor_settings.RenderAheadWorkers;
+    timeline->mRenderAheadMaxBytes = (int64_t)g_media_editor_settings.RenderAheadMaxMB*1024*1024;
     timeline->mAudioAttribute.mAudioSpectrogramLight = g_media_editor_settings.AudioSpectrogramLight;
     timeline->mAudioAttribute.mAudioSpectrogramOffset = g_media_editor_settings.AudioSpectrogramOffset;
     timeline->mAudioAttribute.mAudioVectorScale = g_media_editor_settings.AudioVectorScale;
@@ -1789,55 +1831,7 @@ static void LoadProjectThread(std::string path, bool in_splash)
     if (jnProjContent.contains(attrName) && jnProjContent[attrName].is_array())
     {
         const auto& jnMediaBank = jnProjContent[attrName].get<imgui_json::array>();
-        const auto szItemCnt = jnMediaBank.size();
-        float percentage = szItemCnt > 0 ?  0.6 / szItemCnt : 0;
-        for (const auto& jnItem : jnMediaBank)
-        {
-            int64_t id = -1;
-            std::string name;
-            std::string path;
-            uint32_t type = MEDIA_UNKNOWN;
-            if (jnItem.contains("id"))
-            {
-                auto& val = jnItem["id"];
-                if (val.is_number())
-                {
-                    id = val.get<imgui_json::number>();
-                }
-            }
-            if (jnItem.contains("name"))
-            {
-                auto& val = jnItem["name"];
-                if (val.is_string())
-                {
-                    name = val.get<imgui_json::string>();
-                }
-            }
-            if (jnItem.contains("path"))
-            {
-                auto& val = jnItem["path"];
-                if (val.is_string())
-                {
-                    path = val.get<imgui_json::string>();
-                }
-            }
-            if (jnItem.contains("type"))
-            {
-                auto& val = jnItem["type"];
-                if (val.is_number())
-                {
-                    type = val.get<imgui_json::number>();
-                }
-            }
-
-            MediaItem* item = new MediaItem(name, path, type, timeline);
-            if (id != -1) item->mID = id;
-            item->Initialize();
-            if (jnItem.contains("meta_data"))
-                item->mMetaData = jnItem["meta_data"];
-            timeline->media_items.push_back(item);
-            g_project_loading_percentage += percentage;
-        }
+        timeline->LoadMediaBank(jnMediaBank, &g_project_loading_percentage, 0.6f);
     }
     else
     {
@@ -2425,8 +2419,11 @@ static std::vector<MediaItem *>::iterator InsertMediaIcon(std::vector<MediaItem
 {
     ImGuiIO& io = ImGui::GetIO();
     ImGui::PushStyleColor(ImGuiCol_Button, ImVec4(0, 0, 0, 0));
-    (*item)->UpdateThumbnail();
     ImVec2 icon_size = ImVec2(media_icon_size, media_icon_size);
+    // the overview of an item is opened when it's scrolled into view
+    const bool icon_visible = ImGui::IsRectVisible(icon_pos, icon_pos + icon_size);
+    if (icon_visible)
+        (*item)->UpdateThumbnail();
     // Draw Shadow for Icon
     draw_list->AddRectFilled(icon_pos + ImVec2(6, 6), icon_pos + ImVec2(6, 6) + icon_size, IM_COL32(16, 16, 16, 255), 8, ImDrawFlags_RoundCornersAll);
     draw_list->AddRectFilled(icon_pos + ImVec2(4, 4), icon_pos + ImVec2(4, 4) + icon_size, IM_COL32(32, 32, 48, 255), 8, ImDrawFlags_RoundCornersAll);
@@ -2444,7 +2441,7 @@ static std::vector<MediaItem *>::iterator InsertMediaIcon(std::vector<MediaItem
             ImGui::TextUnformatted((*item)->mName.c_str());
             if (!(*item)->mMediaThumbnail.empty() && (*item)->mMediaThumbnail[0])
             {
-                const auto vidstm = (*item)->mMediaOverview->GetVideoStream();
+                const auto vidstm = (*item)->mhParser->GetBestVideoStream();
                 float aspectRatio = (float)vidstm->width / (float)vidstm->height;
                 auto hTx = (*item)->mMediaThumbnail[0];
                 auto tid = hTx->TextureID();
@@ -2475,8 +2472,8 @@ static std::vector<MediaItem *>::iterator InsertMediaIcon(std::vector<MediaItem
                 pItem->mSelected = true;
                 // set timeline player
                 timeline->mMediaPlayer->Close();
-                if (pItem->mMediaOverview && pItem->mMediaOverview->IsOpened())
-                    timeline->mMediaPlayer->Open(pItem->mMediaOverview->GetMediaParser());
+                if (pItem->mhParser && pItem->mhParser->IsOpened())
+                    timeline->mMediaPlayer->Open(pItem->mhParser);
                 else if (SysUtils::IsFile(pItem->mPath))
                     timeline->mMediaPlayer->Open(pItem->mPath);
                 else
@@ -2522,9 +2519,9 @@ static std::vector<MediaItem *>::iterator InsertMediaIcon(std::vector<MediaItem
         }
         else
         {
-            if (IS_AUDIO((*item)->mMediaType) && (*item)->mMediaOverview)
+            if (IS_AUDIO((*item)->mMediaType) && (*item)->mValid && icon_visible)
             {
-                auto wavefrom = (*item)->mMediaOverview->GetWaveform();
+                auto wavefrom = (*item)->GetWaveform();
                 if (wavefrom && wavefrom->pcm.size() > 0)
                 {
                     ImVec2 wave_pos = icon_pos + ImVec2(4, 28);
@@ -2583,11 +2580,11 @@ static std::vector<MediaItem *>::iterator InsertMediaIcon(std::vector<MediaItem
                 ImGui::Button((*item)->mName.c_str(), ImVec2(media_icon_size, media_icon_size));
         }
 
-        if ((*item)->mMediaOverview && (*item)->mMediaOverview->IsOpened())
+        if ((*item)->mValid && (*item)->mhParser && (*item)->mhParser->IsOpened())
         {
-            auto has_video = (*item)->mMediaOverview->HasVideo();
-            auto has_audio = (*item)->mMediaOverview->HasAudio();
-            auto media_length = (*item)->mMediaOverview->GetMediaParser()->GetMediaInfo()->duration;
+            auto has_video = (*item)->mhParser->HasVideo();
+            auto has_audio = (*item)->mhParser->HasAudio();
+            auto media_length = (*item)->mhParser->GetMediaInfo()->duration;
             ImGui::SetCursorScreenPos(icon_pos + ImVec2(4, 4));
             std::string type_string = "? ";
             if (IS_VIDEO((*item)->mMediaType))
@@ -2613,7 +2610,7 @@ static std::vector<MediaItem *>::iterator InsertMediaIcon(std::vector<MediaItem
             ImGui::PushStyleColor(ImGuiCol_ButtonActive, ImVec4(0, 0, 0, 0));
             if (has_video)
             {
-                auto stream = (*item)->mMediaOverview->GetVideoStream();
+                auto stream = (*item)->mhParser->GetBestVideoStream();
                 if (stream)
                 {
                     auto video_icon = GetVideoIcon(stream->width, stream->height);
@@ -2646,7 +2643,7 @@ static std::vector<MediaItem *>::iterator InsertMediaIcon(std::vector<MediaItem
             }
             if (has_audio)
             {
-                auto stream = (*item)->mMediaOverview->GetAudioStream();
+                auto stream = (*item)->mhParser->GetBestAudioStream();
                 if (stream)
                 {
                     auto audio_channels = stream->channels;
@@ -4367,6 +4364,17 @@ static void ShowMediaOutputWindow(ImDrawList *_draw_list)
                 ImGui::SameLine();
                 ImGui::Text("%s", ImGuiHelper::MillisecToString(valid_duration, 2).c_str());
             }
+            if (encoder_stage != 0 && ImGui::TreeNode("Encoding statistics"))
+            {
+                // stage times are summed over threads, the largest one tells which stage bounds the throughput
+                auto stats = timeline->GetEncodingStats();
+                ImGui::Text("Frames: %lld  FPS: %.1f  Realtime: %.2fx", (long long)stats.videoFrames, stats.fps, stats.realtimeFactor);
+                ImGui::Text("Video compose: %.2fs  Audio mix: %.2fs  Encode: %.2fs", stats.videoComposeSec, stats.audioMixSec, stats.encodeSec);
+                ImGui::Text("Wait on full queue: %.2fs  Wait on empty queue: %.2fs", stats.composeQueueWaitSec, stats.encodeQueueWaitSec);
+                if (stats.concatSec > 0)
+                    ImGui::Text("Concat: %.2fs", stats.concatSec);
+                ImGui::TreePop();
+            }
 
             const ImVec2 btnPaddingSize { 30, 14 };
             std::string btnText;
@@ -4385,6 +4393,54 @@ static void ShowMediaOutputWindow(ImDrawList *_draw_list)
             ImGui::EndDisabled();
             ImGui::SameLine();
 
+            auto buildEncoderParams = [] (TimeLine::VideoEncoderParams& vidEncParams, TimeLine::AudioEncoderParams& audEncParams)
+            {
+                auto addVidEncOpt = [&vidEncParams] (const std::string& name, int value)
+                {
+                    vidEncParams.extraOpts.push_back({name, MediaCore::Value(value)});
+                    vidEncParams.jnExtraOpts[name] = imgui_json::number(value);
+                };
+                vidEncParams.codecName = g_currVidEncDescList[g_media_editor_settings.OutputVideoCodecTypeIndex].codecName;
+                vidEncParams.width = g_media_editor_settings.OutputVideoResolutionWidth;
+                vidEncParams.height = g_media_editor_settings.OutputVideoResolutionHeight;
+                vidEncParams.frameRate = g_media_editor_settings.OutputVideoFrameRate;
+                vidEncParams.bitRate = g_media_editor_settings.OutputVideoBitrate;
+                auto outColorspaceValue = ColorSpace[g_media_editor_settings.OutputColorSpaceIndex].tag;
+                switch (outColorspaceValue)
+                {
+                case AVCOL_SPC_BT709:
+                    addVidEncOpt("color_primaries", (int)AVCOL_PRI_BT709);
+                    break;
+                case AVCOL_SPC_FCC:
+                    addVidEncOpt("color_primaries", (int)AVCOL_PRI_BT470M);
+                    break;
+                case AVCOL_SPC_BT470BG:
+                    addVidEncOpt("color_primaries", (int)AVCOL_PRI_BT470BG);
+                    break;
+                case AVCOL_SPC_SMPTE170M:
+                    addVidEncOpt("color_primaries", (int)AVCOL_PRI_SMPTE170M);
+                    break;
+                case AVCOL_SPC_SMPTE240M:
+                    addVidEncOpt("color_primaries", (int)AVCOL_PRI_SMPTE240M);
+                    break;
+                case AVCOL_SPC_BT2020_NCL:
+                case AVCOL_SPC_BT2020_CL:
+                    addVidEncOpt("color_primaries", (int)AVCOL_PRI_BT2020);
+                    break;
+                default:
+                    addVidEncOpt("color_primaries", (int)AVCOL_PRI_UNSPECIFIED);
+                }
+                if (vidEncParams.codecName.compare("prores_videotoolbox") == 0)
+                {
+                    addVidEncOpt("allow_sw", 1);
+                }
+                addVidEncOpt("colorspace", (int)outColorspaceValue);
+                addVidEncOpt("color_trc", (int)(ColorTransfer[g_media_editor_settings.OutputColorTransferIndex].tag));
+                audEncParams.codecName = g_currAudEncDescList[g_media_editor_settings.OutputAudioCodecTypeIndex].codecName;
+                audEncParams.channels = g_media_editor_settings.OutputAudioChannels;
+                audEncParams.sampleRate = g_media_editor_settings.OutputAudioSampleRate;
+                audEncParams.bitRate = 128000;
+            };
             btnText = timeline->mIsEncoding ? "Stop encoding" : "Start encoding";
             btnTxtSize = ImGui::CalcTextSize(btnText.c_str());
             if (encoder_stage != 2 && ImGui::Button(btnText.c_str(), btnTxtSize + btnPaddingSize))
@@ -4398,47 +4454,8 @@ static void ShowMediaOutputWindow(ImDrawList *_draw_list)
                 {
                     // config encoders
                     TimeLine::VideoEncoderParams vidEncParams;
-                    vidEncParams.codecName = g_currVidEncDescList[g_media_editor_settings.OutputVideoCodecTypeIndex].codecName;
-                    vidEncParams.width = g_media_editor_settings.OutputVideoResolutionWidth;
-                    vidEncParams.height = g_media_editor_settings.OutputVideoResolutionHeight;
-                    vidEncParams.frameRate = g_media_editor_settings.OutputVideoFrameRate;
-                    vidEncParams.bitRate = g_media_editor_settings.OutputVideoBitrate;
-                    auto outColorspaceValue = ColorSpace[g_media_editor_settings.OutputColorSpaceIndex].tag;
-                    switch (outColorspaceValue)
-                    {
-                    case AVCOL_SPC_BT709:
-                        vidEncParams.extraOpts.push_back({"color_primaries", MediaCore::Value((int)AVCOL_PRI_BT709)});
-                        break;
-                    case AVCOL_SPC_FCC:
-                        vidEncParams.extraOpts.push_back({"color_primaries", MediaCore::Value((int)AVCOL_PRI_BT470M)});
-                        break;
-                    case AVCOL_SPC_BT470BG:
-                        vidEncParams.extraOpts.push_back({"color_primaries", MediaCore::Value((int)AVCOL_PRI_BT470BG)});
-                        break;
-                    case AVCOL_SPC_SMPTE170M:
-                        vidEncParams.extraOpts.push_back({"color_primaries", MediaCore::Value((int)AVCOL_PRI_SMPTE170M)});
-                        break;
-                    case AVCOL_SPC_SMPTE240M:
-                        vidEncParams.extraOpts.push_back({"color_primaries", MediaCore::Value((int)AVCOL_PRI_SMPTE240M)});
-                        break;
-                    case AVCOL_SPC_BT2020_NCL:
-                    case AVCOL_SPC_BT2020_CL:
-                        vidEncParams.extraOpts.push_back({"color_primaries", MediaCore::Value((int)AVCOL_PRI_BT2020)});
-                        break;
-                    default:
-                        vidEncParams.extraOpts.push_back({"color_primaries", MediaCore::Value((int)AVCOL_PRI_UNSPECIFIED)});
-                    }
-                    if (vidEncParams.codecName.compare("prores_videotoolbox") == 0)
-                    {
-                        vidEncParams.extraOpts.push_back({"allow_sw", MediaCore::Value(1)});
-                    }
-                    vidEncParams.extraOpts.push_back({"colorspace", MediaCore::Value((int)outColorspaceValue)});
-                    vidEncParams.extraOpts.push_back({"color_trc", MediaCore::Value((int)(ColorTransfer[g_media_editor_settings.OutputColorTransferIndex].tag))});
                     TimeLine::AudioEncoderParams audEncParams;
-                    audEncParams.codecName = g_currAudEncDescList[g_media_editor_settings.OutputAudioCodecTypeIndex].codecName;
-                    audEncParams.channels = g_media_editor_settings.OutputAudioChannels;
-                    audEncParams.sampleRate = g_media_editor_settings.OutputAudioSampleRate;
-                    audEncParams.bitRate = 128000;
+                    buildEncoderParams(vidEncParams, audEncParams);
                     if (timeline->ConfigEncoder(fullpath, vidEncParams, audEncParams, g_encoderConfigErrorMessage))
                     {
                         timeline->StartEncoding();
@@ -4448,6 +4465,51 @@ static void ShowMediaOutputWindow(ImDrawList *_draw_list)
                     }
                 }
             }
+            if (encoder_stage != 2)
+            {
+                // render in a background task with a snapshot of the timeline, editing can go on while it is queued or running
+                ImGui::SameLine();
+                btnText = "Queue export";
+                btnTxtSize = ImGui::CalcTextSize(btnText.c_str());
+                ImGui::BeginDisabled(timeline->mIsEncoding || valid_duration <= 0 || !timeline->IsProjectDirReady());
+                if (ImGui::Button(btnText.c_str(), btnTxtSize + btnPaddingSize))
+                {
+                    TimeLine::VideoEncoderParams vidEncParams;
+                    TimeLine::AudioEncoderParams audEncParams;
+                    buildEncoderParams(vidEncParams, audEncParams);
+                    imgui_json::value jnEncParams;
+                    TimeLine::SaveEncoderParams(vidEncParams, audEncParams, jnEncParams);
+                    imgui_json::value jnProjContent;
+                    imgui_json::array jnMediaBank;
+                    timeline->SaveMediaBank(jnMediaBank);
+                    jnProjContent["MediaBank"] = jnMediaBank;
+                    imgui_json::value jnTimeLine;
+                    timeline->Save(jnTimeLine);
+                    jnProjContent["TimeLine"] = jnTimeLine;
+                    imgui_json::value jnTask;
+                    jnTask["type"] = "Export";
+                    jnTask["project_dir"] = timeline->mhProject->GetProjectDir();
+                    jnTask["project_content"] = jnProjContent;
+                    jnTask["output_path"] = fullpath;
+                    jnTask["encoder_params"] = jnEncParams;
+                    if (timeline->mEncodingInRange)
+                    {
+                        jnTask["export_start"] = imgui_json::number(timeline->mark_in);
+                        jnTask["export_end"] = imgui_json::number(timeline->mark_out);
+                    }
+                    jnTask["segment_count"] = imgui_json::number(timeline->mEncodingSegmentCount);
+                    jnTask["smart_render"] = timeline->mEncodingSmartRender;
+                    jnTask["use_cache"] = timeline->mEncodingUseCache;
+                    jnTask["checkpoint"] = timeline->mEncodingCheckpoint;
+                    auto hTask = MEC::BackgroundTask::CreateBackgroundTask(jnTask, timeline->mhMediaSettings->Clone(), timeline->mTxMgr);
+                    if (hTask && timeline->mhProject->EnqueueBackgroundTask(hTask) == MEC::Project::OK)
+                        g_encoderConfigErrorMessage.clear();
+                    else
+                        g_encoderConfigErrorMessage = "FAILED to queue the export as a background task!";
+                }
+                ImGui::ShowTooltipOnHover("Export a snapshot of the current timeline in background, see the background task tab for its progress.");
+                ImGui::EndDisabled();
+            }
             if (timeline->mark_in != -1 && timeline->mark_out != -1 && encoder_stage != 2)
             {
                 ImGui::SameLine();
@@ -4459,11 +4521,34 @@ static void ShowMediaOutputWindow(ImDrawList *_draw_list)
             {
                 timeline->mEncodingInRange = false;
             }
+            if (encoder_stage != 2)
+            {
+                ImGui::BeginDisabled(timeline->mIsEncoding);
+                ImGui::PushItemWidth(120);
+                ImGui::SliderInt("Parallel segments", &timeline->mEncodingSegmentCount, 1, 16);
+                ImGui::PopItemWidth();
+                ImGui::ShowTooltipOnHover("Split the output into segments which are rendered in parallel, then concatenated without re-encoding.");
+                ImGui::SameLine();
+                ImGui::Checkbox("Smart render", &timeline->mEncodingSmartRender);
+                ImGui::ShowTooltipOnHover("Copy untouched source video instead of re-encoding it, when its codec, size and frame rate match the output.");
+                ImGui::SameLine();
+                ImGui::Checkbox("Reuse unchanged segments", &timeline->mEncodingUseCache);
+                ImGui::ShowTooltipOnHover("Keep encoded segments in the cache directory, a re-export only encodes the segments which are changed since.");
+                ImGui::SameLine();
+                ImGui::Checkbox("Resumable", &timeline->mEncodingCheckpoint);
+                ImGui::ShowTooltipOnHover("Write the output as segments with a manifest in the cache directory, an interrupted export resumes from the last finished segment.");
+                ImGui::EndDisabled();
+            }
             if (!g_encoderConfigErrorMessage.empty())
             {
                 ImGui::TextColored({1., 0.2, 0.2, 1.}, "%s", g_encoderConfigErrorMessage.c_str());
             }
 
+            if (!timeline->mEncodeNoticeMsg.empty())
+            {
+                ImGui::TextColored({0.8, 0.8, 0.4, 1.}, "%s", timeline->mEncodeNoticeMsg.c_str());
+            }
+
             if (!timeline->mEncodeProcErrMsg.empty())
             {
                 ImGui::TextColored({1., 0.5, 0.5, 1.}, "%s", timeline->mEncodeProcErrMsg.c_str());
@@ -4685,7 +4770,8 @@ static void ShowMediaPreviewWindow(ImDrawList *draw_list, std::string title, flo
     PreviewSize = window_size - ImVec2(16 + (audio_bar ? 64 : 0), 16 + bar_height);
     if (force_update)
         timeline->mIsPreviewNeedUpdate = true;
-    bool bTxUpdated = timeline->UpdatePreviewTexture();
+    timeline->SetPreviewViewportSize(PreviewSize * ImGui::GetIO().DisplayFramebufferScale);
+    bool bTxUpdated = timeline->UpdatePreviewTexture(false, true);
     if ((bTxUpdated || need_update_scope) && !timeline->mPreviewMat.empty())
         CalculateVideoScope(timeline->mPreviewMat);
 
@@ -4709,7 +4795,7 @@ static void ShowMediaPreviewWindow(ImDrawList *draw_list, std::string title, flo
         float pos_x = 0, pos_y = 0;
         float offset_x = 0, offset_y = 0;
         float tf_x = 0, tf_y = 0;
-        ImVec2 scale_range = ImVec2(2.0 / timeline->mPreviewScale, 8.0 / timeline->mPreviewScale);
+        ImVec2 scale_range = ImVec2(2.0 / timeline->mPreviewAppliedScale, 8.0 / timeline->mPreviewAppliedScale);
         static float texture_zoom = scale_range.x;
         ShowVideoWindow(draw_list, tidMainPreview, PreviewPos, PreviewSize, title, title_size, offset_x, offset_y, tf_x, tf_y, true, out_of_border);
         if (!out_of_border && ImGui::IsItemHovered() && timeline->bPreviewZoom)
@@ -4922,7 +5008,7 @@ static void ShowVideoPreviewWindow(ImDrawList *draw_list, EditingVideoClip* pVid
     ImVec2 VideoZoomPos = window_pos + ImVec2(window_size.x - 740.f, window_size.y - PanelBarSize.y + 4);
     if (pVidEditingClip)
     {
-        ImVec2 scale_range = ImVec2(0.5 / timeline->mPreviewScale, 4.0 / timeline->mPreviewScale);
+        ImVec2 scale_range = ImVec2(0.5 / timeline->mPreviewAppliedScale, 4.0 / timeline->mPreviewAppliedScale);
         static float texture_zoom = scale_range.x;
         if (InputVideoRect.Contains(io.MousePos) || OutVideoRect.Contains(io.MousePos))
         {
@@ -11013,13 +11099,23 @@ static void ShowMediaScopeView(int index, ImVec2 pos, ImVec2 size)
                 
                 if (!timeline->mAudioAttribute.channel_data[i].m_Spectrogram.empty())
                 {
-                    ImVec2 texture_pos = center - ImVec2(channel_view_size.y / 2, channel_view_size.x / 2);
                     if (timeline->mAudioAttribute.channel_data[i].m_Spectrogram.flags & IM_MAT_FLAGS_CUSTOM_UPDATED)
                     {
                         ImGui::ImMatToTexture(timeline->mAudioAttribute.channel_data[i].m_Spectrogram, timeline->mAudioAttribute.channel_data[i].texture_spectrogram);
                         timeline->mAudioAttribute.channel_data[i].m_Spectrogram.flags &= ~IM_MAT_FLAGS_CUSTOM_UPDATED;
                     }
-                    ImGui::AddImageRotate(draw_list, timeline->mAudioAttribute.channel_data[i].texture_spectrogram, texture_pos, ImVec2(channel_view_size.y, channel_view_size.x), -90.0);
+                    // the texture is a ring of rows, time runs left to right from the oldest row at 'm_SpectrogramRow'
+                    // and frequency bottom to top, as the texture rotated by -90 degree
+                    const auto& channel_data = timeline->mAudioAttribute.channel_data[i];
+                    const float split = (float)channel_data.m_SpectrogramRow / channel_data.m_Spectrogram.h;
+                    const ImVec2 area_min = center - channel_view_size / 2;
+                    const ImVec2 area_max = center + channel_view_size / 2;
+                    const float split_x = area_min.x + (1.f - split) * channel_view_size.x;
+                    draw_list->AddImageQuad(channel_data.texture_spectrogram, ImVec2(area_min.x, area_max.y), area_min, ImVec2(split_x, area_min.y), ImVec2(split_x, area_max.y),
+                                            ImVec2(0, split), ImVec2(1, split), ImVec2(1, 1), ImVec2(0, 1));
+                    if (split > 0)
+                        draw_list->AddImageQuad(channel_data.texture_spectrogram, ImVec2(split_x, area_max.y), ImVec2(split_x, area_min.y), ImVec2(area_max.x, area_min.y), area_max,
+                                                ImVec2(0, 0), ImVec2(1, 0), ImVec2(1, split), ImVec2(0, split));
                 }
             }
             // draw bar mark
@@ -11342,10 +11438,20 @@ static void MediaEditor_SetupContext(ImGuiContext* ctx, void* handle, bool in_sp
         else if (sscanf(line, "ControlPanelWidth=%f", &val_float) == 1) { setting->ControlPanelWidth = val_float; }
         else if (sscanf(line, "MainViewWidth=%f", &val_float) == 1) { setting->MainViewWidth = val_float; }
         else if (sscanf(line, "HWCodec=%d", &val_int) == 1) { setting->HardwareCodec = val_int == 1; }
+        else if (sscanf(line, "MediaLoadThreads=%d", &val_int) == 1) { setting->MediaLoadThreads = val_int; }
+        else if (sscanf(line, "LazyMediaInit=%d", &val_int) == 1) { setting->LazyMediaInit = val_int == 1; }
+        else if (sscanf(line, "HistoryMaxRecords=%d", &val_int) == 1) { setting->HistoryMaxRecords = ImClamp(val_int, 10, 10000); }
+        else if (sscanf(line, "HistoryMemoryLimit=%d", &val_int) == 1) { setting->HistoryMemoryLimit = ImClamp(val_int, 1, 1024); }
+        else if (sscanf(line, "EncodingVideoQueueSize=%d", &val_int) == 1) { setting->EncodingVideoQueueSize = ImClamp(val_int, 1, 64); }
+        else if (sscanf(line, "EncodingAudioQueueSize=%d", &val_int) == 1) { setting->EncodingAudioQueueSize = ImClamp(val_int, 1, 256); }
+        else if (sscanf(line, "RenderAheadEnabled=%d", &val_int) == 1) { setting->RenderAheadEnabled = val_int == 1; }
+        else if (sscanf(line, "RenderAheadWorkers=%d", &val_int) == 1) { setting->RenderAheadWorkers = ImClamp(val_int, 1, 8); }
+        else if (sscanf(line, "RenderAheadMaxMB=%d", &val_int) == 1) { setting->RenderAheadMaxMB = ImClamp(val_int, 64, 8192); }
         else if (sscanf(line, "CustomVideoFrameSize=%d", &val_int) == 1) { setting->isCustomVideoFrameSize = val_int == 1; }
         else if (sscanf(line, "VideoWidth=%d", &val_int) == 1) { setting->VideoWidth = val_int; }
         else if (sscanf(line, "VideoHeight=%d", &val_int) == 1) { setting->VideoHeight = val_int; }
         else if (sscanf(line, "PreviewScale=%f", &val_float) == 1) { setting->PreviewScale = val_float; }
+        else if (sscanf(line, "AdaptivePreview=%d", &val_int) == 1) { setting->AdaptivePreview = val_int == 1; }
         else if (sscanf(line, "CustomVideoFrameRate=%d", &val_int) == 1) { setting->isCustomVideoFrameRate = val_int == 1; }
         else if (sscanf(line, "VideoFrameRateNum=%d", &val_int) == 1) { setting->VideoFrameRate.num = val_int; }
         else if (sscanf(line, "VideoFrameRateDen=%d", &val_int) == 1) { setting->VideoFrameRate.den = val_int; }
@@ -11474,10 +11580,20 @@ static void MediaEditor_SetupContext(ImGuiContext* ctx, void* handle, bool in_sp
         out_buf->appendf("ControlPanelWidth=%f\n", g_media_editor_settings.ControlPanelWidth);
         out_buf->appendf("MainViewWidth=%f\n", g_media_editor_settings.MainViewWidth);
         out_buf->appendf("HWCodec=%d\n", g_media_editor_settings.HardwareCodec ? 1 : 0);
+        out_buf->appendf("MediaLoadThreads=%d\n", g_media_editor_settings.MediaLoadThreads);
+        out_buf->appendf("LazyMediaInit=%d\n", g_media_editor_settings.LazyMediaInit ? 1 : 0);
+        out_buf->appendf("HistoryMaxRecords=%d\n", g_media_editor_settings.HistoryMaxRecords);
+        out_buf->appendf("HistoryMemoryLimit=%d\n", g_media_editor_settings.HistoryMemoryLimit);
+        out_buf->appendf("EncodingVideoQueueSize=%d\n", g_media_editor_settings.EncodingVideoQueueSize);
+        out_buf->appendf("EncodingAudioQueueSize=%d\n", g_media_editor_settings.EncodingAudioQueueSize);
+        out_buf->appendf("RenderAheadEnabled=%d\n", g_media_editor_settings.RenderAheadEnabled ? 1 : 0);
+        out_buf->appendf("RenderAheadWorkers=%d\n", g_media_editor_settings.RenderAheadWorkers);
+        out_buf->appendf("RenderAheadMaxMB=%d\n", g_media_editor_settings.RenderAheadMaxMB);
         out_buf->appendf("CustomVideoFrameSize=%d\n", g_media_editor_settings.isCustomVideoFrameSize ? 1 : 0);
         out_buf->appendf("VideoWidth=%d\n", g_media_editor_settings.VideoWidth);
         out_buf->appendf("VideoHeight=%d\n", g_media_editor_settings.VideoHeight);
         out_buf->appendf("PreviewScale=%f\n", g_media_editor_settings.PreviewScale);
+        out_buf->appendf("AdaptivePreview=%d\n", g_media_editor_settings.AdaptivePreview ? 1 : 0);
         out_buf->appendf("CustomVideoFrameRate=%d\n", g_media_editor_settings.isCustomVideoFrameRate ? 1 : 0);
         out_buf->appendf("VideoFrameRateNum=%d\n", g_media_editor_settings.VideoFrameRate.num);
         out_buf->appendf("VideoFrameRateDen=%d\n", g_media_editor_settings.VideoFrameRate.den);
@@ -11962,6 +12078,24 @@ static bool MediaEditor_Frame(void * handle, bool app_will_quit)
                 }
                 timeline->mMaxCachedVideoFrame = g_media_editor_settings.VideoFrameCacheSize > 0 ? g_media_editor_settings.VideoFrameCacheSize : MAX_VIDEO_CACHE_FRAMES;
                 timeline->mShowHelpTooltips = g_media_editor_settings.ShowHelpTooltips;
+                timeline->mPreviewAdaptive = g_media_editor_settings.AdaptivePreview;
+                timeline->mMediaLoadThreads = g_media_editor_settings.MediaLoadThreads;
+                timeline->mLazyMediaInit = g_media_editor_settings.LazyMediaInit;
+                timeline->mHistoryMaxRecords = g_media_editor_settings.HistoryMaxRecords;
+                timeline->mHistoryMemoryLimit = g_media_editor_settings.HistoryMemoryLimit;
+                timeline->mEncodingVideoQueueSize = g_media_editor_settings.EncodingVideoQueueSize;
+                timeline->mEncodingAudioQueueSize = g_media_editor_settings.EncodingAudioQueueSize;
+                timeline->mRenderAheadEnabled = g_media_editor_settings.RenderAheadEnabled;
+                if (timeline->mRenderAheadWorkerCount != g_media_editor_settings.RenderAheadWorkers)
+                {
+                    // the workers are created with the cache, a new one is made on the next preview update
+                    timeline->mRenderAheadWorkerCount = g_media_editor_settings.RenderAheadWorkers;
+                    timeline->mhRenderAheadCache = nullptr;
+                    timeline->mRenderAheadTrackStates.clear();
+                }
+                timeline->mRenderAheadMaxBytes = (int64_t)g_media_editor_settings.RenderAheadMaxMB*1024*1024;
+                if (timeline->mhRenderAheadCache)
+                    timeline->mhRenderAheadCache->SetMaxBytes(timeline->mRenderAheadMaxBytes);
                 timeline->mFontName = g_media_editor_settings.FontName;
 
                 MediaCore::SharedSettings::Holder hNewSettings = MediaCore::SharedSettings::CreateInstance();
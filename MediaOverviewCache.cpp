@@ -0,0 +1,321 @@
+#include <sys/stat.h>
+#include <utime.h>
+#include <cstring>
+#include <algorithm>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <Logger.h>
+#include <FileSystemUtils.h>
+#include <ThreadUtils.h>
+#include "MediaOverviewCache.h"
+#include "HashUtils.h"
+
+using namespace std;
+using namespace Logger;
+
+namespace MEC
+{
+static const char OVERVIEW_CACHE_MAGIC[8] = {'M', 'E', 'C', 'O', 'V', 'W', '0', '1'};
+static const int64_t FINGERPRINT_BLOCK_SIZE = 64*1024;  // size of each sampled block of the file content
+static const uint64_t OVERVIEW_SNAPSHOT_HEADER_SIZE = 6*sizeof(int32_t)+sizeof(uint64_t);
+static const int32_t MAX_SNAPSHOT_SIZE = 16384;         // width or height of a snapshot
+
+template <typename T>
+static void WriteValue(ofstream& ofs, const T& val)
+{
+    ofs.write((const char*)&val, sizeof(T));
+}
+
+template <typename T>
+static bool ReadValue(ifstream& ifs, T& val)
+{
+    return (bool)ifs.read((char*)&val, sizeof(T));
+}
+
+MediaOverviewCache::Holder MediaOverviewCache::CreateInstance(const string& strCacheDir, int64_t i64MaxBytes, string& strErrMsg)
+{
+    if (!SysUtils::IsDirectory(strCacheDir) && !SysUtils::CreateDirectoryAt(strCacheDir, true))
+    {
+        strErrMsg = "FAILED to create overview cache directory '" + strCacheDir + "'!";
+        return nullptr;
+    }
+    return Holder(new MediaOverviewCache(strCacheDir, i64MaxBytes));
+}
+
+MediaOverviewCache::~MediaOverviewCache()
+{
+    {
+        lock_guard<mutex> lk(m_mtxSaveJobs);
+        m_bQuit = true;
+    }
+    m_cvSaveJobs.notify_all();
+    // the queued saves are finished before quitting, they are what the next session loads
+    if (m_thSaver.joinable())
+        m_thSaver.join();
+}
+
+uint64_t MediaOverviewCache::GetFingerprint(const string& strPath, const string& strSalt)
+{
+    struct stat tStat;
+    if (stat(strPath.c_str(), &tStat) != 0 || (tStat.st_mode&S_IFMT) != S_IFREG)
+        return 0;
+    ifstream ifs(strPath, ios::binary);
+    if (!ifs.is_open())
+        return 0;
+    uint64_t u64Hash = FNV1A_64_OFFSET_BASIS;
+    const int64_t i64FileSize = (int64_t)tStat.st_size;
+    const int64_t i64ModifyTime = (int64_t)tStat.st_mtime;
+    HashFnv1a(u64Hash, &i64FileSize, sizeof(i64FileSize));
+    HashFnv1a(u64Hash, &i64ModifyTime, sizeof(i64ModifyTime));
+    HashFnv1a(u64Hash, strSalt.data(), strSalt.size());
+    // the head, middle and tail blocks, which cover the container header and index of usual media files
+    vector<char> aBlock(FINGERPRINT_BLOCK_SIZE);
+    const int64_t aOffsets[] = {0, i64FileSize/2-FINGERPRINT_BLOCK_SIZE/2, i64FileSize-FINGERPRINT_BLOCK_SIZE};
+    for (auto i64Offset : aOffsets)
+    {
+        i64Offset = max(i64Offset, (int64_t)0);
+        ifs.clear();
+        ifs.seekg(i64Offset);
+        ifs.read(aBlock.data(), aBlock.size());
+        HashFnv1a(u64Hash, aBlock.data(), (size_t)ifs.gcount());
+    }
+    return u64Hash;
+}
+
+string MediaOverviewCache::GetEntryPath(uint64_t u64Key) const
+{
+    ostringstream oss; oss << setw(16) << setfill('0') << hex << u64Key << ".ovw";
+    return SysUtils::JoinPath(m_strCacheDir, oss.str());
+}
+
+// Every count and size read from the entry is checked against the bytes left in the file before anything is allocated
+// for it, so a corrupted entry fails here instead of allocating gigabytes.
+static bool ReadEntry(ifstream& ifs, int64_t i64FileSize, MediaCore::Overview::Waveform::Holder& hWaveform, vector<ImGui::ImMat>& aSnapshots)
+{
+    auto bytesLeft = [&] () -> uint64_t {
+        const int64_t i64Pos = (int64_t)ifs.tellg();
+        return i64Pos < 0 || i64Pos > i64FileSize ? 0 : (uint64_t)(i64FileSize-i64Pos);
+    };
+    uint8_t u8HasWaveform = 0;
+    if (!ReadValue(ifs, u8HasWaveform))
+        return false;
+    if (u8HasWaveform)
+    {
+        hWaveform = make_shared<MediaCore::Overview::Waveform>();
+        uint32_t u32Channels = 0;
+        if (!ReadValue(ifs, hWaveform->aggregateDuration) || !ReadValue(ifs, hWaveform->minSample) || !ReadValue(ifs, hWaveform->maxSample)
+                || !ReadValue(ifs, u32Channels) || u32Channels > bytesLeft()/sizeof(uint64_t))
+            return false;
+        hWaveform->pcm.resize(u32Channels);
+        for (auto& aSamples : hWaveform->pcm)
+        {
+            uint64_t u64Samples = 0;
+            if (!ReadValue(ifs, u64Samples) || u64Samples > bytesLeft()/sizeof(float))
+                return false;
+            aSamples.resize(u64Samples);
+            if (!ifs.read((char*)aSamples.data(), u64Samples*sizeof(float)))
+                return false;
+        }
+        hWaveform->parseDone = true;
+    }
+    uint32_t u32Snapshots = 0;
+    if (!ReadValue(ifs, u32Snapshots) || u32Snapshots > bytesLeft()/OVERVIEW_SNAPSHOT_HEADER_SIZE)
+        return false;
+    for (uint32_t i = 0; i < u32Snapshots; i++)
+    {
+        int32_t w, h, c, type, elempack, color_format;
+        uint64_t u64Bytes = 0;
+        if (!ReadValue(ifs, w) || !ReadValue(ifs, h) || !ReadValue(ifs, c) || !ReadValue(ifs, type)
+                || !ReadValue(ifs, elempack) || !ReadValue(ifs, color_format) || !ReadValue(ifs, u64Bytes))
+            return false;
+        if (w <= 0 || w > MAX_SNAPSHOT_SIZE || h <= 0 || h > MAX_SNAPSHOT_SIZE || c <= 0 || c > 4 || elempack <= 0 || elempack > c
+                || type < IM_DT_INT8 || type > IM_DT_FLOAT64 || u64Bytes > bytesLeft() || (uint64_t)w*h*c > u64Bytes)
+            return false;
+        ImGui::ImMat mSnapshot;
+        mSnapshot.create_type(w, h, c, (ImDataType)type);
+        mSnapshot.elempack = elempack;
+        mSnapshot.color_format = (ImColorFormat)color_format;
+        if (u64Bytes != (uint64_t)(mSnapshot.total()*mSnapshot.elemsize) || !ifs.read((char*)mSnapshot.data, u64Bytes))
+            return false;
+        aSnapshots.push_back(mSnapshot);
+    }
+    return true;
+}
+
+bool MediaOverviewCache::Load(uint64_t u64Key, MediaCore::Overview::Waveform::Holder& hWaveform, vector<ImGui::ImMat>& aSnapshots) const
+{
+    const auto strEntryPath = GetEntryPath(u64Key);
+    struct stat tStat;
+    if (stat(strEntryPath.c_str(), &tStat) != 0 || (tStat.st_mode&S_IFMT) != S_IFREG)
+        return false;
+    MediaCore::Overview::Waveform::Holder hLoadedWaveform;
+    vector<ImGui::ImMat> aLoadedSnapshots;
+    bool bSuccess = false;
+    {
+        ifstream ifs(strEntryPath, ios::binary);
+        char acMagic[sizeof(OVERVIEW_CACHE_MAGIC)];
+        if (ifs.is_open() && ifs.read(acMagic, sizeof(acMagic)) && memcmp(acMagic, OVERVIEW_CACHE_MAGIC, sizeof(acMagic)) == 0)
+        {
+            try
+            {
+                bSuccess = ReadEntry(ifs, (int64_t)tStat.st_size, hLoadedWaveform, aLoadedSnapshots);
+            }
+            catch (const exception& e)
+            {
+                Log(WARN) << "Exception while reading overview cache entry '" << strEntryPath << "': " << e.what() << endl;
+            }
+        }
+    }
+    if (!bSuccess)
+    {
+        // it would fail the same way on every load, the overview is built again and saved as a new entry
+        Log(WARN) << "FAILED to read overview cache entry '" << strEntryPath << "', it's truncated or corrupted, delete it." << endl;
+        SysUtils::DeleteFileAt(strEntryPath);
+        return false;
+    }
+    // the modification time is the last use time for 'Trim()'
+    utime(strEntryPath.c_str(), nullptr);
+    hWaveform = hLoadedWaveform;
+    aSnapshots = std::move(aLoadedSnapshots);
+    return true;
+}
+
+bool MediaOverviewCache::Save(uint64_t u64Key, MediaCore::Overview::Waveform::Holder hWaveform, const vector<ImGui::ImMat>& aSnapshots) const
+{
+    for (const auto& mSnapshot : aSnapshots)
+    {
+        // a partial entry would be loaded as the complete overview
+        if (mSnapshot.empty() || mSnapshot.device != IM_DD_CPU)
+            return false;
+    }
+    const auto strEntryPath = GetEntryPath(u64Key);
+    // write into a temporary file first, so a crash never leaves a partial entry under the key
+    const auto strTempPath = strEntryPath+".tmp";
+    {
+        ofstream ofs(strTempPath, ios::binary|ios::trunc);
+        if (!ofs.is_open())
+        {
+            Log(WARN) << "FAILED to create overview cache file '" << strTempPath << "'." << endl;
+            return false;
+        }
+        ofs.write(OVERVIEW_CACHE_MAGIC, sizeof(OVERVIEW_CACHE_MAGIC));
+        WriteValue(ofs, (uint8_t)(hWaveform ? 1 : 0));
+        if (hWaveform)
+        {
+            WriteValue(ofs, hWaveform->aggregateDuration);
+            WriteValue(ofs, hWaveform->minSample);
+            WriteValue(ofs, hWaveform->maxSample);
+            WriteValue(ofs, (uint32_t)hWaveform->pcm.size());
+            for (const auto& aSamples : hWaveform->pcm)
+            {
+                WriteValue(ofs, (uint64_t)aSamples.size());
+                ofs.write((const char*)aSamples.data(), aSamples.size()*sizeof(float));
+            }
+        }
+        WriteValue(ofs, (uint32_t)aSnapshots.size());
+        for (const auto& mSnapshot : aSnapshots)
+        {
+            WriteValue(ofs, (int32_t)mSnapshot.w);
+            WriteValue(ofs, (int32_t)mSnapshot.h);
+            WriteValue(ofs, (int32_t)mSnapshot.c);
+            WriteValue(ofs, (int32_t)mSnapshot.type);
+            WriteValue(ofs, (int32_t)mSnapshot.elempack);
+            WriteValue(ofs, (int32_t)mSnapshot.color_format);
+            const uint64_t u64Bytes = mSnapshot.total()*mSnapshot.elemsize;
+            WriteValue(ofs, u64Bytes);
+            ofs.write((const char*)mSnapshot.data, u64Bytes);
+        }
+        if (!ofs.good())
+        {
+            Log(WARN) << "FAILED to write overview cache file '" << strTempPath << "'." << endl;
+            ofs.close();
+            SysUtils::DeleteFileAt(strTempPath);
+            return false;
+        }
+    }
+    if (!SysUtils::RenameFile(strTempPath, strEntryPath))
+    {
+        Log(WARN) << "FAILED to move '" << strTempPath << "' into overview cache as '" << strEntryPath << "'." << endl;
+        SysUtils::DeleteFileAt(strTempPath);
+        return false;
+    }
+    return true;
+}
+
+void MediaOverviewCache::SaveAsync(uint64_t u64Key, MediaCore::Overview::Waveform::Holder hWaveform, const vector<ImGui::ImMat>& aSnapshots)
+{
+    {
+        lock_guard<mutex> lk(m_mtxSaveJobs);
+        if (m_bQuit)
+            return;
+        m_aSaveJobs.push_back({u64Key, hWaveform, aSnapshots});
+        if (!m_thSaver.joinable())
+        {
+            m_thSaver = thread(&MediaOverviewCache::SaveProc, this);
+            SysUtils::SetThreadName(m_thSaver, "OvwCacheSave");
+        }
+    }
+    m_cvSaveJobs.notify_one();
+}
+
+void MediaOverviewCache::SaveProc()
+{
+    Log(DEBUG) << "Enter MediaOverviewCache::SaveProc()..." << endl;
+    while (true)
+    {
+        SaveJob tJob;
+        {
+            unique_lock<mutex> lk(m_mtxSaveJobs);
+            m_cvSaveJobs.wait(lk, [this] { return m_bQuit || !m_aSaveJobs.empty(); });
+            if (m_aSaveJobs.empty())
+                break;
+            tJob = std::move(m_aSaveJobs.front());
+            m_aSaveJobs.pop_front();
+        }
+        if (!Save(tJob.u64Key, tJob.hWaveform, tJob.aSnapshots))
+            Log(WARN) << "FAILED to save overview cache entry '" << GetEntryPath(tJob.u64Key) << "'." << endl;
+        else
+            Trim(m_i64MaxBytes);
+    }
+    Log(DEBUG) << "Leave MediaOverviewCache::SaveProc()." << endl;
+}
+
+void MediaOverviewCache::Trim(int64_t i64MaxBytes)
+{
+    struct EntryFile
+    {
+        string strPath;
+        int64_t i64Size;
+        int64_t i64LastUsed;
+    };
+    vector<EntryFile> aEntryFiles;
+    int64_t i64TotalBytes = 0;
+    auto hFileIter = SysUtils::FileIterator::CreateInstance(m_strCacheDir);
+    hFileIter->SetFilterPattern(".+\\.ovw", true);
+    hFileIter->StartParsing();
+    for (const auto& strPath : hFileIter->GetAllFilePaths())
+    {
+        // skip the temporary files of the saves in progress
+        if (strPath.size() < 4 || strPath.compare(strPath.size()-4, 4, ".ovw") != 0)
+            continue;
+        struct stat tStat;
+        if (stat(strPath.c_str(), &tStat) != 0 || (tStat.st_mode&S_IFMT) != S_IFREG)
+            continue;
+        aEntryFiles.push_back({strPath, (int64_t)tStat.st_size, (int64_t)tStat.st_mtime});
+        i64TotalBytes += (int64_t)tStat.st_size;
+    }
+    if (i64TotalBytes <= i64MaxBytes)
+        return;
+    sort(aEntryFiles.begin(), aEntryFiles.end(), [] (const EntryFile& a, const EntryFile& b) {
+        return a.i64LastUsed < b.i64LastUsed;
+    });
+    for (const auto& tEntryFile : aEntryFiles)
+    {
+        if (i64TotalBytes <= i64MaxBytes)
+            break;
+        if (SysUtils::DeleteFileAt(tEntryFile.strPath))
+            i64TotalBytes -= tEntryFile.i64Size;
+    }
+}
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <immat.h>
+#include "Overview.h"
+
+namespace MEC
+{
+    // Persistent store of the overview snapshots and waveform of media files, so reopening a project doesn't need to
+    // wait for every source to be decoded again. An entry is keyed by 'GetFingerprint()' of the media file, it's found
+    // again as long as the file is not modified, wherever it's moved. Least recently used entries beyond the byte budget
+    // are removed after each save.
+    class MediaOverviewCache
+    {
+    public:
+        using Holder = std::shared_ptr<MediaOverviewCache>;
+        static Holder CreateInstance(const std::string& strCacheDir, int64_t i64MaxBytes, std::string& strErrMsg);
+        ~MediaOverviewCache();
+
+        // Hash of the file size, modification time and a few sampled blocks of the content, mixed with 'strSalt'.
+        // Returns 0 if the file can't be read.
+        static uint64_t GetFingerprint(const std::string& strPath, const std::string& strSalt);
+
+        // 'hWaveform' is nullptr if no waveform was saved with the entry, it's marked as 'parseDone' otherwise
+        bool Load(uint64_t u64Key, MediaCore::Overview::Waveform::Holder& hWaveform, std::vector<ImGui::ImMat>& aSnapshots) const;
+        // All the snapshots must be in cpu memory, otherwise nothing is saved and false is returned. 'hWaveform' can be nullptr.
+        bool Save(uint64_t u64Key, MediaCore::Overview::Waveform::Holder hWaveform, const std::vector<ImGui::ImMat>& aSnapshots) const;
+        // Run 'Save()' and then 'Trim()' on the cache thread, the snapshots are shared with the caller, not copied
+        void SaveAsync(uint64_t u64Key, MediaCore::Overview::Waveform::Holder hWaveform, const std::vector<ImGui::ImMat>& aSnapshots);
+        // Remove the least recently loaded or saved entries until the cache holds no more than 'i64MaxBytes'
+        void Trim(int64_t i64MaxBytes);
+
+    private:
+        MediaOverviewCache(const std::string& strCacheDir, int64_t i64MaxBytes) : m_strCacheDir(strCacheDir), m_i64MaxBytes(i64MaxBytes) {}
+        std::string GetEntryPath(uint64_t u64Key) const;
+        void SaveProc();
+
+    private:
+        struct SaveJob
+        {
+            uint64_t u64Key;
+            MediaCore::Overview::Waveform::Holder hWaveform;
+            std::vector<ImGui::ImMat> aSnapshots;
+        };
+        std::string m_strCacheDir;
+        int64_t m_i64MaxBytes;
+        std::list<SaveJob> m_aSaveJobs;
+        std::mutex m_mtxSaveJobs;
+        std::condition_variable m_cvSaveJobs;
+        std::thread m_thSaver;                  // started by the first 'SaveAsync()'
+        bool m_bQuit {false};
+    };
+}
@@ -0,0 +1,392 @@
+/*
+    Copyright (c) 2023-2024 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Headless renderer: load a .mep project and export it without creating any window.
+
+#include <imgui.h>
+#include <imgui_helper.h>
+#include <imgui_json.h>
+#if IMGUI_VULKAN_SHADER
+#include <ImVulkanShader.h>
+#endif
+#include <FileSystemUtils.h>
+#include <ThreadUtils.h>
+#include "MecProject.h"
+#include "MediaTimeline.h"
+#include "HwaccelManager.h"
+#include "TextureManager.h"
+#include "Logger.h"
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <climits>
+#include <getopt.h>
+#include <SDL.h>
+
+using namespace MediaTimeline;
+
+enum RenderExitCode
+{
+    RENDER_OK = 0,
+    RENDER_INVALID_ARGUMENT = 1,
+    RENDER_LOAD_FAILED = 2,
+    RENDER_ENCODE_FAILED = 3,
+};
+
+static void ShowUsage(const char* prog)
+{
+    std::cout << "Usage: " << prog << " [options] <project.mep>" << std::endl
+        << "  -o, --output <path>        output media file path" << std::endl
+        << "  -c, --config <json>        json file with encoder parameters, same attribute names as the options below." << std::endl
+        << "                             a 'renditions' array of objects with 'output' and overriding parameters adds" << std::endl
+        << "                             more outputs, which are scaled from the largest one in the same pass" << std::endl
+        << "  -p, --plugin_dir <dir>     blueprint plugin directory" << std::endl
+        << "  -s, --segments <n>         render the export range in n parallel segments" << std::endl
+        << "  -r, --range <in,out>       export range in milliseconds" << std::endl
+        << "      --smart_render         copy untouched source video instead of re-encoding it" << std::endl
+        << "      --use_cache            reuse the unchanged segments encoded by previous exports" << std::endl
+        << "      --checkpoint           keep finished segments, so running the same command again resumes an interrupted render" << std::endl
+        << "      --vcodec <name>        video codec (videnc_codec)" << std::endl
+        << "      --pixfmt <name>        video encoder pixel format (videnc_pixfmt)" << std::endl
+        << "      --width <w>            video width (videnc_width)" << std::endl
+        << "      --height <h>           video height (videnc_height)" << std::endl
+        << "      --framerate <num[/den]> video frame rate (videnc_framerate_num/den)" << std::endl
+        << "      --vbitrate <bps>       video bitrate (videnc_bitrate)" << std::endl
+        << "      --acodec <name>        audio codec (audenc_codec)" << std::endl
+        << "      --channels <n>         audio channels (audenc_channels)" << std::endl
+        << "      --samplerate <hz>      audio sample rate (audenc_samprate)" << std::endl
+        << "      --abitrate <bps>       audio bitrate (audenc_bitrate)" << std::endl
+        << "  -h, --help                 show this message" << std::endl;
+}
+
+static bool ParseNumber(const char* str, double& value)
+{
+    char* end = nullptr;
+    value = strtod(str, &end);
+    return end && end != str && *end == '\0';
+}
+
+int main(int argc, char** argv)
+{
+    enum
+    {
+        OPT_VCODEC = 256, OPT_PIXFMT, OPT_WIDTH, OPT_HEIGHT, OPT_FRAMERATE, OPT_VBITRATE,
+        OPT_ACODEC, OPT_CHANNELS, OPT_SAMPLERATE, OPT_ABITRATE, OPT_SMART_RENDER, OPT_USE_CACHE, OPT_CHECKPOINT,
+    };
+    static struct option long_options[] = {
+        { "output", required_argument, NULL, 'o' },
+        { "config", required_argument, NULL, 'c' },
+        { "plugin_dir", required_argument, NULL, 'p' },
+        { "segments", required_argument, NULL, 's' },
+        { "range", required_argument, NULL, 'r' },
+        { "smart_render", no_argument, NULL, OPT_SMART_RENDER },
+        { "use_cache", no_argument, NULL, OPT_USE_CACHE },
+        { "checkpoint", no_argument, NULL, OPT_CHECKPOINT },
+        { "vcodec", required_argument, NULL, OPT_VCODEC },
+        { "pixfmt", required_argument, NULL, OPT_PIXFMT },
+        { "width", required_argument, NULL, OPT_WIDTH },
+        { "height", required_argument, NULL, OPT_HEIGHT },
+        { "framerate", required_argument, NULL, OPT_FRAMERATE },
+        { "vbitrate", required_argument, NULL, OPT_VBITRATE },
+        { "acodec", required_argument, NULL, OPT_ACODEC },
+        { "channels", required_argument, NULL, OPT_CHANNELS },
+        { "samplerate", required_argument, NULL, OPT_SAMPLERATE },
+        { "abitrate", required_argument, NULL, OPT_ABITRATE },
+        { "help", no_argument, NULL, 'h' },
+        { 0, 0, 0, 0 }
+    };
+    std::string outputPath;
+    std::string configPath;
+    std::string pluginPath;
+    int segmentCount = 1;
+    bool smartRender = false;
+    bool useCache = false;
+    bool checkpoint = false;
+    int64_t rangeIn = -1, rangeOut = -1;
+    // command line options are collected into the same json form as the config file, and override it
+    imgui_json::value jnCliParams;
+    auto setNumberParam = [&] (const char* name, const char* str)
+    {
+        double value;
+        if (!ParseNumber(str, value))
+        {
+            std::cerr << "INVALID number '" << str << "' for '" << name << "'!" << std::endl;
+            return false;
+        }
+        jnCliParams[name] = imgui_json::number(value);
+        return true;
+    };
+
+    int o = -1;
+    int option_index = 0;
+    bool argsValid = true;
+    while (argsValid && (o = getopt_long(argc, argv, "o:c:p:s:r:h", long_options, &option_index)) != -1)
+    {
+        switch (o)
+        {
+            case 'o': outputPath = std::string(optarg); break;
+            case 'c': configPath = std::string(optarg); break;
+            case 'p': pluginPath = std::string(optarg); break;
+            case 's':
+            {
+                double value;
+                if (!ParseNumber(optarg, value) || value < 1 || value > INT_MAX || value != (int)value)
+                {
+                    std::cerr << "INVALID segment count '" << optarg << "'! It should be a positive integer." << std::endl;
+                    argsValid = false;
+                    break;
+                }
+                segmentCount = (int)value;
+                break;
+            }
+            case 'r':
+            {
+                long long in = -1, out = -1;
+                if (sscanf(optarg, "%lld,%lld", &in, &out) != 2 || in < 0 || out <= in)
+                {
+                    std::cerr << "INVALID range '" << optarg << "'! It should be 'in,out' in milliseconds." << std::endl;
+                    argsValid = false;
+                }
+                rangeIn = in; rangeOut = out;
+                break;
+            }
+            case OPT_SMART_RENDER: smartRender = true; break;
+            case OPT_USE_CACHE: useCache = true; break;
+            case OPT_CHECKPOINT: checkpoint = true; break;
+            case OPT_VCODEC: jnCliParams["videnc_codec"] = imgui_json::string(optarg); break;
+            case OPT_PIXFMT: jnCliParams["videnc_pixfmt"] = imgui_json::string(optarg); break;
+            case OPT_WIDTH: argsValid = setNumberParam("videnc_width", optarg); break;
+            case OPT_HEIGHT: argsValid = setNumberParam("videnc_height", optarg); break;
+            case OPT_FRAMERATE:
+            {
+                int num = 0, den = 1;
+                if (sscanf(optarg, "%d/%d", &num, &den) < 1 || num <= 0 || den <= 0)
+                {
+                    std::cerr << "INVALID frame rate '" << optarg << "'!" << std::endl;
+                    argsValid = false;
+                }
+                jnCliParams["videnc_framerate_num"] = imgui_json::number(num);
+                jnCliParams["videnc_framerate_den"] = imgui_json::number(den);
+                break;
+            }
+            case OPT_VBITRATE: argsValid = setNumberParam("videnc_bitrate", optarg); break;
+            case OPT_ACODEC: jnCliParams["audenc_codec"] = imgui_json::string(optarg); break;
+            case OPT_CHANNELS: argsValid = setNumberParam("audenc_channels", optarg); break;
+            case OPT_SAMPLERATE: argsValid = setNumberParam("audenc_samprate", optarg); break;
+            case OPT_ABITRATE: argsValid = setNumberParam("audenc_bitrate", optarg); break;
+            case 'h': ShowUsage(argv[0]); return RENDER_OK;
+            default: argsValid = false; break;
+        }
+    }
+    if (!argsValid || optind != argc-1)
+    {
+        ShowUsage(argv[0]);
+        return RENDER_INVALID_ARGUMENT;
+    }
+    const std::string projectPath = argv[optind];
+
+    imgui_json::value jnEncParams;
+    if (!configPath.empty())
+    {
+        auto res = imgui_json::value::load(configPath);
+        if (!res.second || !res.first.is_object())
+        {
+            std::cerr << "FAILED to parse encoder config json from '" << configPath << "'!" << std::endl;
+            return RENDER_INVALID_ARGUMENT;
+        }
+        jnEncParams = res.first;
+    }
+    if (jnCliParams.is_object())
+    {
+        for (const auto& item : jnCliParams.get<imgui_json::object>())
+            jnEncParams[item.first] = item.second;
+    }
+    if (outputPath.empty() && jnEncParams.contains("output") && jnEncParams["output"].is_string())
+        outputPath = jnEncParams["output"].get<imgui_json::string>();
+    if (segmentCount <= 1 && jnEncParams.contains("segment_count") && jnEncParams["segment_count"].is_number())
+        segmentCount = (int)jnEncParams["segment_count"].get<imgui_json::number>();
+    if (!smartRender && jnEncParams.contains("smart_render") && jnEncParams["smart_render"].is_boolean())
+        smartRender = jnEncParams["smart_render"].get<imgui_json::boolean>();
+    if (!useCache && jnEncParams.contains("use_cache") && jnEncParams["use_cache"].is_boolean())
+        useCache = jnEncParams["use_cache"].get<imgui_json::boolean>();
+    if (!checkpoint && jnEncParams.contains("checkpoint") && jnEncParams["checkpoint"].is_boolean())
+        checkpoint = jnEncParams["checkpoint"].get<imgui_json::boolean>();
+    if (outputPath.empty())
+    {
+        std::cerr << "Output path is NOT specified!" << std::endl;
+        ShowUsage(argv[0]);
+        return RENDER_INVALID_ARGUMENT;
+    }
+
+    SDL_Init(SDL_INIT_TIMER);
+    ImGui::CreateContext();
+#if IMGUI_VULKAN_SHADER
+    ImGui::ImVulkanShaderInit();
+#endif
+
+    auto hHwaMgr = MediaCore::HwaccelManager::GetDefaultInstance();
+    if (!hHwaMgr->Init())
+        Logger::Log(Logger::Error) << "FAILED to init 'HwaccelManager' instance! Error is '" << hHwaMgr->GetError() << "'." << std::endl;
+
+    if (pluginPath.empty())
+        pluginPath = ImGuiHelper::path_parent(ImGuiHelper::exec_path()) + "plugins";
+    {
+        std::vector<std::string> plugin_paths;
+        plugin_paths.push_back(pluginPath);
+        int plugin_index = 0;
+        float plugin_percentage = 0;
+        std::string plugin_message;
+        int plugins = BluePrint::BluePrintUI::CheckPlugins(plugin_paths);
+        BluePrint::BluePrintUI::LoadPlugins(plugin_paths, plugin_index, plugin_message, plugin_percentage, plugins);
+    }
+
+    int ret = RENDER_OK;
+    TimeLine* timeline = nullptr;
+    MEC::Project::ErrorCode ec;
+    auto hProj = MEC::Project::OpenProjectFile(ec, projectPath);
+    do {
+        if (!hProj)
+        {
+            Logger::Log(Logger::Error) << "FAILED to load mec project from '" << projectPath << "'! Error code is " << (int)ec << "." << std::endl;
+            ret = RENDER_LOAD_FAILED;
+            break;
+        }
+        timeline = new TimeLine(true);
+        hProj->SetTimelineHandle(timeline);
+        timeline->mhProject = hProj;
+        MediaCore::VideoClip::USE_HWACCEL = timeline->mHardwareCodec;
+        const auto& jnProjContent = hProj->GetProjectContentJson();
+        if (jnProjContent.contains("MediaBank") && jnProjContent["MediaBank"].is_array())
+            timeline->LoadMediaBank(jnProjContent["MediaBank"].get<imgui_json::array>());
+        if (!jnProjContent.contains("TimeLine") || !jnProjContent["TimeLine"].is_object())
+        {
+            Logger::Log(Logger::Error) << "CANNOT find 'TimeLine' attribute in MEC project content json at '" << projectPath << "'!" << std::endl;
+            ret = RENDER_LOAD_FAILED;
+            break;
+        }
+        timeline->Load(jnProjContent["TimeLine"]);
+
+        TimeLine::VideoEncoderParams vidEncParams;
+        TimeLine::AudioEncoderParams audEncParams;
+        std::string errMsg;
+        if (!timeline->LoadEncoderParams(jnEncParams, vidEncParams, audEncParams, errMsg))
+        {
+            Logger::Log(Logger::Error) << "INVALID encoder parameters! " << errMsg << std::endl;
+            ret = RENDER_INVALID_ARGUMENT;
+            break;
+        }
+        if (rangeIn >= 0)
+        {
+            timeline->mark_in = rangeIn;
+            timeline->mark_out = rangeOut;
+            timeline->mEncodingInRange = true;
+        }
+        else
+        {
+            timeline->mEncodingInRange = false;
+        }
+        if (timeline->ValidDuration() <= 0)
+        {
+            Logger::Log(Logger::Error) << "Export range is EMPTY!" << std::endl;
+            ret = RENDER_INVALID_ARGUMENT;
+            break;
+        }
+        std::vector<TimeLine::EncodingRendition> renditions;
+        renditions.push_back({outputPath, vidEncParams, audEncParams});
+        if (jnEncParams.contains("renditions") && jnEncParams["renditions"].is_array())
+        {
+            for (const auto& jnRendition : jnEncParams["renditions"].get<imgui_json::array>())
+            {
+                if (!jnRendition.is_object() || !jnRendition.contains("output") || !jnRendition["output"].is_string())
+                {
+                    Logger::Log(Logger::Error) << "INVALID rendition, 'output' is NOT specified!" << std::endl;
+                    ret = RENDER_INVALID_ARGUMENT;
+                    break;
+                }
+                imgui_json::value jnRenditionParams = jnEncParams;
+                for (const auto& item : jnRendition.get<imgui_json::object>())
+                    jnRenditionParams[item.first] = item.second;
+                TimeLine::EncodingRendition rendition;
+                rendition.outputPath = jnRendition["output"].get<imgui_json::string>();
+                if (!timeline->LoadEncoderParams(jnRenditionParams, rendition.vidEncParams, rendition.audEncParams, errMsg))
+                {
+                    Logger::Log(Logger::Error) << "INVALID encoder parameters for rendition '" << rendition.outputPath << "'! " << errMsg << std::endl;
+                    ret = RENDER_INVALID_ARGUMENT;
+                    break;
+                }
+                renditions.push_back(rendition);
+            }
+            if (ret != RENDER_OK)
+                break;
+        }
+        timeline->mEncodingSegmentCount = segmentCount > 1 ? segmentCount : 1;
+        timeline->mEncodingSmartRender = smartRender;
+        timeline->mEncodingUseCache = useCache;
+        timeline->mEncodingCheckpoint = checkpoint;
+        const bool configured = renditions.size() > 1 ? timeline->ConfigEncoder(renditions, errMsg) : timeline->ConfigEncoder(outputPath, vidEncParams, audEncParams, errMsg);
+        if (!configured)
+        {
+            Logger::Log(Logger::Error) << "FAILED to configure encoder! " << errMsg << std::endl;
+            ret = RENDER_ENCODE_FAILED;
+            break;
+        }
+
+        Logger::Log(Logger::INFO) << "Render '" << projectPath << "' into '" << outputPath << "', " << vidEncParams.codecName << " " << vidEncParams.width << "x" << vidEncParams.height
+                << "@" << vidEncParams.frameRate.num << "/" << vidEncParams.frameRate.den << ", " << audEncParams.codecName << " " << audEncParams.channels << "ch "
+                << audEncParams.sampleRate << "Hz." << std::endl;
+        for (size_t i = 1; i < renditions.size(); i++)
+            Logger::Log(Logger::INFO) << "  + rendition '" << renditions[i].outputPath << "', " << renditions[i].vidEncParams.codecName << " "
+                    << renditions[i].vidEncParams.width << "x" << renditions[i].vidEncParams.height << "." << std::endl;
+        const auto startTime = ImGui::get_current_time();
+        timeline->StartEncoding();
+        while (timeline->mIsEncoding)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            std::cout << "\rRendering " << std::fixed << std::setprecision(1) << timeline->mEncodingProgress*100 << "%" << std::flush;
+        }
+        std::cout << std::endl;
+        timeline->StopEncoding();
+        if (!timeline->mEncodeProcErrMsg.empty())
+        {
+            Logger::Log(Logger::Error) << "Render FAILED! " << timeline->mEncodeProcErrMsg << std::endl;
+            ret = RENDER_ENCODE_FAILED;
+            break;
+        }
+        Logger::Log(Logger::INFO) << "Render finished in " << std::fixed << std::setprecision(2) << ImGui::get_current_time()-startTime << " seconds." << std::endl;
+        const auto stats = timeline->GetEncodingStats();
+        Logger::Log(Logger::INFO) << "  " << stats.videoFrames << " frames, " << stats.fps << " fps, " << stats.realtimeFactor << "x realtime; video compose "
+                << stats.videoComposeSec << "s, audio mix " << stats.audioMixSec << "s, encode " << stats.encodeSec << "s, queue wait "
+                << stats.composeQueueWaitSec << "s/" << stats.encodeQueueWaitSec << "s (full/empty)." << std::endl;
+    } while (false);
+
+    if (timeline)
+        delete timeline;
+    if (hProj)
+        hProj->Close(false);
+    hProj = nullptr;
+
+    RenderUtils::TextureManager::ReleaseDefaultInstance();
+    SysUtils::ThreadPoolExecutor::ReleaseDefaultInstance();
+#if IMGUI_VULKAN_SHADER
+    ImGui::ImVulkanShaderClear();
+#endif
+    ImGui::DestroyContext();
+    SDL_Quit();
+    return ret;
+}
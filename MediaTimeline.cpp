@@ -27,12 +27,17 @@
 #include <vector>
 #include <utility>
 #include <ThreadUtils.h>
+#include <FileSystemUtils.h>
 #include <MatUtilsImVecHelper.h>
 #include "EventStackFilter.h"
 #include "TextureManager.h"
 #include "MatUtils.h"
 #include "Logger.h"
 #include "DebugHelper.h"
+#if IMGUI_VULKAN_SHADER
+#include <Resize_vulkan.h>
+#include <CopyTo_vulkan.h>
+#endif
 
 const MediaTimeline::audio_band_config DEFAULT_BAND_CFG[10] = {
     { 32,       32,         0 },        { 64,       64,         0 },
@@ -148,6 +153,15 @@ static void waveformToMat(const MediaCore::Overview::Waveform::Holder wavefrom,
     ImGui::PopStyleColor(2);
 }
 
+// copy audio scope results into the mats read by the UI, they are only reallocated when the shape changes
+static void CopyScopeMat(const ImGui::ImMat& src, ImGui::ImMat& dst)
+{
+    if (dst.empty() || dst.dims != src.dims || dst.w != src.w || dst.h != src.h || dst.c != src.c || dst.type != src.type)
+        dst = src.clone();
+    else
+        memcpy(dst.data, src.data, src.total()*src.elemsize);
+}
+
 namespace MediaTimeline
 {
 /***********************************************************************************************************
@@ -212,7 +226,25 @@ bool MediaItem::ChangeSource(const std::string& name, const std::string& path)
     return Initialize();
 }
 
-bool MediaItem::Initialize()
+// Apply the snapshot settings of media item overviews to 'hOverview' (can be nullptr), returns them as a string for the overview cache key
+static std::string ConfigureOverviewSnapshots(RenderUtils::TextureManager::Holder hTxMgr, MediaCore::Overview::Holder hOverview)
+{
+    std::ostringstream oss; oss << "snapshots=" << MEDIA_ITEM_OVERVIEW_SNAPSHOTS;
+    RenderUtils::TextureManager::TexturePoolAttributes tTxPoolAttrs;
+    if (hTxMgr->GetTexturePoolAttributes(VIDEOITEM_OVERVIEW_GRID_TEXTURE_POOL_NAME, tTxPoolAttrs))
+    {
+        if (hOverview) hOverview->SetSnapshotSize(tTxPoolAttrs.tTxSize.x, tTxPoolAttrs.tTxSize.y);
+        oss << ",size=" << tTxPoolAttrs.tTxSize.x << "x" << tTxPoolAttrs.tTxSize.y;
+    }
+    else
+    {
+        if (hOverview) hOverview->SetSnapshotResizeFactor(0.05, 0.05);
+        oss << ",factor=0.05";
+    }
+    return oss.str();
+}
+
+bool MediaItem::Initialize(bool deferOverview)
 {
     mValid = false;
     if (mPath.empty() || !ImGuiHelper::file_exists(mPath))
@@ -236,25 +268,59 @@ bool MediaItem::Initialize()
             if (!mhParser->IsOpened())
                 return false;
         }
-
-        mMediaOverview = MediaCore::Overview::CreateInstance();
-        mMediaOverview->EnableHwAccel(timeline->mHardwareCodec);
-        RenderUtils::TextureManager::TexturePoolAttributes tTxPoolAttrs;
-        if (mTxMgr->GetTexturePoolAttributes(VIDEOITEM_OVERVIEW_GRID_TEXTURE_POOL_NAME, tTxPoolAttrs))
-            mMediaOverview->SetSnapshotSize(tTxPoolAttrs.tTxSize.x, tTxPoolAttrs.tTxSize.y);
-        else
-            mMediaOverview->SetSnapshotResizeFactor(0.05, 0.05);
-        if (!mMediaOverview->Open(mhParser, 64))
+        auto hMediaInfo = mhParser->GetMediaInfo();
+        if (!hMediaInfo)
             return false;
-        mSrcLength = mMediaOverview->GetMediaInfo()->duration * 1000;
+        mSrcLength = hMediaInfo->duration * 1000;
         mValid = true;
+
+        // snapshots and waveform of an unchanged source are taken from the overview cache, not waiting for the overview to decode them
+        auto hOvwCache = !IS_IMAGESEQ(mMediaType) ? timeline->GetOverviewCache() : nullptr;
+        if (hOvwCache)
+        {
+            mOverviewCacheKey = MEC::MediaOverviewCache::GetFingerprint(mPath, ConfigureOverviewSnapshots(mTxMgr, nullptr));
+            if (mOverviewCacheKey != 0 && hOvwCache->Load(mOverviewCacheKey, mCachedWaveform, mCachedSnapshots))
+                mOverviewCacheSaved = mOverviewFromCache = true;
+        }
+
+        mOverviewDeferred = true;
+        if (!deferOverview && !mOverviewFromCache && !GetOverview())
+            return false;
     }
     return true;
 }
 
+MediaCore::Overview::Holder MediaItem::GetOverview()
+{
+    std::lock_guard<std::mutex> lk(mOverviewLock);
+    if (mOverviewDeferred)
+    {
+        mOverviewDeferred = false;
+        TimeLine* timeline = (TimeLine*)mHandle;
+        auto hOverview = MediaCore::Overview::CreateInstance();
+        hOverview->EnableHwAccel(timeline->mHardwareCodec);
+        ConfigureOverviewSnapshots(mTxMgr, hOverview);
+        if (hOverview->Open(mhParser, MEDIA_ITEM_OVERVIEW_SNAPSHOTS))
+            mMediaOverview = hOverview;
+        else
+        {
+            Logger::Log(Logger::WARN) << "FAILED to open overview of media item '" << mPath << "'!" << std::endl;
+            mValid = false;
+        }
+    }
+    return mMediaOverview;
+}
+
 void MediaItem::ReleaseItem()
 {
+    mOverviewDeferred = false;
     mMediaOverview = nullptr;
+    mWaveformPyramid = nullptr;
+    mCachedWaveform = nullptr;
+    mCachedSnapshots.clear();
+    mOverviewCacheKey = 0;
+    mOverviewCacheSaved = false;
+    mOverviewFromCache = false;
     mMediaThumbnail.clear();
     mSrcLength = 0;
     mValid = false;
@@ -262,28 +328,122 @@ void MediaItem::ReleaseItem()
 
 void MediaItem::UpdateThumbnail()
 {
-    if (mMediaOverview && mMediaOverview->IsOpened())
+    if (mOverviewFromCache)
     {
-        auto count = mMediaOverview->GetSnapshotCount();
-        if (mMediaThumbnail.size() >= count)
-            return;
-        std::vector<ImGui::ImMat> snapshots;
-        if (mMediaOverview->GetSnapshots(snapshots))
+        for (int i = mMediaThumbnail.size(); i < mCachedSnapshots.size(); i++)
+        {
+            auto hTx = mTxMgr->GetGridTextureFromPool(VIDEOITEM_OVERVIEW_GRID_TEXTURE_POOL_NAME);
+            if (!hTx)
+                break;
+            hTx->RenderMatToTexture(mCachedSnapshots[i]);
+            mMediaThumbnail.push_back(hTx);
+        }
+        return;
+    }
+    auto hOverview = GetOverview();
+    if (hOverview && hOverview->IsOpened())
+    {
+        auto count = hOverview->GetSnapshotCount();
+        if (mMediaThumbnail.size() < count)
         {
-            for (int i = 0; i < snapshots.size(); i++)
+            std::vector<ImGui::ImMat> snapshots;
+            if (hOverview->GetSnapshots(snapshots))
             {
-                if (i >= mMediaThumbnail.size() && !snapshots[i].empty())
+                for (int i = 0; i < snapshots.size(); i++)
                 {
-                    auto hTx = mTxMgr->GetGridTextureFromPool(VIDEOITEM_OVERVIEW_GRID_TEXTURE_POOL_NAME);
-                    if (hTx)
+                    if (i >= mMediaThumbnail.size() && !snapshots[i].empty())
                     {
-                        hTx->RenderMatToTexture(snapshots[i]);
-                        mMediaThumbnail.push_back(hTx);
+                        auto hTx = mTxMgr->GetGridTextureFromPool(VIDEOITEM_OVERVIEW_GRID_TEXTURE_POOL_NAME);
+                        if (hTx)
+                        {
+                            hTx->RenderMatToTexture(snapshots[i]);
+                            mMediaThumbnail.push_back(hTx);
+                        }
                     }
                 }
             }
         }
+        if (!mOverviewCacheSaved && mMediaThumbnail.size() >= count)
+            SaveOverviewCache();
+    }
+}
+
+MediaCore::Overview::Waveform::Holder MediaItem::GetWaveform()
+{
+    if (mCachedWaveform || mOverviewFromCache)
+        return mCachedWaveform;
+    auto hOverview = GetOverview();
+    return hOverview ? hOverview->GetWaveform() : nullptr;
+}
+
+void MediaItem::SaveOverviewCache()
+{
+    if (!mMediaOverview)
+        return;
+    auto hWaveform = mMediaOverview->HasAudio() ? mMediaOverview->GetWaveform() : nullptr;
+    if (hWaveform && !hWaveform->parseDone)
+        return;
+    std::vector<ImGui::ImMat> snapshots;
+    if (mMediaOverview->GetSnapshotCount() > 0 && !mMediaOverview->GetSnapshots(snapshots))
+        return;
+    // snapshots kept in gpu memory can't be written, an entry without them would be taken as the complete overview
+    for (const auto& snapshot : snapshots)
+    {
+        if (snapshot.empty())
+            return;
+        if (snapshot.device != IM_DD_CPU)
+        {
+            Logger::Log(Logger::DEBUG) << "Overview snapshots of '" << mPath << "' are not in cpu memory, they are not cached." << std::endl;
+            mOverviewCacheSaved = true;
+            return;
+        }
+    }
+    mOverviewCacheSaved = true;
+    TimeLine* timeline = (TimeLine*)mHandle;
+    auto hOvwCache = timeline && mOverviewCacheKey != 0 ? timeline->GetOverviewCache() : nullptr;
+    // written on the cache thread, this is called while drawing the media bank
+    if (hOvwCache)
+        hOvwCache->SaveAsync(mOverviewCacheKey, hWaveform, snapshots);
+}
+
+MEC::WaveformPyramid::Holder MediaItem::GetWaveformPyramid()
+{
+    if (!mWaveformPyramid)
+    {
+        auto hWaveform = GetWaveform();
+        if (hWaveform && hWaveform->parseDone && !hWaveform->pcm.empty())
+            mWaveformPyramid = MEC::WaveformPyramid::CreateInstance(hWaveform->pcm);
+    }
+    return mWaveformPyramid;
+}
+
+// resample a waveform channel for drawing, through the peak pyramid of the media item once its waveform is parsed
+static bool waveFrameResample(MediaItem* item, int channel, float * wave, int samples, int size, int start_offset, int size_max, int zoom, ImGui::ImMat& plot_frame_max, ImGui::ImMat& plot_frame_min)
+{
+    auto hPyramid = item ? item->GetWaveformPyramid() : nullptr;
+    if (hPyramid && samples > 16)
+    {
+        plot_frame_max.create_type(size, 1, 1, IM_DT_FLOAT32);
+        plot_frame_min.create_type(size, 1, 1, IM_DT_FLOAT32);
+        float * out_channel_data_max = (float *)plot_frame_max.data;
+        float * out_channel_data_min = (float *)plot_frame_min.data;
+        if (hPyramid->Resample(channel, start_offset, samples, size, out_channel_data_max, out_channel_data_min))
+        {
+            for (int i = 0; i < size; i++)
+            {
+                float max_val = out_channel_data_max[i];
+                float min_val = out_channel_data_min[i];
+                if (max_val < 0 && min_val < 0)
+                    max_val = min_val;
+                else if (max_val > 0 && min_val > 0)
+                    min_val = max_val;
+                out_channel_data_max[i] = ImMin(max_val, 1.f);
+                out_channel_data_min[i] = ImMax(min_val, -1.f);
+            }
+            return true;
+        }
     }
+    return ::waveFrameResample(wave, samples, size, start_offset, size_max, zoom, plot_frame_max, plot_frame_min);
 }
 } //namespace MediaTimeline
 
@@ -1096,6 +1256,7 @@ void Clip::Cutting(int64_t pos, int64_t gid, int64_t newClipId, std::list<imgui_
     // crop this clip's end
     mEnd = adj_end;
     mEndOffset = adj_end_offset;
+    track->MarkClipsChanged();
     // and add a new clip start at this clip's end
     if ((newClipId = timeline->AddNewClip(mMediaID, mType, track->mID,
             new_start, new_start_offset, org_end, org_end_offset,
@@ -1692,6 +1853,7 @@ void Clip::ChangeStart(int64_t pos)
     const int64_t length = Length();
     mStart = pos;
     mEnd = pos+length;
+    OnRangeChanged();
 }
 
 void Clip::ChangeStartOffset(int64_t newOffset)
@@ -1701,6 +1863,7 @@ void Clip::ChangeStartOffset(int64_t newOffset)
     assert(newOffset >= 0 && newOffset-mStartOffset < Length());
     mStart += newOffset-mStartOffset;
     mStartOffset = newOffset;
+    OnRangeChanged();
 }
 
 void Clip::ChangeEndOffset(int64_t newOffset)
@@ -1710,6 +1873,17 @@ void Clip::ChangeEndOffset(int64_t newOffset)
     assert(newOffset >= 0 && newOffset-mEndOffset < Length());
     mEnd -= newOffset-mEndOffset;
     mEndOffset = newOffset;
+    OnRangeChanged();
+}
+
+void Clip::OnRangeChanged()
+{
+    TimeLine * timeline = (TimeLine *)mHandle;
+    if (!timeline)
+        return;
+    auto track = timeline->FindTrackByClipID(mID);
+    if (track)
+        track->MarkClipsChanged();
 }
 
 // clip event editing
@@ -2065,7 +2239,7 @@ bool VideoClip::UpdateClip(MediaItem* pMediaItem)
     mpMediaItem = pMediaItem;
     mMediaID = pMediaItem->mID;
     mMediaParser = pMediaItem->mhParser;
-    mhOverview = pMediaItem->mMediaOverview;
+    mhOverview = pMediaItem->GetOverview();
     mhSsViewer = hSsViewer;
     mPath = mMediaParser->GetUrl();
     mWidth = pVidstm->width;
@@ -2461,9 +2635,9 @@ bool AudioClip::UpdateClip(MediaItem* pMediaItem)
     mpMediaItem = pMediaItem;
     mMediaID = pMediaItem->mID;
     mMediaParser = pMediaItem->mhParser;
-    mhOverview = pMediaItem->mMediaOverview;
+    mhOverview = pMediaItem->GetOverview();
     mPath = mMediaParser->GetUrl();
-    mWaveform = mhOverview->GetWaveform();
+    mWaveform = pMediaItem->GetWaveform();
     mAudioChannels = pAudstm->channels;
     mAudioChannels = pAudstm->sampleRate;
     return true;
@@ -2620,7 +2794,7 @@ void AudioClip::DrawContent(ImDrawList* drawList, const ImVec2& leftTop, const I
                 ImGui::ImMat plot_mat;
                 start_offset = start_offset / sample_stride * sample_stride; // align start_offset
                 ImGui::ImMat plot_frame_max, plot_frame_min;
-                auto filled = waveFrameResample(&mWaveform->pcm[0][0], sample_stride, draw_size.x, start_offset, sampleSize, zoom, plot_frame_max, plot_frame_min);
+                auto filled = waveFrameResample(mpMediaItem, 0, &mWaveform->pcm[0][0], sample_stride, draw_size.x, start_offset, sampleSize, zoom, plot_frame_max, plot_frame_min);
                 ImGui::PushStyleColor(ImGuiCol_PlotLines, ImVec4(0.4f, 0.4f, 1.0f, 1.0f));
                 ImGui::PushStyleColor(ImGuiCol_PlotHistogram, ImVec4(0.3f, 0.3f, 0.8f, 0.5f));
                 if (filled)
@@ -2648,7 +2822,7 @@ void AudioClip::DrawContent(ImDrawList* drawList, const ImVec2& leftTop, const I
                 std::string plot_max_id = id_string + "_line_max";
                 std::string plot_min_id = id_string + "_line_min";
                 ImGui::ImMat plot_frame_max, plot_frame_min;
-                waveFrameResample(&mWaveform->pcm[0][0], sample_stride, draw_size.x, start_offset, sampleSize, zoom, plot_frame_max, plot_frame_min);
+                waveFrameResample(mpMediaItem, 0, &mWaveform->pcm[0][0], sample_stride, draw_size.x, start_offset, sampleSize, zoom, plot_frame_max, plot_frame_min);
                 ImGui::SetCursorScreenPos(customViewStart);
                 ImGui::PlotLinesEx(plot_max_id.c_str(), (float *)plot_frame_max.data, plot_frame_max.w, 0, nullptr, -wave_range, wave_range, draw_size, sizeof(float), false, true);
                 ImGui::SetCursorScreenPos(customViewStart);
@@ -3070,6 +3244,7 @@ int BluePrintVideoTransition::OnBluePrintChange(int type, std::string name, void
 
 MediaCore::VideoTransition::Holder BluePrintVideoTransition::Clone()
 {
+    std::lock_guard<std::mutex> lk(mBpLock);
     BluePrintVideoTransition* bpTrans = new BluePrintVideoTransition(mHandle);
     auto bpJson = mBp->m_Document->Serialize();
     bpTrans->SetBluePrintFromJson(bpJson);
@@ -3077,6 +3252,18 @@ MediaCore::VideoTransition::Holder BluePrintVideoTransition::Clone()
     return MediaCore::VideoTransition::Holder(bpTrans);
 }
 
+void BluePrintVideoTransition::ApplyTo(MediaCore::VideoOverlap* overlap)
+{
+    std::lock_guard<std::mutex> lk(mBpLock);
+    mOverlap = overlap;
+}
+
+void BluePrintVideoTransition::SetKeyPoint(ImGui::KeyPointEditor &keypoint)
+{
+    std::lock_guard<std::mutex> lk(mBpLock);
+    mKeyPoints = keypoint;
+}
+
 imgui_json::value BluePrintVideoTransition::SaveAsJson() const
 {
     imgui_json::value j;
@@ -3176,6 +3363,18 @@ int BluePrintAudioTransition::OnBluePrintChange(int type, std::string name, void
     return ret;
 }
 
+void BluePrintAudioTransition::ApplyTo(MediaCore::AudioOverlap* overlap)
+{
+    std::lock_guard<std::mutex> lk(mBpLock);
+    mOverlap = overlap;
+}
+
+void BluePrintAudioTransition::SetKeyPoint(ImGui::KeyPointEditor &keypoint)
+{
+    std::lock_guard<std::mutex> lk(mBpLock);
+    mKeyPoints = keypoint;
+}
+
 ImGui::ImMat BluePrintAudioTransition::MixTwoAudioMats(const ImGui::ImMat& amat1, const ImGui::ImMat& amat2, int64_t pos)
 {
     std::lock_guard<std::mutex> lk(mBpLock);
@@ -3274,8 +3473,8 @@ EditingVideoClip::EditingVideoClip(VideoClip* vidclip)
     {
         mSsGen = MediaCore::Snapshot::Generator::CreateInstance();
         MediaItem* mi = timeline->FindMediaItemByID(vidclip->mMediaID);
-        if (mi && mi->mMediaOverview)
-            mSsGen->SetOverview(mi->mMediaOverview);
+        if (mi && mi->GetOverview())
+            mSsGen->SetOverview(mi->GetOverview());
         if (!mSsGen)
         {
             Logger::Log(Logger::Error) << "Create Editing Video Clip FAILED!" << std::endl;
@@ -3756,7 +3955,7 @@ void EditingAudioClip::DrawContent(ImDrawList* drawList, const ImVec2& leftTop,
             ImGui::ImMat plot_mat;
             start_offset = start_offset / sample_stride * sample_stride; // align start_offset
             ImGui::ImMat plot_frame_max, plot_frame_min;
-            auto filled = waveFrameResample(&mWaveform->pcm[i][0], sample_stride, window_size.x, start_offset, sampleSize, zoom, plot_frame_max, plot_frame_min);
+            auto filled = waveFrameResample(aclip->mpMediaItem, i, &mWaveform->pcm[i][0], sample_stride, window_size.x, start_offset, sampleSize, zoom, plot_frame_max, plot_frame_min);
             ImGui::PushStyleColor(ImGuiCol_PlotLines, ImVec4(0.4f, 0.8f, 0.4f, 1.0f));
             ImGui::PushStyleColor(ImGuiCol_PlotHistogram, ImVec4(0.3f, 0.8f, 0.3f, 0.5f));
             if (filled)
@@ -3787,7 +3986,7 @@ void EditingAudioClip::DrawContent(ImDrawList* drawList, const ImVec2& leftTop,
             std::string plot_max_id = id_string + "_line_max";
             std::string plot_min_id = id_string + "_line_min";
             ImGui::ImMat plot_frame_max, plot_frame_min;
-            waveFrameResample(&mWaveform->pcm[i][0], sample_stride, window_size.x, start_offset, sampleSize, zoom, plot_frame_max, plot_frame_min);
+            waveFrameResample(aclip->mpMediaItem, i, &mWaveform->pcm[i][0], sample_stride, window_size.x, start_offset, sampleSize, zoom, plot_frame_max, plot_frame_min);
             ImGui::SetCursorScreenPos(leftTop + ImVec2(0, i * window_size.y));
             ImGui::PlotLinesEx(plot_max_id.c_str(), (float *)plot_frame_max.data, plot_frame_max.w, 0, nullptr, -wave_range, wave_range, window_size, sizeof(float), false, true);
             ImGui::SetCursorScreenPos(leftTop + ImVec2(0, i * window_size.y));
@@ -4090,8 +4289,8 @@ EditingVideoOverlap::EditingVideoOverlap(int64_t id, void* handle)
         {
             mSsGen1 = MediaCore::Snapshot::Generator::CreateInstance();
             MediaItem* mi = timeline->FindMediaItemByID(vidclip1->mMediaID);
-            if (mi && mi->mMediaOverview)
-                mSsGen1->SetOverview(mi->mMediaOverview);
+            if (mi && mi->GetOverview())
+                mSsGen1->SetOverview(mi->GetOverview());
             if (timeline) mSsGen1->EnableHwAccel(timeline->mHardwareCodec);
             if (!mSsGen1->Open(vidclip1->mhSsViewer->GetMediaParser(), timeline->mhMediaSettings->VideoOutFrameRate()))
                 throw std::runtime_error("FAILED to open the snapshot generator for the 1st video clip!");
@@ -4120,8 +4319,8 @@ EditingVideoOverlap::EditingVideoOverlap(int64_t id, void* handle)
         {
             mSsGen2 = MediaCore::Snapshot::Generator::CreateInstance();
             MediaItem* mi = timeline->FindMediaItemByID(vidclip2->mMediaID);
-            if (mi && mi->mMediaOverview)
-                mSsGen2->SetOverview(mi->mMediaOverview);
+            if (mi && mi->GetOverview())
+                mSsGen2->SetOverview(mi->GetOverview());
             if (timeline) mSsGen2->EnableHwAccel(timeline->mHardwareCodec);
             if (!mSsGen2->Open(vidclip2->mhSsViewer->GetMediaParser(), timeline->mhMediaSettings->VideoOutFrameRate()))
                 throw std::runtime_error("FAILED to open the snapshot generator for the 2nd video clip!");
@@ -4602,7 +4801,7 @@ void EditingAudioOverlap::DrawContent(ImDrawList* drawList, const ImVec2& leftTo
                 ImGui::ImMat plot_mat;
                 start_offset = start_offset / sample_stride * sample_stride; // align start_offset
                 ImGui::ImMat plot_frame_max, plot_frame_min;
-                auto filled = waveFrameResample(&waveform->pcm[i][0], sample_stride, clip_window_size.x, start_offset, sampleSize, zoom, plot_frame_max, plot_frame_min);
+                auto filled = waveFrameResample(mClip1->mpMediaItem, i, &waveform->pcm[i][0], sample_stride, clip_window_size.x, start_offset, sampleSize, zoom, plot_frame_max, plot_frame_min);
                 if (filled)
                 {
                     ImGui::PlotMat(plot_mat, (float *)plot_frame_max.data, plot_frame_max.w, 0, -wave_range, wave_range, clip_window_size, sizeof(float), filled, true);
@@ -4627,7 +4826,7 @@ void EditingAudioOverlap::DrawContent(ImDrawList* drawList, const ImVec2& leftTo
                 std::string plot_max_id = id_string + "_line_max";
                 std::string plot_min_id = id_string + "_line_min";
                 ImGui::ImMat plot_frame_max, plot_frame_min;
-                waveFrameResample(&waveform->pcm[i][0], sample_stride, clip_window_size.x, start_offset, sampleSize, zoom, plot_frame_max, plot_frame_min);
+                waveFrameResample(mClip1->mpMediaItem, i, &waveform->pcm[i][0], sample_stride, clip_window_size.x, start_offset, sampleSize, zoom, plot_frame_max, plot_frame_min);
                 ImGui::SetCursorScreenPos(leftTop + ImVec2(0, i * clip_window_size.y));
                 ImGui::PlotLinesEx(plot_max_id.c_str(), (float *)plot_frame_max.data, plot_frame_max.w, 0, nullptr, -wave_range, wave_range, clip_window_size, sizeof(float), false, true);
                 ImGui::SetCursorScreenPos(leftTop + ImVec2(0, i * clip_window_size.y));
@@ -4687,7 +4886,7 @@ void EditingAudioOverlap::DrawContent(ImDrawList* drawList, const ImVec2& leftTo
                 ImGui::ImMat plot_mat;
                 start_offset = start_offset / sample_stride * sample_stride; // align start_offset
                 ImGui::ImMat plot_frame_max, plot_frame_min;
-                auto filled = waveFrameResample(&waveform->pcm[i][0], sample_stride, clip_window_size.x, start_offset, sampleSize, zoom, plot_frame_max, plot_frame_min);
+                auto filled = waveFrameResample(mClip2->mpMediaItem, i, &waveform->pcm[i][0], sample_stride, clip_window_size.x, start_offset, sampleSize, zoom, plot_frame_max, plot_frame_min);
                 if (filled)
                 {
                     ImGui::PlotMat(plot_mat, (float *)plot_frame_max.data, plot_frame_max.w, 0, -wave_range, wave_range, clip_window_size, sizeof(float), filled, true);
@@ -4712,7 +4911,7 @@ void EditingAudioOverlap::DrawContent(ImDrawList* drawList, const ImVec2& leftTo
                 std::string plot_max_id = id_string + "_line_max";
                 std::string plot_min_id = id_string + "_line_min";
                 ImGui::ImMat plot_frame_max, plot_frame_min;
-                waveFrameResample(&waveform->pcm[i][0], sample_stride, clip_window_size.x, start_offset, sampleSize, zoom, plot_frame_max, plot_frame_min);
+                waveFrameResample(mClip2->mpMediaItem, i, &waveform->pcm[i][0], sample_stride, clip_window_size.x, start_offset, sampleSize, zoom, plot_frame_max, plot_frame_min);
                 ImGui::SetCursorScreenPos(clip2_pos + ImVec2(0, i * clip_window_size.y));
                 ImGui::PlotLinesEx(plot_max_id.c_str(), (float *)plot_frame_max.data, plot_frame_max.w, 0, nullptr, -wave_range, wave_range, clip_window_size, sizeof(float), false, true);
                 ImGui::SetCursorScreenPos(clip2_pos + ImVec2(0, i * clip_window_size.y));
@@ -4887,63 +5086,161 @@ void MediaTrack::Update()
     if (!timeline)
         return;
     // sort m_Clips by clip start time
-    std::sort(m_Clips.begin(), m_Clips.end(), [](const Clip *a, const Clip* b){
+    auto startLess = [](const Clip *a, const Clip* b){
         return a->Start() < b->Start();
-    });
-    
+    };
+    if (!std::is_sorted(m_Clips.begin(), m_Clips.end(), startLess))
+    {
+        std::sort(m_Clips.begin(), m_Clips.end(), startLess);
+        MarkClipsChanged();
+    }
+
+    // only the overlaps of clips added, removed or moved since the last update are checked, unless the overlaps
+    // were changed out of this track
+    auto lastRanges = std::move(mUpdatedClipRanges);
+    mUpdatedClipRanges.clear();
+    std::unordered_set<int64_t> changedClips;
+    for (auto clip : m_Clips)
+    {
+        auto iter = lastRanges.find(clip->mID);
+        if (iter == lastRanges.end() || iter->second != std::make_pair(clip->Start(), clip->End()))
+            changedClips.insert(clip->mID);
+        if (iter != lastRanges.end())
+            lastRanges.erase(iter);
+    }
+    for (auto& item : lastRanges)
+        changedClips.insert(item.first);
+    bool fullCheck = m_Overlaps.size() != mUpdatedOverlapIds.size();
+    for (size_t i = 0; !fullCheck && i < m_Overlaps.size(); i++)
+        fullCheck = m_Overlaps[i]->mID != mUpdatedOverlapIds[i];
+    BuildClipIntervals();
+
     // check all overlaps
+    std::map<std::pair<int64_t, int64_t>, Overlap*> overlapsByClips;
     for (auto iter = m_Overlaps.begin(); iter != m_Overlaps.end();)
     {
-        if (!(*iter)->IsOverlapValid(true))
+        auto overlap = *iter;
+        const bool affected = fullCheck || changedClips.count(overlap->m_Clip.first) || changedClips.count(overlap->m_Clip.second);
+        if (affected && !overlap->IsOverlapValid(true))
         {
-            int64_t id = (*iter)->mID;
+            int64_t id = overlap->mID;
             iter = m_Overlaps.erase(iter);
+            MarkOverlapsChanged();
             timeline->DeleteOverlap(id);
         }
         else
+        {
+            overlapsByClips[std::minmax(overlap->m_Clip.first, overlap->m_Clip.second)] = overlap;
             ++iter;
+        }
     }
 
-    // check is there have new overlap area
-    for (auto iter = m_Clips.begin(); iter != m_Clips.end(); iter++)
+    // check is there have new overlap area, for each pair of clips where the first one starts first
+    auto checkOverlap = [&] (Clip* first, Clip* second)
     {
-        for (auto next = iter + 1; next != m_Clips.end(); next++)
+        if (first->End() >= second->Start())
         {
-            if ((*iter)->End() >= (*next)->Start())
+            // it is a overlap area
+            int64_t start = std::max(second->Start(), first->Start());
+            int64_t end = std::min(first->End(), second->End());
+            if (end > start)
             {
-                // it is a overlap area
-                int64_t start = std::max((*next)->Start(), (*iter)->Start());
-                int64_t end = std::min((*iter)->End(), (*next)->End());
-                if (end > start)
-                {
-                    // check it is in exist overlaps
-                    auto overlap = FindExistOverlap((*iter)->mID, (*next)->mID);
-                    if (overlap)
-                        overlap->Update(start, (*iter)->mID, end, (*next)->mID);
-                    else
-                        CreateOverlap(start, (*iter)->mID, end, (*next)->mID, (*iter)->mType);
-                }
+                // check it is in exist overlaps
+                auto iter = overlapsByClips.find(std::minmax(first->mID, second->mID));
+                if (iter != overlapsByClips.end())
+                    iter->second->Update(start, first->mID, end, second->mID);
+                else
+                    overlapsByClips[std::minmax(first->mID, second->mID)] = CreateOverlap(start, first->mID, end, second->mID, first->mType);
             }
         }
+    };
+    // the clips starting before a clip ends are after it in the sorted intervals, the ones before it are found
+    // walking back while the running max end still reaches its start
+    auto checkClipOverlaps = [&] (size_t idx, bool checkBefore)
+    {
+        const auto& current = mClipIntervals[idx];
+        for (size_t j = idx + 1; j < mClipIntervals.size() && mClipIntervals[j].start <= current.end; j++)
+            checkOverlap(current.clip, mClipIntervals[j].clip);
+        for (size_t i = idx; checkBefore && i > 0 && mClipIntervals[i - 1].maxEnd >= current.start; i--)
+            checkOverlap(mClipIntervals[i - 1].clip, current.clip);
+    };
+    for (size_t i = 0; i < mClipIntervals.size(); i++)
+    {
+        if (fullCheck)
+            checkClipOverlaps(i, false);
+        else if (changedClips.count(mClipIntervals[i].id))
+            checkClipOverlaps(i, true);
     }
+    BuildOverlapEdges();
+    for (auto& ci : mClipIntervals)
+        mUpdatedClipRanges[ci.id] = {ci.start, ci.end};
+    mUpdatedOverlapIds.clear();
+    for (auto overlap : m_Overlaps)
+        mUpdatedOverlapIds.push_back(overlap->mID);
+
     // update curve range
     if (mMttReader)
         mMttReader->GetKeyPoints()->SetTimeRange(0, timeline->mEnd - timeline->mStart, true);
 }
 
-void MediaTrack::CreateOverlap(int64_t start, int64_t start_clip_id, int64_t end, int64_t end_clip_id, uint32_t type)
+void MediaTrack::BuildClipIntervals()
+{
+    mClipIntervalsGeneration = mClipsGeneration;
+    mClipIntervals.clear();
+    mClipIntervals.reserve(m_Clips.size());
+    for (auto clip : m_Clips)
+        mClipIntervals.push_back({clip->Start(), clip->End(), 0, clip->mID, clip});
+    auto startLess = [](const ClipInterval& a, const ClipInterval& b) { return a.start < b.start; };
+    if (!std::is_sorted(mClipIntervals.begin(), mClipIntervals.end(), startLess))
+        std::stable_sort(mClipIntervals.begin(), mClipIntervals.end(), startLess);
+    int64_t maxEnd = INT64_MIN;
+    for (auto& ci : mClipIntervals)
+    {
+        maxEnd = std::max(maxEnd, ci.end);
+        ci.maxEnd = maxEnd;
+    }
+}
+
+void MediaTrack::BuildOverlapEdges()
+{
+    mOverlapEdgesGeneration = mOverlapsGeneration;
+    mOverlapIntervals.clear();
+    mOverlapStarts.clear();
+    mOverlapEnds.clear();
+    for (auto overlap : m_Overlaps)
+    {
+        mOverlapIntervals.push_back({overlap->mStart, overlap->mEnd, 0, overlap});
+        mOverlapStarts.push_back(overlap->mStart);
+        mOverlapEnds.push_back(overlap->mEnd);
+    }
+    auto startLess = [](const OverlapInterval& a, const OverlapInterval& b) { return a.start < b.start; };
+    if (!std::is_sorted(mOverlapIntervals.begin(), mOverlapIntervals.end(), startLess))
+        std::stable_sort(mOverlapIntervals.begin(), mOverlapIntervals.end(), startLess);
+    int64_t maxEnd = INT64_MIN;
+    for (auto& oi : mOverlapIntervals)
+    {
+        maxEnd = std::max(maxEnd, oi.end);
+        oi.maxEnd = maxEnd;
+    }
+    std::sort(mOverlapStarts.begin(), mOverlapStarts.end());
+    std::sort(mOverlapEnds.begin(), mOverlapEnds.end());
+}
+
+Overlap * MediaTrack::CreateOverlap(int64_t start, int64_t start_clip_id, int64_t end, int64_t end_clip_id, uint32_t type)
 {
     TimeLine * timeline = (TimeLine *)m_Handle;
     if (!timeline)
-        return;
+        return nullptr;
 
     Overlap * new_overlap = new Overlap(start, end, start_clip_id, end_clip_id, type, timeline);
     timeline->m_Overlaps.push_back(new_overlap);
-    m_Overlaps.push_back(new_overlap);
-    // sort track overlap by overlap start time
-    std::sort(m_Overlaps.begin(), m_Overlaps.end(), [](const Overlap *a, const Overlap *b){
+    // keep track overlaps sorted by overlap start time
+    auto iter = std::upper_bound(m_Overlaps.begin(), m_Overlaps.end(), new_overlap, [](const Overlap *a, const Overlap *b){
         return a->mStart < b->mStart;
     });
+    m_Overlaps.insert(iter, new_overlap);
+    MarkOverlapsChanged();
+    return new_overlap;
 }
 
 Overlap * MediaTrack::FindExistOverlap(int64_t start_clip_id, int64_t end_clip_id)
@@ -4983,6 +5280,7 @@ void MediaTrack::DeleteClip(int64_t id)
             }
         }
         m_Clips.erase(iter);
+        MarkClipsChanged();
     }
 }
 
@@ -4995,15 +5293,15 @@ bool MediaTrack::CanInsertClip(Clip * clip, int64_t pos)
     }
     else
     {
-        for (auto overlap : m_Overlaps)
-        {
-            if ((overlap->mStart >= pos && overlap->mStart <= pos + clip->Length()) || 
-                (overlap->mEnd >= pos && overlap->mEnd <= pos + clip->Length()))
-            {
-                can_insert_clip = false;
-                break;
-            }
-        }
+        if (mOverlapEdgesGeneration != mOverlapsGeneration)
+            BuildOverlapEdges();
+        // no overlap may start or end within the clip range
+        const int64_t end = pos + clip->Length();
+        auto start_iter = std::lower_bound(mOverlapStarts.begin(), mOverlapStarts.end(), pos);
+        auto end_iter = std::lower_bound(mOverlapEnds.begin(), mOverlapEnds.end(), pos);
+        if ((start_iter != mOverlapStarts.end() && *start_iter <= end) ||
+            (end_iter != mOverlapEnds.end() && *end_iter <= end))
+            can_insert_clip = false;
     }
     return can_insert_clip;
 }
@@ -5025,6 +5323,7 @@ void MediaTrack::InsertClip(Clip* clip, int64_t pos, bool update, std::list<imgu
         clip->ConfigViewWindow(mViewWndDur, mPixPerMs);
         clip->SetTrackHeight(mTrackHeight);
         m_Clips.push_back(clip);
+        MarkClipsChanged();
         if (pActionList)
         {
             imgui_json::value action;
@@ -5045,6 +5344,24 @@ void MediaTrack::InsertClip(Clip* clip, int64_t pos, bool update, std::list<imgu
     if (update) Update();
 }
 
+// Position of 'clip' in the clips of a track, found by binary search as they're sorted by start after each update
+static std::vector<Clip *>::iterator FindClipPosition(std::vector<Clip *>& clips, const Clip * clip)
+{
+    const int64_t start = clip->Start();
+    auto iter = std::lower_bound(clips.begin(), clips.end(), start, [](const Clip* c, int64_t t) {
+        return c->Start() < t;
+    });
+    for (; iter != clips.end() && (*iter)->Start() == start; iter++)
+    {
+        if ((*iter)->mID == clip->mID)
+            return iter;
+    }
+    // not sorted yet, the clip is moved since the last update
+    return std::find_if(clips.begin(), clips.end(), [clip](const Clip* c) {
+        return c->mID == clip->mID;
+    });
+}
+
 Clip * MediaTrack::FindPrevClip(int64_t id)
 {
     Clip * found_clip = nullptr;
@@ -5054,9 +5371,7 @@ Clip * MediaTrack::FindPrevClip(int64_t id)
     auto current_clip = timeline->FindClipByID(id);
     if (!current_clip)
         return found_clip;
-    auto iter = std::find_if(m_Clips.begin(), m_Clips.end(), [id](const Clip* ss) {
-        return ss->mID == id;
-    });
+    auto iter = FindClipPosition(m_Clips, current_clip);
     if (iter == m_Clips.begin() || iter == m_Clips.end())
         return found_clip;
     
@@ -5073,9 +5388,7 @@ Clip * MediaTrack::FindNextClip(int64_t id)
     auto current_clip = timeline->FindClipByID(id);
     if (!current_clip)
         return found_clip;
-    auto iter = std::find_if(m_Clips.begin(), m_Clips.end(), [id](const Clip* ss) {
-        return ss->mID == id;
-    });
+    auto iter = FindClipPosition(m_Clips, current_clip);
 
     if (iter == m_Clips.end() || iter == m_Clips.end() - 1)
         return found_clip;
@@ -5090,14 +5403,22 @@ Clip * MediaTrack::FindClips(int64_t time, int& count)
     int selected_count = 0;
     std::vector<Clip *> clips;
     std::vector<Clip *> select_clips;
-    for (auto clip : m_Clips)
+    if (mClipIntervalsGeneration != mClipsGeneration)
+        BuildClipIntervals();
+    // the clips starting until 'time', walking back while the running max end still reaches it
+    auto iter = std::upper_bound(mClipIntervals.begin(), mClipIntervals.end(), time, [](int64_t t, const ClipInterval& ci) {
+        return t < ci.start;
+    });
+    for (; iter != mClipIntervals.begin() && (iter - 1)->maxEnd >= time; iter--)
     {
-        if (clip->Start() <= time && clip->End() >= time)
-        {
-            clips.push_back(clip);
-            if (clip->bSelected)
-                select_clips.push_back(clip);
-        }
+        if ((iter - 1)->end >= time)
+            clips.push_back((iter - 1)->clip);
+    }
+    std::reverse(clips.begin(), clips.end());
+    for (auto clip : clips)
+    {
+        if (clip->bSelected)
+            select_clips.push_back(clip);
     }
     for (auto clip : select_clips)
     {
@@ -5116,6 +5437,49 @@ Clip * MediaTrack::FindClips(int64_t time, int& count)
     return ret_clip;
 }
 
+int64_t MediaTrack::NextClipStart(int64_t pos, bool inclusive)
+{
+    if (mClipIntervalsGeneration != mClipsGeneration)
+        BuildClipIntervals();
+    auto iter = inclusive ?
+        std::lower_bound(mClipIntervals.begin(), mClipIntervals.end(), pos, [](const ClipInterval& ci, int64_t t) { return ci.start < t; }) :
+        std::upper_bound(mClipIntervals.begin(), mClipIntervals.end(), pos, [](int64_t t, const ClipInterval& ci) { return t < ci.start; });
+    return iter != mClipIntervals.end() ? iter->start : -1;
+}
+
+void MediaTrack::FindClipsInRange(int64_t start, int64_t end, std::vector<Clip *>& clips)
+{
+    clips.clear();
+    if (mClipIntervalsGeneration != mClipsGeneration)
+        BuildClipIntervals();
+    // the clips starting before 'end', walking back while the running max end still passes 'start'
+    auto iter = std::lower_bound(mClipIntervals.begin(), mClipIntervals.end(), end, [](const ClipInterval& ci, int64_t t) {
+        return ci.start < t;
+    });
+    for (; iter != mClipIntervals.begin() && (iter - 1)->maxEnd > start; iter--)
+    {
+        if ((iter - 1)->end > start)
+            clips.push_back((iter - 1)->clip);
+    }
+    std::reverse(clips.begin(), clips.end());
+}
+
+void MediaTrack::FindOverlapsInRange(int64_t start, int64_t end, std::vector<Overlap *>& overlaps)
+{
+    overlaps.clear();
+    if (mOverlapEdgesGeneration != mOverlapsGeneration)
+        BuildOverlapEdges();
+    auto iter = std::upper_bound(mOverlapIntervals.begin(), mOverlapIntervals.end(), end, [](int64_t t, const OverlapInterval& oi) {
+        return t < oi.start;
+    });
+    for (; iter != mOverlapIntervals.begin() && (iter - 1)->maxEnd >= start; iter--)
+    {
+        if ((iter - 1)->end >= start)
+            overlaps.push_back((iter - 1)->overlap);
+    }
+    std::reverse(overlaps.begin(), overlaps.end());
+}
+
 void MediaTrack::SelectClip(Clip * clip, bool appand)
 {
     TimeLine * timeline = (TimeLine *)m_Handle;
@@ -5128,6 +5492,8 @@ void MediaTrack::SelectClip(Clip * clip, bool appand)
         selected = false;
     }
     
+    clip->bSelected = selected;
+    int selected_count = 0;
     for (auto _clip : timeline->m_Clips)
     {
         if (_clip->mID != clip->mID)
@@ -5141,8 +5507,9 @@ void MediaTrack::SelectClip(Clip * clip, bool appand)
                 _clip->bSelected = !selected;
             }
         }
+        if (_clip->bSelected) selected_count++;
     }
-    clip->bSelected = selected;
+    timeline->mSelectedClipCount = selected_count;
 }
 
 void MediaTrack::SelectEditingClip(Clip * clip)
@@ -5273,43 +5640,6 @@ void MediaTrack::SelectEditingOverlap(Overlap * overlap)
     }
 }
 
-void MediaTrack::CalculateAudioScopeData(ImGui::ImMat& mat_in)
-{
-    ImGui::ImMat mat;
-    if (mat_in.empty() || mat_in.w < 64)
-        return;
-    int fft_size = mat_in.w  > 256 ? 256 : mat_in.w > 128 ? 128 : 64;
-    if (mat_in.elempack > 1)
-    {
-        mat.create_type(fft_size, 1, mat_in.c, mat_in.type);
-        float * data = (float *)mat_in.data;
-        for (int x = 0; x < mat.w; x++)
-        {
-            for (int i = 0; i < mat.c; i++)
-            {
-                mat.at<float>(x, 0, i) = data[x * mat.c + i];
-            }
-        }
-    }
-    else
-    {
-        //mat = mat_in;
-        mat.create_type(fft_size, 1, mat_in.c, mat_in.data, mat_in.type);
-    }
-    for (int i = 0; i < mat.c; i++)
-    {
-        if (i < mAudioChannels)
-        {
-            // we only calculate decibel for now
-            auto & channel_data = mAudioTrackAttribute.channel_data[i];
-            channel_data.m_wave.clone_from(mat.channel(i));
-            channel_data.m_fft.clone_from(mat.channel(i));
-            ImGui::ImRFFT((float *)channel_data.m_fft.data, channel_data.m_fft.w, true);
-            channel_data.m_decibel = ImGui::ImDoDecibel((float*)channel_data.m_fft.data, mat.w);
-        }
-    }
-}
-
 float MediaTrack::GetAudioLevel(int channel)
 {
     if (IS_AUDIO(mType))
@@ -5399,6 +5729,7 @@ MediaTrack* MediaTrack::Load(const imgui_json::value& value, void * handle)
                 if (clip)
                 {
                     new_track->m_Clips.push_back(clip);
+                    new_track->MarkClipsChanged();
                     clip->ConfigViewWindow(new_track->mViewWndDur, new_track->mPixPerMs);
                     clip->SetTrackHeight(new_track->mTrackHeight);
                 }
@@ -5414,7 +5745,10 @@ MediaTrack* MediaTrack::Load(const imgui_json::value& value, void * handle)
                 int64_t overlap_id = id_val.get<imgui_json::number>();
                 Overlap * overlap = timeline->FindOverlapByID(overlap_id);
                 if (overlap)
+                {
                     new_track->m_Overlaps.push_back(overlap);
+                    new_track->MarkOverlapsChanged();
+                }
             }
         }
 
@@ -5704,7 +6038,7 @@ EditingItem::EditingItem(uint32_t media_type, BaseEditingClip * clip)
     }
     else if (IS_AUDIO(media_type))
     {
-        auto wavefrom = item->mMediaOverview->GetWaveform();
+        auto wavefrom = item->GetWaveform();
         if (wavefrom && wavefrom->pcm.size() > 0)
         {
             ImGui::ImMat plot_mat;
@@ -5790,8 +6124,8 @@ EditingItem::EditingItem(uint32_t media_type, BaseEditingOverlap * overlap)
     else if (IS_AUDIO(media_type))
     {
         ImGui::ImMat first_mat, second_mat;
-        auto first_wavefrom = first_item->mMediaOverview->GetWaveform();
-        auto second_wavefrom = second_item->mMediaOverview->GetWaveform();
+        auto first_wavefrom = first_item->GetWaveform();
+        auto second_wavefrom = second_item->GetWaveform();
         ImVec2 wave_size(96, 48);
         if (first_wavefrom && first_wavefrom->pcm.size() > 0)
         {
@@ -5900,8 +6234,8 @@ int TimeLine::OnBluePrintChange(int type, std::string name, void* handle)
     return ret;
 }
 
-TimeLine::TimeLine()
-    : mStart(0), mEnd(0), mPcmStream(this)
+TimeLine::TimeLine(bool headless)
+    : mStart(0), mEnd(0), mPcmStream(this), mHeadless(headless)
 {
     std::srand(std::time(0)); // init std::rand
 
@@ -5948,15 +6282,20 @@ TimeLine::TimeLine()
     // preview use the same settings of timeline as default
     mhPreviewSettings = mhMediaSettings->Clone();
 
-    mAudioRender = MediaCore::AudioRender::CreateInstance();
-    if (!mAudioRender)
-        throw std::runtime_error("FAILED to create AudioRender instance!");
-    if (!mAudioRender->OpenDevice(mhPreviewSettings->AudioOutSampleRate(), mhPreviewSettings->AudioOutChannels(), mAudioRenderFormat, &mPcmStream))
-        throw std::runtime_error("FAILED to open audio render device!");
+    if (!mHeadless)
+    {
+        mAudioRender = MediaCore::AudioRender::CreateInstance();
+        if (!mAudioRender)
+            throw std::runtime_error("FAILED to create AudioRender instance!");
+        if (!mAudioRender->OpenDevice(mhPreviewSettings->AudioOutSampleRate(), mhPreviewSettings->AudioOutChannels(), mAudioRenderFormat, &mPcmStream))
+            throw std::runtime_error("FAILED to open audio render device!");
+    }
 
     auto exec_path = ImGuiHelper::exec_path();
     m_BP_UI.Initialize();
 
+    if (!mHeadless)
+        StartAudioScopeThread();
     ConfigureDataLayer();
 
     mAudioAttribute.channel_data.clear();
@@ -5964,12 +6303,15 @@ TimeLine::TimeLine()
     memcpy(&mAudioAttribute.mBandCfg, &DEFAULT_BAND_CFG, sizeof(mAudioAttribute.mBandCfg));
 
     mhPreviewTx = mTxMgr->GetTextureFromPool(PREVIEW_TEXTURE_POOL_NAME);
-    mRecordIter = mHistoryRecords.begin();
+    mhUndoHistory = MEC::UndoHistory::CreateInstance(mHistoryMaxRecords, (int64_t)mHistoryMemoryLimit*1024*1024);
     mMediaPlayer = new MEC::MediaPlayer(mTxMgr);
 }
 
 TimeLine::~TimeLine()
 {    
+    // the scope analysis works on the tracks, stop it and its feeder before they are released
+    mPcmStream.SetAudioReader(nullptr);
+    StopAudioScopeThread();
     ImGui::ImDestroyTexture(&mEncodingPreviewTexture);
     mAudioAttribute.channel_data.clear();
     ImGui::ImDestroyTexture(&mAudioAttribute.m_audio_vector_texture);
@@ -5980,6 +6322,7 @@ TimeLine::~TimeLine()
     for (auto track : m_Tracks) delete track;
     for (auto clip : m_Clips) delete clip;
     for (auto overlap : m_Overlaps)  delete overlap;
+    mSyncedTransitions.clear();
     for (auto item : media_items) delete item;
 
     ImGui::ImDestroyTexture(&mVideoTransitionInputFirstTexture);
@@ -6001,6 +6344,9 @@ TimeLine::~TimeLine()
     mTxMgr->ReleaseTexturePool(VIDEOITEM_OVERVIEW_GRID_TEXTURE_POOL_NAME);
     mTxMgr->ReleaseTexturePool(VIDEOCLIP_SNAPSHOT_GRID_TEXTURE_POOL_NAME);
     mTxMgr->ReleaseTexturePool(EDITING_VIDEOCLIP_SNAPSHOT_GRID_TEXTURE_POOL_NAME);
+    mhRenderAheadCache = nullptr;
+    StopRenderInToOut();
+    mRenderCacheReaders.clear();
     mMtvReader = nullptr;
     mMtaReader = nullptr;
 
@@ -6068,6 +6414,121 @@ const imgui_json::value& TimeLine::CheckMediaItemMetaData(const std::string& fil
     return EMPTY_JSON;
 }
 
+MEC::MediaOverviewCache::Holder TimeLine::GetOverviewCache()
+{
+    std::lock_guard<std::mutex> lk(mOverviewCacheLock);
+    if (!mhOverviewCache)
+    {
+        const auto strCacheDir = MEC::Project::GetCacheDir();
+        if (strCacheDir.empty())
+            return nullptr;
+        std::string errMsg;
+        mhOverviewCache = MEC::MediaOverviewCache::CreateInstance(SysUtils::JoinPath(strCacheDir, "OverviewCache"), mOverviewCacheMaxBytes, errMsg);
+        if (!mhOverviewCache)
+            Logger::Log(Logger::WARN) << "Overview cache is NOT available! " << errMsg << std::endl;
+    }
+    return mhOverviewCache;
+}
+
+void TimeLine::LoadMediaBank(const imgui_json::array& jnMediaBank, float* pProgress, float fProgressSpan)
+{
+    std::vector<MediaItem*> items;
+    items.reserve(jnMediaBank.size());
+    for (const auto& jnItem : jnMediaBank)
+    {
+        int64_t id = -1;
+        std::string name;
+        std::string path;
+        uint32_t type = MEDIA_UNKNOWN;
+        if (jnItem.contains("id"))
+        {
+            auto& val = jnItem["id"];
+            if (val.is_number())
+            {
+                id = val.get<imgui_json::number>();
+            }
+        }
+        if (jnItem.contains("name"))
+        {
+            auto& val = jnItem["name"];
+            if (val.is_string())
+            {
+                name = val.get<imgui_json::string>();
+            }
+        }
+        if (jnItem.contains("path"))
+        {
+            auto& val = jnItem["path"];
+            if (val.is_string())
+            {
+                path = val.get<imgui_json::string>();
+            }
+        }
+        if (jnItem.contains("type"))
+        {
+            auto& val = jnItem["type"];
+            if (val.is_number())
+            {
+                type = val.get<imgui_json::number>();
+            }
+        }
+
+        MediaItem* item = new MediaItem(name, path, type, this);
+        if (id != -1) item->mID = id;
+        if (jnItem.contains("meta_data"))
+            item->mMetaData = jnItem["meta_data"];
+        items.push_back(item);
+    }
+    if (items.empty())
+        return;
+
+    // opening the parsers and overviews takes most of the loading time, it's shared by a few workers, in lazy mode
+    // the overviews are left to be opened when the items are shown or used, and the items are added in the order of the media bank once all of them are initialized
+    int threadCount = mMediaLoadThreads > 0 ? mMediaLoadThreads : (int)std::thread::hardware_concurrency();
+    threadCount = std::max(1, std::min(threadCount, (int)items.size()));
+    std::atomic<size_t> nextItemIdx {0};
+    std::atomic<size_t> initializedCount {0};
+    const bool deferOverview = mLazyMediaInit;
+    auto initProc = [&items, &nextItemIdx, &initializedCount, deferOverview] () {
+        size_t itemIdx;
+        while ((itemIdx = nextItemIdx++) < items.size())
+        {
+            items[itemIdx]->Initialize(deferOverview);
+            initializedCount++;
+        }
+    };
+    std::vector<std::thread> initThreads;
+    for (int i = 0; i < threadCount; i++)
+    {
+        initThreads.push_back(std::thread(initProc));
+        SysUtils::SetThreadName(initThreads.back(), "TL-MediaInit"+std::to_string(i));
+    }
+    const float progressStart = pProgress ? *pProgress : 0;
+    while (pProgress && initializedCount < items.size())
+    {
+        *pProgress = progressStart + fProgressSpan * initializedCount / items.size();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    for (auto& t : initThreads)
+        t.join();
+    if (pProgress) *pProgress = progressStart + fProgressSpan;
+    media_items.insert(media_items.end(), items.begin(), items.end());
+}
+
+void TimeLine::SaveMediaBank(imgui_json::array& jnMediaBank)
+{
+    for (auto media : media_items)
+    {
+        imgui_json::value item;
+        item["id"] = imgui_json::number(media->mID);
+        item["name"] = media->mName;
+        item["path"] = media->mPath;
+        item["type"] = imgui_json::number(media->mMediaType);
+        item["meta_data"] = media->mMetaData;
+        jnMediaBank.push_back(item);
+    }
+}
+
 int64_t TimeLine::AlignTime(int64_t time, int mode)
 {
     const auto frameRate = mhMediaSettings->VideoOutFrameRate();
@@ -6155,6 +6616,7 @@ void TimeLine::Click(int index, int64_t time)
         {
             clip->bSelected = false;
         }
+        mSelectedClipCount = 0;
     }
 }
 
@@ -6667,6 +7129,7 @@ void TimeLine::MovingClip(int64_t id, int from_track_index, int to_track_index)
         if ((*iter)->mID == id)
         {
             iter = track->m_Clips.erase(iter);
+            track->MarkClipsChanged();
         }
         else
             ++iter;
@@ -6708,6 +7171,8 @@ bool TimeLine::DeleteClip(int64_t id, std::list<imgui_json::value>* pActionList)
     {
         auto clip = *iter;
         m_Clips.erase(iter);
+        if (clip->bSelected && mSelectedClipCount > 0)
+            mSelectedClipCount--;
 
         auto found = FindEditingItem(EDITING_CLIP, clip->mID);
         if (found != -1)
@@ -6766,6 +7231,7 @@ void TimeLine::DeleteOverlap(int64_t id)
                     m_CallBacks.EditingOverlap(overlap->mType, overlap);
                 }
             }
+            mSyncedTransitions.erase(overlap->mID);
             delete overlap;
         }
         else
@@ -6820,33 +7286,541 @@ void TimeLine::RefreshPreview(bool updateDuration)
 {
     mMtvReader->Refresh(updateDuration);
     mIsPreviewNeedUpdate = true;
+    MarkRenderAheadDirty({});
 }
 
 void TimeLine::RefreshTrackView(const std::unordered_set<int64_t>& trackIds)
 {
     mMtvReader->RefreshTrackView(trackIds);
     mIsPreviewNeedUpdate = true;
+    MarkRenderAheadDirty(trackIds);
 }
 
-std::vector<MediaCore::CorrelativeFrame> TimeLine::GetPreviewFrame(bool blocking)
+void TimeLine::MarkRenderAheadDirty(const std::unordered_set<int64_t>& trackIds)
 {
-    int64_t auddataPos, previewPos;
-    if (!bSeeking)
+    if (trackIds.empty())
+        mRenderAheadFullDiff = true;
+    else
+        mRenderAheadDirtyTrackIds.insert(trackIds.begin(), trackIds.end());
+    mRenderAheadDirty = true;
+    mRenderCacheKeysDirty = !mRenderCacheChunks.empty();
+    mRenderAheadEditTp = PlayerClock::now();
+}
+
+void TimeLine::InvalidateChangedRenderAheadRanges()
+{
+    // An edit is either structural, a track or an item is added, removed, moved or trimmed, whose old and new places
+    // are invalidated, or a content edit like a filter or a subtitle change, which is only known to touch the refreshed
+    // track, so all the items of a refreshed track are invalidated. A full refresh doesn't tell which tracks have content
+    // edits, so it clears the whole cache.
+    std::vector<std::pair<int64_t, int64_t>> changedRanges;
+    auto addItemRanges = [&changedRanges] (const RenderAheadTrackState& state) {
+        for (const auto& elem : state.items)
+            changedRanges.push_back({elem.second.start, elem.second.end});
+    };
+    std::unordered_map<int64_t, RenderAheadTrackState> newStates;
+    int trackOrder = 0;
+    for (auto track : m_Tracks)
     {
-        if (mPcmStream.GetTimestampMs(auddataPos))
+        if (!IS_VIDEO(track->mType) && !IS_TEXT(track->mType))
+            continue;
+        trackOrder++;
+        auto itOld = mRenderAheadTrackStates.find(track->mID);
+        if (!mRenderAheadFullDiff && mRenderAheadDirtyTrackIds.find(track->mID) == mRenderAheadDirtyTrackIds.end())
         {
-            int64_t bufferedDur = mMtaReader->SizeToDuration(mAudioRender->GetBufferedDataSize());
-            previewPos = mIsPreviewForward ? auddataPos-bufferedDur : auddataPos+bufferedDur;
-            if (previewPos < 0) previewPos = 0;
+            if (itOld != mRenderAheadTrackStates.end())
+                newStates[track->mID] = std::move(itOld->second);
+            continue;
         }
-        else
+        auto& state = newStates[track->mID];
+        state.order = trackOrder;
+        state.type = track->mType;
+        state.view = track->mView;
+        for (auto clip : track->m_Clips)
+            state.items[clip->mID] = {clip->Start(), clip->End(), clip->StartOffset()};
+        for (auto overlap : track->m_Overlaps)
+            state.items[overlap->mID] = {overlap->mStart, overlap->mEnd, 0};
+        if (itOld == mRenderAheadTrackStates.end())
         {
-            int64_t elapsedTime = (int64_t)(std::chrono::duration_cast<std::chrono::duration<double>>((PlayerClock::now()-mPlayTriggerTp)).count()*1000);
-            previewPos = mIsPreviewPlaying ? (mIsPreviewForward ? mPreviewResumePos+elapsedTime : mPreviewResumePos-elapsedTime) : mPreviewResumePos;
-            if (previewPos < 0) previewPos = 0;
+            addItemRanges(state);
+            continue;
         }
-    }
-    else
+        const auto& oldState = itOld->second;
+        if (oldState.order != state.order || oldState.type != state.type || oldState.view != state.view)
+        {
+            addItemRanges(oldState);
+            addItemRanges(state);
+            continue;
+        }
+        // a content edit may come with a structural one on the same track, so all its items are invalidated at their
+        // new place, plus the old place of the items moved or removed
+        addItemRanges(state);
+        for (const auto& elem : oldState.items)
+        {
+            auto itNewItem = state.items.find(elem.first);
+            if (itNewItem == state.items.end() || itNewItem->second.start != elem.second.start ||
+                itNewItem->second.end != elem.second.end || itNewItem->second.startOffset != elem.second.startOffset)
+                changedRanges.push_back({elem.second.start, elem.second.end});
+        }
+    }
+    // removed tracks
+    for (const auto& elem : mRenderAheadTrackStates)
+    {
+        if (newStates.find(elem.first) == newStates.end())
+            addItemRanges(elem.second);
+    }
+    const bool clearAll = mRenderAheadFullDiff;
+    mRenderAheadTrackStates = std::move(newStates);
+    mRenderAheadDirtyTrackIds.clear();
+    mRenderAheadFullDiff = false;
+
+    if (clearAll)
+    {
+        mhRenderAheadCache->Clear();
+        return;
+    }
+    for (const auto& range : changedRanges)
+    {
+        const auto startFrameIndex = mMtvReader->MillsecToFrameIndex(range.first);
+        const auto endFrameIndex = mMtvReader->MillsecToFrameIndex(range.second)+1;
+        mhRenderAheadCache->Invalidate(startFrameIndex, endFrameIndex);
+    }
+}
+
+void TimeLine::UpdateRenderAhead()
+{
+    if (!mRenderAheadEnabled)
+    {
+        if (mhRenderAheadCache)
+        {
+            mhRenderAheadCache = nullptr;
+            mRenderAheadTrackStates.clear();
+        }
+        return;
+    }
+    if (!mhRenderAheadCache)
+    {
+        mhRenderAheadCache = MEC::RenderAheadCache::CreateInstance(mRenderAheadWorkerCount, mRenderAheadMaxBytes);
+        mRenderAheadDirty = mRenderAheadFullDiff = true;
+        mRenderAheadEditTp = PlayerClock::time_point();
+    }
+    // wait for the edits to settle, so dragging a clip or a slider does not clone the readers on each frame
+    if (mRenderAheadDirty && PlayerClock::now()-mRenderAheadEditTp >= std::chrono::milliseconds(300))
+    {
+        InvalidateChangedRenderAheadRanges();
+        const auto frameRate = mhPreviewSettings->VideoOutFrameRate();
+        std::vector<MediaCore::MultiTrackVideoReader::Holder> readers;
+        for (int i = 0; i < mhRenderAheadCache->GetWorkerCount(); i++)
+            readers.push_back(mMtvReader->CloneAndConfigure(mhPreviewSettings->VideoOutWidth(), mhPreviewSettings->VideoOutHeight(), frameRate));
+        mhRenderAheadCache->SetReaders(readers);
+        mRenderAheadDirty = false;
+    }
+    const int64_t endFrameIndex = mMtvReader->MillsecToFrameIndex(ValidDuration());
+    mhRenderAheadCache->SetPlayhead(mFrameIndex, mIsPreviewForward, endFrameIndex, bSeeking || !mIsPreviewPlaying || mRenderAheadDirty || mIsEncoding);
+}
+
+int64_t TimeLine::GetRenderCacheChunkFrames()
+{
+    return std::max((int64_t)1, mMtvReader->MillsecToFrameIndex(RENDER_CACHE_CHUNK_MS));
+}
+
+uint64_t TimeLine::CalcRenderCacheKey(int64_t startFrameIndex, int64_t endFrameIndex)
+{
+    const int64_t startMs = mMtvReader->FrameIndexToMillsec(startFrameIndex);
+    const int64_t endMs = mMtvReader->FrameIndexToMillsec(endFrameIndex);
+    const auto frameRate = mhPreviewSettings->VideoOutFrameRate();
+    std::ostringstream oss;
+    oss << "render:" << startFrameIndex << "-" << endFrameIndex
+        << "|preview:" << mhPreviewSettings->VideoOutWidth() << "x" << mhPreviewSettings->VideoOutHeight() << "@" << frameRate.num << "/" << frameRate.den
+        << "," << (int)mhPreviewSettings->VideoOutColorFormat() << "," << (int)mhPreviewSettings->VideoOutDataType();
+    AppendRangeStateDesc(startMs, endMs, oss);
+    return MEC::ExportSegmentCache::Hash(oss.str());
+}
+
+bool TimeLine::StartRenderInToOut(std::string& errMsg)
+{
+    if (mIsRenderingCache)
+    {
+        errMsg = "Render in-to-out is already running!";
+        return false;
+    }
+    if (mRenderCacheThread.joinable())
+        mRenderCacheThread.join();
+    const int64_t mediaDuration = mMtvReader->Duration();
+    const int64_t startMs = mark_in >= 0 ? mark_in : 0;
+    const int64_t endMs = mark_out > 0 ? std::min(mark_out, mediaDuration) : mediaDuration;
+    if (endMs <= startMs)
+    {
+        errMsg = "NO valid range to render!";
+        return false;
+    }
+    if (!mhRenderCache)
+    {
+        std::string cacheDir;
+        if (IsProjectDirReady())
+            cacheDir = SysUtils::JoinPath(mhProject->GetProjectDir(), "RenderCache");
+        else if (!MEC::Project::GetCacheDir().empty())
+            cacheDir = SysUtils::JoinPath(MEC::Project::GetCacheDir(), "RenderCache");
+        if (cacheDir.empty())
+        {
+            errMsg = "NO cache directory is available for render in-to-out!";
+            return false;
+        }
+        mhRenderCache = MEC::ExportSegmentCache::CreateInstance(cacheDir, errMsg);
+        if (!mhRenderCache)
+            return false;
+    }
+
+    // chunks are aligned to a fixed grid, so the same chunk keeps its key whatever range is marked
+    const int64_t chunkFrames = GetRenderCacheChunkFrames();
+    const int64_t startFrameIndex = mMtvReader->MillsecToFrameIndex(startMs);
+    const int64_t endFrameIndex = mMtvReader->MillsecToFrameIndex(endMs);
+    const int64_t mediaEndFrameIndex = mMtvReader->MillsecToFrameIndex(mediaDuration);
+    std::vector<RenderCacheChunk> chunks;
+    for (int64_t i = startFrameIndex/chunkFrames*chunkFrames; i < endFrameIndex; i += chunkFrames)
+    {
+        RenderCacheChunk chunk;
+        chunk.startFrameIndex = i;
+        chunk.endFrameIndex = std::min(i+chunkFrames, mediaEndFrameIndex);
+        chunk.key = CalcRenderCacheKey(chunk.startFrameIndex, chunk.endFrameIndex);
+        std::string chunkPath;
+        chunk.rendered = mhRenderCache->Lookup(chunk.key, ".mov", chunkPath);
+        chunks.push_back(chunk);
+    }
+    {
+        std::lock_guard<std::mutex> lk(mRenderCacheLock);
+        for (const auto& chunk : chunks)
+        {
+            auto iter = std::find_if(mRenderCacheChunks.begin(), mRenderCacheChunks.end(), [&chunk] (const auto& elem) {
+                return elem.startFrameIndex == chunk.startFrameIndex;
+            });
+            if (iter != mRenderCacheChunks.end())
+                *iter = chunk;
+            else
+                mRenderCacheChunks.push_back(chunk);
+        }
+        std::sort(mRenderCacheChunks.begin(), mRenderCacheChunks.end(), [] (const auto& a, const auto& b) {
+            return a.startFrameIndex < b.startFrameIndex;
+        });
+        mRenderCacheReaders.clear();
+    }
+
+    // intra-frame only, so any frame can be decoded without its neighbours
+    VideoEncoderParams vidEncParams;
+    vidEncParams.codecName = "mjpeg";
+    vidEncParams.width = mhPreviewSettings->VideoOutWidth();
+    vidEncParams.height = mhPreviewSettings->VideoOutHeight();
+    vidEncParams.frameRate = mhPreviewSettings->VideoOutFrameRate();
+    vidEncParams.bitRate = (uint64_t)vidEncParams.width*vidEncParams.height*vidEncParams.frameRate.num/vidEncParams.frameRate.den*2;
+    auto hReader = mMtvReader->CloneAndConfigure(vidEncParams.width, vidEncParams.height, vidEncParams.frameRate);
+    {
+        std::lock_guard<std::mutex> lk(mRenderCacheErrLock);
+        mRenderCacheErrMsg.clear();
+    }
+    mRenderCacheProgress = 0;
+    mQuitRenderCache = false;
+    mIsRenderingCache = true;
+    mRenderCacheThread = std::thread(&TimeLine::_RenderCacheProc, this, hReader, vidEncParams, chunks);
+    SysUtils::SetThreadName(mRenderCacheThread, "TL-RenderCache");
+    return true;
+}
+
+void TimeLine::StopRenderInToOut()
+{
+    mQuitRenderCache = true;
+    if (mRenderCacheThread.joinable())
+        mRenderCacheThread.join();
+    mIsRenderingCache = false;
+    if (mRenderCacheOpenThread.joinable())
+        mRenderCacheOpenThread.join();
+}
+
+void TimeLine::ClearRenderInToOut()
+{
+    StopRenderInToOut();
+    std::lock_guard<std::mutex> lk(mRenderCacheLock);
+    mRenderCacheChunks.clear();
+    mRenderCacheReaders.clear();
+    mRenderCacheKeysDirty = false;
+}
+
+void TimeLine::UpdateRenderCacheKeys()
+{
+    std::lock_guard<std::mutex> lk(mRenderCacheLock);
+    for (auto& chunk : mRenderCacheChunks)
+    {
+        chunk.key = CalcRenderCacheKey(chunk.startFrameIndex, chunk.endFrameIndex);
+        std::string chunkPath;
+        // an undone edit finds its earlier render again
+        chunk.rendered = mhRenderCache && mhRenderCache->Lookup(chunk.key, ".mov", chunkPath);
+    }
+    mRenderCacheReaders.clear();
+    mRenderCacheKeysDirty = false;
+}
+
+bool TimeLine::ReadRenderCacheFrame(int64_t frameIndex, ImGui::ImMat& vmat)
+{
+    if (!mhRenderCache || mRenderCacheKeysDirty)
+        return false;
+    MediaCore::MediaReader::Holder hReader;
+    int64_t chunkStartFrameIndex;
+    std::vector<RenderCacheChunk> toOpen;
+    std::vector<MediaCore::MediaReader::Holder> staleReaders;
+    {
+        std::lock_guard<std::mutex> lk(mRenderCacheLock);
+        auto iter = std::upper_bound(mRenderCacheChunks.begin(), mRenderCacheChunks.end(), frameIndex, [] (int64_t idx, const RenderCacheChunk& chunk) {
+            return idx < chunk.startFrameIndex;
+        });
+        if (iter == mRenderCacheChunks.begin())
+            return false;
+        iter--;
+        if (frameIndex >= iter->endFrameIndex || !iter->rendered)
+            return false;
+        chunkStartFrameIndex = iter->startFrameIndex;
+        auto itReader = mRenderCacheReaders.find(chunkStartFrameIndex);
+        if (itReader != mRenderCacheReaders.end())
+            hReader = itReader->second;
+        else
+            toOpen.push_back(*iter);
+        // also open the next chunk in play direction, so crossing a chunk border doesn't wait for a file to open
+        int64_t nextChunkStart = -1;
+        auto itNext = mIsPreviewForward ? iter+1 : (iter == mRenderCacheChunks.begin() ? mRenderCacheChunks.end() : iter-1);
+        if (itNext != mRenderCacheChunks.end() && itNext->rendered)
+        {
+            nextChunkStart = itNext->startFrameIndex;
+            if (mRenderCacheReaders.find(nextChunkStart) == mRenderCacheReaders.end())
+                toOpen.push_back(*itNext);
+        }
+        if (!toOpen.empty() && !mIsOpeningRenderCache)
+        {
+            for (itReader = mRenderCacheReaders.begin(); itReader != mRenderCacheReaders.end();)
+            {
+                if (itReader->first != chunkStartFrameIndex && itReader->first != nextChunkStart)
+                {
+                    staleReaders.push_back(itReader->second);
+                    itReader = mRenderCacheReaders.erase(itReader);
+                }
+                else
+                    itReader++;
+            }
+        }
+        else
+            toOpen.clear();
+    }
+    // the chunk files are opened and closed on the 'TL-RCacheOpen' thread, until then the frame is composed live
+    if (!toOpen.empty())
+    {
+        if (mRenderCacheOpenThread.joinable())
+            mRenderCacheOpenThread.join();
+        mIsOpeningRenderCache = true;
+        mRenderCacheOpenThread = std::thread(&TimeLine::_OpenRenderCacheReadersProc, this, std::move(toOpen), std::move(staleReaders));
+        SysUtils::SetThreadName(mRenderCacheOpenThread, "TL-RCacheOpen");
+    }
+    if (!hReader)
+        return false;
+
+    const int64_t posInChunk = mMtvReader->FrameIndexToMillsec(frameIndex)-mMtvReader->FrameIndexToMillsec(chunkStartFrameIndex);
+    bool eof = false;
+    auto hVf = hReader->ReadVideoFrame(posInChunk, eof, !mIsPreviewPlaying);
+    if (!hVf)
+        return false;
+    hVf->GetMat(vmat);
+    if (vmat.empty())
+        return false;
+    vmat.time_stamp = (double)mMtvReader->FrameIndexToMillsec(frameIndex)/1000.;
+    return true;
+}
+
+void TimeLine::_OpenRenderCacheReadersProc(std::vector<RenderCacheChunk> chunks, std::vector<MediaCore::MediaReader::Holder> staleReaders)
+{
+    for (auto& hReader : staleReaders)
+        hReader->Close();
+    staleReaders.clear();
+    for (const auto& chunk : chunks)
+    {
+        if (mQuitRenderCache)
+            break;
+        std::string chunkPath;
+        MediaCore::MediaReader::Holder hReader;
+        if (mhRenderCache->Lookup(chunk.key, ".mov", chunkPath))
+        {
+            auto hParser = MediaCore::MediaParser::CreateInstance();
+            hReader = MediaCore::MediaReader::CreateVideoInstance();
+            if (!hParser->Open(chunkPath) || !hReader->Open(hParser) ||
+                !hReader->ConfigVideoReader(1.f, 1.f, mhPreviewSettings->VideoOutColorFormat(), mhPreviewSettings->VideoOutDataType(), IM_INTERPOLATE_AREA, mhMediaSettings->GetHwaccelManager()) ||
+                !hReader->Start())
+            {
+                Logger::Log(Logger::WARN) << "FAILED to open render cache file '" << chunkPath << "'! " << hReader->GetError() << std::endl;
+                hReader = nullptr;
+            }
+        }
+        MediaCore::MediaReader::Holder hUnusedReader;
+        {
+            std::lock_guard<std::mutex> lk(mRenderCacheLock);
+            auto iter = std::find_if(mRenderCacheChunks.begin(), mRenderCacheChunks.end(), [&chunk] (const auto& elem) {
+                return elem.startFrameIndex == chunk.startFrameIndex && elem.key == chunk.key;
+            });
+            // the chunk is changed while opening its file
+            if (iter == mRenderCacheChunks.end())
+                hUnusedReader = hReader;
+            else if (hReader)
+                mRenderCacheReaders[chunk.startFrameIndex] = hReader;
+            else
+                iter->rendered = false;
+        }
+        if (hUnusedReader)
+            hUnusedReader->Close();
+    }
+    mIsOpeningRenderCache = false;
+}
+
+void TimeLine::_RenderCacheProc(MediaCore::MultiTrackVideoReader::Holder hReader, VideoEncoderParams vidEncParams, std::vector<RenderCacheChunk> chunks)
+{
+    Logger::Log(Logger::DEBUG) << "Enter _RenderCacheProc()..." << std::endl;
+    int64_t totalFrames = 0, renderedFrames = 0;
+    for (const auto& chunk : chunks)
+    {
+        if (!chunk.rendered)
+            totalFrames += chunk.endFrameIndex-chunk.startFrameIndex;
+    }
+    // the chunk files are read by position, an empty frame is written as a blank one of the same format, so the frames
+    // after it keep their position in the file
+    auto makeBlankFrame = [] (const ImGui::ImMat& tmpl, double timestamp) {
+        ImGui::ImMat blank;
+        blank.create_type(tmpl.w, tmpl.h, tmpl.c, tmpl.type);
+        blank.fill((int8_t)0);
+        blank.elempack = tmpl.elempack;
+        blank.color_format = tmpl.color_format;
+        blank.color_space = tmpl.color_space;
+        blank.color_range = tmpl.color_range;
+        blank.time_stamp = timestamp;
+        return blank;
+    };
+    std::string errMsg;
+    hReader->SetCacheFrameNum(8);
+    for (const auto& chunk : chunks)
+    {
+        if (mQuitRenderCache || !errMsg.empty())
+            break;
+        if (chunk.rendered)
+            continue;
+        const auto renderingPath = mhRenderCache->GetSegmentPath(chunk.key, ".rendering.mov");
+        auto hEncoder = MediaCore::MediaEncoder::CreateInstance();
+        if (!hEncoder->Open(renderingPath) ||
+            !hEncoder->ConfigureVideoStream(vidEncParams.codecName, vidEncParams.imageFormat, vidEncParams.width, vidEncParams.height,
+                vidEncParams.frameRate, vidEncParams.bitRate, &vidEncParams.extraOpts) ||
+            !hEncoder->Start())
+        {
+            errMsg = hEncoder->GetError();
+            break;
+        }
+        const int64_t chunkStartMs = hReader->FrameIndexToMillsec(chunk.startFrameIndex);
+        hReader->SeekTo(chunkStartMs);
+        std::vector<double> pendingBlanks;     // timestamps of the empty frames before the first non-empty one
+        ImGui::ImMat lastFrame;
+        bool encodedAny = false;
+        for (int64_t frameIndex = chunk.startFrameIndex; frameIndex < chunk.endFrameIndex && !mQuitRenderCache; frameIndex++)
+        {
+            ImGui::ImMat vmat;
+            if (!hReader->ReadVideoFrameByIdx(frameIndex, vmat))
+            {
+                errMsg = hReader->GetError();
+                break;
+            }
+            renderedFrames++;
+            mRenderCacheProgress = (float)renderedFrames/totalFrames;
+            const double timestamp = (double)(hReader->FrameIndexToMillsec(frameIndex)-chunkStartMs)/1000.;
+            if (vmat.empty())
+            {
+                if (lastFrame.empty())
+                {
+                    pendingBlanks.push_back(timestamp);
+                    continue;
+                }
+                vmat = makeBlankFrame(lastFrame, timestamp);
+            }
+            else
+            {
+                lastFrame = vmat;
+                for (auto blankTs : pendingBlanks)
+                {
+                    ImGui::ImMat blank = makeBlankFrame(vmat, blankTs);
+                    bool consumed = false;
+                    if (!hEncoder->EncodeVideoFrame(blank, consumed))
+                    {
+                        errMsg = hEncoder->GetError();
+                        break;
+                    }
+                }
+                pendingBlanks.clear();
+                if (!errMsg.empty())
+                    break;
+            }
+            vmat.time_stamp = timestamp;
+            bool consumed = false;
+            if (!hEncoder->EncodeVideoFrame(vmat, consumed))
+            {
+                errMsg = hEncoder->GetError();
+                break;
+            }
+            encodedAny = true;
+        }
+        if (!mQuitRenderCache && errMsg.empty())
+        {
+            ImGui::ImMat vmat;
+            bool consumed = false;
+            if (!hEncoder->EncodeVideoFrame(vmat, consumed) || !hEncoder->FinishEncoding())
+                errMsg = hEncoder->GetError();
+        }
+        hEncoder->Close();
+        if (!encodedAny && errMsg.empty() && !mQuitRenderCache)
+            Logger::Log(Logger::DEBUG) << "Render cache chunk [" << chunk.startFrameIndex << ", " << chunk.endFrameIndex << ") has no frame, it's composed live." << std::endl;
+        std::string chunkPath;
+        if (mQuitRenderCache || !errMsg.empty() || !encodedAny || !mhRenderCache->Commit(chunk.key, ".mov", renderingPath, chunkPath))
+        {
+            SysUtils::DeleteFileAt(renderingPath);
+            continue;
+        }
+        std::lock_guard<std::mutex> lk(mRenderCacheLock);
+        for (auto& elem : mRenderCacheChunks)
+        {
+            if (elem.startFrameIndex == chunk.startFrameIndex && elem.key == chunk.key)
+                elem.rendered = true;
+        }
+    }
+    if (!errMsg.empty())
+        Logger::Log(Logger::Error) << "Render in-to-out FAILED! " << errMsg << std::endl;
+    else if (!mQuitRenderCache)
+        mRenderCacheProgress = 1;
+    {
+        std::lock_guard<std::mutex> lk(mRenderCacheErrLock);
+        mRenderCacheErrMsg = errMsg;
+    }
+    mhRenderCache->Trim(mRenderCacheMaxBytes);
+    mIsRenderingCache = false;
+    Logger::Log(Logger::DEBUG) << "Leave _RenderCacheProc()." << std::endl;
+}
+
+std::vector<MediaCore::CorrelativeFrame> TimeLine::GetPreviewFrame(bool blocking, bool useRenderAhead)
+{
+    SyncAudioTrackScopes();
+    int64_t auddataPos, previewPos;
+    if (!bSeeking)
+    {
+        if (mPcmStream.GetTimestampMs(auddataPos))
+        {
+            int64_t bufferedDur = mAudioRender ? mMtaReader->SizeToDuration(mAudioRender->GetBufferedDataSize()) : 0;
+            previewPos = mIsPreviewForward ? auddataPos-bufferedDur : auddataPos+bufferedDur;
+            if (previewPos < 0) previewPos = 0;
+        }
+        else
+        {
+            int64_t elapsedTime = (int64_t)(std::chrono::duration_cast<std::chrono::duration<double>>((PlayerClock::now()-mPlayTriggerTp)).count()*1000);
+            previewPos = mIsPreviewPlaying ? (mIsPreviewForward ? mPreviewResumePos+elapsedTime : mPreviewResumePos-elapsedTime) : mPreviewResumePos;
+            if (previewPos < 0) previewPos = 0;
+        }
+    }
+    else
     {
         previewPos = mCurrentTime;
     }
@@ -6908,17 +7882,40 @@ std::vector<MediaCore::CorrelativeFrame> TimeLine::GetPreviewFrame(bool blocking
     }
 
     std::vector<MediaCore::CorrelativeFrame> frames;
-    const bool needPreciseFrame = !(bSeeking || mIsPreviewPlaying);
-    mMtvReader->ReadVideoFrameByIdxEx(mFrameIndex, frames, !blocking, needPreciseFrame);
+    ImGui::ImMat cachedFrame;
+    if (useRenderAhead)
+    {
+        UpdateAdaptivePreview();
+        UpdateRenderAhead();
+        if (mRenderCacheKeysDirty && PlayerClock::now()-mRenderAheadEditTp >= std::chrono::milliseconds(300))
+            UpdateRenderCacheKeys();
+    }
+    if (useRenderAhead && !bSeeking && (ReadRenderCacheFrame(mFrameIndex, cachedFrame) ||
+        (mhRenderAheadCache && !mRenderAheadDirty && mhRenderAheadCache->GetFrame(mFrameIndex, cachedFrame))))
+    {
+        // only the mixed frame is cached, the editing windows which need the other phases don't use render-ahead
+        MediaCore::CorrelativeFrame cf;
+        cf.phase = MediaCore::CorrelativeFrame::PHASE_AFTER_MIXING;
+        cf.frame = cachedFrame;
+        frames.push_back(cf);
+    }
+    else
+    {
+        const bool needPreciseFrame = !(bSeeking || mIsPreviewPlaying);
+        const auto composeTp = PlayerClock::now();
+        mMtvReader->ReadVideoFrameByIdxEx(mFrameIndex, frames, !blocking, needPreciseFrame);
+        if (useRenderAhead)
+            MeasureAdaptivePreview(frames, std::chrono::duration_cast<std::chrono::microseconds>(PlayerClock::now()-composeTp).count());
+    }
     mCurrentTime = mMtvReader->FrameIndexToMillsec(mFrameIndex);
     if (mIsPreviewPlaying && !ImGui::IsMouseDragging(ImGuiMouseButton_Left)) UpdateCurrent();
     return frames;
 }
 
-bool TimeLine::UpdatePreviewTexture(bool blocking)
+bool TimeLine::UpdatePreviewTexture(bool blocking, bool useRenderAhead)
 {
     bool bTxUpdated = false;
-    maCurrFrames = GetPreviewFrame(blocking);
+    maCurrFrames = GetPreviewFrame(blocking, useRenderAhead);
     if (maCurrFrames.empty())
         return bTxUpdated;
     int preview_index = -1;
@@ -6959,12 +7956,7 @@ void TimeLine::SetAudioLevel(int channel, float level)
 
 int TimeLine::GetSelectedClipCount()
 {
-    int count = 0;
-    for (auto clip : m_Clips)
-    {
-        if (clip->bSelected) count++;
-    }
-    return count;
+    return mSelectedClipCount;
 }
 
 void TimeLine::Play(bool play, bool forward)
@@ -6985,6 +7977,8 @@ void TimeLine::Play(bool play, bool forward)
         }
         mMtvReader->SetDirection(forward, mCurrentTime);
         mMtaReader->SetDirection(forward, mCurrentTime);
+        // drop the samples mixed ahead in the old direction
+        mPcmStream.Flush();
         mIsPreviewForward = forward;
         mPlayTriggerTp = PlayerClock::now();
         mPreviewResumePos = mCurrentTime;
@@ -6995,8 +7989,8 @@ void TimeLine::Play(bool play, bool forward)
     }
     if (needSeekAudio && mAudioRender)
     {
-        mAudioRender->Flush();
         mMtaReader->SeekTo(mCurrentTime);
+        mAudioRender->Flush();
     }
     if (play != mIsPreviewPlaying)
     {
@@ -7011,6 +8005,7 @@ void TimeLine::Play(bool play, bool forward)
         {
             mLastFrameTime = -1;
             mPreviewResumePos = mCurrentTime;
+            mPreviewAdaptiveRestore = true;
             if (mAudioRender)
                 mAudioRender->Pause();
             for (int i = 0; i < mAudioAttribute.channel_data.size(); i++) SetAudioLevel(i, 0);
@@ -7032,6 +8027,9 @@ void TimeLine::Seek(int64_t msPos, bool enterSeekingState)
             mAudioRender->Resume();
     }
 
+    // a loop restart seeks during playback, keep the lowered preview scale then
+    if (bSeeking || !mIsPreviewPlaying)
+        mPreviewAdaptiveRestore = true;
     auto targetFrameIndex = mMtvReader->MillsecToFrameIndex(msPos, 1);
     if (targetFrameIndex == mFrameIndex)
     {
@@ -7052,7 +8050,8 @@ void TimeLine::Seek(int64_t msPos, bool enterSeekingState)
         mPlayTriggerTp = PlayerClock::now();
         mMtaReader->SeekTo(msPos, false);
         mMtvReader->SeekToByIdx(mFrameIndex);
-        mAudioRender->Flush();
+        if (mAudioRender)
+            mAudioRender->Flush();
         mPreviewResumePos = mCurrentTime;
     }
 }
@@ -7087,6 +8086,7 @@ void TimeLine::StopSeek()
 
 void TimeLine::Step(bool forward)
 {
+    mPreviewAdaptiveRestore = true;
     if (mIsPreviewPlaying)
     {
         mIsPreviewPlaying = false;
@@ -7177,13 +8177,7 @@ MediaItem* TimeLine::FindMediaItemByName(std::string name)
 
 MediaItem* TimeLine::FindMediaItemByID(int64_t id)
 {
-    auto iter = std::find_if(media_items.begin(), media_items.end(), [id](const MediaItem* item)
-    {
-        return item->mID == id;
-    });
-    if (iter != media_items.end())
-        return *iter;
-    return nullptr;
+    return mMediaItemIndex.Find(media_items, id);
 }
 
 void TimeLine::SortMediaItemByID()
@@ -7221,27 +8215,29 @@ void TimeLine::FilterMediaItemByType(uint32_t mediaType)
 
 MediaTrack * TimeLine::FindTrackByID(int64_t id)
 {
-    auto iter = std::find_if(m_Tracks.begin(), m_Tracks.end(), [id](const MediaTrack* track)
-    {
-        return track->mID == id;
-    });
-    if (iter != m_Tracks.end())
-        return *iter;
-    return nullptr;
+    return mTrackIndex.Find(m_Tracks, id);
 }
 
 MediaTrack * TimeLine::FindTrackByClipID(int64_t id)
 {
-    auto iter = std::find_if(m_Tracks.begin(), m_Tracks.end(), [id](const MediaTrack* track)
+    auto iter = mClipTrackIndex.find(id);
+    if (iter != mClipTrackIndex.end())
+    {
+        auto track = FindTrackByID(iter->second);
+        if (track && track->mClipIndex.Find(track->m_Clips, id))
+            return track;
+    }
+    // the clip is new, or it's moved to another track
+    for (auto track : m_Tracks)
     {
-        auto iter_clip = std::find_if(track->m_Clips.begin(), track->m_Clips.end(), [id](const Clip* clip)
+        if (track->mClipIndex.Find(track->m_Clips, id))
         {
-            return clip->mID == id;
-        });
-        return iter_clip != track->m_Clips.end();
-    });
-    if (iter != m_Tracks.end())
-        return *iter;
+            if (mClipTrackIndex.size() > m_Clips.size() * 2 + 64)
+                mClipTrackIndex.clear();    // drop the entries of deleted clips
+            mClipTrackIndex[id] = track->mID;
+            return track;
+        }
+    }
     return nullptr;
 }
 
@@ -7284,24 +8280,12 @@ int TimeLine::FindTrackIndexByClipID(int64_t id)
 
 Clip * TimeLine::FindClipByID(int64_t id)
 {
-    auto iter = std::find_if(m_Clips.begin(), m_Clips.end(), [id](const Clip* clip)
-    {
-        return clip->mID == id;
-    });
-    if (iter != m_Clips.end())
-        return *iter;
-    return nullptr;
+    return mClipIndex.Find(m_Clips, id);
 }
 
 Overlap * TimeLine::FindOverlapByID(int64_t id)
 {
-    auto iter = std::find_if(m_Overlaps.begin(), m_Overlaps.end(), [id](const Overlap* overlap)
-    {
-        return overlap->mID == id;
-    });
-    if (iter != m_Overlaps.end())
-        return *iter;
-    return nullptr;
+    return mOverlapIndex.Find(m_Overlaps, id);
 }
 
 Overlap * TimeLine::FindEditingOverlap()
@@ -7319,24 +8303,24 @@ int64_t TimeLine::NextClipStart(Clip * clip)
 {
     int64_t next_start = -1;
     if (!clip) return next_start;
-    auto iter = std::find_if(m_Clips.begin(), m_Clips.end(), [clip](const Clip* _clip)
+    for (auto track : m_Tracks)
     {
-        return _clip->Start() >= clip->End();
-    });
-    if (iter != m_Clips.end())
-        next_start = (*iter)->Start();
+        auto start = track->NextClipStart(clip->End(), true);
+        if (start != -1 && (next_start == -1 || start < next_start))
+            next_start = start;
+    }
     return next_start;
 }
 
 int64_t TimeLine::NextClipStart(int64_t pos)
 {
     int64_t next_start = -1;
-    auto iter = std::find_if(m_Clips.begin(), m_Clips.end(), [pos](const Clip* _clip)
+    for (auto track : m_Tracks)
     {
-        return _clip->Start() > pos;
-    });
-    if (iter != m_Clips.end())
-        next_start = (*iter)->Start();
+        auto start = track->NextClipStart(pos, false);
+        if (start != -1 && (next_start == -1 || start < next_start))
+            next_start = start;
+    }
     return next_start;
 }
 
@@ -7561,10 +8545,17 @@ void TimeLine::CustomDraw(
     auto is_control_hovered = track->DrawTrackControlBar(draw_list, legendRect, enable_select, pActionList);
     draw_list->PopClipRect();
 
+    // only the clips and overlaps around the view window are visited
+    const int64_t cullingMargin = msPixelWidthTarget > 0 ? (int64_t)(TIMELINE_CULLING_MARGIN / msPixelWidthTarget) : 0;
+    std::vector<Clip *> visibleClips;
+    std::vector<Overlap *> visibleOverlaps;
+    track->FindClipsInRange(firstTime - cullingMargin, viewEndTime + cullingMargin, visibleClips);
+    track->FindOverlapsInRange(firstTime - cullingMargin, viewEndTime + cullingMargin, visibleOverlaps);
+
     bool bOverlapHovered = false;
     if (clippingRect.Contains(io.MousePos))
     {
-        for (auto overlap : track->m_Overlaps)
+        for (auto overlap : visibleOverlaps)
         {
             if (overlap->mStart <= mouse_time && overlap->mEnd >= mouse_time)
             {
@@ -7575,7 +8566,7 @@ void TimeLine::CustomDraw(
     }
 
     // draw clips
-    for (auto clip : track->m_Clips)
+    for (auto clip : visibleClips)
     {
         clip->SetViewWindowStart(firstTime);
         bool draw_clip = false;
@@ -7759,7 +8750,7 @@ void TimeLine::CustomDraw(
     }
 
     // draw overlap
-    for (auto overlap : track->m_Overlaps)
+    for (auto overlap : visibleOverlaps)
     {
         bool draw_overlap = false;
         float cursor_start = 0;
@@ -8021,7 +9012,8 @@ int TimeLine::Load(const imgui_json::value& value)
         throw std::runtime_error("UNSUPPORTED audio render format!");
     mhMediaSettings->SetAudioOutDataType(pcmDataType);
     mhPreviewSettings->SyncVideoSettingsFrom(mhMediaSettings.get());
-    auto previewSize = CalcPreviewSize({(int32_t)mhMediaSettings->VideoOutWidth(), (int32_t)mhMediaSettings->VideoOutHeight()}, mPreviewScale);
+    mPreviewAppliedScale = CalcAppliedPreviewScale(mPreviewScale, {(int32_t)mhMediaSettings->VideoOutWidth(), (int32_t)mhMediaSettings->VideoOutHeight()});
+    auto previewSize = CalcPreviewSize({(int32_t)mhMediaSettings->VideoOutWidth(), (int32_t)mhMediaSettings->VideoOutHeight()}, mPreviewAppliedScale);
     mhPreviewSettings->SetVideoOutWidth(previewSize.x);
     mhPreviewSettings->SetVideoOutHeight(previewSize.y);
     mhPreviewSettings->SyncAudioSettingsFrom(mhMediaSettings.get());
@@ -8030,9 +9022,10 @@ int TimeLine::Load(const imgui_json::value& value)
     tTxPoolAttrs.tTxSize = previewSize;
     mTxMgr->SetTexturePoolAttributes(PREVIEW_TEXTURE_POOL_NAME, tTxPoolAttrs);
     mhPreviewTx = mTxMgr->GetTextureFromPool(PREVIEW_TEXTURE_POOL_NAME);
-    mAudioRender->CloseDevice();
+    if (mAudioRender)
+        mAudioRender->CloseDevice();
     mPcmStream.Flush();
-    if (!mAudioRender->OpenDevice(mhPreviewSettings->AudioOutSampleRate(), mhPreviewSettings->AudioOutChannels(), mAudioRenderFormat, &mPcmStream))
+    if (mAudioRender && !mAudioRender->OpenDevice(mhPreviewSettings->AudioOutSampleRate(), mhPreviewSettings->AudioOutChannels(), mAudioRenderFormat, &mPcmStream))
         throw std::runtime_error("FAILED to open audio render device!");
     mAudioAttribute.channel_data.clear();
     mAudioAttribute.channel_data.resize(mhMediaSettings->AudioOutChannels());
@@ -8589,6 +9582,19 @@ void TimeLine::PerformUiActions()
         if (action["action"].get<imgui_json::string>() == "BP_OPERATION")
             continue;
 
+        // only the tracks touched by the actions need to be checked by SyncDataLayer()
+        bool hasTrackId = false;
+        for (auto key : {"track_id", "from_track_id", "to_track_id"})
+        {
+            if (action.contains(key) && action[key].is_number())
+            {
+                mSyncDirtyTracks.insert((int64_t)action[key].get<imgui_json::number>());
+                hasTrackId = true;
+            }
+        }
+        if (!hasTrackId)
+            mSyncAllTracks = true;
+
         uint32_t mediaType = MEDIA_UNKNOWN;
         if (action.contains("media_type"))
             mediaType = action["media_type"].get<imgui_json::number>();
@@ -9152,8 +10158,56 @@ void TimeLine::ConfigureDataLayer()
     mPcmStream.SetAudioReader(mMtaReader);
 }
 
+struct ClipPairHash
+{
+    size_t operator()(const std::pair<int64_t, int64_t>& p) const
+    {
+        return std::hash<int64_t>()(p.first) ^ (std::hash<int64_t>()(p.second) * 0x9e3779b97f4a7c15ULL);
+    }
+};
+
 void TimeLine::SyncDataLayer(bool forceRefresh)
 {
+    // only the tracks touched by the performed actions are checked, unless it's a forced refresh
+    const bool syncAll = forceRefresh || mSyncAllTracks;
+    auto needSync = [&] (int64_t trackId) {
+        return syncAll || mSyncDirtyTracks.find(trackId) != mSyncDirtyTracks.end();
+    };
+    // ui overlaps by the IDs of their clips, built when the first data layer overlap is checked
+    std::unordered_map<std::pair<int64_t, int64_t>, Overlap*, ClipPairHash> overlapsByClips;
+    auto findOverlap = [&] (int64_t frontClipId, int64_t rearClipId) -> Overlap* {
+        if (overlapsByClips.empty())
+        {
+            for (auto ovlp : m_Overlaps)
+                overlapsByClips.emplace(std::minmax(ovlp->m_Clip.first, ovlp->m_Clip.second), ovlp);
+        }
+        auto iter = overlapsByClips.find(std::minmax(frontClipId, rearClipId));
+        return iter != overlapsByClips.end() ? iter->second : nullptr;
+    };
+    // the transition set before is reused as long as the overlap blueprint is the same
+    auto getSyncedTransition = [&] (Overlap* ovlp, bool isVideo) -> SyncedTransition& {
+        auto& synced = mSyncedTransitions[ovlp->mID];
+        auto bpJson = ovlp->mTransitionBP.dump();
+        if (synced.strBluePrint != bpJson)
+        {
+            synced = SyncedTransition();
+            synced.strBluePrint = bpJson;
+        }
+        if (isVideo && !synced.hVideoTransition)
+        {
+            BluePrintVideoTransition* bpvt = new BluePrintVideoTransition(this);
+            bpvt->SetBluePrintFromJson(ovlp->mTransitionBP);
+            synced.hVideoTransition = MediaCore::VideoTransition::Holder(bpvt);
+        }
+        if (!isVideo && !synced.hAudioTransition)
+        {
+            BluePrintAudioTransition* bpat = new BluePrintAudioTransition(this);
+            bpat->SetBluePrintFromJson(ovlp->mTransitionBP);
+            synced.hAudioTransition = MediaCore::AudioTransition::Holder(bpat);
+        }
+        return synced;
+    };
+
     // video overlap
     int syncedOverlapCount = 0;
     bool needUpdatePreview = false;
@@ -9162,6 +10216,11 @@ void TimeLine::SyncDataLayer(bool forceRefresh)
     while (vidTrackIter != mMtvReader->TrackListEnd())
     {
         auto& vidTrack = *vidTrackIter++;
+        if (!needSync(vidTrack->Id()))
+        {
+            syncedOverlapCount += vidTrack->GetOverlapList().size();
+            continue;
+        }
         vidTrack->UpdateClipState();
         auto ovlpList = vidTrack->GetOverlapList();
         auto ovlpIter = ovlpList.begin();
@@ -9170,31 +10229,23 @@ void TimeLine::SyncDataLayer(bool forceRefresh)
             auto& vidOvlp = *ovlpIter++;
             const int64_t frontClipId = vidOvlp->FrontClip()->Id();
             const int64_t rearClipId = vidOvlp->RearClip()->Id();
-            bool found = false;
-            for (auto ovlp : m_Overlaps)
+            auto ovlp = findOverlap(frontClipId, rearClipId);
+            if (!ovlp)
             {
-                if ((ovlp->m_Clip.first == frontClipId && ovlp->m_Clip.second == rearClipId) ||
-                    (ovlp->m_Clip.first == rearClipId && ovlp->m_Clip.second == frontClipId))
-                {
-                    if (vidOvlp->Id() != ovlp->mID)
-                    {
-                        vidOvlp->SetId(ovlp->mID);
-                        BluePrintVideoTransition* bpvt = new BluePrintVideoTransition(this);
-                        bpvt->SetBluePrintFromJson(ovlp->mTransitionBP);
-                        bpvt->SetKeyPoint(ovlp->mTransitionKeyPoints);
-                        MediaCore::VideoTransition::Holder hTrans(bpvt);
-                        vidOvlp->SetTransition(hTrans);
-                        needUpdatePreview = true;
-                    }
-                    found = true;
-                    break;
-                }
-            }
-            if (!found)
                 Logger::Log(Logger::Error) << "CANNOT find matching video OVERLAP! Front clip id is " << frontClipId
                     << ", rear clip id is " << rearClipId << "." << std::endl;
-            else
-                syncedOverlapCount++;
+                continue;
+            }
+            if (vidOvlp->Id() != ovlp->mID)
+            {
+                vidOvlp->SetId(ovlp->mID);
+                auto& synced = getSyncedTransition(ovlp, true);
+                auto bpvt = dynamic_cast<BluePrintVideoTransition*>(synced.hVideoTransition.get());
+                if (bpvt) bpvt->SetKeyPoint(ovlp->mTransitionKeyPoints);
+                vidOvlp->SetTransition(synced.hVideoTransition);
+                needUpdatePreview = true;
+            }
+            syncedOverlapCount++;
         }
     }
     // audio overlap
@@ -9202,39 +10253,38 @@ void TimeLine::SyncDataLayer(bool forceRefresh)
     while (audTrackIter != mMtaReader->TrackListEnd())
     {
         auto& audTrack = *audTrackIter++;
+        if (!needSync(audTrack->Id()))
+        {
+            syncedOverlapCount += std::distance(audTrack->OverlapListBegin(), audTrack->OverlapListEnd());
+            continue;
+        }
         auto ovlpIter = audTrack->OverlapListBegin();
         while (ovlpIter != audTrack->OverlapListEnd())
         {
             auto& audOvlp = *ovlpIter++;
             const int64_t frontClipId = audOvlp->FrontClip()->Id();
             const int64_t rearClipId = audOvlp->RearClip()->Id();
-            bool found = false;
-            for (auto ovlp : m_Overlaps)
+            auto ovlp = findOverlap(frontClipId, rearClipId);
+            if (!ovlp)
             {
-                if ((ovlp->m_Clip.first == frontClipId && ovlp->m_Clip.second == rearClipId) ||
-                    (ovlp->m_Clip.first == rearClipId && ovlp->m_Clip.second == frontClipId))
-                {
-                    if (audOvlp->Id() != ovlp->mID)
-                    {
-                        audOvlp->SetId(ovlp->mID);
-                        BluePrintAudioTransition* bpat = new BluePrintAudioTransition(this);
-                        bpat->SetBluePrintFromJson(ovlp->mTransitionBP);
-                        bpat->SetKeyPoint(ovlp->mTransitionKeyPoints);
-                        MediaCore::AudioTransition::Holder hTrans(bpat);
-                        audOvlp->SetTransition(hTrans);
-                        needRefreshAudio = true;
-                    }
-                    found = true;
-                    break;
-                }
-            }
-            if (!found)
                 Logger::Log(Logger::Error) << "CANNOT find matching audio OVERLAP! Front clip id is " << frontClipId
                     << ", rear clip id is " << rearClipId << "." << std::endl;
-            else
-                syncedOverlapCount++;
+                continue;
+            }
+            if (audOvlp->Id() != ovlp->mID)
+            {
+                audOvlp->SetId(ovlp->mID);
+                auto& synced = getSyncedTransition(ovlp, false);
+                auto bpat = dynamic_cast<BluePrintAudioTransition*>(synced.hAudioTransition.get());
+                if (bpat) bpat->SetKeyPoint(ovlp->mTransitionKeyPoints);
+                audOvlp->SetTransition(synced.hAudioTransition);
+                needRefreshAudio = true;
+            }
+            syncedOverlapCount++;
         }
     }
+    mSyncDirtyTracks.clear();
+    mSyncAllTracks = false;
     if (needUpdatePreview || forceRefresh)
         RefreshPreview();
     if (needRefreshAudio || forceRefresh)
@@ -9265,10 +10315,13 @@ MediaCore::Snapshot::Generator::Holder TimeLine::GetSnapshotGenerator(int64_t me
         return nullptr;
     if (!IS_VIDEO(mi->mMediaType) || IS_IMAGE(mi->mMediaType))
         return nullptr;
+    auto hOverview = mi->GetOverview();
+    if (!hOverview)
+        return nullptr;
     MediaCore::Snapshot::Generator::Holder hSsGen = MediaCore::Snapshot::Generator::CreateInstance();
-    hSsGen->SetOverview(mi->mMediaOverview);
+    hSsGen->SetOverview(hOverview);
     hSsGen->EnableHwAccel(mHardwareCodec);
-    if (!hSsGen->Open(mi->mMediaOverview->GetMediaParser(), mhMediaSettings->VideoOutFrameRate()))
+    if (!hSsGen->Open(hOverview->GetMediaParser(), mhMediaSettings->VideoOutFrameRate()))
     {
         Logger::Log(Logger::Error) << hSsGen->GetError() << std::endl;
         return nullptr;
@@ -9280,7 +10333,7 @@ MediaCore::Snapshot::Generator::Holder TimeLine::GetSnapshotGenerator(int64_t me
     }
     else
     {
-        auto video_info = mi->mMediaOverview->GetMediaParser()->GetBestVideoStream();
+        auto video_info = hOverview->GetMediaParser()->GetBestVideoStream();
         float snapshot_scale = video_info->height > 0 ? DEFAULT_VIDEO_TRACK_HEIGHT / (float)video_info->height : 0.05;
         hSsGen->SetSnapshotResizeFactor(snapshot_scale, snapshot_scale);
     }
@@ -9349,10 +10402,120 @@ MatUtils::Size2i TimeLine::CalcPreviewSize(const MatUtils::Size2i& videoSize, fl
     return {previewWidth, previewHeight};
 }
 
+static const float PREVIEW_ADAPTIVE_STEPS[] = {1.f, 0.75f, 0.5f, 0.35f, 0.25f};
+
+float TimeLine::CalcAppliedPreviewScale(float previewScale, const MatUtils::Size2i& videoSize)
+{
+    if (!mPreviewAdaptive)
+        return previewScale;
+    float scale = previewScale*PREVIEW_ADAPTIVE_STEPS[mPreviewAdaptiveLevel];
+    // no need to compose more pixels than the preview window shows, but the magnifier shows them all
+    if (!bPreviewZoom && mPreviewViewportSize.x > 0 && mPreviewViewportSize.y > 0 && videoSize.x > 0 && videoSize.y > 0)
+        scale = std::min(scale, std::min(mPreviewViewportSize.x/videoSize.x, mPreviewViewportSize.y/videoSize.y));
+    return std::max(scale, 0.02f);
+}
+
+void TimeLine::SetPreviewViewportSize(const ImVec2& size)
+{
+    if (fabs(size.x-mPreviewViewportSize.x) < 1 && fabs(size.y-mPreviewViewportSize.y) < 1)
+        return;
+    mPreviewViewportSize = size;
+    mPreviewViewportChanged = true;
+    mPreviewViewportChangeTp = PlayerClock::now();
+}
+
+void TimeLine::UpdateAdaptivePreview()
+{
+    bool needApply = false, viewportOnly = false;
+    if (!mPreviewAdaptive)
+    {
+        mPreviewAdaptiveLevel = 0;
+        needApply = mPreviewAppliedScale != mPreviewScale;
+    }
+    else if (mPreviewAdaptiveRestore)
+    {
+        needApply = mPreviewAdaptiveLevel > 0;
+        mPreviewAdaptiveLevel = 0;
+    }
+    else if (mPreviewAdaptiveStepDown && mIsPreviewPlaying && mPreviewAdaptiveLevel+1 < IM_ARRAYSIZE(PREVIEW_ADAPTIVE_STEPS))
+    {
+        mPreviewAdaptiveLevel++;
+        needApply = true;
+        Logger::Log(Logger::DEBUG) << "Preview can't keep up, lower the preview scale to step " << mPreviewAdaptiveLevel << "." << std::endl;
+    }
+    if (mPreviewZoomApplied != bPreviewZoom)
+    {
+        mPreviewZoomApplied = bPreviewZoom;
+        needApply = true;
+    }
+    // a resizing window changes the size on each frame, wait for it to settle
+    if (mPreviewViewportChanged && !mIsPreviewPlaying && PlayerClock::now()-mPreviewViewportChangeTp >= std::chrono::milliseconds(300))
+    {
+        mPreviewViewportChanged = false;
+        viewportOnly = !needApply;
+        needApply = true;
+    }
+    if (mPreviewAdaptiveRestore || mPreviewAdaptiveStepDown)
+    {
+        mPreviewAdaptiveFrames = mPreviewAdaptiveLateFrames = 0;
+        mPreviewAdaptiveWindowTp = PlayerClock::now();
+    }
+    mPreviewAdaptiveRestore = mPreviewAdaptiveStepDown = false;
+    if (!needApply)
+        return;
+    const float appliedScale = CalcAppliedPreviewScale(mPreviewScale, {(int32_t)mhMediaSettings->VideoOutWidth(), (int32_t)mhMediaSettings->VideoOutHeight()});
+    if (appliedScale == mPreviewAppliedScale || (viewportOnly && fabs(appliedScale-mPreviewAppliedScale) < mPreviewAppliedScale*0.1f))
+        return;
+    try
+    {
+        UpdateVideoSettings(mhMediaSettings, mPreviewScale);
+    }
+    catch (const std::exception& e)
+    {
+        Logger::Log(Logger::WARN) << "FAILED to change the preview scale! " << e.what() << std::endl;
+    }
+}
+
+void TimeLine::MeasureAdaptivePreview(const std::vector<MediaCore::CorrelativeFrame>& frames, int64_t composeUs)
+{
+    if (!mPreviewAdaptive || !mIsPreviewPlaying || bSeeking)
+    {
+        mPreviewAdaptiveFrames = mPreviewAdaptiveLateFrames = 0;
+        mPreviewAdaptiveWindowTp = PlayerClock::now();
+        return;
+    }
+    // a frame is late when the mixed frame lags the play position by more than 2 frames, or composing it blocked longer than a frame
+    const auto frameRate = mhPreviewSettings->VideoOutFrameRate();
+    const double frameDurMs = 1000.*frameRate.den/frameRate.num;
+    auto iter = std::find_if(frames.begin(), frames.end(), [] (const auto& cf) {
+        return cf.phase == MediaCore::CorrelativeFrame::PHASE_AFTER_MIXING;
+    });
+    bool isLate = composeUs > frameDurMs*1000;
+    if (iter == frames.end() || iter->frame.empty())
+        isLate = true;
+    else
+    {
+        const int64_t frameTime = (int64_t)(iter->frame.time_stamp*1000);
+        const int64_t lagMs = mIsPreviewForward ? mCurrentTime-frameTime : frameTime-mCurrentTime;
+        if (lagMs > frameDurMs*2)
+            isLate = true;
+    }
+    mPreviewAdaptiveFrames++;
+    if (isLate)
+        mPreviewAdaptiveLateFrames++;
+    if (PlayerClock::now()-mPreviewAdaptiveWindowTp < std::chrono::seconds(1))
+        return;
+    if (mPreviewAdaptiveFrames >= 10 && mPreviewAdaptiveLateFrames*3 > mPreviewAdaptiveFrames)
+        mPreviewAdaptiveStepDown = true;
+    mPreviewAdaptiveFrames = mPreviewAdaptiveLateFrames = 0;
+    mPreviewAdaptiveWindowTp = PlayerClock::now();
+}
+
 void TimeLine::UpdateVideoSettings(MediaCore::SharedSettings::Holder hSettings, float previewScale)
 {
     auto hNewPreviewSettings = hSettings->Clone();
-    auto previewSize = CalcPreviewSize({(int32_t)hSettings->VideoOutWidth(), (int32_t)hSettings->VideoOutHeight()}, previewScale);
+    const float appliedScale = CalcAppliedPreviewScale(previewScale, {(int32_t)hSettings->VideoOutWidth(), (int32_t)hSettings->VideoOutHeight()});
+    auto previewSize = CalcPreviewSize({(int32_t)hSettings->VideoOutWidth(), (int32_t)hSettings->VideoOutHeight()}, appliedScale);
     hNewPreviewSettings->SetVideoOutWidth(previewSize.x);
     hNewPreviewSettings->SetVideoOutHeight(previewSize.y);
     if (!mMtvReader->UpdateSettings(hNewPreviewSettings))
@@ -9363,11 +10526,16 @@ void TimeLine::UpdateVideoSettings(MediaCore::SharedSettings::Holder hSettings,
     mhMediaSettings->SyncVideoSettingsFrom(hSettings.get());
     mhPreviewSettings = hNewPreviewSettings;
     mPreviewScale = previewScale;
+    mPreviewAppliedScale = appliedScale;
     RenderUtils::TextureManager::TexturePoolAttributes tTxPoolAttrs;
     mTxMgr->GetTexturePoolAttributes(PREVIEW_TEXTURE_POOL_NAME, tTxPoolAttrs);
     tTxPoolAttrs.tTxSize = previewSize;
     mTxMgr->SetTexturePoolAttributes(PREVIEW_TEXTURE_POOL_NAME, tTxPoolAttrs);
     mhPreviewTx = mTxMgr->GetTextureFromPool(PREVIEW_TEXTURE_POOL_NAME);
+    if (mhRenderAheadCache)
+        mhRenderAheadCache->Clear();
+    // the render cache keys include the preview size
+    mRenderCacheKeysDirty = !mRenderCacheChunks.empty();
     RefreshPreview(false);
     for (auto& item : mEditingItems)
         item->RefreshDataLayer();
@@ -9377,86 +10545,324 @@ void TimeLine::UpdateVideoSettings(MediaCore::SharedSettings::Holder hSettings,
 
 void TimeLine::UpdateAudioSettings(MediaCore::SharedSettings::Holder hSettings, MediaCore::AudioRender::PcmFormat pcmFormat)
 {
-    mAudioRender->CloseDevice();
+    // the mixing reads from 'mMtaReader' and the scope analysis writes the channel data, neither may run while they change
+    const bool scopeRunning = mAudioScopeThread.joinable();
+    mPcmStream.StopProducer();
+    if (scopeRunning)
+        StopAudioScopeThread();
+    auto restartThreads = [this, scopeRunning] {
+        mPcmStream.StartProducer();
+        if (scopeRunning)
+            StartAudioScopeThread();
+    };
+    if (mAudioRender)
+        mAudioRender->CloseDevice();
     mPcmStream.Flush();
-    if (!mAudioRender->OpenDevice(hSettings->AudioOutSampleRate(), hSettings->AudioOutChannels(), pcmFormat, &mPcmStream))
+    if (mAudioRender && !mAudioRender->OpenDevice(hSettings->AudioOutSampleRate(), hSettings->AudioOutChannels(), pcmFormat, &mPcmStream))
+    {
+        restartThreads();
         throw std::runtime_error("FAILED to open audio render device!");
+    }
     mAudioRenderFormat = pcmFormat;
     if (!mMtaReader->UpdateSettings(hSettings))
         Logger::Log(Logger::Error) << "FAILED to update audio settings!" << std::endl;
     mhMediaSettings->SyncAudioSettingsFrom(mhPreviewSettings.get());
-    mAudioAttribute.channel_data.clear();
-    mAudioAttribute.channel_data.resize(hSettings->AudioOutChannels());
-    if (mIsPreviewPlaying)
+    {
+        std::lock_guard<std::mutex> lk(mAudioAttribute.audio_mutex);
+        mAudioAttribute.channel_data.clear();
+        mAudioAttribute.channel_data.resize(hSettings->AudioOutChannels());
+    }
+    restartThreads();
+    if (mIsPreviewPlaying && mAudioRender)
         mAudioRender->Resume();
 }
 
+void TimeLine::SimplePcmStream::SetAudioReader(MediaCore::MultiTrackAudioReader::Holder areader)
+{
+    StopProducer();
+    m_areader = areader;
+    Flush();
+    StartProducer();
+}
+
+void TimeLine::SimplePcmStream::StopProducer()
+{
+    m_quitProducer = true;
+    WakeProducer();
+    if (m_producer.joinable())
+        m_producer.join();
+}
+
+void TimeLine::SimplePcmStream::StartProducer()
+{
+    if (!m_areader || m_producer.joinable())
+        return;
+    m_quitProducer = false;
+    m_producer = std::thread(&SimplePcmStream::ProducerProc, this);
+    SysUtils::SetThreadName(m_producer, "TL-PcmMix");
+}
+
 uint32_t TimeLine::SimplePcmStream::Read(uint8_t* buff, uint32_t buffSize, bool blocking)
 {
-    if (!m_areader)
-        return 0;
-    std::lock_guard<std::mutex> lk(m_amatLock);
-    uint32_t readSize = 0;
-    while (readSize < buffSize)
-    {
-        uint32_t amatTotalDataSize = m_amat.total()*m_amat.elemsize;
-        if (m_readPosInAmat < amatTotalDataSize)
-        {
-            uint32_t copySize = buffSize-readSize;
-            if (copySize > amatTotalDataSize)
-                copySize = amatTotalDataSize;
-            memcpy(buff+readSize, (uint8_t*)m_amat.data+m_readPosInAmat, copySize);
-            readSize += copySize;
-            m_readPosInAmat += copySize;
-        }
-        if (m_readPosInAmat >= amatTotalDataSize)
-        {
-            std::vector<MediaCore::CorrelativeFrame> amats;
-            bool eof;
-            if (!m_areader->ReadAudioSamplesEx(amats, eof))
-                return 0;
-            // main audio out
-            m_amat = amats[0].frame;
-            // if (!m_amat.empty())
-            //     Logger::Log(Logger::INFO) << "=======> m_amat.timestamp=" << m_amat.time_stamp << std::endl;
-            if (m_owner->mAudioAttribute.audio_mutex.try_lock())
-            {
-                m_owner->CalculateAudioScopeData(m_amat);
-                m_owner->mAudioAttribute.audio_mutex.unlock();
-            }
-            // channel audio
-            for (auto amat : amats)
-            {
-                if (amat.phase == MediaCore::CorrelativeFrame::PHASE_AFTER_TRANSITION)
-                {
-                    auto track = m_owner->FindTrackByID(amat.trackId);
-                    if (track && IS_AUDIO(track->mType))
-                    {
-                        if (track->mAudioTrackAttribute.audio_mutex.try_lock())
-                        {
-                            track->CalculateAudioScopeData(amat.frame);
-                            track->mAudioTrackAttribute.audio_mutex.unlock();
-                        }
-                    }
-                }
-            }
-            m_readPosInAmat = 0;
+    uint64_t readPos = m_readPos.load(std::memory_order_relaxed);
+    const uint32_t flushEpoch = m_flushEpoch.load(std::memory_order_acquire);
+    if (flushEpoch != m_readEpoch)
+    {
+        m_readEpoch = flushEpoch;
+        const uint64_t flushWritePos = m_flushWritePos.load(std::memory_order_acquire);
+        if (readPos < flushWritePos)
+            readPos = flushWritePos;
+        m_tsValid = false;
+    }
+    uint64_t writePos = m_writePos.load(std::memory_order_acquire);
+    // give the producer a moment when asked to block, but never wait long on the device thread
+    for (int i = 0; blocking && i < 10 && writePos-readPos < buffSize && !m_quitProducer; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        writePos = m_writePos.load(std::memory_order_acquire);
+    }
+    const uint32_t readSize = (uint32_t)std::min<uint64_t>(buffSize, writePos-readPos);
+    const uint32_t ringOffset = (uint32_t)(readPos%PCM_RING_SIZE);
+    const uint32_t firstPartSize = std::min(readSize, PCM_RING_SIZE-ringOffset);
+    memcpy(buff, m_ring.data()+ringOffset, firstPartSize);
+    if (readSize > firstPartSize)
+        memcpy(buff+firstPartSize, m_ring.data(), readSize-firstPartSize);
+    // on underrun play silence instead of stalling the device
+    if (readSize < buffSize)
+        memset(buff+readSize, 0, buffSize-readSize);
+    readPos += readSize;
+
+    // timestamp of the next byte to play, from the last block starting at or before it
+    uint64_t markIdx = m_markReadIdx.load(std::memory_order_relaxed);
+    const uint64_t markWriteIdx = m_markWriteIdx.load(std::memory_order_acquire);
+    while (markIdx+1 < markWriteIdx && m_marks[(markIdx+1)%PCM_MARK_COUNT].bytePos <= readPos)
+        markIdx++;
+    if (readSize > 0 && markIdx < markWriteIdx)
+    {
+        const auto& mark = m_marks[markIdx%PCM_MARK_COUNT];
+        if (mark.bytePos <= readPos)
+        {
+            m_timestampMs = mark.timestampMs+(int64_t)(readPos-mark.bytePos)*mark.blockDurMs/mark.blockSize;
+            m_tsValid = true;
+            // a 'Flush()' since the epoch check must not see the timestamp of the flushed samples, it clears
+            // 'm_tsValid' after increasing the epoch, so either it runs after this or the epoch has changed
+            if (m_flushEpoch.load() != flushEpoch)
+                m_tsValid = false;
+        }
+    }
+    m_markReadIdx.store(markIdx, std::memory_order_release);
+    m_readPos.store(readPos);
+    if (readSize > 0)
+        WakeProducer();
+    return buffSize;
+}
+
+void TimeLine::SimplePcmStream::Flush()
+{
+    std::lock_guard<std::mutex> lk(m_produceLock);
+    m_flushWritePos.store(m_writePos.load(std::memory_order_relaxed));
+    m_flushEpoch.fetch_add(1, std::memory_order_release);
+    m_tsValid = false;
+    WakeProducer();
+}
+
+bool TimeLine::SimplePcmStream::IsRingFull() const
+{
+    // the consumer skips the flushed bytes on its next read, they don't count as buffered
+    const uint64_t writePos = m_writePos.load(std::memory_order_relaxed);
+    const uint64_t readPos = std::max(m_readPos.load(), m_flushWritePos.load());
+    return writePos-readPos >= m_maxFillSize || m_markWriteIdx.load(std::memory_order_relaxed)-m_markReadIdx.load() >= PCM_MARK_COUNT-1;
+}
+
+void TimeLine::SimplePcmStream::WakeProducer()
+{
+    // the space is published before 'm_producerWaiting' is read, and the producer sets it before checking the space,
+    // so either the producer sees the space or it is woken here
+    if (!m_producerWaiting.load())
+        return;
+    std::lock_guard<std::mutex> lk(m_spaceLock);
+    m_spaceCv.notify_one();
+}
+
+void TimeLine::SimplePcmStream::ProducerProc()
+{
+    Logger::Log(Logger::DEBUG) << "Enter SimplePcmStream::ProducerProc()..." << std::endl;
+    while (!m_quitProducer)
+    {
+        // nothing is read while the playback is paused or stopped, the producer sleeps until 'Read()' or 'Flush()' makes space
+        if (IsRingFull())
+        {
+            std::unique_lock<std::mutex> lk(m_spaceLock);
+            m_producerWaiting = true;
+            m_spaceCv.wait(lk, [this] { return m_quitProducer || !IsRingFull(); });
+            m_producerWaiting = false;
+            continue;
+        }
+        const uint64_t writePos = m_writePos.load(std::memory_order_relaxed);
+        const uint32_t flushEpoch = m_flushEpoch.load(std::memory_order_acquire);
+        std::vector<MediaCore::CorrelativeFrame> amats;
+        bool eof = false;
+        if (!m_areader->ReadAudioSamplesEx(amats, eof) || amats.empty() || amats[0].frame.empty())
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            continue;
+        }
+        // scopes are analyzed on their own thread
+        const auto& amat = amats[0].frame;
+        m_owner->PostAudioScopeJob(-1, amat);
+        for (auto& cf : amats)
+        {
+            if (cf.phase == MediaCore::CorrelativeFrame::PHASE_AFTER_TRANSITION)
+                m_owner->PostAudioScopeJob(cf.trackId, cf.frame);
+        }
+
+        const uint32_t blockSize = amat.total()*amat.elemsize;
+        if (blockSize > PCM_RING_SIZE/2)
+        {
+            Logger::Log(Logger::WARN) << "Audio block of " << blockSize << " bytes is too large for the pcm ring!" << std::endl;
+            continue;
         }
+        const int64_t blockDurMs = m_areader->SizeToDuration(blockSize);
+        std::lock_guard<std::mutex> lk(m_produceLock);
+        // samples mixed before a seek
+        if (flushEpoch != m_flushEpoch.load(std::memory_order_relaxed))
+            continue;
+        const uint32_t ringOffset = (uint32_t)(writePos%PCM_RING_SIZE);
+        const uint32_t firstPartSize = std::min(blockSize, PCM_RING_SIZE-ringOffset);
+        memcpy(m_ring.data()+ringOffset, amat.data, firstPartSize);
+        if (blockSize > firstPartSize)
+            memcpy(m_ring.data(), (const uint8_t*)amat.data+firstPartSize, blockSize-firstPartSize);
+        const uint64_t markWriteIdx = m_markWriteIdx.load(std::memory_order_relaxed);
+        m_marks[markWriteIdx%PCM_MARK_COUNT] = {writePos, (int64_t)(amat.time_stamp*1000), blockSize, blockDurMs};
+        m_markWriteIdx.store(markWriteIdx+1, std::memory_order_release);
+        m_writePos.store(writePos+blockSize, std::memory_order_release);
+        // keep about 'PCM_AHEAD_MS' buffered, and at least 2 blocks
+        int64_t aheadBlocks = blockDurMs > 0 ? (PCM_AHEAD_MS+blockDurMs-1)/blockDurMs : 2;
+        if (aheadBlocks < 2)
+            aheadBlocks = 2;
+        m_maxFillSize = (uint32_t)std::min<int64_t>(aheadBlocks*blockSize, PCM_RING_SIZE/2);
     }
-    if (!m_amat.empty())
+    Logger::Log(Logger::DEBUG) << "Leave SimplePcmStream::ProducerProc()." << std::endl;
+}
+
+void TimeLine::StartAudioScopeThread()
+{
+    mQuitAudioScope = false;
+    mAudioScopeThread = std::thread(&TimeLine::AudioScopeProc, this);
+    SysUtils::SetThreadName(mAudioScopeThread, "TL-AudScope");
+}
+
+void TimeLine::StopAudioScopeThread()
+{
     {
-        m_timestampMs = (int64_t)(m_amat.time_stamp*1000)+m_areader->SizeToDuration(m_readPosInAmat);
-        m_tsValid = true;
+        std::lock_guard<std::mutex> lk(mAudioScopeJobLock);
+        mQuitAudioScope = true;
+        mAudioScopeJobs.clear();
     }
-    return buffSize;
+    mAudioScopeJobCv.notify_all();
+    if (mAudioScopeThread.joinable())
+        mAudioScopeThread.join();
 }
 
-void TimeLine::SimplePcmStream::Flush()
+void TimeLine::PostAudioScopeJob(int64_t trackId, const ImGui::ImMat& frame)
 {
-    std::lock_guard<std::mutex> lk(m_amatLock);
-    m_amat.release();
-    m_readPosInAmat = 0;
-    m_tsValid = false;
+    if (frame.empty())
+        return;
+    {
+        std::lock_guard<std::mutex> lk(mAudioScopeJobLock);
+        // the analysis is best effort, drop the oldest block rather than hold up the mixing
+        if (mAudioScopeJobs.size() >= MAX_AUDIO_SCOPE_JOBS)
+            mAudioScopeJobs.pop_front();
+        mAudioScopeJobs.push_back({trackId, frame});
+    }
+    mAudioScopeJobCv.notify_one();
+}
+
+void TimeLine::AudioScopeProc()
+{
+    Logger::Log(Logger::DEBUG) << "Enter TimeLine::AudioScopeProc()..." << std::endl;
+    while (true)
+    {
+        AudioScopeJob job;
+        {
+            std::unique_lock<std::mutex> lk(mAudioScopeJobLock);
+            mAudioScopeJobCv.wait(lk, [this] { return mQuitAudioScope || !mAudioScopeJobs.empty(); });
+            if (mQuitAudioScope)
+                break;
+            job = mAudioScopeJobs.front();
+            mAudioScopeJobs.pop_front();
+        }
+        if (job.trackId == -1)
+        {
+            CalculateAudioScopeData(job.frame);
+        }
+        else
+        {
+            CalculateTrackAudioScopeData(job.trackId, job.frame);
+        }
+    }
+    Logger::Log(Logger::DEBUG) << "Leave TimeLine::AudioScopeProc()." << std::endl;
+}
+
+void TimeLine::CalculateTrackAudioScopeData(int64_t trackId, ImGui::ImMat& mat_in)
+{
+    if (mat_in.empty() || mat_in.w < 64)
+        return;
+    int trackChannels;
+    {
+        std::lock_guard<std::mutex> lk(mAudioTrackScopeLock);
+        auto iter = mAudioTrackScopes.find(trackId);
+        if (iter == mAudioTrackScopes.end())
+            return;
+        trackChannels = iter->second.channels;
+    }
+    const int fft_size = mat_in.w  > 256 ? 256 : mat_in.w > 128 ? 128 : 64;
+    const int channels = std::min(mat_in.c, trackChannels);
+    auto& ws = mAudioTrackScopeWork;
+    ws.Prepare(channels, fft_size);
+    if (!MEC::PcmToPlanarFloat(mat_in, channels, fft_size, ws.aWavePtrs.data()))
+        return;
+    // we only calculate decibel for now
+    for (int i = 0; i < channels; i++)
+    {
+        float* pFft = (float*)ws.aFfts[i].data;
+        memcpy(pFft, ws.aWavePtrs[i], fft_size*sizeof(float));
+        ImGui::ImRFFT(pFft, fft_size, true);
+        ws.aDecibels[i] = ImGui::ImDoDecibel(pFft, fft_size);
+    }
+    std::lock_guard<std::mutex> lk(mAudioTrackScopeLock);
+    auto iter = mAudioTrackScopes.find(trackId);
+    if (iter == mAudioTrackScopes.end())
+        return;
+    auto& scope = iter->second;
+    scope.decibels.assign(ws.aDecibels.begin(), ws.aDecibels.begin()+channels);
+    scope.updated = true;
+}
+
+void TimeLine::SyncAudioTrackScopes()
+{
+    std::lock_guard<std::mutex> lk(mAudioTrackScopeLock);
+    std::unordered_set<int64_t> audioTrackIds;
+    for (auto track : m_Tracks)
+    {
+        if (!IS_AUDIO(track->mType))
+            continue;
+        audioTrackIds.insert(track->mID);
+        auto& scope = mAudioTrackScopes[track->mID];
+        scope.channels = track->mAudioChannels;
+        if (!scope.updated)
+            continue;
+        for (int i = 0; i < scope.decibels.size(); i++)
+            track->SetAudioLevel(i, scope.decibels[i]);
+        scope.updated = false;
+    }
+    for (auto iter = mAudioTrackScopes.begin(); iter != mAudioTrackScopes.end();)
+    {
+        if (audioTrackIds.find(iter->first) == audioTrackIds.end())
+            iter = mAudioTrackScopes.erase(iter);
+        else
+            iter++;
+    }
 }
 
 void TimeLine::CalculateAudioScopeData(ImGui::ImMat& mat_in)
@@ -9464,395 +10870,1778 @@ void TimeLine::CalculateAudioScopeData(ImGui::ImMat& mat_in)
     if (mat_in.empty() || mat_in.w < 64)
         return;
     const int fft_size = mat_in.w  > 256 ? 256 : mat_in.w > 128 ? 128 : 64;
-    const int ch = mat_in.c;
-    ImGui::ImMat mat;
-    mat.create_type(fft_size, 1, ch, IM_DT_FLOAT32);
-    // copy fft_size samples from input mat, and convert them into float type
+    const int channels = std::min(mat_in.c, (int)mhMediaSettings->AudioOutChannels());
+    auto& ws = mAudioScopeWork;
+    ws.Prepare(channels, fft_size);
+    // copy fft_size samples from input mat, and convert them into planar float
+    if (!MEC::PcmToPlanarFloat(mat_in, channels, fft_size, ws.aWavePtrs.data()))
+        return;
+    if ((int)mAudioScopeSpectrograms.size() != channels)
+        mAudioScopeSpectrograms.resize(channels);
+    if (mAudioScopeSpectrogramLutLight != mAudioAttribute.mAudioSpectrogramLight)
+    {
+        mAudioScopeSpectrogramLutLight = mAudioAttribute.mAudioSpectrogramLight;
+        MEC::BuildSpectrogramLut(mAudioScopeSpectrogramLutLight, mAudioScopeSpectrogramLut);
+    }
+    for (int i = 0; i < channels; i++)
+    {
+        float* pFft = (float*)ws.aFfts[i].data;
+        memcpy(pFft, ws.aWavePtrs[i], fft_size*sizeof(float));
+        ImGui::ImRFFT(pFft, fft_size, true);
+        ws.aDbMaxIndices[i] = ImGui::ImReComposeDB(pFft, (float *)ws.aDbs[i].data, fft_size, false);
+        ImGui::ImReComposeDBShort(pFft, (float*)ws.aDbShorts[i].data, fft_size);
+        ImGui::ImReComposeDBLong(pFft, (float*)ws.aDbLongs[i].data, fft_size);
+        ws.aDecibels[i] = ImGui::ImDoDecibel(pFft, fft_size);
+        mAudioScopeSpectrograms[i].AddRow((const float*)ws.aDbs[i].data, (fft_size >> 1) + 1, mAudioAttribute.mAudioSpectrogramOffset, mAudioScopeSpectrogramLut);
+    }
+    if (channels >= 2)
+    {
+        mAudioScopeVector.Fade(64);
+        mAudioScopeVector.Accumulate(ws.aWavePtrs[0], ws.aWavePtrs[1], fft_size, mAudioAttribute.mAudioVectorMode, mAudioAttribute.mAudioVectorScale,
+                256, 256, ws.aVectorOffsets);
+    }
+
+    // publish, skip this block if the UI is drawing the scopes, the next one carries the accumulated state
+    if (!mAudioAttribute.audio_mutex.try_lock())
+        return;
+    for (int i = 0; i < channels && i < mAudioAttribute.channel_data.size(); i++)
+    {
+        auto & channel_data = mAudioAttribute.channel_data[i];
+        CopyScopeMat(ws.aWaves[i], channel_data.m_wave);
+        CopyScopeMat(ws.aFfts[i], channel_data.m_fft);
+        CopyScopeMat(ws.aDbs[i], channel_data.m_db);
+        CopyScopeMat(ws.aDbShorts[i], channel_data.m_DBShort);
+        CopyScopeMat(ws.aDbLongs[i], channel_data.m_DBLong);
+        channel_data.m_DBMaxIndex = ws.aDbMaxIndices[i];
+        channel_data.m_decibel = ws.aDecibels[i];
+        // the images are only copied again once the UI has uploaded the last one, so they cost nothing while hidden
+        if (!mAudioScopeSpectrograms[i].mImage.empty() && !(channel_data.m_Spectrogram.flags & IM_MAT_FLAGS_CUSTOM_UPDATED))
+        {
+            mAudioScopeSpectrograms[i].CopyRowsTo(channel_data.m_Spectrogram, channel_data.m_SpectrogramRow);
+            channel_data.m_Spectrogram.flags |= IM_MAT_FLAGS_CUSTOM_UPDATED;
+        }
+    }
+    if (channels >= 2 && !mAudioScopeVector.mImage.empty() && !(mAudioAttribute.m_audio_vector.flags & IM_MAT_FLAGS_CUSTOM_UPDATED))
+    {
+        mAudioScopeVector.CopyTo(mAudioAttribute.m_audio_vector);
+        mAudioAttribute.m_audio_vector.flags |= IM_MAT_FLAGS_CUSTOM_UPDATED;
+    }
+    mAudioAttribute.audio_mutex.unlock();
+}
+
+bool LoadEncoderExtraOptions(const imgui_json::value& jnOpts, std::vector<MediaCore::MediaEncoder::Option>& aOpts)
+{
+    if (!jnOpts.is_object())
+        return false;
+    const auto& jnOptObj = jnOpts.get<imgui_json::object>();
+    for (const auto& item : jnOptObj)
     {
-        float** ppDstPtrs = new float*[ch];
-        for (int i = 0; i < ch; i++)
-            ppDstPtrs[i] = (float*)mat.data+mat.w*i;
-        if (mat_in.elempack > 1)
+        const auto& name = item.first;
+        const auto& jval = item.second;
+        MediaCore::MediaEncoder::Option tOpt;
+        switch (jval.type())
         {
-            if (mat_in.type == IM_DT_FLOAT32)
-            {
-                const float* pSrcPtr = (const float*)mat_in.data;
-                for (int i = 0; i < fft_size; i++)
-                {
-                    for (int j = 0; j < ch; j++)
-                    {
-                        auto& pDstPtr = ppDstPtrs[j];
-                        *pDstPtr++ = *pSrcPtr++;
-                    }
-                }
-            }
-            else if (mat_in.type == IM_DT_INT16)
-            {
-                const int16_t* pSrcPtr = (const int16_t*)mat_in.data;
-                for (int i = 0; i < fft_size; i++)
-                {
-                    for (int j = 0; j < ch; j++)
-                    {
-                        auto& pDstPtr = ppDstPtrs[j];
-                        *pDstPtr++ = (float)(*pSrcPtr++)/INT16_MAX;
-                    }
+        case imgui_json::type_t::string:
+            tOpt = { std::string(name), MediaCore::Value(std::string(jval.get<imgui_json::string>())) };
+            break;
+        case imgui_json::type_t::number:
+        {
+            const double dval = jval.get<imgui_json::number>();
+            double ival;
+            if (modf(dval, &ival) == 0.0f)
+                tOpt = { std::string(name), MediaCore::Value(int64_t(dval)) };
+            else
+                tOpt = { std::string(name), MediaCore::Value(dval) };
+            break;
+        }
+        case imgui_json::type_t::boolean:
+            tOpt = { std::string(name), MediaCore::Value(bool(jval.get<imgui_json::boolean>())) };
+            break;
+        default:
+            Logger::Log(Logger::WARN) << "INVALID json attribute for 'MediaCore::MediaEncoder::Option' -> {'" << name << "' : " << jval.dump()
+                    << "}. Ignore this option." << std::endl;
+            break;
+        }
+        if (!tOpt.name.empty())
+            aOpts.push_back(std::move(tOpt));
+    }
+    return true;
+}
+
+void TimeLine::SaveEncoderParams(const VideoEncoderParams& vidEncParams, const AudioEncoderParams& audEncParams, imgui_json::value& jnParams)
+{
+    jnParams["videnc_codec"] = vidEncParams.codecName;
+    if (!vidEncParams.imageFormat.empty())
+        jnParams["videnc_pixfmt"] = vidEncParams.imageFormat;
+    jnParams["videnc_width"] = imgui_json::number(vidEncParams.width);
+    jnParams["videnc_height"] = imgui_json::number(vidEncParams.height);
+    jnParams["videnc_framerate_num"] = imgui_json::number(vidEncParams.frameRate.num);
+    jnParams["videnc_framerate_den"] = imgui_json::number(vidEncParams.frameRate.den);
+    jnParams["videnc_bitrate"] = imgui_json::number(vidEncParams.bitRate);
+    if (vidEncParams.jnExtraOpts.is_object())
+        jnParams["videnc_extra_opts"] = vidEncParams.jnExtraOpts;
+    jnParams["audenc_codec"] = audEncParams.codecName;
+    if (!audEncParams.sampleFormat.empty())
+        jnParams["audenc_sampfmt"] = audEncParams.sampleFormat;
+    jnParams["audenc_channels"] = imgui_json::number(audEncParams.channels);
+    jnParams["audenc_samprate"] = imgui_json::number(audEncParams.sampleRate);
+    jnParams["audenc_bitrate"] = imgui_json::number(audEncParams.bitRate);
+}
+
+bool TimeLine::LoadEncoderParams(const imgui_json::value& jnParams, VideoEncoderParams& vidEncParams, AudioEncoderParams& audEncParams, std::string& errMsg)
+{
+    // video parameters, default to the timeline settings
+    std::string attrName = "videnc_codec";
+    vidEncParams.codecName = mVideoCodec;
+    if (jnParams.contains(attrName) && jnParams[attrName].is_string())
+        vidEncParams.codecName = jnParams[attrName].get<imgui_json::string>();
+    if (vidEncParams.codecName.empty())
+    {
+        errMsg = "INVALID argument 'videnc_codec'! This argument CANNOT be EMPTY.";
+        return false;
+    }
+    attrName = "videnc_pixfmt";
+    vidEncParams.imageFormat.clear();
+    if (jnParams.contains(attrName) && jnParams[attrName].is_string())
+        vidEncParams.imageFormat = jnParams[attrName].get<imgui_json::string>();
+    attrName = "videnc_width";
+    vidEncParams.width = mhMediaSettings->VideoOutWidth();
+    if (jnParams.contains(attrName) && jnParams[attrName].is_number())
+        vidEncParams.width = (uint32_t)jnParams[attrName].get<imgui_json::number>();
+    attrName = "videnc_height";
+    vidEncParams.height = mhMediaSettings->VideoOutHeight();
+    if (jnParams.contains(attrName) && jnParams[attrName].is_number())
+        vidEncParams.height = (uint32_t)jnParams[attrName].get<imgui_json::number>();
+    if (vidEncParams.width == 0 || vidEncParams.height == 0)
+    {
+        std::ostringstream oss; oss << "INVALID video size " << vidEncParams.width << "x" << vidEncParams.height << "!";
+        errMsg = oss.str();
+        return false;
+    }
+    vidEncParams.frameRate = mhMediaSettings->VideoOutFrameRate();
+    attrName = "videnc_framerate_num";
+    if (jnParams.contains(attrName) && jnParams[attrName].is_number())
+    {
+        vidEncParams.frameRate.num = (int32_t)jnParams[attrName].get<imgui_json::number>();
+        vidEncParams.frameRate.den = 1;
+    }
+    attrName = "videnc_framerate_den";
+    if (jnParams.contains(attrName) && jnParams[attrName].is_number())
+        vidEncParams.frameRate.den = (int32_t)jnParams[attrName].get<imgui_json::number>();
+    if (vidEncParams.frameRate.num <= 0 || vidEncParams.frameRate.den <= 0)
+    {
+        std::ostringstream oss; oss << "INVALID video frame rate " << vidEncParams.frameRate.num << "/" << vidEncParams.frameRate.den << "!";
+        errMsg = oss.str();
+        return false;
+    }
+    attrName = "videnc_bitrate";
+    if (jnParams.contains(attrName) && jnParams[attrName].is_number())
+        vidEncParams.bitRate = (uint64_t)jnParams[attrName].get<imgui_json::number>();
+    else
+        vidEncParams.bitRate = (uint64_t)((double)vidEncParams.width*vidEncParams.height*0.2*vidEncParams.frameRate.num/vidEncParams.frameRate.den);
+    vidEncParams.extraOpts.clear();
+    attrName = "videnc_extra_opts";
+    vidEncParams.jnExtraOpts = imgui_json::value();
+    if (jnParams.contains(attrName) && LoadEncoderExtraOptions(jnParams[attrName], vidEncParams.extraOpts))
+        vidEncParams.jnExtraOpts = jnParams[attrName];
+
+    // audio parameters
+    attrName = "audenc_codec";
+    audEncParams.codecName = mAudioCodec;
+    if (jnParams.contains(attrName) && jnParams[attrName].is_string())
+        audEncParams.codecName = jnParams[attrName].get<imgui_json::string>();
+    if (audEncParams.codecName.empty())
+    {
+        errMsg = "INVALID argument 'audenc_codec'! This argument CANNOT be EMPTY.";
+        return false;
+    }
+    attrName = "audenc_sampfmt";
+    audEncParams.sampleFormat.clear();
+    if (jnParams.contains(attrName) && jnParams[attrName].is_string())
+        audEncParams.sampleFormat = jnParams[attrName].get<imgui_json::string>();
+    attrName = "audenc_channels";
+    audEncParams.channels = mhMediaSettings->AudioOutChannels();
+    if (jnParams.contains(attrName) && jnParams[attrName].is_number())
+        audEncParams.channels = (uint32_t)jnParams[attrName].get<imgui_json::number>();
+    attrName = "audenc_samprate";
+    audEncParams.sampleRate = mhMediaSettings->AudioOutSampleRate();
+    if (jnParams.contains(attrName) && jnParams[attrName].is_number())
+        audEncParams.sampleRate = (uint32_t)jnParams[attrName].get<imgui_json::number>();
+    if (audEncParams.channels == 0 || audEncParams.sampleRate == 0)
+    {
+        std::ostringstream oss; oss << "INVALID audio arguments, channels=" << audEncParams.channels << ", sample rate=" << audEncParams.sampleRate << "!";
+        errMsg = oss.str();
+        return false;
+    }
+    attrName = "audenc_bitrate";
+    audEncParams.bitRate = 128000;
+    if (jnParams.contains(attrName) && jnParams[attrName].is_number())
+        audEncParams.bitRate = (uint64_t)jnParams[attrName].get<imgui_json::number>();
+    audEncParams.extraOpts.clear();
+    attrName = "audenc_extra_opts";
+    if (jnParams.contains(attrName))
+        LoadEncoderExtraOptions(jnParams[attrName], audEncParams.extraOpts);
+    return true;
+}
+
+bool TimeLine::ConfigEncoder(const std::string& outputPath, VideoEncoderParams& vidEncParams, AudioEncoderParams& audEncParams, std::string& errMsg)
+{
+    ReleaseExportCachePins();
+    mEncSegments.clear();
+    mEncSegReaders.clear();
+    mEncScaledOutputs.clear();
+    mEncAudioEncoder = nullptr;
+    mEncOutputPath = outputPath;
+    if (mEncodingSegmentCount > 1 || mEncodingSmartRender || mEncodingUseCache || mEncodingCheckpoint)
+        return ConfigSegmentEncoders(outputPath, vidEncParams, audEncParams, errMsg);
+
+    mEncoder = MediaCore::MediaEncoder::CreateInstance();
+    if (!mEncoder->Open(outputPath))
+    {
+        errMsg = mEncoder->GetError();
+        return false;
+    }
+    // Video
+    if (!mEncoder->ConfigureVideoStream(
+        vidEncParams.codecName, vidEncParams.imageFormat, vidEncParams.width, vidEncParams.height,
+        vidEncParams.frameRate, vidEncParams.bitRate, &vidEncParams.extraOpts))
+    {
+        errMsg = mEncoder->GetError();
+        return false;
+    }
+    mEncMtvReader = mMtvReader->CloneAndConfigure(vidEncParams.width, vidEncParams.height, vidEncParams.frameRate);
+
+    // Audio
+    if (!mEncoder->ConfigureAudioStream(
+        audEncParams.codecName, audEncParams.sampleFormat, audEncParams.channels,
+        audEncParams.sampleRate, audEncParams.bitRate))
+    {
+        errMsg = mEncoder->GetError();
+        return false;
+    }
+    mEncMtaReader = mMtaReader->CloneAndConfigure(audEncParams.channels, audEncParams.sampleRate, audEncParams.sampleFormat, audEncParams.samplesPerFrame);
+    return true;
+}
+
+bool TimeLine::ConfigEncoder(std::vector<EncodingRendition>& renditions, std::string& errMsg)
+{
+    if (renditions.empty())
+    {
+        errMsg = "No rendition to encode!";
+        return false;
+    }
+    if (renditions.size() == 1)
+        return ConfigEncoder(renditions[0].outputPath, renditions[0].vidEncParams, renditions[0].audEncParams, errMsg);
+#if IMGUI_VULKAN_SHADER
+    if (mEncodingSegmentCount > 1 || mEncodingSmartRender || mEncodingUseCache || mEncodingCheckpoint)
+    {
+        errMsg = "Multi-rendition export can not be combined with segment export, smart render, export cache or checkpoints!";
+        return false;
+    }
+    // the largest rendition is composed by the timeline, the others are scaled from it.
+    // they share the composed frames and the mixed audio, so frame rate and pcm format must match.
+    size_t topIdx = 0;
+    for (size_t i = 1; i < renditions.size(); i++)
+    {
+        const auto& vidParams = renditions[i].vidEncParams;
+        const auto& topParams = renditions[topIdx].vidEncParams;
+        if ((uint64_t)vidParams.width*vidParams.height > (uint64_t)topParams.width*topParams.height)
+            topIdx = i;
+    }
+    const auto& topRendition = renditions[topIdx];
+    for (const auto& rendition : renditions)
+    {
+        const auto& vidParams = rendition.vidEncParams;
+        const auto& audParams = rendition.audEncParams;
+        const auto& topVidParams = topRendition.vidEncParams;
+        const auto& topAudParams = topRendition.audEncParams;
+        if ((int64_t)vidParams.frameRate.num*topVidParams.frameRate.den != (int64_t)vidParams.frameRate.den*topVidParams.frameRate.num)
+        {
+            std::ostringstream oss;
+            oss << "Rendition '" << rendition.outputPath << "' has a different frame rate from the top rendition!";
+            errMsg = oss.str();
+            return false;
+        }
+        if (audParams.channels != topAudParams.channels || audParams.sampleRate != topAudParams.sampleRate ||
+            audParams.sampleFormat != topAudParams.sampleFormat || audParams.samplesPerFrame != topAudParams.samplesPerFrame)
+        {
+            std::ostringstream oss;
+            oss << "Rendition '" << rendition.outputPath << "' has a different audio format from the top rendition!";
+            errMsg = oss.str();
+            return false;
+        }
+    }
+
+    auto& topVidParams = renditions[topIdx].vidEncParams;
+    auto& topAudParams = renditions[topIdx].audEncParams;
+    if (!ConfigEncoder(renditions[topIdx].outputPath, topVidParams, topAudParams, errMsg))
+        return false;
+    for (size_t i = 0; i < renditions.size(); i++)
+    {
+        if (i == topIdx)
+            continue;
+        auto& rendition = renditions[i];
+        EncodingScaledOutput output;
+        output.outputPath = rendition.outputPath;
+        output.width = rendition.vidEncParams.width;
+        output.height = rendition.vidEncParams.height;
+        output.hEncoder = MediaCore::MediaEncoder::CreateInstance();
+        if (!output.hEncoder->Open(rendition.outputPath))
+        {
+            errMsg = output.hEncoder->GetError();
+            mEncScaledOutputs.clear();
+            return false;
+        }
+        if (!output.hEncoder->ConfigureVideoStream(
+            rendition.vidEncParams.codecName, rendition.vidEncParams.imageFormat, rendition.vidEncParams.width, rendition.vidEncParams.height,
+            rendition.vidEncParams.frameRate, rendition.vidEncParams.bitRate, &rendition.vidEncParams.extraOpts))
+        {
+            errMsg = output.hEncoder->GetError();
+            mEncScaledOutputs.clear();
+            return false;
+        }
+        if (!output.hEncoder->ConfigureAudioStream(
+            rendition.audEncParams.codecName, rendition.audEncParams.sampleFormat, rendition.audEncParams.channels,
+            rendition.audEncParams.sampleRate, rendition.audEncParams.bitRate))
+        {
+            errMsg = output.hEncoder->GetError();
+            mEncScaledOutputs.clear();
+            return false;
+        }
+        mEncScaledOutputs.push_back(std::move(output));
+    }
+    Logger::Log(Logger::DEBUG) << "[ConfigEncoder] compose at " << topVidParams.width << "x" << topVidParams.height
+            << ", " << mEncScaledOutputs.size() << " scaled renditions." << std::endl;
+    return true;
+#else
+    errMsg = "Multi-rendition export requires vulkan shader support!";
+    return false;
+#endif
+}
+
+bool TimeLine::ConfigSegmentEncoders(const std::string& outputPath, VideoEncoderParams& vidEncParams, AudioEncoderParams& audEncParams, std::string& errMsg)
+{
+    const auto strCacheDir = MEC::Project::GetCacheDir();
+    if (strCacheDir.empty())
+    {
+        errMsg = "NO cache directory is available for segment export!";
+        return false;
+    }
+    std::ostringstream oss;
+    const auto outputFileName = SysUtils::ExtractFileName(outputPath);
+    const auto extPos = outputFileName.rfind('.');
+    const std::string fileExt = extPos != std::string::npos ? outputFileName.substr(extPos) : ".mp4";
+    mEncSegFileExt = fileExt;
+    mEncSegCache = nullptr;
+    mEncodeNoticeMsg.clear();
+    if (mEncodingUseCache)
+    {
+        std::string cacheErrMsg;
+        mEncSegCache = MEC::ExportSegmentCache::CreateInstance(SysUtils::JoinPath(strCacheDir, "ExportCache"), cacheErrMsg);
+        if (!mEncSegCache)
+            Logger::Log(Logger::WARN) << "Export cache is NOT available! " << cacheErrMsg << std::endl;
+    }
+
+    ValidDuration();
+    mEncMtvReader = mMtvReader->CloneAndConfigure(vidEncParams.width, vidEncParams.height, vidEncParams.frameRate);
+    const int64_t startFrameIndex = mEncMtvReader->MillsecToFrameIndex(mEncodingStart);
+    int64_t endFrameIndex = mEncMtvReader->MillsecToFrameIndex(mEncodingEnd);
+    while (mEncMtvReader->FrameIndexToMillsec(endFrameIndex) < mEncodingEnd)
+        endFrameIndex++;
+    while (endFrameIndex > startFrameIndex && mEncMtvReader->FrameIndexToMillsec(endFrameIndex-1) >= mEncodingEnd)
+        endFrameIndex--;
+    const int64_t totalFrames = endFrameIndex-startFrameIndex;
+    if (totalFrames <= 0)
+    {
+        errMsg = "Export range is EMPTY!";
+        return false;
+    }
+    // a checkpointed export always uses the same directory for the same output and range, the manifest in it
+    // lists the finished segments, which are reused if their content key still matches.
+    mEncCheckpointManifest = imgui_json::value();
+    mEncCheckpointManifestPath.clear();
+    if (mEncodingCheckpoint)
+    {
+        oss.str(""); oss << outputPath << "|" << startFrameIndex << "-" << endFrameIndex;
+        const auto checkpointId = MEC::ExportSegmentCache::Hash(oss.str());
+        oss.str(""); oss << "ExportCheckpoint-" << std::setw(16) << std::setfill('0') << std::hex << checkpointId << std::dec;
+        mEncSegmentDir = SysUtils::JoinPath(strCacheDir, oss.str());
+        mEncCheckpointManifestPath = SysUtils::JoinPath(mEncSegmentDir, "manifest.json");
+        if (SysUtils::IsFile(mEncCheckpointManifestPath))
+        {
+            const auto res = imgui_json::value::load(mEncCheckpointManifestPath);
+            if (res.second && res.first.is_object() && res.first.contains("segments") && res.first["segments"].is_array())
+                mEncCheckpointManifest = res.first;
+            else
+                Logger::Log(Logger::WARN) << "INVALID export checkpoint manifest '" << mEncCheckpointManifestPath << "', start over." << std::endl;
+        }
+    }
+    else
+    {
+        oss.str(""); oss << "ExportSegments-" << std::setw(16) << std::setfill('0') << std::hex << SysUtils::GetTickHash() << std::dec;
+        mEncSegmentDir = SysUtils::JoinPath(strCacheDir, oss.str());
+    }
+    if (!SysUtils::IsDirectory(mEncSegmentDir) && !SysUtils::CreateDirectoryAt(mEncSegmentDir, true))
+    {
+        errMsg = "FAILED to create directory '" + mEncSegmentDir + "' for segment export!";
+        return false;
+    }
+    UpdateExportCheckpointRegistry(strCacheDir, mEncSegmentDir, mEncodingCheckpoint);
+    if (!mEncCheckpointManifest.is_object())
+    {
+        mEncCheckpointManifest = imgui_json::value();
+        mEncCheckpointManifest["output"] = outputPath;
+        mEncCheckpointManifest["segments"] = imgui_json::array();
+    }
+    // every segment starts with a new encoder, hence a new closed GOP. Segment length is kept as multiple of
+    // one second GOP to have the same keyframe cadence as a continuous export.
+    const auto& frameRate = vidEncParams.frameRate;
+    const int64_t gopSize = frameRate.den > 0 ? std::max<int64_t>((int64_t)round((double)frameRate.num/frameRate.den), 1) : 1;
+    const int64_t gopCount = (totalFrames+gopSize-1)/gopSize;
+    const int64_t segCount = std::min<int64_t>(std::max(mEncodingSegmentCount, 1), gopCount);
+    const int64_t framesPerSeg = (gopCount+segCount-1)/segCount*gopSize;
+    const int64_t startTimeOffset = mEncMtvReader->FrameIndexToMillsec(startFrameIndex);
+    // cached and checkpointed segments sit on a fixed grid from the timeline start, so their boundaries do not move
+    // with the export range or between runs
+    const int64_t cacheSegFrames = std::max<int64_t>(mEncodingCacheSegmentSec, 1)*gopSize;
+    const bool gridAligned = mEncSegCache || mEncodingCheckpoint;
+    // the segment encoders use the one second GOP, unless the user asks for another one
+    mEncSegVidParams = vidEncParams;
+    auto& segEncOpts = mEncSegVidParams.extraOpts;
+    if (std::none_of(segEncOpts.begin(), segEncOpts.end(), [] (const MediaCore::MediaEncoder::Option& opt) { return opt.name == "g"; }))
+        segEncOpts.push_back({ std::string("g"), MediaCore::Value(gopSize) });
+    auto addEncodedSegments = [&] (int64_t fromFrameIndex, int64_t toFrameIndex)
+    {
+        int64_t segStartFrameIndex = fromFrameIndex;
+        while (segStartFrameIndex < toFrameIndex)
+        {
+            EncodingSegment segment;
+            segment.startFrameIndex = segStartFrameIndex;
+            if (gridAligned)
+                segment.endFrameIndex = std::min((segStartFrameIndex/cacheSegFrames+1)*cacheSegFrames, toFrameIndex);
+            else
+                segment.endFrameIndex = std::min(segStartFrameIndex+framesPerSeg, toFrameIndex);
+            segStartFrameIndex = segment.endFrameIndex;
+            segment.seg.i64StartMs = mEncMtvReader->FrameIndexToMillsec(segment.startFrameIndex)-startTimeOffset;
+            segment.seg.i64EndMs = mEncMtvReader->FrameIndexToMillsec(segment.endFrameIndex)-startTimeOffset;
+            if (gridAligned)
+                segment.cacheKey = CalcExportSegmentKey(segment.startFrameIndex, segment.endFrameIndex, vidEncParams);
+            if (mEncSegCache && mEncSegCache->Lookup(segment.cacheKey, fileExt, segment.seg.strPath))
+            {
+                segment.cachePinned = true;
+                mEncSegments.push_back(std::move(segment));
+                continue;
+            }
+            if (mEncodingCheckpoint && FindCheckpointSegment(segment))
+            {
+                mEncSegments.push_back(std::move(segment));
+                continue;
+            }
+            // checkpointed segment files are named by their range, a later run writes the same range to the same file
+            oss.str("");
+            if (mEncodingCheckpoint)
+                oss << "segment_" << std::dec << segment.startFrameIndex << "-" << segment.endFrameIndex << fileExt;
+            else
+                oss << "segment_" << std::dec << std::setw(4) << std::setfill('0') << mEncSegments.size() << fileExt;
+            segment.seg.strPath = SysUtils::JoinPath(mEncSegmentDir, oss.str());
+            segment.encode = true;
+            mEncSegments.push_back(std::move(segment));
+        }
+    };
+
+    // untouched source spans are copied, only the frames between them are encoded
+    std::vector<MEC::ExportSegment> passthroughSpans;
+    if (mEncodingSmartRender)
+    {
+        CollectPassthroughSpans(vidEncParams, startTimeOffset, mEncMtvReader->FrameIndexToMillsec(endFrameIndex), passthroughSpans);
+        if (!passthroughSpans.empty())
+            DropMismatchedPassthroughSpans(startFrameIndex, passthroughSpans);
+        if (passthroughSpans.empty())
+        {
+            mEncodeNoticeMsg = "Smart render: no source video can be copied into this output, all frames are encoded.";
+            Logger::Log(Logger::DEBUG) << mEncodeNoticeMsg << std::endl;
+        }
+    }
+    int64_t frameIndex = startFrameIndex;
+    for (const auto& span : passthroughSpans)
+    {
+        const int64_t spanStartFrameIndex = (int64_t)round((double)span.i64StartMs*frameRate.num/((double)frameRate.den*1000));
+        const int64_t spanEndFrameIndex = (int64_t)round((double)span.i64EndMs*frameRate.num/((double)frameRate.den*1000));
+        if (spanStartFrameIndex < frameIndex || spanEndFrameIndex <= spanStartFrameIndex || spanEndFrameIndex > endFrameIndex)
+            continue;
+        addEncodedSegments(frameIndex, spanStartFrameIndex);
+        EncodingSegment segment;
+        segment.seg = span;
+        segment.startFrameIndex = spanStartFrameIndex;
+        segment.endFrameIndex = spanEndFrameIndex;
+        segment.seg.i64StartMs = mEncMtvReader->FrameIndexToMillsec(spanStartFrameIndex)-startTimeOffset;
+        segment.seg.i64EndMs = mEncMtvReader->FrameIndexToMillsec(spanEndFrameIndex)-startTimeOffset;
+        mEncSegments.push_back(std::move(segment));
+        frameIndex = spanEndFrameIndex;
+    }
+    addEncodedSegments(frameIndex, endFrameIndex);
+    const size_t encodedSegCount = std::count_if(mEncSegments.begin(), mEncSegments.end(), [] (const EncodingSegment& segment) {
+        return segment.encode;
+    });
+    const size_t workerCount = std::min<size_t>(std::max(mEncodingSegmentCount, 1), encodedSegCount);
+    mEncSegReaders.clear();
+    for (size_t i = 0; i < workerCount; i++)
+        mEncSegReaders.push_back(mMtvReader->CloneAndConfigure(vidEncParams.width, vidEncParams.height, vidEncParams.frameRate));
+    Logger::Log(Logger::DEBUG) << "[ConfigSegmentEncoders] " << mEncSegments.size() << " segments, " << mEncSegments.size()-encodedSegCount
+            << " of them are passthrough or cached, " << workerCount << " encoding workers." << std::endl;
+
+    mEncAudioPath = SysUtils::JoinPath(mEncSegmentDir, "audio"+fileExt);
+    mEncAudioEncoder = MediaCore::MediaEncoder::CreateInstance();
+    if (!mEncAudioEncoder->Open(mEncAudioPath))
+    {
+        errMsg = mEncAudioEncoder->GetError();
+        ReleaseExportCachePins();
+        mEncSegments.clear();
+        return false;
+    }
+    if (!mEncAudioEncoder->ConfigureAudioStream(
+        audEncParams.codecName, audEncParams.sampleFormat, audEncParams.channels,
+        audEncParams.sampleRate, audEncParams.bitRate))
+    {
+        errMsg = mEncAudioEncoder->GetError();
+        ReleaseExportCachePins();
+        mEncSegments.clear();
+        return false;
+    }
+    mEncMtaReader = mMtaReader->CloneAndConfigure(audEncParams.channels, audEncParams.sampleRate, audEncParams.sampleFormat, audEncParams.samplesPerFrame);
+    return true;
+}
+
+void TimeLine::ReleaseExportCachePins()
+{
+    for (auto& segment : mEncSegments)
+    {
+        if (segment.cachePinned && mEncSegCache)
+            mEncSegCache->Unpin(segment.cacheKey, mEncSegFileExt);
+        segment.cachePinned = false;
+    }
+}
+
+bool TimeLine::OpenSegmentEncoder(EncodingSegment& segment, std::string& errMsg)
+{
+    auto hEncoder = MediaCore::MediaEncoder::CreateInstance();
+    if (!hEncoder->Open(segment.seg.strPath))
+    {
+        errMsg = hEncoder->GetError();
+        return false;
+    }
+    const auto& vidEncParams = mEncSegVidParams;
+    if (!hEncoder->ConfigureVideoStream(
+        vidEncParams.codecName, vidEncParams.imageFormat, vidEncParams.width, vidEncParams.height,
+        vidEncParams.frameRate, vidEncParams.bitRate, &mEncSegVidParams.extraOpts))
+    {
+        errMsg = hEncoder->GetError();
+        return false;
+    }
+    segment.hEncoder = hEncoder;
+    return true;
+}
+
+// The codec parameters written by the segment encoders, like the H.264 SPS/PPS, are only known after the encoder has
+// written something, and camera sources rarely share them. One frame is encoded with the segment encoder settings before
+// the segments are scheduled, and the spans of the sources which don't match it are dropped, so their frames are encoded
+// in the same parallel pass as the rest. If the reference can't be made, no span is passed through.
+void TimeLine::DropMismatchedPassthroughSpans(int64_t refFrameIndex, std::vector<MEC::ExportSegment>& spans)
+{
+    EncodingSegment refSegment;
+    refSegment.seg.strPath = SysUtils::JoinPath(mEncSegmentDir, "passthrough_reference"+mEncSegFileExt);
+    std::string errMsg;
+    bool refEncoded = false;
+    if (OpenSegmentEncoder(refSegment, errMsg))
+    {
+        auto hEncoder = refSegment.hEncoder;
+        ImGui::ImMat vmat, flushMat;
+        bool consumed = false;
+        mEncMtvReader->SeekTo(mEncMtvReader->FrameIndexToMillsec(refFrameIndex));
+        refEncoded = hEncoder->Start() && mEncMtvReader->ReadVideoFrameByIdx(refFrameIndex, vmat) && !vmat.empty();
+        if (refEncoded)
+        {
+            vmat.time_stamp = 0;
+            refEncoded = hEncoder->EncodeVideoFrame(vmat, consumed) && hEncoder->EncodeVideoFrame(flushMat, consumed) && hEncoder->FinishEncoding();
+        }
+        if (!refEncoded)
+            errMsg = hEncoder->GetError().empty() ? mEncMtvReader->GetError() : hEncoder->GetError();
+        hEncoder->Close();
+    }
+    if (!refEncoded)
+    {
+        Logger::Log(Logger::WARN) << "FAILED to encode the smart render reference frame, no source is passed through. " << errMsg << std::endl;
+        spans.clear();
+        SysUtils::DeleteFileAt(refSegment.seg.strPath);
+        return;
+    }
+
+    std::unordered_map<std::string, bool> matchedSources;
+    for (const auto& span : spans)
+    {
+        if (matchedSources.find(span.strPath) != matchedSources.end())
+            continue;
+        bool matched = false;
+        if (!MEC::MatchSegmentCodecParams(refSegment.seg.strPath, span.strPath, matched, errMsg))
+            Logger::Log(Logger::WARN) << "FAILED to compare the codec parameters of '" << span.strPath << "'. " << errMsg << std::endl;
+        else if (!matched)
+            Logger::Log(Logger::DEBUG) << "Source '" << span.strPath << "' does NOT match the encoder's codec parameters, its spans are encoded." << std::endl;
+        matchedSources[span.strPath] = matched;
+    }
+    spans.erase(std::remove_if(spans.begin(), spans.end(), [&] (const MEC::ExportSegment& span) {
+        return !matchedSources[span.strPath];
+    }), spans.end());
+    SysUtils::DeleteFileAt(refSegment.seg.strPath);
+}
+
+// The passthrough spans are checked against a reference frame before scheduling, this is the last check before they are
+// concatenated. A passthrough segment which still does not match the encoded ones is turned into an encoded segment
+// for a second pass.
+bool TimeLine::PrepareMismatchedPassthroughSegments(size_t& reencodeCount, std::string& errMsg)
+{
+    reencodeCount = 0;
+    if (mEncSegments.empty())
+        return true;
+    auto refIter = std::find_if(mEncSegments.begin(), mEncSegments.end(), [] (const EncodingSegment& segment) {
+        return !segment.seg.IsPassthrough();
+    });
+    // without any encoded segment, the passthrough segments only need to match each other
+    const std::string refPath = refIter != mEncSegments.end() ? refIter->seg.strPath : mEncSegments.front().seg.strPath;
+    std::vector<size_t> mismatchedIndices;
+    for (size_t i = 0; i < mEncSegments.size(); i++)
+    {
+        const auto& segment = mEncSegments[i];
+        if (!segment.seg.IsPassthrough())
+            continue;
+        bool matched = false;
+        if (!MEC::MatchSegmentCodecParams(refPath, segment.seg.strPath, matched, errMsg))
+            return false;
+        if (!matched)
+            mismatchedIndices.push_back(i);
+    }
+    // passthrough segments differing from each other are all encoded
+    if (refIter == mEncSegments.end() && !mismatchedIndices.empty())
+    {
+        mismatchedIndices.clear();
+        for (size_t i = 0; i < mEncSegments.size(); i++)
+            mismatchedIndices.push_back(i);
+    }
+    for (auto i : mismatchedIndices)
+    {
+        auto& segment = mEncSegments[i];
+        Logger::Log(Logger::DEBUG) << "Passthrough segment [" << segment.startFrameIndex << ", " << segment.endFrameIndex << ") of '"
+                << segment.seg.strPath << "' does NOT match the encoded codec parameters, encode it instead." << std::endl;
+        std::ostringstream oss;
+        oss << "segment_" << std::dec << std::setw(4) << std::setfill('0') << i << "_reencoded" << mEncSegFileExt;
+        segment.seg.strPath = SysUtils::JoinPath(mEncSegmentDir, oss.str());
+        segment.seg.i64SrcStartMs = segment.seg.i64SrcEndMs = -1;
+        segment.encode = true;
+        segment.encodedFrames = 0;
+        segment.finished = false;
+    }
+    reencodeCount = mismatchedIndices.size();
+    return true;
+}
+
+// Checkpoint directories of the exports that never finish, like the cancelled ones, are listed in a registry in the
+// cache directory with the time they were last used, and removed after they are left alone for a week.
+static void UpdateExportCheckpointRegistry(const std::string& cacheDir, const std::string& checkpointDir, bool inUse)
+{
+    static const int64_t CHECKPOINT_KEEP_SECONDS = 7*24*3600;
+    static std::mutex s_registryLock;
+    std::lock_guard<std::mutex> lk(s_registryLock);
+    const auto registryPath = SysUtils::JoinPath(cacheDir, "ExportCheckpoints.json");
+    imgui_json::value jnRegistry;
+    if (SysUtils::IsFile(registryPath))
+    {
+        const auto res = imgui_json::value::load(registryPath);
+        if (res.second && res.first.is_object())
+            jnRegistry = res.first;
+    }
+    const int64_t now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    imgui_json::value jnUpdated;
+    if (jnRegistry.is_object())
+    {
+        for (const auto& item : jnRegistry.get<imgui_json::object>())
+        {
+            const auto& dirPath = item.first;
+            if (dirPath == checkpointDir || !item.second.is_number() || !SysUtils::IsDirectory(dirPath))
+                continue;
+            if (now-(int64_t)item.second.get<imgui_json::number>() > CHECKPOINT_KEEP_SECONDS)
+            {
+                if (SysUtils::DeleteDirectoryAt(dirPath))
+                    continue;
+                Logger::Log(Logger::WARN) << "FAILED to remove stale export checkpoint directory '" << dirPath << "'." << std::endl;
+            }
+            jnUpdated[dirPath] = item.second;
+        }
+    }
+    if (inUse)
+        jnUpdated[checkpointDir] = imgui_json::number(now);
+    if (!jnUpdated.is_object())
+        jnUpdated = imgui_json::value(imgui_json::object());
+    if (!jnUpdated.save(registryPath))
+        Logger::Log(Logger::WARN) << "FAILED to save export checkpoint registry '" << registryPath << "'." << std::endl;
+}
+
+bool TimeLine::FindCheckpointSegment(EncodingSegment& segment)
+{
+    std::lock_guard<std::mutex> lk(mEncCheckpointLock);
+    for (const auto& jnSeg : mEncCheckpointManifest["segments"].get<imgui_json::array>())
+    {
+        // the manifest is read from disk, an entry of unexpected form is ignored
+        if (!jnSeg.is_object() || !jnSeg.contains("path") || !jnSeg["path"].is_string() || !jnSeg.contains("key") || !jnSeg["key"].is_string() ||
+            !jnSeg.contains("start_frame") || !jnSeg["start_frame"].is_number() || !jnSeg.contains("end_frame") || !jnSeg["end_frame"].is_number())
+            continue;
+        if ((int64_t)jnSeg["start_frame"].get<imgui_json::number>() != segment.startFrameIndex ||
+            (int64_t)jnSeg["end_frame"].get<imgui_json::number>() != segment.endFrameIndex)
+            continue;
+        // the key is saved as string, a json number can not hold all the 64 bits
+        std::ostringstream oss; oss << std::hex << segment.cacheKey;
+        const std::string path = jnSeg["path"].get<imgui_json::string>();
+        if (jnSeg["key"].get<imgui_json::string>() != oss.str() || !SysUtils::IsFile(path))
+            return false;
+        segment.seg.strPath = path;
+        return true;
+    }
+    return false;
+}
+
+void TimeLine::CommitCheckpointSegment(const EncodingSegment& segment)
+{
+    std::lock_guard<std::mutex> lk(mEncCheckpointLock);
+    auto& jnSegs = mEncCheckpointManifest["segments"].get<imgui_json::array>();
+    jnSegs.erase(std::remove_if(jnSegs.begin(), jnSegs.end(), [&segment] (const imgui_json::value& jnSeg) {
+        return !jnSeg.is_object() || !jnSeg.contains("start_frame") || !jnSeg["start_frame"].is_number() ||
+               (int64_t)jnSeg["start_frame"].get<imgui_json::number>() == segment.startFrameIndex;
+    }), jnSegs.end());
+    imgui_json::value jnSeg;
+    jnSeg["path"] = segment.seg.strPath;
+    jnSeg["start_frame"] = imgui_json::number(segment.startFrameIndex);
+    jnSeg["end_frame"] = imgui_json::number(segment.endFrameIndex);
+    std::ostringstream oss; oss << std::hex << segment.cacheKey;
+    jnSeg["key"] = oss.str();
+    jnSegs.push_back(jnSeg);
+    // write a new file and rename it, a crash while saving never leaves a truncated manifest behind
+    const auto tmpPath = mEncCheckpointManifestPath+".tmp";
+    if (!mEncCheckpointManifest.save(tmpPath) || !SysUtils::RenameFile(tmpPath, mEncCheckpointManifestPath))
+        Logger::Log(Logger::WARN) << "FAILED to update export checkpoint manifest '" << mEncCheckpointManifestPath << "'." << std::endl;
+}
+
+uint64_t TimeLine::CalcExportSegmentKey(int64_t startFrameIndex, int64_t endFrameIndex, const VideoEncoderParams& vidEncParams)
+{
+    const int64_t startMs = mEncMtvReader->FrameIndexToMillsec(startFrameIndex);
+    const int64_t endMs = mEncMtvReader->FrameIndexToMillsec(endFrameIndex);
+    std::ostringstream oss;
+    oss << "range:" << startFrameIndex << "-" << endFrameIndex
+        << "|venc:" << vidEncParams.codecName << "," << vidEncParams.imageFormat << "," << vidEncParams.width << "x" << vidEncParams.height
+        << "@" << vidEncParams.frameRate.num << "/" << vidEncParams.frameRate.den << "," << vidEncParams.bitRate << "," << vidEncParams.jnExtraOpts.dump()
+        << "|settings:" << mhMediaSettings->VideoOutWidth() << "x" << mhMediaSettings->VideoOutHeight() << "@" << mhMediaSettings->VideoOutFrameRate().num
+        << "/" << mhMediaSettings->VideoOutFrameRate().den << "," << (int)mhMediaSettings->VideoOutColorFormat() << "," << (int)mhMediaSettings->VideoOutDataType();
+    AppendRangeStateDesc(startMs, endMs, oss);
+    return MEC::ExportSegmentCache::Hash(oss.str());
+}
+
+void TimeLine::AppendRangeStateDesc(int64_t startMs, int64_t endMs, std::ostringstream& oss)
+{
+    // clips and transitions drawn in the range, in track order
+    for (auto track : m_Tracks)
+    {
+        if (!track->mView || !(IS_VIDEO(track->mType) || IS_TEXT(track->mType)))
+            continue;
+        oss << "|track:" << track->mID << "," << track->mType;
+        if (IS_TEXT(track->mType))
+        {
+            imgui_json::value jnTrack;
+            track->Save(jnTrack);
+            if (jnTrack.contains("SubTrack"))
+                oss << "," << jnTrack["SubTrack"].dump();
+        }
+        for (auto clip : track->m_Clips)
+        {
+            if (clip->End() <= startMs || clip->Start() >= endMs)
+                continue;
+            oss << "|clip:" << clip->SaveAsJson().dump();
+            if (!clip->mPath.empty())
+                oss << "|source:" << MEC::ExportSegmentCache::GetSourceIdentity(clip->mPath);
+        }
+        for (auto overlap : track->m_Overlaps)
+        {
+            if (overlap->mEnd <= startMs || overlap->mStart >= endMs)
+                continue;
+            imgui_json::value jnOverlap;
+            overlap->Save(jnOverlap);
+            oss << "|overlap:" << jnOverlap.dump();
+        }
+    }
+}
+
+bool TimeLine::IsPassthroughClip(Clip* pClip)
+{
+    if (!pClip || !IS_VIDEO(pClip->mType) || IS_IMAGE(pClip->mType) || IS_IMAGESEQ(pClip->mType) || IS_DUMMY(pClip->mType))
+        return false;
+    if (pClip->mEventStack && !pClip->mEventStack->GetEventList().empty())
+        return false;
+    auto hDataLayerClip = static_cast<VideoClip*>(pClip)->GetDataLayer();
+    if (!hDataLayerClip)
+        return false;
+    auto hTransformFilter = hDataLayerClip->GetTransformFilter();
+    if (!hTransformFilter)
+        return true;
+    if (hTransformFilter->IsKeyFramesEnabledOnCrop() || hTransformFilter->IsKeyFramesEnabledOnPosOffset() || hTransformFilter->IsKeyFramesEnabledOnScale() ||
+        hTransformFilter->IsKeyFramesEnabledOnRotation() || hTransformFilter->IsKeyFramesEnabledOnOpacity())
+        return false;
+    return hTransformFilter->GetCropRatioL() == 0.f && hTransformFilter->GetCropRatioT() == 0.f &&
+           hTransformFilter->GetCropRatioR() == 0.f && hTransformFilter->GetCropRatioB() == 0.f &&
+           hTransformFilter->GetPosOffsetRatioX() == 0.f && hTransformFilter->GetPosOffsetRatioY() == 0.f &&
+           hTransformFilter->GetScaleX() == 1.f && hTransformFilter->GetScaleY() == 1.f &&
+           fmod(hTransformFilter->GetRotation(), 360.f) == 0.f && hTransformFilter->GetOpacity() == 1.f &&
+           hTransformFilter->GetOpacityMaskCount() == 0;
+}
+
+void TimeLine::CollectPassthroughSpans(const VideoEncoderParams& vidEncParams, int64_t startMs, int64_t endMs, std::vector<MEC::ExportSegment>& spans)
+{
+    spans.clear();
+    const auto outFrameRate = mhMediaSettings->VideoOutFrameRate();
+    if (vidEncParams.width != mhMediaSettings->VideoOutWidth() || vidEncParams.height != mhMediaSettings->VideoOutHeight() ||
+        (int64_t)vidEncParams.frameRate.num*outFrameRate.den != (int64_t)vidEncParams.frameRate.den*outFrameRate.num)
+        return;
+
+    // everything that draws on the output, a clip can only be copied where it is the only one
+    struct RenderRange { Clip* pClip; int64_t start; int64_t end; };
+    std::vector<RenderRange> renderRanges;
+    for (auto track : m_Tracks)
+    {
+        if (!track->mView || !(IS_VIDEO(track->mType) || IS_TEXT(track->mType)))
+            continue;
+        for (auto clip : track->m_Clips)
+            renderRanges.push_back({clip, clip->Start(), clip->End()});
+    }
+    for (auto overlap : m_Overlaps)
+    {
+        if (IS_VIDEO(overlap->mType))
+            renderRanges.push_back({nullptr, overlap->mStart, overlap->mEnd});
+    }
+
+    for (const auto& candidate : renderRanges)
+    {
+        auto pClip = candidate.pClip;
+        if (!pClip || !IsPassthroughClip(pClip))
+            continue;
+        std::vector<std::pair<int64_t, int64_t>> pieces;
+        pieces.push_back({std::max(pClip->Start(), startMs), std::min(pClip->End(), endMs)});
+        for (const auto& other : renderRanges)
+        {
+            if (other.pClip == pClip)
+                continue;
+            std::vector<std::pair<int64_t, int64_t>> remained;
+            for (const auto& piece : pieces)
+            {
+                if (other.end <= piece.first || other.start >= piece.second)
+                {
+                    remained.push_back(piece);
+                    continue;
+                }
+                if (other.start > piece.first)
+                    remained.push_back({piece.first, other.start});
+                if (other.end < piece.second)
+                    remained.push_back({other.end, piece.second});
+            }
+            pieces = std::move(remained);
+        }
+
+        for (const auto& piece : pieces)
+        {
+            if (piece.second <= piece.first)
+                continue;
+            const int64_t srcStartMs = piece.first-pClip->Start()+pClip->StartOffset();
+            const int64_t srcEndMs = piece.second-pClip->Start()+pClip->StartOffset();
+            std::vector<int64_t> keyFramesMs;
+            std::string errMsg;
+            if (!MEC::ProbePassthroughSource(pClip->mPath, vidEncParams.codecName, vidEncParams.imageFormat, vidEncParams.width, vidEncParams.height,
+                    vidEncParams.frameRate.num, vidEncParams.frameRate.den, srcStartMs, srcEndMs, keyFramesMs, errMsg))
+            {
+                Logger::Log(Logger::DEBUG) << "Clip '" << pClip->mName << "' CANNOT be passed through: " << errMsg << std::endl;
+                break;
+            }
+            // the frames before the first key frame and after the last one are encoded
+            if (keyFramesMs.size() < 2)
+                continue;
+            MEC::ExportSegment span;
+            span.strPath = pClip->mPath;
+            span.i64SrcStartMs = keyFramesMs.front();
+            span.i64SrcEndMs = keyFramesMs.back();
+            span.i64StartMs = piece.first+span.i64SrcStartMs-srcStartMs;
+            span.i64EndMs = piece.first+span.i64SrcEndMs-srcStartMs;
+            spans.push_back(std::move(span));
+        }
+    }
+    std::sort(spans.begin(), spans.end(), [] (const MEC::ExportSegment& a, const MEC::ExportSegment& b) {
+        return a.i64StartMs < b.i64StartMs;
+    });
+}
+
+static int64_t ElapsedUs(const std::chrono::steady_clock::time_point& tp)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-tp).count();
+}
+
+void TimeLine::EncodingStatCounters::Reset()
+{
+    videoComposeUs = 0;
+    audioMixUs = 0;
+    encodeUs = 0;
+    concatUs = 0;
+    composeQueueWaitUs = 0;
+    encodeQueueWaitUs = 0;
+    videoFrames = 0;
+    audioBlocks = 0;
+}
+
+TimeLine::EncodingStats TimeLine::GetEncodingStats()
+{
+    EncodingStats stats;
+    std::chrono::steady_clock::time_point startTp, endTp;
+    {
+        std::lock_guard<std::mutex> lk(mEncTpLock);
+        startTp = mEncStartTp;
+        endTp = mIsEncoding && mEncEndTp == mEncStartTp ? std::chrono::steady_clock::now() : mEncEndTp;
+    }
+    stats.elapsedSec = std::chrono::duration_cast<std::chrono::duration<double>>(endTp-startTp).count();
+    stats.mediaSec = mEncodingProgress*mEncodingDuration;
+    stats.videoComposeSec = (double)mEncStatCounters.videoComposeUs/1e6;
+    stats.audioMixSec = (double)mEncStatCounters.audioMixUs/1e6;
+    stats.encodeSec = (double)mEncStatCounters.encodeUs/1e6;
+    stats.concatSec = (double)mEncStatCounters.concatUs/1e6;
+    stats.composeQueueWaitSec = (double)mEncStatCounters.composeQueueWaitUs/1e6;
+    stats.encodeQueueWaitSec = (double)mEncStatCounters.encodeQueueWaitUs/1e6;
+    stats.videoFrames = mEncStatCounters.videoFrames;
+    stats.audioBlocks = mEncStatCounters.audioBlocks;
+    if (stats.elapsedSec > 0)
+    {
+        stats.fps = stats.videoFrames/stats.elapsedSec;
+        stats.realtimeFactor = stats.mediaSec/stats.elapsedSec;
+    }
+    return stats;
+}
+
+imgui_json::value TimeLine::EncodingStatsToJson(const EncodingStats& stats)
+{
+    imgui_json::value jnStats;
+    jnStats["elapsed_sec"] = imgui_json::number(stats.elapsedSec);
+    jnStats["media_sec"] = imgui_json::number(stats.mediaSec);
+    jnStats["video_compose_sec"] = imgui_json::number(stats.videoComposeSec);
+    jnStats["audio_mix_sec"] = imgui_json::number(stats.audioMixSec);
+    jnStats["encode_sec"] = imgui_json::number(stats.encodeSec);
+    jnStats["concat_sec"] = imgui_json::number(stats.concatSec);
+    jnStats["compose_queue_wait_sec"] = imgui_json::number(stats.composeQueueWaitSec);
+    jnStats["encode_queue_wait_sec"] = imgui_json::number(stats.encodeQueueWaitSec);
+    jnStats["video_frames"] = imgui_json::number(stats.videoFrames);
+    jnStats["audio_blocks"] = imgui_json::number(stats.audioBlocks);
+    jnStats["fps"] = imgui_json::number(stats.fps);
+    jnStats["realtime_factor"] = imgui_json::number(stats.realtimeFactor);
+    return jnStats;
+}
+
+void TimeLine::_WriteEncodingReport()
+{
+    {
+        std::lock_guard<std::mutex> lk(mEncTpLock);
+        mEncEndTp = std::chrono::steady_clock::now();
+    }
+    if (!mEncodingWriteReport || mEncOutputPath.empty())
+        return;
+    imgui_json::value jnReport;
+    jnReport["output"] = mEncOutputPath;
+    jnReport["succeeded"] = mEncodeProcErrMsg.empty() && mEncodingProgress >= 1;
+    if (!mEncodeProcErrMsg.empty())
+        jnReport["error"] = mEncodeProcErrMsg;
+    jnReport["segment_count"] = imgui_json::number(mEncSegments.size());
+    jnReport["scaled_renditions"] = imgui_json::number(mEncScaledOutputs.size());
+    jnReport["stats"] = EncodingStatsToJson(GetEncodingStats());
+    const auto reportPath = mEncOutputPath+".report.json";
+    if (!jnReport.save(reportPath))
+        Logger::Log(Logger::WARN) << "FAILED to write encoding report '" << reportPath << "'." << std::endl;
+}
+
+void TimeLine::StartEncoding()
+{
+    if (mEncodingThread.joinable())
+    {
+        mQuitEncoding = true;
+        mEncodingThread.join();
+        //return;
+    }
+    mEncodeProcErrMsg.clear();
+    mEncodingProgress = 0;
+    mEncodingDuration = (double)ValidDuration()/1000.f;
+    mEncStatCounters.Reset();
+    {
+        std::lock_guard<std::mutex> lk(mEncTpLock);
+        mEncStartTp = mEncEndTp = std::chrono::steady_clock::now();
+    }
+    mQuitEncoding = false;
+    mIsEncoding = true;
+    if (mEncSegments.empty())
+        mEncodingThread = std::thread(&TimeLine::_EncodeProc, this);
+    else
+        mEncodingThread = std::thread(&TimeLine::_EncodeSegmentsProc, this);
+    SysUtils::SetThreadName(mEncodingThread, "TL-EncProc");
+}
+
+void TimeLine::StopEncoding()
+{
+    mQuitEncoding = true;
+    if (mEncodingThread.joinable())
+    {
+        mEncodingThread.join();
+        mEncodingThread = std::thread();
+    }
+    mIsEncoding = false;
+    mEncoder = nullptr;
+    mEncMtvReader = nullptr;
+    mEncMtaReader = nullptr;
+    mEncScaledOutputs.clear();
+    ReleaseExportCachePins();
+    mEncSegments.clear();
+    mEncSegReaders.clear();
+    mEncSegCache = nullptr;
+    mEncAudioEncoder = nullptr;
+}
+
+bool EncodingMatQueue::Push(ImGui::ImMat& mat)
+{
+    std::unique_lock<std::mutex> lk(mQueueLock);
+    mQueueCv.wait(lk, [this] { return mIsAborted || mQueue.size() < mCapacity; });
+    if (mIsAborted)
+        return false;
+    mQueue.push_back(mat);
+    mQueueCv.notify_all();
+    return true;
+}
+
+bool EncodingMatQueue::Pop(ImGui::ImMat& mat, bool& eof)
+{
+    std::unique_lock<std::mutex> lk(mQueueLock);
+    mQueueCv.wait(lk, [this] { return mIsAborted || mIsEof || !mQueue.empty(); });
+    if (mIsAborted)
+        return false;
+    if (mQueue.empty())
+    {
+        eof = true;
+        mat.release();
+        return true;
+    }
+    eof = false;
+    mat = mQueue.front();
+    mQueue.pop_front();
+    mQueueCv.notify_all();
+    return true;
+}
+
+void EncodingMatQueue::SetEof()
+{
+    std::lock_guard<std::mutex> lk(mQueueLock);
+    mIsEof = true;
+    mQueueCv.notify_all();
+}
+
+void EncodingMatQueue::Abort()
+{
+    std::lock_guard<std::mutex> lk(mQueueLock);
+    mIsAborted = true;
+    mQueue.clear();
+    mQueueCv.notify_all();
+}
+
+size_t EncodingMatQueue::Size()
+{
+    std::lock_guard<std::mutex> lk(mQueueLock);
+    return mQueue.size();
+}
+
+void TimeLine::_EncodeVideoComposeProc(EncodingMatQueue* pQueue, std::string* pErrMsg)
+{
+    int64_t vidFrameCount = mEncMtvReader->MillsecToFrameIndex(mEncodingStart);
+    const int64_t startTimeOffset = mEncMtvReader->FrameIndexToMillsec(vidFrameCount);
+    while (!mQuitEncoding)
+    {
+        if (mPauseEncoding)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            continue;
+        }
+        const int64_t vidpos = mEncMtvReader->FrameIndexToMillsec(vidFrameCount);
+        if (vidpos >= mEncodingEnd)
+            break;
+        ImGui::ImMat vmat;
+        auto tp = std::chrono::steady_clock::now();
+        if (!mEncMtvReader->ReadVideoFrameByIdx(vidFrameCount, vmat))
+        {
+            std::ostringstream oss;
+            oss << "[video] '" << mEncMtvReader->GetError() << "'.";
+            *pErrMsg = oss.str();
+            break;
+        }
+        mEncStatCounters.videoComposeUs += ElapsedUs(tp);
+        if (vmat.empty())
+            continue;
+        mEncStatCounters.videoFrames++;
+        vmat.time_stamp = (double)(vidpos-startTimeOffset)/1000.;
+        vidFrameCount++;
+        tp = std::chrono::steady_clock::now();
+        if (!pQueue->Push(vmat))
+            break;
+        mEncStatCounters.composeQueueWaitUs += ElapsedUs(tp);
+    }
+    pQueue->SetEof();
+}
+
+void TimeLine::_EncodeAudioComposeProc(EncodingMatQueue* pQueue, std::string* pErrMsg)
+{
+    const int64_t startTimeOffset = mEncMtvReader->FrameIndexToMillsec(mEncMtvReader->MillsecToFrameIndex(mEncodingStart));
+    while (!mQuitEncoding)
+    {
+        if (mPauseEncoding)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            continue;
+        }
+        ImGui::ImMat amat;
+        bool eof = false;
+        auto tp = std::chrono::steady_clock::now();
+        if (!mEncMtaReader->ReadAudioSamples(amat, eof) && !eof)
+        {
+            std::ostringstream oss;
+            oss << "[audio] '" << mEncMtaReader->GetError() << "'.";
+            *pErrMsg = oss.str();
+            break;
+        }
+        mEncStatCounters.audioMixUs += ElapsedUs(tp);
+        if (eof || amat.empty())
+            break;
+        mEncStatCounters.audioBlocks++;
+        const int64_t audpos = amat.time_stamp * 1000;
+        if (audpos >= mEncodingEnd)
+            break;
+        amat.time_stamp = (double)(audpos-startTimeOffset)/1000.;
+        tp = std::chrono::steady_clock::now();
+        if (!pQueue->Push(amat))
+            break;
+        mEncStatCounters.composeQueueWaitUs += ElapsedUs(tp);
+    }
+    pQueue->SetEof();
+}
+
+// feed the encoder with the earlier one of the pending video frame and audio samples, the consumed one is released
+static bool EncodeEarlierPendingMat(MediaCore::MediaEncoder::Holder hEncoder, ImGui::ImMat& vmat, ImGui::ImMat& amat, double& encpos, bool& anyConsumed, std::string& errMsg)
+{
+    bool encodeVideoFirst = !vmat.empty() && (amat.empty() || vmat.time_stamp <= amat.time_stamp);
+    anyConsumed = false;
+    for (int i = 0; i < 2; i++)
+    {
+        const bool encodeVideo = (i == 0) == encodeVideoFirst;
+        bool consumed = false;
+        if (encodeVideo && !vmat.empty())
+        {
+            if (!hEncoder->EncodeVideoFrame(vmat, consumed, false))
+            {
+                std::ostringstream oss;
+                oss << "[video] '" << hEncoder->GetError() << "'.";
+                errMsg = oss.str();
+                return false;
+            }
+            if (consumed)
+            {
+                if (vmat.time_stamp > encpos) encpos = vmat.time_stamp;
+                vmat.release();
+            }
+        }
+        else if (!encodeVideo && !amat.empty())
+        {
+            if (!hEncoder->EncodeAudioSamples(amat, consumed, false))
+            {
+                std::ostringstream oss;
+                oss << "[audio] '" << hEncoder->GetError() << "'.";
+                errMsg = oss.str();
+                return false;
+            }
+            if (consumed)
+            {
+                if (amat.time_stamp > encpos) encpos = amat.time_stamp;
+                amat.release();
+            }
+        }
+        // only try the other stream if the encoder refuses the earlier one
+        if (consumed)
+        {
+            anyConsumed = true;
+            break;
+        }
+    }
+    return true;
+}
+
+// an empty mat flushes the encoder at the end of the stream
+static bool FlushEncoderStream(MediaCore::MediaEncoder::Holder hEncoder, bool isVideo, std::string& errMsg)
+{
+    ImGui::ImMat eofMat;
+    bool consumed = false;
+    const bool ret = isVideo ? hEncoder->EncodeVideoFrame(eofMat, consumed) : hEncoder->EncodeAudioSamples(eofMat, consumed);
+    if (!ret)
+    {
+        std::ostringstream oss;
+        oss << (isVideo ? "[video] '" : "[audio] '") << hEncoder->GetError() << "'.";
+        errMsg = oss.str();
+    }
+    return ret;
+}
+
+void TimeLine::_EncodeProc()
+{
+    Logger::Log(Logger::DEBUG) << ">>>>>>>>>>> Enter encoding proc >>>>>>>>>>>>" << std::endl;
+    bool started = mEncoder->Start();
+    if (!started)
+        mEncodeProcErrMsg = mEncoder->GetError();
+    for (auto& output : mEncScaledOutputs)
+    {
+        if (!started)
+            break;
+        started = output.hEncoder->Start();
+        if (!started)
+            mEncodeProcErrMsg = "[" + output.outputPath + "] " + output.hEncoder->GetError();
+    }
+    if (!started)
+    {
+        for (auto& output : mEncScaledOutputs)
+            output.hEncoder->Close();
+        mEncoder->Close();
+        _WriteEncodingReport();
+        mIsEncoding = false;
+        Logger::Log(Logger::Error) << "FAILED to start encoding! " << mEncodeProcErrMsg << std::endl;
+        return;
+    }
+    auto dur = ValidDuration();
+    mEncMtvReader->SetCacheFrameNum(8);
+    if (mEncMtvReader) mEncMtvReader->SeekTo(mEncodingStart);
+    if (mEncMtaReader) mEncMtaReader->SeekTo(mEncodingStart);
+
+    // video composing, audio mixing and encoding are running as separated stages,
+    // the bounded queues between them apply back-pressure to the faster producer.
+    EncodingMatQueue vidQueue(mEncodingVideoQueueSize);
+    EncodingMatQueue audQueue(mEncodingAudioQueueSize);
+    std::string vidComposeErrMsg, audComposeErrMsg;
+    std::thread vidComposeThread(&TimeLine::_EncodeVideoComposeProc, this, &vidQueue, &vidComposeErrMsg);
+    SysUtils::SetThreadName(vidComposeThread, "TL-EncVidCmp");
+    std::thread audComposeThread(&TimeLine::_EncodeAudioComposeProc, this, &audQueue, &audComposeErrMsg);
+    SysUtils::SetThreadName(audComposeThread, "TL-EncAudCmp");
+
+    // composed frames and mixed samples are also fanned out to the scaled renditions, each has its own encoding thread
+    std::vector<std::thread> scaledOutputThreads;
+    for (size_t i = 0; i < mEncScaledOutputs.size(); i++)
+    {
+        auto& output = mEncScaledOutputs[i];
+        output.hVidQueue.reset(new EncodingMatQueue(mEncodingVideoQueueSize));
+        output.hAudQueue.reset(new EncodingMatQueue(mEncodingAudioQueueSize));
+        output.errMsg.clear();
+        scaledOutputThreads.push_back(std::thread(&TimeLine::_EncodeScaledOutputProc, this, &output));
+        std::ostringstream thnOss; thnOss << "TL-EncRnd" << i;
+        SysUtils::SetThreadName(scaledOutputThreads.back(), thnOss.str());
+    }
+    auto fanOut = [this] (ImGui::ImMat& mat, bool isVideo, bool eof) {
+        for (auto& output : mEncScaledOutputs)
+        {
+            auto& hQueue = isVideo ? output.hVidQueue : output.hAudQueue;
+            if (eof)
+                hQueue->SetEof();
+            else if (!hQueue->Push(mat))
+            {
+                mEncodeProcErrMsg = output.errMsg.empty() ? std::string("Scaled rendition encoding is aborted!") : output.errMsg;
+                return false;
+            }
+        }
+        return true;
+    };
+
+    bool vidInputEof = false;
+    bool audInputEof = false;
+    ImGui::ImMat vmat, amat;
+    double encpos = 0;
+    while (!mQuitEncoding && (!vidInputEof || !audInputEof))
+    {
+        if (!vidInputEof && vmat.empty())
+        {
+            const auto tp = std::chrono::steady_clock::now();
+            if (!vidQueue.Pop(vmat, vidInputEof))
+                break;
+            mEncStatCounters.encodeQueueWaitUs += ElapsedUs(tp);
+            if (vidInputEof)
+            {
+                if (!vidComposeErrMsg.empty())
+                {
+                    mEncodeProcErrMsg = vidComposeErrMsg;
+                    break;
                 }
+                fanOut(vmat, true, true);
+                if (!FlushEncoderStream(mEncoder, true, mEncodeProcErrMsg))
+                    break;
             }
             else
-                throw std::runtime_error("This PCM format is NOT SUPPORTED yet!");
-        }
-        else
-        {
-            if (mat_in.type == IM_DT_FLOAT32)
             {
-                const float** ppSrcPtrs = new const float*[ch];
-                for (int i = 0; i < ch; i++)
-                    ppSrcPtrs[i] = (const float*)mat_in.data+mat_in.w*i;
-                for (int i = 0; i < ch; i++)
-                    memcpy(ppDstPtrs[i], ppSrcPtrs[i], fft_size*sizeof(float));
-                delete [] ppSrcPtrs;
+                if (!fanOut(vmat, true, false))
+                    break;
+                std::lock_guard<std::mutex> lk(mEncodingMutex);
+                mEncodingVFrame = vmat;
             }
-            else if (mat_in.type == IM_DT_INT16)
+        }
+        if (!audInputEof && amat.empty())
+        {
+            const auto tp = std::chrono::steady_clock::now();
+            if (!audQueue.Pop(amat, audInputEof))
+                break;
+            mEncStatCounters.encodeQueueWaitUs += ElapsedUs(tp);
+            if (audInputEof)
             {
-                const int16_t** ppSrcPtrs = new const int16_t*[ch];
-                for (int i = 0; i < ch; i++)
-                    ppSrcPtrs[i] = (const int16_t*)mat_in.data+mat_in.w*i;
-                for (int i = 0; i < ch; i++)
+                if (!audComposeErrMsg.empty())
                 {
-                    auto& pDstPtr = ppDstPtrs[i];
-                    auto& pSrcPtr = ppSrcPtrs[i];
-                    for (int j = 0; j < fft_size; j++)
-                        *pDstPtr++ = (float)(*pSrcPtr++)/INT16_MAX;
+                    mEncodeProcErrMsg = audComposeErrMsg;
+                    break;
                 }
-                delete [] ppSrcPtrs;
+                fanOut(amat, false, true);
+                if (!FlushEncoderStream(mEncoder, false, mEncodeProcErrMsg))
+                    break;
             }
-            else
-                throw std::runtime_error("This PCM format is NOT SUPPORTED yet!");
+            else if (!fanOut(amat, false, false))
+                break;
         }
-        delete [] ppDstPtrs;
-    }
 
-    for (int i = 0; i < mat.c; i++)
-    {
-        if (i >= (int)mhMediaSettings->AudioOutChannels())
+        bool anyConsumed = false;
+        const auto tp = std::chrono::steady_clock::now();
+        if (!EncodeEarlierPendingMat(mEncoder, vmat, amat, encpos, anyConsumed, mEncodeProcErrMsg))
             break;
-        auto & channel_data = mAudioAttribute.channel_data[i];
-        channel_data.m_wave.clone_from(mat.channel(i));
-        channel_data.m_fft.clone_from(mat.channel(i));
-        ImGui::ImRFFT((float *)channel_data.m_fft.data, channel_data.m_fft.w, true);
-        channel_data.m_db.create_type((mat.w >> 1) + 1, IM_DT_FLOAT32);
-        channel_data.m_DBMaxIndex = ImGui::ImReComposeDB((float*)channel_data.m_fft.data, (float *)channel_data.m_db.data, mat.w, false);
-        channel_data.m_DBShort.create_type(20, IM_DT_FLOAT32);
-        ImGui::ImReComposeDBShort((float*)channel_data.m_fft.data, (float*)channel_data.m_DBShort.data, mat.w);
-        channel_data.m_DBLong.create_type(76, IM_DT_FLOAT32);
-        ImGui::ImReComposeDBLong((float*)channel_data.m_fft.data, (float*)channel_data.m_DBLong.data, mat.w);
-        channel_data.m_decibel = ImGui::ImDoDecibel((float*)channel_data.m_fft.data, mat.w);
-        if (channel_data.m_Spectrogram.w != (mat.w >> 1) + 1)
-        {
-            channel_data.m_Spectrogram.create_type((mat.w >> 1) + 1, 256, 4, IM_DT_INT8);
-        }
-        if (!channel_data.m_Spectrogram.empty())
-        {
-            auto w = channel_data.m_Spectrogram.w;
-            auto c = channel_data.m_Spectrogram.c;
-            memmove(channel_data.m_Spectrogram.data, (char *)channel_data.m_Spectrogram.data + w * c, channel_data.m_Spectrogram.total() - w * c);
-            uint32_t * last_line = (uint32_t *)channel_data.m_Spectrogram.row_c<uint8_t>(255);
-            for (int n = 0; n < w; n++)
-            {
-                float value = channel_data.m_db.at<float>(n) * M_SQRT2 + 64 + mAudioAttribute.mAudioSpectrogramOffset;
-                value = ImClamp(value, -64.f, 63.f);
-                float light = (value + 64) / 127.f;
-                value = (int)((value + 64) + 170) % 255; 
-                auto hue = value / 255.f;
-                auto color = ImColor::HSV(hue, 1.0, light * mAudioAttribute.mAudioSpectrogramLight);
-                last_line[n] = color;
-            }
-            channel_data.m_Spectrogram.flags |= IM_MAT_FLAGS_CUSTOM_UPDATED;
-        }
+        mEncStatCounters.encodeUs += ElapsedUs(tp);
+        if (dur > 0)
+            mEncodingProgress = (float)(encpos * 1000 / dur);
+        if (!anyConsumed && (!vmat.empty() || !amat.empty()))
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
-    if (mat.c >= 2)
+
+    vidQueue.Abort();
+    audQueue.Abort();
+    if (vidComposeThread.joinable())
+        vidComposeThread.join();
+    if (audComposeThread.joinable())
+        audComposeThread.join();
+    // on success the scaled renditions drain their queues till eof, otherwise they are aborted
+    const bool succeeded = !mQuitEncoding && mEncodeProcErrMsg.empty();
+    for (auto& output : mEncScaledOutputs)
     {
-        if (mAudioAttribute.m_audio_vector.empty())
+        if (!succeeded)
         {
-            mAudioAttribute.m_audio_vector.create_type(256, 256, 4, IM_DT_INT8);
-            mAudioAttribute.m_audio_vector.fill((int8_t)0);
-            mAudioAttribute.m_audio_vector.elempack = 4;
+            output.hVidQueue->Abort();
+            output.hAudQueue->Abort();
         }
-        if (!mAudioAttribute.m_audio_vector.empty())
+    }
+    for (auto& th : scaledOutputThreads)
+    {
+        if (th.joinable())
+            th.join();
+    }
+    for (auto& output : mEncScaledOutputs)
+    {
+        if (mEncodeProcErrMsg.empty() && !output.errMsg.empty())
+            mEncodeProcErrMsg = output.errMsg;
+        output.hEncoder->FinishEncoding();
+        output.hEncoder->Close();
+    }
+    if (!mQuitEncoding && mEncodeProcErrMsg.empty())
+    {
+        mEncodingProgress = 1;
+    }
+    mEncoder->FinishEncoding();
+    mEncoder->Close();
+    _WriteEncodingReport();
+    mIsEncoding = false;
+    Logger::Log(Logger::DEBUG) << "<<<<<<<<<<<<< Quit encoding proc <<<<<<<<<<<<<<<<" << std::endl;
+}
+
+void TimeLine::_EncodeScaledOutputProc(EncodingScaledOutput* pOutput)
+{
+#if IMGUI_VULKAN_SHADER
+    ImGui::Resize_vulkan scaler(ImGui::get_default_gpu_index());
+    ImGui::CopyTo_vulkan copier(ImGui::get_default_gpu_index());
+#endif
+    bool vidInputEof = false;
+    bool audInputEof = false;
+    ImGui::ImMat vmat, amat;
+    double encpos = 0;
+    while (!vidInputEof || !audInputEof)
+    {
+        if (!vidInputEof && vmat.empty())
         {
-            float zoom = mAudioAttribute.mAudioVectorScale;
-            float hw = mAudioAttribute.m_audio_vector.w / 2;
-            float hh = mAudioAttribute.m_audio_vector.h / 2;
-            int samples = mat.w;
-            mAudioAttribute.m_audio_vector -= 64;
-            for (int n = 0; n < samples; n++)
+            ImGui::ImMat srcMat;
+            if (!pOutput->hVidQueue->Pop(srcMat, vidInputEof))
+                break;
+            if (vidInputEof)
             {
-                float s1 = mAudioAttribute.channel_data[0].m_wave.at<float>(n, 0);
-                float s2 = mAudioAttribute.channel_data[1].m_wave.at<float>(n, 0);
-                int x = hw;
-                int y = hh;
-
-                if (mAudioAttribute.mAudioVectorMode == LISSAJOUS)
-                {
-                    x = ((s2 - s1) * zoom / 2 + 1) * hw;
-                    y = (1.0 - (s1 + s2) * zoom / 2) * hh;
-                }
-                else if (mAudioAttribute.mAudioVectorMode == LISSAJOUS_XY)
+                if (!FlushEncoderStream(pOutput->hEncoder, true, pOutput->errMsg))
+                    break;
+            }
+            else if (srcMat.w == (int)pOutput->width && srcMat.h == (int)pOutput->height)
+            {
+                vmat = srcMat;
+            }
+            else
+            {
+#if IMGUI_VULKAN_SHADER
+                // keep the aspect ratio, a frame of another shape is centered on a black canvas of the rendition size
+                const float scale = std::min((float)pOutput->width/srcMat.w, (float)pOutput->height/srcMat.h);
+                ImGui::VkMat scaledMat;
+                scaledMat.type = srcMat.type;
+                scaler.Resize(srcMat, scaledMat, scale, scale, IM_INTERPOLATE_AREA);
+                if (scaledMat.w == (int)pOutput->width && scaledMat.h == (int)pOutput->height)
                 {
-                    x = (s2 * zoom + 1) * hw;
-                    y = (s1 * zoom + 1) * hh;
+                    vmat = scaledMat;
                 }
                 else
                 {
-                    float sx, sy, cx, cy;
-                    sx = s2 * zoom;
-                    sy = s1 * zoom;
-                    cx = sx * sqrtf(1 - 0.5 * sy * sy);
-                    cy = sy * sqrtf(1 - 0.5 * sx * sx);
-                    x = hw + hw * ImSign(cx + cy) * (cx - cy) * .7;
-                    y = mAudioAttribute.m_audio_vector.h - mAudioAttribute.m_audio_vector.h * fabsf(cx + cy) * .7;
+                    ImGui::ImMat canvas;
+                    canvas.create_type(pOutput->width, pOutput->height, srcMat.c, srcMat.type);
+                    memset(canvas.data, 0, canvas.total()*canvas.elemsize);
+                    copier.copyTo(scaledMat, canvas, ((int)pOutput->width-scaledMat.w)/2, ((int)pOutput->height-scaledMat.h)/2);
+                    vmat = canvas;
                 }
-                x = ImClamp(x, 0, mAudioAttribute.m_audio_vector.w - 1);
-                y = ImClamp(y, 0, mAudioAttribute.m_audio_vector.h - 1);
-                uint8_t r = ImClamp(mAudioAttribute.m_audio_vector.at<uint8_t>(x, y, 0) + 30, 0, 255);
-                uint8_t g = ImClamp(mAudioAttribute.m_audio_vector.at<uint8_t>(x, y, 1) + 50, 0, 255);
-                uint8_t b = ImClamp(mAudioAttribute.m_audio_vector.at<uint8_t>(x, y, 2) + 30, 0, 255);
-                mAudioAttribute.m_audio_vector.set_pixel(x, y, ImPixel(r / 255.0, g / 255.0, b / 255.0, 1.f));
+                vmat.time_stamp = srcMat.time_stamp;
+#endif
             }
-            mAudioAttribute.m_audio_vector.flags |= IM_MAT_FLAGS_CUSTOM_UPDATED;
         }
-    }
-}
+        if (!audInputEof && amat.empty())
+        {
+            if (!pOutput->hAudQueue->Pop(amat, audInputEof))
+                break;
+            if (audInputEof && !FlushEncoderStream(pOutput->hEncoder, false, pOutput->errMsg))
+                break;
+        }
 
-bool TimeLine::ConfigEncoder(const std::string& outputPath, VideoEncoderParams& vidEncParams, AudioEncoderParams& audEncParams, std::string& errMsg)
-{
-    mEncoder = MediaCore::MediaEncoder::CreateInstance();
-    if (!mEncoder->Open(outputPath))
-    {
-        errMsg = mEncoder->GetError();
-        return false;
+        bool anyConsumed = false;
+        const auto tp = std::chrono::steady_clock::now();
+        if (!EncodeEarlierPendingMat(pOutput->hEncoder, vmat, amat, encpos, anyConsumed, pOutput->errMsg))
+            break;
+        mEncStatCounters.encodeUs += ElapsedUs(tp);
+        if (!anyConsumed && (!vmat.empty() || !amat.empty()))
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
-    // Video
-    if (!mEncoder->ConfigureVideoStream(
-        vidEncParams.codecName, vidEncParams.imageFormat, vidEncParams.width, vidEncParams.height,
-        vidEncParams.frameRate, vidEncParams.bitRate, &vidEncParams.extraOpts))
+    // stop the fan-out from blocking on a failed rendition
+    if (!pOutput->errMsg.empty())
     {
-        errMsg = mEncoder->GetError();
-        return false;
+        pOutput->hVidQueue->Abort();
+        pOutput->hAudQueue->Abort();
     }
-    mEncMtvReader = mMtvReader->CloneAndConfigure(vidEncParams.width, vidEncParams.height, vidEncParams.frameRate);
+}
 
-    // Audio
-    if (!mEncoder->ConfigureAudioStream(
-        audEncParams.codecName, audEncParams.sampleFormat, audEncParams.channels,
-        audEncParams.sampleRate, audEncParams.bitRate))
+void TimeLine::_EncodeSegmentWorkerProc(MediaCore::MultiTrackVideoReader::Holder hReader, std::atomic<size_t>* pNextSegIdx, std::vector<std::string>* pErrMsgs)
+{
+    while (true)
     {
-        errMsg = mEncoder->GetError();
-        return false;
+        const size_t segIdx = (*pNextSegIdx)++;
+        if (segIdx >= mEncSegments.size())
+            break;
+        auto& segment = mEncSegments[segIdx];
+        // a second pass only encodes the passthrough segments turned into encoded ones
+        if (!segment.encode || segment.finished)
+            continue;
+        // the remaining segments are skipped, but still need to be marked as finished
+        if (mQuitEncoding || mEncSegmentFailed)
+        {
+            segment.finished = true;
+            continue;
+        }
+        _EncodeVideoSegmentProc(&segment, hReader, &(*pErrMsgs)[segIdx]);
     }
-    mEncMtaReader = mMtaReader->CloneAndConfigure(audEncParams.channels, audEncParams.sampleRate, audEncParams.sampleFormat, audEncParams.samplesPerFrame);
-    return true;
 }
 
-void TimeLine::StartEncoding()
+void TimeLine::_EncodeVideoSegmentProc(EncodingSegment* pSegment, MediaCore::MultiTrackVideoReader::Holder hReader, std::string* pErrMsg)
 {
-    if (mEncodingThread.joinable())
+    // the encoder only lives while its segment is encoded, so no more encoders are open than there are workers
+    std::string errMsg;
+    if (!OpenSegmentEncoder(*pSegment, errMsg) || !pSegment->hEncoder->Start())
     {
-        mQuitEncoding = true;
-        mEncodingThread.join();
-        //return;
+        std::ostringstream oss; oss << "[video] '" << (pSegment->hEncoder ? pSegment->hEncoder->GetError() : errMsg) << "'.";
+        *pErrMsg = oss.str();
+        mEncSegmentFailed = true;
+        pSegment->hEncoder = nullptr;
+        pSegment->finished = true;
+        return;
     }
-    mEncodeProcErrMsg.clear();
-    mEncodingProgress = 0;
-    mEncodingDuration = (double)ValidDuration()/1000.f;
-    mQuitEncoding = false;
-    mIsEncoding = true;
-    mEncodingThread = std::thread(&TimeLine::_EncodeProc, this);
-    SysUtils::SetThreadName(mEncodingThread, "TL-EncProc");
+    auto hEncoder = pSegment->hEncoder;
+    hReader->SetCacheFrameNum(8);
+    const int64_t segStartMs = hReader->FrameIndexToMillsec(pSegment->startFrameIndex);
+    hReader->SeekTo(segStartMs);
+    int64_t frameIndex = pSegment->startFrameIndex;
+    while (!mQuitEncoding && !mEncSegmentFailed && frameIndex < pSegment->endFrameIndex)
+    {
+        if (mPauseEncoding)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            continue;
+        }
+        ImGui::ImMat vmat;
+        auto tp = std::chrono::steady_clock::now();
+        if (!hReader->ReadVideoFrameByIdx(frameIndex, vmat))
+        {
+            std::ostringstream oss; oss << "[video] '" << hReader->GetError() << "'.";
+            *pErrMsg = oss.str();
+            mEncSegmentFailed = true;
+            break;
+        }
+        mEncStatCounters.videoComposeUs += ElapsedUs(tp);
+        if (vmat.empty())
+            continue;
+        mEncStatCounters.videoFrames++;
+        vmat.time_stamp = (double)(hReader->FrameIndexToMillsec(frameIndex)-segStartMs)/1000.;
+        bool consumed = false;
+        tp = std::chrono::steady_clock::now();
+        if (!hEncoder->EncodeVideoFrame(vmat, consumed))
+        {
+            std::ostringstream oss; oss << "[video] '" << hEncoder->GetError() << "'.";
+            *pErrMsg = oss.str();
+            mEncSegmentFailed = true;
+            break;
+        }
+        mEncStatCounters.encodeUs += ElapsedUs(tp);
+        if (hReader == mEncSegReaders[0])
+        {
+            std::lock_guard<std::mutex> lk(mEncodingMutex);
+            mEncodingVFrame = vmat;
+        }
+        frameIndex++;
+        pSegment->encodedFrames++;
+    }
+    if (!mQuitEncoding && pErrMsg->empty())
+    {
+        ImGui::ImMat vmat;
+        bool consumed = false;
+        if (!hEncoder->EncodeVideoFrame(vmat, consumed) || !hEncoder->FinishEncoding())
+        {
+            std::ostringstream oss; oss << "[video] '" << hEncoder->GetError() << "'.";
+            *pErrMsg = oss.str();
+            mEncSegmentFailed = true;
+        }
+    }
+    hEncoder->Close();
+    pSegment->hEncoder = nullptr;
+    if (!mQuitEncoding && pErrMsg->empty())
+    {
+        if (mEncSegCache && pSegment->cacheKey)
+            pSegment->cachePinned = mEncSegCache->Commit(pSegment->cacheKey, mEncSegFileExt, pSegment->seg.strPath, pSegment->seg.strPath);
+        if (mEncodingCheckpoint)
+            CommitCheckpointSegment(*pSegment);
+    }
+    pSegment->finished = true;
 }
 
-void TimeLine::StopEncoding()
+void TimeLine::_EncodeAudioOnlyProc(std::string* pErrMsg)
 {
-    mQuitEncoding = true;
-    if (mEncodingThread.joinable())
+    if (!mEncAudioEncoder->Start())
     {
-        mEncodingThread.join();
-        mEncodingThread = std::thread();
+        std::ostringstream oss; oss << "[audio] '" << mEncAudioEncoder->GetError() << "'.";
+        *pErrMsg = oss.str();
+        mEncSegmentFailed = true;
+        mEncAudioFinished = true;
+        return;
     }
-    mIsEncoding = false;
-    mEncoder = nullptr;
-    mEncMtvReader = nullptr;
-    mEncMtaReader = nullptr;
+    const int64_t startTimeOffset = mEncMtvReader->FrameIndexToMillsec(mEncMtvReader->MillsecToFrameIndex(mEncodingStart));
+    mEncMtaReader->SeekTo(mEncodingStart);
+    while (!mQuitEncoding && !mEncSegmentFailed)
+    {
+        if (mPauseEncoding)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            continue;
+        }
+        ImGui::ImMat amat;
+        bool eof = false;
+        auto tp = std::chrono::steady_clock::now();
+        if (!mEncMtaReader->ReadAudioSamples(amat, eof) && !eof)
+        {
+            std::ostringstream oss; oss << "[audio] '" << mEncMtaReader->GetError() << "'.";
+            *pErrMsg = oss.str();
+            mEncSegmentFailed = true;
+            break;
+        }
+        mEncStatCounters.audioMixUs += ElapsedUs(tp);
+        if (eof || amat.empty())
+            break;
+        mEncStatCounters.audioBlocks++;
+        const int64_t audpos = amat.time_stamp * 1000;
+        if (audpos >= mEncodingEnd)
+            break;
+        amat.time_stamp = (double)(audpos-startTimeOffset)/1000.;
+        bool consumed = false;
+        tp = std::chrono::steady_clock::now();
+        if (!mEncAudioEncoder->EncodeAudioSamples(amat, consumed))
+        {
+            std::ostringstream oss; oss << "[audio] '" << mEncAudioEncoder->GetError() << "'.";
+            *pErrMsg = oss.str();
+            mEncSegmentFailed = true;
+            break;
+        }
+        mEncStatCounters.encodeUs += ElapsedUs(tp);
+    }
+    if (!mQuitEncoding && pErrMsg->empty())
+    {
+        ImGui::ImMat amat;
+        bool consumed = false;
+        if (!mEncAudioEncoder->EncodeAudioSamples(amat, consumed) || !mEncAudioEncoder->FinishEncoding())
+        {
+            std::ostringstream oss; oss << "[audio] '" << mEncAudioEncoder->GetError() << "'.";
+            *pErrMsg = oss.str();
+            mEncSegmentFailed = true;
+        }
+    }
+    mEncAudioEncoder->Close();
+    mEncAudioFinished = true;
 }
 
-void TimeLine::_EncodeProc()
+void TimeLine::_EncodeSegmentsProc()
 {
-    Logger::Log(Logger::DEBUG) << ">>>>>>>>>>> Enter encoding proc >>>>>>>>>>>>" << std::endl;
-    mEncoder->Start();
-    bool vidInputEof = false;
-    bool audInputEof = false;
-    int nextLoopEncodeType = 0;  // 0: no hint, 1: video, 2: audio
-    int64_t audpos = 0, vidpos = 0;
-    double maxEncodeDuration = 0;
-    MediaCore::Ratio outFrameRate = mEncoder->GetVideoFrameRate();
-    ImGui::ImMat vmat, amat;
-    uint32_t pcmbufSize = 8192;
-    uint8_t* pcmbuf = new uint8_t[pcmbufSize];
-    auto dur = ValidDuration();
-    int64_t encpos = 0;
-    int64_t vidFrameCount = mEncMtvReader->MillsecToFrameIndex(mEncodingStart);
-    int64_t startTimeOffset = mEncMtvReader->FrameIndexToMillsec(vidFrameCount);
-    mEncMtvReader->SetCacheFrameNum(8);
-    if (mEncMtvReader) mEncMtvReader->SeekTo(mEncodingStart);
-    if (mEncMtaReader) mEncMtaReader->SeekTo(mEncodingStart);
-    while (!mQuitEncoding && (!vidInputEof || !audInputEof))
+    Logger::Log(Logger::DEBUG) << ">>>>>>>>>>> Enter segment encoding proc >>>>>>>>>>>>" << std::endl;
+    mEncSegmentFailed = false;
+    mEncAudioFinished = false;
+    const size_t segCount = mEncSegments.size();
+    std::vector<std::string> segErrMsgs(segCount);
+    std::string audErrMsg;
+    int64_t totalFrames = 0;
+    for (auto& segment : mEncSegments)
     {
-        bool idleLoop = true;
-        if (!vidInputEof && (nextLoopEncodeType == 1 || audInputEof || (nextLoopEncodeType == 0 && vidpos <= audpos)))
+        totalFrames += segment.endFrameIndex-segment.startFrameIndex;
+        // passthrough and cached segments cost nothing until concatenating
+        if (!segment.encode)
         {
-            vidpos = mEncMtvReader->FrameIndexToMillsec(vidFrameCount);
-            bool eof = vidpos >= mEncodingEnd;
-            if (!eof)
-            {
-                if (vmat.empty())
-                {
-                    if (!mEncMtvReader->ReadVideoFrameByIdx(vidFrameCount, vmat))
-                    {
-                        std::ostringstream oss;
-                        oss << "[video] '" << mEncMtvReader->GetError() << "'.";
-                        mEncodeProcErrMsg = oss.str();
-                        break;
-                    }
-                    if (!vmat.empty())
-                    {
-                        vmat.time_stamp = (double)(vidpos-startTimeOffset)/1000.;
-                        vidFrameCount++;
-                    }
-                }
-                if (!vmat.empty())
-                {
-                    {
-                        std::lock_guard<std::mutex> lk(mEncodingMutex);
-                        mEncodingVFrame = vmat;
-                    }
-                    bool consumed = false;
-                    if (!mEncoder->EncodeVideoFrame(vmat, consumed, false))
-                    {
-                        std::ostringstream oss;
-                        oss << "[video] '" << mEncoder->GetError() << "'.";
-                        mEncodeProcErrMsg = oss.str();
-                        break;
-                    }
-                    if (consumed)
-                    {
-                        vmat.release();
-                        nextLoopEncodeType = 0;
-                    }
-                    else
-                        nextLoopEncodeType = 2;
-                    if (vidpos > encpos)
-                    {
-                        encpos = vidpos;
-                        mEncodingProgress = (float)((double)(encpos - startTimeOffset) / dur);
-                    }
-                }
-            }
-            else
+            segment.encodedFrames = segment.endFrameIndex-segment.startFrameIndex;
+            segment.finished = true;
+        }
+    }
+    // rendering takes most of the progress, the rest is for concatenating
+    const float renderShare = 0.95f;
+    auto runSegmentWorkers = [&] () {
+        std::vector<std::thread> segThreads;
+        std::atomic<size_t> nextSegIdx {0};
+        for (size_t i = 0; i < mEncSegReaders.size(); i++)
+        {
+            segThreads.push_back(std::thread(&TimeLine::_EncodeSegmentWorkerProc, this, mEncSegReaders[i], &nextSegIdx, &segErrMsgs));
+            SysUtils::SetThreadName(segThreads.back(), "TL-EncSeg"+std::to_string(i));
+        }
+        bool allFinished = false;
+        while (!allFinished)
+        {
+            int64_t encodedFrames = 0;
+            allFinished = mEncAudioFinished;
+            for (auto& segment : mEncSegments)
             {
-                vmat.release();
-                bool consumed = false;
-                if (!mEncoder->EncodeVideoFrame(vmat, consumed))
-                {
-                    std::ostringstream oss;
-                    oss << "[video] '" << mEncoder->GetError() << "'.";
-                    mEncodeProcErrMsg = oss.str();
-                    break;
-                }
-                vidInputEof = true;
+                encodedFrames += segment.encodedFrames;
+                allFinished &= segment.finished;
             }
+            if (totalFrames > 0)
+                mEncodingProgress = renderShare*encodedFrames/totalFrames;
+            if (!allFinished)
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
         }
-        else
+        for (auto& t : segThreads)
+            t.join();
+        for (auto& errMsg : segErrMsgs)
         {
-            bool eof;
-            uint32_t readSize = pcmbufSize;
-            if (amat.empty() && !mEncMtaReader->ReadAudioSamples(amat, eof) && !eof)
+            if (!errMsg.empty())
             {
-                std::ostringstream oss;
-                oss << "[audio] '" << mEncMtaReader->GetError() << "'.";
-                mEncodeProcErrMsg = oss.str();
+                mEncodeProcErrMsg = errMsg;
                 break;
             }
-            if (audpos > mEncodingEnd) eof = true;
-            if (!eof && !amat.empty())
-            {
-                audpos = amat.time_stamp * 1000;
-                amat.time_stamp = (double)(audpos-startTimeOffset)/1000.;
-                bool consumed = false;
-                if (!mEncoder->EncodeAudioSamples(amat, consumed, false))
-                {
-                    std::ostringstream oss;
-                    oss << "[audio] '" << mEncoder->GetError() << "'.";
-                    mEncodeProcErrMsg = oss.str();
-                    break;
-                }
-                if (consumed)
-                {
-                    amat.release();
-                    nextLoopEncodeType = 0;
-                }
-                else
-                    nextLoopEncodeType = 1;
-                if (audpos > encpos)
-                {
-                    encpos = audpos;
-                    mEncodingProgress = (float)((double)(encpos - startTimeOffset) / dur);
-                }
-            }
-            else
-            {
-                amat.release();
-                // {
-                //     std::lock_guard<std::mutex> lk(mEncodingMutex);
-                //     mEncodingAFrame = amat;
-                // }
-                bool consumed = false;
-                if (!mEncoder->EncodeAudioSamples(amat, consumed))
-                {
-                    std::ostringstream oss;
-                    oss << "[audio] '" << mEncoder->GetError() << "'.";
-                    mEncodeProcErrMsg = oss.str();
-                    break;
-                }
-                audInputEof = true;
-            }
+        }
+    };
+    std::thread audThread(&TimeLine::_EncodeAudioOnlyProc, this, &audErrMsg);
+    SysUtils::SetThreadName(audThread, "TL-EncSegAud");
+    runSegmentWorkers();
+    audThread.join();
+    if (mEncodeProcErrMsg.empty())
+        mEncodeProcErrMsg = audErrMsg;
+    if (!mQuitEncoding && mEncodeProcErrMsg.empty() && mEncodingSmartRender)
+    {
+        size_t reencodeCount = 0;
+        std::string errMsg;
+        if (!PrepareMismatchedPassthroughSegments(reencodeCount, errMsg))
+            mEncodeProcErrMsg = "[passthrough] '" + errMsg + "'.";
+        else if (reencodeCount > 0)
+        {
+            if (mEncSegReaders.empty())
+                mEncSegReaders.push_back(mMtvReader->CloneAndConfigure(mEncSegVidParams.width, mEncSegVidParams.height, mEncSegVidParams.frameRate));
+            runSegmentWorkers();
         }
     }
     if (!mQuitEncoding && mEncodeProcErrMsg.empty())
     {
-        mEncodingProgress = 1;
-    }
-    mEncoder->FinishEncoding();
-    mEncoder->Close();
+        std::vector<MEC::ExportSegment> segments;
+        for (auto& segment : mEncSegments)
+            segments.push_back(segment.seg);
+        std::string errMsg;
+        const auto tp = std::chrono::steady_clock::now();
+        const bool concatOk = MEC::ConcatExportSegments(segments, mEncAudioPath, mEncOutputPath, errMsg);
+        mEncStatCounters.concatUs += ElapsedUs(tp);
+        if (concatOk)
+            mEncodingProgress = 1;
+        else
+            mEncodeProcErrMsg = "[concat] '" + errMsg + "'.";
+    }
+    // the cache files are no longer read once concatenated, this export's segments can be trimmed from here on
+    ReleaseExportCachePins();
+    if (mEncSegCache && mEncodingProgress >= 1)
+        mEncSegCache->Trim(mEncodingCacheLimitMB*1024*1024);
+    // an interrupted checkpointed export keeps its finished segments for the next run
+    const bool keepSegmentDir = mEncodingCheckpoint && mEncodingProgress < 1;
+    if (!keepSegmentDir && !SysUtils::DeleteDirectoryAt(mEncSegmentDir))
+        Logger::Log(Logger::WARN) << "FAILED to remove segment export directory '" << mEncSegmentDir << "'." << std::endl;
+    if (!keepSegmentDir && mEncodingCheckpoint)
+        UpdateExportCheckpointRegistry(MEC::Project::GetCacheDir(), mEncSegmentDir, false);
+    _WriteEncodingReport();
     mIsEncoding = false;
-    Logger::Log(Logger::DEBUG) << "<<<<<<<<<<<<< Quit encoding proc <<<<<<<<<<<<<<<<" << std::endl;
+    Logger::Log(Logger::DEBUG) << "<<<<<<<<<<<<< Quit segment encoding proc <<<<<<<<<<<<<<<<" << std::endl;
 }
 
 void TimeLine::AddNewRecord(imgui_json::value& record)
 {
-    // truncate the history record list if needed
-    if (mRecordIter != mHistoryRecords.end())
-        mHistoryRecords.erase(mRecordIter, mHistoryRecords.end());
-    mHistoryRecords.push_back(std::move(record));
-    mRecordIter = mHistoryRecords.end();
+    if (mhUndoHistory->GetSpillDir().empty() && !MEC::Project::GetCacheDir().empty())
+        mhUndoHistory->SetSpillDir(SysUtils::JoinPath(MEC::Project::GetCacheDir(), "UndoHistory"));
+    mhUndoHistory->SetBudget(mHistoryMaxRecords, (int64_t)mHistoryMemoryLimit*1024*1024);
+    // blueprint operations keep the state after the operation as a diff against the one before it. The clip, track and
+    // event payloads ("clip_json", "track_json", "event_json") are single snapshots with nothing in the record to diff
+    // against, and a diff to an older record would depend on records the budget may drop, so they are only packed.
+    if (record.contains("actions"))
+    {
+        for (auto& action : record["actions"].get<imgui_json::array>())
+        {
+            if (action["action"].get<imgui_json::string>() != "BP_OPERATION" || !action.contains("after_op_state"))
+                continue;
+            action["after_op_diff"] = MEC::UndoHistory::Diff(action["before_op_state"], action["after_op_state"]);
+            action.get<imgui_json::object>().erase("after_op_state");
+        }
+    }
+    mhUndoHistory->Push(record);
+}
+
+static void ExpandRecordActions(imgui_json::value& record)
+{
+    for (auto& action : record["actions"].get<imgui_json::array>())
+    {
+        if (action["action"].get<imgui_json::string>() == "BP_OPERATION" && action.contains("after_op_diff"))
+            action["after_op_state"] = MEC::UndoHistory::Patch(action["before_op_state"], action["after_op_diff"]);
+    }
 }
 
 bool TimeLine::UndoOneRecord()
 {
-    if (mRecordIter == mHistoryRecords.begin())
+    imgui_json::value record;
+    if (!mhUndoHistory->Undo(record))
         return false;
 
-    mRecordIter--;
-    auto& record = *mRecordIter;
     auto& actions = record["actions"].get<imgui_json::array>();
     PrintActionList("UNDO record", actions);
     auto iter = actions.end();
@@ -10153,12 +12942,12 @@ bool TimeLine::UndoOneRecord()
 
 bool TimeLine::RedoOneRecord()
 {
-    if (mRecordIter == mHistoryRecords.end())
+    imgui_json::value record;
+    if (!mhUndoHistory->Redo(record))
         return false;
 
-    auto& record = *mRecordIter;
+    ExpandRecordActions(record);
     auto& actions = record["actions"].get<imgui_json::array>();
-    mRecordIter++;
     ImU32 groupColor = 0;
     PrintActionList("REDO record", actions);
     for (auto& action : actions)
@@ -10598,6 +13387,7 @@ bool DrawTimeLine(TimeLine *timeline, bool *expanded, bool& need_save, bool edit
     static int64_t clipMovingEntry = -1;
     static int clipMovingPart = -1;
     static int64_t diffTime = 0;
+    static int64_t hoveredClip = -1;
     int delTrackEntry = -1;
     int mouseEntry = -1;
     int legendEntry = -1;
@@ -11069,6 +13859,24 @@ bool DrawTimeLine(TimeLine *timeline, bool *expanded, bool& need_save, bool edit
         ImGui::ShowTooltipOnHover("Delete mark point");
         ImGui::EndDisabled();
 
+        ImGui::SameLine();
+        if (timeline->mIsRenderingCache)
+        {
+            if (ImGui::Button(ICON_RENDER_RANGE "##main_timeline_stop_render_range"))
+                timeline->StopRenderInToOut();
+            ImGui::ShowTooltipOnHover("Stop rendering (%.1f%%)", timeline->mRenderCacheProgress * 100);
+        }
+        else
+        {
+            if (ImGui::Button(ICON_RENDER_RANGE "##main_timeline_render_range"))
+            {
+                std::string errMsg;
+                if (!timeline->StartRenderInToOut(errMsg))
+                    Logger::Log(Logger::WARN) << "Can not start render in-to-out! " << errMsg << std::endl;
+            }
+            ImGui::ShowTooltipOnHover("Render in to out");
+        }
+
         ImGui::SameLine();
         ImGui::SeparatorEx(ImGuiSeparatorFlags_Vertical);
 
@@ -11112,7 +13920,8 @@ bool DrawTimeLine(TimeLine *timeline, bool *expanded, bool& need_save, bool edit
         ImGui::EndDisabled();
         ImGui::EndDisabled();
 #endif
-        ImGui::BeginDisabled(timeline->GetSelectedClipCount() <= 0);
+        const int selectedClipCount = timeline->GetSelectedClipCount();
+        ImGui::BeginDisabled(selectedClipCount <= 0);
         ImGui::SameLine();
         if (ImGui::Button(ICON_DELETE_CLIPS "##main_timeline_delete_selected"))
         {
@@ -11127,7 +13936,7 @@ bool DrawTimeLine(TimeLine *timeline, bool *expanded, bool& need_save, bool edit
         }
         ImGui::ShowTooltipOnHover("Delete Selected");
 
-        ImGui::BeginDisabled(timeline->GetSelectedClipCount() <= 1);
+        ImGui::BeginDisabled(selectedClipCount <= 1);
         ImGui::SameLine();
         if (ImGui::Button(ICON_MEDIA_GROUP "##main_timeline_group_selected"))
         {
@@ -11423,7 +14232,13 @@ bool DrawTimeLine(TimeLine *timeline, bool *expanded, bool& need_save, bool edit
             }
 
             // Ensure grabable handles and find selected clip
-            for (auto clip : timeline->m_Clips)  clip->bHovered = false; // clear clip hovered status
+            if (hoveredClip != -1)
+            {
+                // clear clip hovered status
+                auto clip = timeline->FindClipByID(hoveredClip);
+                if (clip) clip->bHovered = false;
+                hoveredClip = -1;
+            }
             if (mouseTime != -1 && mouseEntry >= 0 && mouseEntry < timeline->m_Tracks.size())
             {
                 MediaTrack * track = timeline->m_Tracks[mouseEntry];
@@ -11434,17 +14249,18 @@ bool DrawTimeLine(TimeLine *timeline, bool *expanded, bool& need_save, bool edit
                     bool swap_clip = ImGui::IsKeyDown(ImGuiKey_LeftShift);
                     mouseClip.clear();
                     // it should be at most 2 clips under mouse
-                    for (auto clip : track->m_Clips)
+                    if (!bClipMoving && !bCropping)
                     {
-                        if (!bClipMoving && !bCropping && clip->IsInClipRange(mouseTime))
-                        {
+                        std::vector<Clip *> clips;
+                        track->FindClipsInRange(mouseTime, mouseTime + 1, clips);
+                        for (auto clip : clips)
                             mouseClip.push_back(clip->mID);
-                        }
                     }
                     if (!mouseClip.empty())
                     {
                         if (mouseClip.size() == 1 || !swap_clip) { mouse_clip = timeline->FindClipByID(mouseClip[0]); mouse_clip->bHovered = true; }
                         else if (mouseClip.size() == 2 && swap_clip) { mouse_clip = timeline->FindClipByID(mouseClip[1]); mouse_clip->bHovered = true; }
+                        if (mouse_clip) hoveredClip = mouse_clip->mID;
                     }
                     if (mouse_clip && clipMovingEntry == -1)
                     {
@@ -11730,6 +14546,15 @@ bool DrawTimeLine(TimeLine *timeline, bool *expanded, bool& need_save, bool edit
                     changed = true;
                 }
             }
+            ImGui::Separator();
+            if (ImGui::MenuItem(ICON_RENDER_RANGE " Render in to out", nullptr, nullptr, !timeline->mIsRenderingCache))
+            {
+                std::string errMsg;
+                if (!timeline->StartRenderInToOut(errMsg))
+                    Logger::Log(Logger::WARN) << "Can not start render in-to-out! " << errMsg << std::endl;
+            }
+            if (ImGui::MenuItem(ICON_MARK_NONE " Clear render bar", nullptr, nullptr, !timeline->mRenderCacheChunks.empty()))
+                timeline->ClearRenderInToOut();
             ImGui::EndPopup();
         }
 
@@ -12218,27 +15043,18 @@ bool DrawTimeLine(TimeLine *timeline, bool *expanded, bool& need_save, bool edit
             if (cutTrkIdx >= 0 && cutTrkIdx < timeline->m_Tracks.size())
             {
                 cutTrk = timeline->m_Tracks[cutTrkIdx];
-                for (auto clip : cutTrk->m_Clips)
-                {
-                    if (clip->IsInClipRange(alignedTime))
-                    {
-                        hoveringClip = clip;
-                        break;
-                    }
-                }
+                std::vector<Clip *> clips;
+                cutTrk->FindClipsInRange(alignedTime, alignedTime + 1, clips);
+                if (!clips.empty())
+                    hoveringClip = clips.front();
             }
             // 3. check if the mouse is reside in an overlap
             bool inOverlap = false;
             if (cutTrk && hoveringClip)
             {
-                for (auto ovlp : cutTrk->m_Overlaps)
-                {
-                    if (alignedTime >= ovlp->mStart && alignedTime <= ovlp->mEnd)
-                    {
-                        inOverlap = true;
-                        break;
-                    }
-                }
+                std::vector<Overlap *> overlaps;
+                cutTrk->FindOverlapsInRange(alignedTime, alignedTime, overlaps);
+                inOverlap = !overlaps.empty();
             }
             // 4. show cutting line in the hovering clip and clips in the same group
             if (hoveringClip && !inOverlap)
@@ -12425,6 +15241,24 @@ bool DrawTimeLine(TimeLine *timeline, bool *expanded, bool& need_save, bool edit
             // add shadow on whole timeline
             draw_list->AddRectFilled(HeaderAreaRect.Min, HeaderAreaRect.Min + ImVec2(timline_size.x + 8, timline_size.y - scrollSize), IM_COL32(0,0,0,128));
         }
+        // render bar, green where the render cache is played, red where it needs to be rendered again
+        if (!timeline->mRenderCacheChunks.empty())
+        {
+            std::lock_guard<std::mutex> lk(timeline->mRenderCacheLock);
+            for (const auto& chunk : timeline->mRenderCacheChunks)
+            {
+                int64_t chunk_start = timeline->mMtvReader->FrameIndexToMillsec(chunk.startFrameIndex);
+                int64_t chunk_end = timeline->mMtvReader->FrameIndexToMillsec(chunk.endFrameIndex);
+                if (chunk_end <= timeline->firstTime || chunk_start >= timeline->lastTime)
+                    continue;
+                chunk_start = std::max(chunk_start, timeline->firstTime);
+                chunk_end = std::min(chunk_end, timeline->lastTime);
+                float chunk_start_offset = (chunk_start - timeline->firstTime) * timeline->msPixelWidthTarget;
+                float chunk_end_offset = (chunk_end - timeline->firstTime) * timeline->msPixelWidthTarget;
+                draw_list->AddRectFilled(HeaderAreaRect.Min + ImVec2(chunk_start_offset, 8), HeaderAreaRect.Min + ImVec2(chunk_end_offset, 11),
+                                        chunk.rendered && !timeline->mRenderCacheKeysDirty ? COL_RENDER_DONE : COL_RENDER_NEEDED, 0);
+            }
+        }
         if (timeline->mark_in == -1 || timeline->mark_out == -1)
             mark_in_view = false;
         
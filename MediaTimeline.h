@@ -35,12 +35,25 @@
 #include "EventStackFilter.h"
 #include "VideoTransformFilterUiCtrl.h"
 #include "MediaPlayer.h"
+#include "ExportSegments.h"
+#include "RenderAheadCache.h"
+#include "AudioScopeKernels.h"
+#include "WaveformPyramid.h"
+#include "MediaOverviewCache.h"
+#include "UndoHistory.h"
 #include <thread>
 #include <string>
+#include <sstream>
 #include <vector>
 #include <list>
+#include <map>
 #include <unordered_set>
+#include <unordered_map>
+#include <algorithm>
+#include <mutex>
 #include <chrono>
+#include <condition_variable>
+#include <atomic>
 
 #define PLOT_IMPLOT   0
 #define PLOT_TEXTURE  1
@@ -225,6 +238,7 @@
 #define ICON_MARK_IN        u8"\ueaf2"
 #define ICON_MARK_OUT       u8"\ueaea"
 #define ICON_MARK_NONE      u8"\ueaf4"
+#define ICON_RENDER_RANGE   u8"\ue43a"
 #define ICON_EMPTY_TRACK    u8"\ue3c0"
 
 #define COL_FRAME_RECT      IM_COL32( 16,  16,  96, 255)
@@ -274,6 +288,8 @@
 #define COL_MARK_BAR        IM_COL32(128, 128, 128,  96)
 #define COL_MARK_DOT        IM_COL32(170, 170, 170, 224)
 #define COL_MARK_DOT_LIGHT  IM_COL32(255, 255, 255, 224)
+#define COL_RENDER_DONE     IM_COL32( 64, 192,  64, 224)
+#define COL_RENDER_NEEDED   IM_COL32(192,  64,  64, 224)
 #define COL_ERROR_MEDIA     IM_COL32(160,   0,   0, 224)
 #define COL_TITLE_COLOR     IM_COL32(192, 192, 192, 255)
 #define COL_TITLE_OUTLINE   IM_COL32( 32,  32, 192, 128)
@@ -288,6 +304,7 @@
 
 #define HALF_COLOR(c)       (c & 0xFFFFFF) | 0x40000000;
 #define TIMELINE_OVER_LENGTH    5000        // add 5 seconds end of timeline
+#define TIMELINE_CULLING_MARGIN 32          // pixels out of the view in which clips and overlaps are still drawn
 
 namespace MediaTimeline
 {
@@ -297,6 +314,8 @@ namespace MediaTimeline
 #define DEFAULT_TEXT_TRACK_HEIGHT   20
 #define DEFAULT_EVENT_TRACK_HEIGHT  20
 
+#define MEDIA_ITEM_OVERVIEW_SNAPSHOTS   64  // snapshots taken by the overview of a media item
+
 #define PREVIEW_TEXTURE_POOL_NAME                           "PreviewTexturePool"
 #define ARBITRARY_SIZE_TEXTURE_POOL_NAME                    "ArbitrarySizeTexturePool"
 #define VIDEOITEM_OVERVIEW_GRID_TEXTURE_POOL_NAME           "VideoItemOverviewGridTexturePool"
@@ -395,6 +414,33 @@ private:
     int64_t m_State = ImGui::get_current_time_usec();
 };
 
+// ID -> position index over a vector of entities, finds an entity by ID in O(1). A position found in the index is checked
+// against the vector, and the index is rebuilt once it's found stale, so it follows every path that inserts, erases or
+// moves the entities without hooks in all of them. Misses are not cached, as an entity with that ID can be added at any
+// time, so looking up an ID that isn't in the vector always falls back to an O(n) scan. Not thread safe, it's used on
+// the UI thread like the vectors it indexes.
+template <typename T>
+struct IDIndex
+{
+    T* Find(const std::vector<T*>& items, int64_t id)
+    {
+        auto iter = mPositions.find(id);
+        if (iter != mPositions.end() && iter->second < items.size() && items[iter->second]->mID == id)
+            return items[iter->second];
+        auto found = std::find_if(items.begin(), items.end(), [id](const T* item) { return item->mID == id; });
+        if (found == items.end())
+            return nullptr;
+        mPositions.clear();
+        mPositions.reserve(items.size());
+        for (size_t i = 0; i < items.size(); i++)
+            mPositions[items[i]->mID] = i;
+        return *found;
+    }
+
+private:
+    std::unordered_map<int64_t, size_t> mPositions;
+};
+
 struct MediaItem
 {
     int64_t mID;                            // media ID
@@ -407,17 +453,29 @@ struct MediaItem
     int64_t mSrcLength  {0};                // whole Media end in ms
     uint32_t mMediaType {MEDIA_UNKNOWN};
     MediaCore::MediaParser::Holder mhParser;
-    MediaCore::Overview::Holder mMediaOverview;
+    MediaCore::Overview::Holder mMediaOverview;  // nullptr until 'GetOverview()' opens it, if 'Initialize()' deferred it
+    bool mOverviewDeferred {false};
+    std::mutex mOverviewLock;
     RenderUtils::TextureManager::Holder mTxMgr;
     std::vector<RenderUtils::ManagedTexture::Holder> mMediaThumbnail;
     std::vector<ImTextureID> mWaveformTextures;
+    MEC::WaveformPyramid::Holder mWaveformPyramid;  // built once the overview waveform is parsed
+    uint64_t mOverviewCacheKey {0};         // fingerprint of the source in the overview cache, 0 if it can't be cached
+    bool mOverviewCacheSaved {false};       // the overview of the source is in the overview cache, or it can't be cached
+    bool mOverviewFromCache {false};        // snapshots and waveform are loaded from the overview cache, the overview is opened only when used otherwise
+    MediaCore::Overview::Waveform::Holder mCachedWaveform;  // loaded from the overview cache, used instead of the overview waveform
+    std::vector<ImGui::ImMat> mCachedSnapshots;             // loaded from the overview cache, used instead of the overview snapshots
     MediaItem(const std::string& name, const std::string& path, uint32_t type, void* handle);
     MediaItem(MediaCore::MediaParser::Holder hParser, void* handle);
     ~MediaItem();
-    bool Initialize();
+    bool Initialize(bool deferOverview = false);    // with 'deferOverview', only the parser is opened
     bool ChangeSource(const std::string& name, const std::string& path);
     void ReleaseItem();
     void UpdateThumbnail();
+    MediaCore::Overview::Holder GetOverview();
+    MediaCore::Overview::Waveform::Holder GetWaveform();
+    void SaveOverviewCache();
+    MEC::WaveformPyramid::Holder GetWaveformPyramid();
 
     imgui_json::value mMetaData;
 
@@ -570,7 +628,7 @@ struct Clip
     int64_t StartOffset() const { return mStartOffset; }
     int64_t EndOffset() const { return mEndOffset; }
     void SetPositionAndRange(int64_t start, int64_t end, int64_t startOffset, int64_t endOffset)
-    { mStart = start; mEnd = end; mStartOffset = startOffset; mEndOffset = endOffset; }
+    { mStart = start; mEnd = end; mStartOffset = startOffset; mEndOffset = endOffset; OnRangeChanged(); }
     bool IsInClipRange(int64_t pos) const { return pos >= mStart && pos < mEnd; }
 
     int AddEventTrack();
@@ -593,6 +651,7 @@ struct Clip
 protected:
     Clip(TimeLine* pOwner, uint32_t u32Type);
     Clip(TimeLine* pOwner, uint32_t u32Type, const std::string& strName, int64_t i64Start, int64_t i64End, int64_t i64StartOffset = 0, int64_t i64EndOffset = 0);
+    void OnRangeChanged();                          // drop the interval index of the track holding this clip
 
 protected:
     int64_t mStart              {0};                // clip start time in timeline, project saved
@@ -744,11 +803,11 @@ public:
     ~BluePrintVideoTransition();
 
     MediaCore::VideoTransition::Holder Clone() override;
-    void ApplyTo(MediaCore::VideoOverlap* overlap) override { mOverlap = overlap; }
+    void ApplyTo(MediaCore::VideoOverlap* overlap) override;
     ImGui::ImMat MixTwoImages(const ImGui::ImMat& vmat1, const ImGui::ImMat& vmat2, int64_t pos, int64_t dur) override;
 
     void SetBluePrintFromJson(imgui_json::value& bpJson);
-    void SetKeyPoint(ImGui::KeyPointEditor &keypoint) { mKeyPoints = keypoint; };
+    void SetKeyPoint(ImGui::KeyPointEditor &keypoint);    // locked, a reused transition may be mixing on the render thread
 
     imgui_json::value SaveAsJson() const override;
 
@@ -768,11 +827,11 @@ class BluePrintAudioTransition : public MediaCore::AudioTransition
 public:
     BluePrintAudioTransition(void * handle);
     ~BluePrintAudioTransition();
-    void ApplyTo(MediaCore::AudioOverlap* overlap) override { mOverlap = overlap; }
+    void ApplyTo(MediaCore::AudioOverlap* overlap) override;
     ImGui::ImMat MixTwoAudioMats(const ImGui::ImMat& amat1, const ImGui::ImMat& amat2, int64_t pos) override;
 
     void SetBluePrintFromJson(imgui_json::value& bpJson);
-    void SetKeyPoint(ImGui::KeyPointEditor &keypoint) { mKeyPoints = keypoint; };
+    void SetKeyPoint(ImGui::KeyPointEditor &keypoint);
 
 public:
     BluePrint::BluePrintUI* mBp{nullptr};
@@ -1057,7 +1116,8 @@ struct audio_channel_data
     ImGui::ImMat m_db;
     ImGui::ImMat m_DBShort;
     ImGui::ImMat m_DBLong;
-    ImGui::ImMat m_Spectrogram;
+    ImGui::ImMat m_Spectrogram;                 // ring of rows, the newest one is above 'm_SpectrogramRow'
+    int m_SpectrogramRow {0};                   // next row to write, the oldest one on screen
     ImTextureID texture_spectrogram {nullptr};
     float m_decibel {0};
     int m_DBMaxIndex {-1};
@@ -1137,6 +1197,36 @@ struct MediaTrack
     std::string mName;                          // track name, project saved
     std::vector<Clip *> m_Clips;                // track clips, project saved(id only)
     std::vector<Overlap *> m_Overlaps;          // track overlaps, project saved(id only)
+    IDIndex<Clip> mClipIndex;                   // index of 'm_Clips', for 'TimeLine::FindTrackByClipID()'
+    // interval index, rebuilt by 'Update()' or when found out of date: the clips sorted by start with the running max
+    // of their ends, the overlaps sorted by start, and the sorted start and end edges of the overlaps.
+    // Any change to 'm_Clips' or a clip range must call 'MarkClipsChanged()', any change to 'm_Overlaps' 'MarkOverlapsChanged()'
+    uint64_t mClipsGeneration {1};
+    uint64_t mOverlapsGeneration {1};
+    uint64_t mClipIntervalsGeneration {0};      // 'mClipsGeneration' the clip intervals were built at
+    uint64_t mOverlapEdgesGeneration {0};       // 'mOverlapsGeneration' the overlap intervals and edges were built at
+    struct ClipInterval
+    {
+        int64_t start;
+        int64_t end;
+        int64_t maxEnd;                         // max end of the clips up to this one
+        int64_t id;
+        Clip* clip;
+    };
+    struct OverlapInterval
+    {
+        int64_t start;
+        int64_t end;
+        int64_t maxEnd;                         // max end of the overlaps up to this one
+        Overlap* overlap;
+    };
+    std::vector<ClipInterval> mClipIntervals;
+    std::vector<OverlapInterval> mOverlapIntervals;
+    std::vector<int64_t> mOverlapStarts;
+    std::vector<int64_t> mOverlapEnds;
+    // clip ranges and overlaps as of the last 'Update()', to tell the clips it needs to check
+    std::unordered_map<int64_t, std::pair<int64_t, int64_t>> mUpdatedClipRanges;
+    std::vector<int64_t> mUpdatedOverlapIds;
     void * m_Handle         {nullptr};          // user handle, so far we using it contant timeline struct
 
     int mTrackHeight {DEFAULT_TRACK_HEIGHT};    // track custom view height, project saved
@@ -1168,10 +1258,16 @@ struct MediaTrack
     Clip * FindPrevClip(int64_t id);                // find prev clip in track, if not found then return null
     Clip * FindNextClip(int64_t id);                // find next clip in track, if not found then return null
     Clip * FindClips(int64_t time, int& count);     // find clips at time, count means clip number at time
-    void CreateOverlap(int64_t start, int64_t start_clip_id, int64_t end, int64_t end_clip_id, uint32_t type);
+    Overlap * CreateOverlap(int64_t start, int64_t start_clip_id, int64_t end, int64_t end_clip_id, uint32_t type);
     Overlap * FindExistOverlap(int64_t start_clip_id, int64_t end_clip_id);
+    int64_t NextClipStart(int64_t pos, bool inclusive);    // start of the first clip starting after 'pos', -1 if none
+    void FindClipsInRange(int64_t start, int64_t end, std::vector<Clip *>& clips);  // clips intersecting [start, end), ordered by start
+    void FindOverlapsInRange(int64_t start, int64_t end, std::vector<Overlap *>& overlaps);  // overlaps intersecting [start, end], ordered by start
+    void BuildClipIntervals();
+    void BuildOverlapEdges();
+    void MarkClipsChanged() { mClipsGeneration++; }
+    void MarkOverlapsChanged() { mOverlapsGeneration++; }
     
-    void CalculateAudioScopeData(ImGui::ImMat& mat_in);
     float GetAudioLevel(int channel);
     void SetAudioLevel(int channel, float level);
 
@@ -1213,6 +1309,25 @@ struct ClipGroup
     void Save(imgui_json::value& value);
 };
 
+struct EncodingMatQueue
+{
+    EncodingMatQueue(int capacity) : mCapacity(capacity > 0 ? (size_t)capacity : 1) {}
+
+    bool Push(ImGui::ImMat& mat);           // block while queue is full, return false if queue is aborted
+    bool Pop(ImGui::ImMat& mat, bool& eof); // block while queue is empty, return false if queue is aborted
+    void SetEof();                          // producer has no more mat to push
+    void Abort();                           // wake up all the waiting producer and consumer
+    size_t Size();
+
+private:
+    std::list<ImGui::ImMat> mQueue;
+    std::mutex mQueueLock;
+    std::condition_variable mQueueCv;
+    size_t mCapacity;
+    bool mIsEof {false};
+    bool mIsAborted {false};
+};
+
 typedef int (*TimeLineCallback)(int type, void* handle);
 typedef struct TimeLineCallbackFunctions
 {
@@ -1223,7 +1338,8 @@ typedef struct TimeLineCallbackFunctions
 struct TimeLine
 {
 #define MAX_VIDEO_CACHE_FRAMES  3
-    TimeLine();
+#define RENDER_CACHE_CHUNK_MS   4000
+    TimeLine(bool headless = false);        // a headless timeline has no preview audio device nor audio scope thread, it only exports
     ~TimeLine();
     IDGenerator m_IDGenerator;              // Timeline ID generator
     std::vector<MediaItem *> media_items;   // Media Bank, project saved
@@ -1231,6 +1347,11 @@ struct TimeLine
     std::vector<Clip *> m_Clips;            // timeline clips, project saved
     std::vector<ClipGroup> m_Groups;        // timeline clip groups, project saved
     std::vector<Overlap *> m_Overlaps;      // timeline clip overlap, project saved
+    IDIndex<MediaItem> mMediaItemIndex;     // ID indexes of the vectors above, for the 'FindXxxByID()' methods
+    IDIndex<MediaTrack> mTrackIndex;
+    IDIndex<Clip> mClipIndex;
+    IDIndex<Overlap> mOverlapIndex;
+    std::unordered_map<int64_t, int64_t> mClipTrackIndex;  // clip ID -> ID of the track it was last found in, UI thread only as the indexes above
     std::unordered_map<int64_t, MediaCore::Snapshot::Generator::Holder> m_VidSsGenTable;  // Snapshot generator for video media item, provide snapshots for VideoClip
     int64_t mStart   {0};                   // whole timeline start in ms, project saved
     int64_t mEnd     {0};                   // whole timeline end in ms, project saved
@@ -1239,6 +1360,10 @@ struct TimeLine
     bool mShowHelpTooltips      {true};     // timeline show help tooltips, project saved, configured
     bool mHardwareCodec         {true};     // timeline Video/Audio decode/encode try to enable HW if available;
     float mPreviewScale {0.5};              // timeline preview video size scale, usually < 1.0, default is 0.5
+    float mPreviewAppliedScale {0.5};       // scale in use, lower than 'mPreviewScale' when capped by the preview window or lowered by adaptive preview
+    bool mPreviewAdaptive {false};          // lower the preview resolution while playback can't keep up, configured
+    bool mLazyMediaInit {true};             // 'LoadMediaBank()' defers opening the media item overviews until they are needed, configured
+    int mMediaLoadThreads {0};              // media items initialized in parallel by 'LoadMediaBank()', 0 for the cpu core count, configured
     int mMaxCachedVideoFrame {MAX_VIDEO_CACHE_FRAMES};  // timeline Media Video Frame cache size, project saved, configured
     float mSnapShotWidth        {60.0};
     RenderUtils::TextureManager::Holder mTxMgr;
@@ -1263,6 +1388,12 @@ struct TimeLine
     bool CheckMediaItemImported(const std::string& strPath);
     bool UpdateMediaItemMetaData(const std::string& fileUrl, const std::string& metaName, const imgui_json::value& metaValue);
     const imgui_json::value& CheckMediaItemMetaData(const std::string& fileUrl, const std::string& metaName);
+    void LoadMediaBank(const imgui_json::array& jnMediaBank, float* pProgress = nullptr, float fProgressSpan = 0.f);  // create media items from the 'MediaBank' array of project content
+    void SaveMediaBank(imgui_json::array& jnMediaBank);
+    MEC::MediaOverviewCache::Holder mhOverviewCache;
+    int64_t mOverviewCacheMaxBytes {512LL*1024*1024};   // least recently used entries beyond it are removed after each save
+    std::mutex mOverviewCacheLock;
+    MEC::MediaOverviewCache::Holder GetOverviewCache();    // created under the cache directory on first use, nullptr if unavailable
 
     // sutitle Setting
     std::string mFontName;
@@ -1284,6 +1415,7 @@ struct TimeLine
         MediaCore::Ratio frameRate;
         uint64_t bitRate;
         std::vector<MediaCore::MediaEncoder::Option> extraOpts;
+        imgui_json::value jnExtraOpts;      // json form of 'extraOpts', part of the export cache key
     };
 
     struct AudioEncoderParams
@@ -1297,21 +1429,141 @@ struct TimeLine
         std::vector<MediaCore::MediaEncoder::Option> extraOpts;
     };
 
+    struct EncodingRendition
+    {
+        std::string outputPath;
+        VideoEncoderParams vidEncParams;
+        AudioEncoderParams audEncParams;
+    };
+
     MediaCore::MultiTrackVideoReader::Holder mEncMtvReader;
     MediaCore::MultiTrackAudioReader::Holder mEncMtaReader;
 
+    struct EncodingScaledOutput
+    {
+        std::string outputPath;
+        uint32_t width {0};
+        uint32_t height {0};
+        MediaCore::MediaEncoder::Holder hEncoder;
+        std::unique_ptr<EncodingMatQueue> hVidQueue;
+        std::unique_ptr<EncodingMatQueue> hAudQueue;
+        std::string errMsg;
+    };
+    std::vector<EncodingScaledOutput> mEncScaledOutputs;    // extra renditions scaled from the frames composed for 'mEncoder'
+
+    struct EncodingSegment
+    {
+        EncodingSegment() = default;
+        // segments are only copied while they are configured, before any worker runs
+        EncodingSegment(const EncodingSegment& other)
+            : seg(other.seg), startFrameIndex(other.startFrameIndex), endFrameIndex(other.endFrameIndex),
+              encodedFrames(other.encodedFrames.load()), finished(other.finished.load()), cacheKey(other.cacheKey), cachePinned(other.cachePinned),
+              encode(other.encode), hEncoder(other.hEncoder) {}
+
+        MEC::ExportSegment seg;
+        int64_t startFrameIndex {0};
+        int64_t endFrameIndex {0};
+        std::atomic<int64_t> encodedFrames {0};     // written by the segment worker, read by the progress loop
+        std::atomic<bool> finished {false};
+        uint64_t cacheKey {0};                      // key in export cache, 0 if the segment is not cached
+        bool cachePinned {false};                   // the cache file is pinned against trimming until 'ReleaseExportCachePins()'
+        bool encode {false};                        // false for passthrough or cached segment
+        MediaCore::MediaEncoder::Holder hEncoder;   // created by the worker encoding the segment, released when it is done
+    };
+    int mEncodingSegmentCount {1};          // split the export range into segments which are rendered in parallel if > 1
+    bool mEncodingSmartRender {false};      // copy the packets of untouched source spans instead of re-encoding them
+    bool mEncodingUseCache {false};         // reuse the unchanged segments encoded by previous exports
+    int mEncodingCacheSegmentSec {10};      // length of cached segments, they are aligned to the timeline start
+    int64_t mEncodingCacheLimitMB {20480};  // export cache size limit
+    bool mEncodingCheckpoint {false};       // keep finished segments with a manifest in the cache dir, an interrupted export resumes from them
+    MEC::ExportSegmentCache::Holder mEncSegCache;
+    std::string mEncSegFileExt;
+    VideoEncoderParams mEncSegVidParams;    // parameters of the segment encoders, with their GOP size
+    std::string mEncCheckpointManifestPath;
+    imgui_json::value mEncCheckpointManifest;
+    std::mutex mEncCheckpointLock;
+    std::vector<EncodingSegment> mEncSegments;
+    std::vector<MediaCore::MultiTrackVideoReader::Holder> mEncSegReaders;   // one reader per segment encoding worker
+    MediaCore::MediaEncoder::Holder mEncAudioEncoder;   // audio encoder used by segment mode
+    std::string mEncAudioPath;
+    std::string mEncSegmentDir;
+    std::string mEncOutputPath;
+    std::atomic<bool> mEncSegmentFailed {false};
+    std::atomic<bool> mEncAudioFinished {false};
+
+    bool LoadEncoderParams(const imgui_json::value& jnParams, VideoEncoderParams& vidEncParams, AudioEncoderParams& audEncParams, std::string& errMsg);  // unspecified parameters fall back to timeline settings
+    static void SaveEncoderParams(const VideoEncoderParams& vidEncParams, const AudioEncoderParams& audEncParams, imgui_json::value& jnParams);  // json form accepted by 'LoadEncoderParams()'
     bool ConfigEncoder(const std::string& outputPath, VideoEncoderParams& vidEncParams, AudioEncoderParams& audEncParams, std::string& errMsg);
+    bool ConfigEncoder(std::vector<EncodingRendition>& renditions, std::string& errMsg);  // compose once at the largest size, encode all renditions in one pass
+    bool ConfigSegmentEncoders(const std::string& outputPath, VideoEncoderParams& vidEncParams, AudioEncoderParams& audEncParams, std::string& errMsg);
+    bool IsPassthroughClip(Clip* pClip);
+    bool OpenSegmentEncoder(EncodingSegment& segment, std::string& errMsg);
+    void ReleaseExportCachePins();
+    void DropMismatchedPassthroughSpans(int64_t refFrameIndex, std::vector<MEC::ExportSegment>& spans);
+    bool PrepareMismatchedPassthroughSegments(size_t& reencodeCount, std::string& errMsg);
+    bool FindCheckpointSegment(EncodingSegment& segment);
+    void CommitCheckpointSegment(const EncodingSegment& segment);
+    uint64_t CalcExportSegmentKey(int64_t startFrameIndex, int64_t endFrameIndex, const VideoEncoderParams& vidEncParams);
+    void AppendRangeStateDesc(int64_t startMs, int64_t endMs, std::ostringstream& oss);
+    void CollectPassthroughSpans(const VideoEncoderParams& vidEncParams, int64_t startMs, int64_t endMs, std::vector<MEC::ExportSegment>& spans);
     void StartEncoding();
     void StopEncoding();
     void _EncodeProc();
-    // encoding 
+    void _EncodeVideoComposeProc(EncodingMatQueue* pQueue, std::string* pErrMsg);
+    void _EncodeAudioComposeProc(EncodingMatQueue* pQueue, std::string* pErrMsg);
+    void _EncodeScaledOutputProc(EncodingScaledOutput* pOutput);
+    void _EncodeSegmentsProc();
+    void _EncodeSegmentWorkerProc(MediaCore::MultiTrackVideoReader::Holder hReader, std::atomic<size_t>* pNextSegIdx, std::vector<std::string>* pErrMsgs);
+    void _EncodeVideoSegmentProc(EncodingSegment* pSegment, MediaCore::MultiTrackVideoReader::Holder hReader, std::string* pErrMsg);
+    void _EncodeAudioOnlyProc(std::string* pErrMsg);
+    // encoding telemetry, time values are summed over the threads of a stage, so they can exceed the elapsed time
+    struct EncodingStats
+    {
+        double elapsedSec {0};              // wall time since the export started
+        double mediaSec {0};                // output duration encoded so far
+        double videoComposeSec {0};         // reading and composing video frames
+        double audioMixSec {0};             // reading and mixing audio samples
+        double encodeSec {0};               // inside the encoder calls
+        double concatSec {0};               // concatenating segments, segment export only
+        double composeQueueWaitSec {0};     // composing stages blocked on a full queue, the encoder is behind
+        double encodeQueueWaitSec {0};      // encoder blocked on an empty queue, composing is behind
+        int64_t videoFrames {0};            // composed video frames
+        int64_t audioBlocks {0};            // mixed audio sample blocks
+        double fps {0};
+        double realtimeFactor {0};          // output duration per second of wall time
+    };
+    struct EncodingStatCounters
+    {
+        std::atomic<int64_t> videoComposeUs {0};
+        std::atomic<int64_t> audioMixUs {0};
+        std::atomic<int64_t> encodeUs {0};
+        std::atomic<int64_t> concatUs {0};
+        std::atomic<int64_t> composeQueueWaitUs {0};
+        std::atomic<int64_t> encodeQueueWaitUs {0};
+        std::atomic<int64_t> videoFrames {0};
+        std::atomic<int64_t> audioBlocks {0};
+        void Reset();
+    };
+    EncodingStatCounters mEncStatCounters;
+    std::chrono::steady_clock::time_point mEncStartTp;
+    std::chrono::steady_clock::time_point mEncEndTp;
+    std::mutex mEncTpLock;                  // guards 'mEncStartTp' and 'mEncEndTp', the encoding thread ends the span the ui thread reads
+    bool mEncodingWriteReport {true};       // write '<output>.report.json' with the encoding stats when an export ends
+    EncodingStats GetEncodingStats();
+    static imgui_json::value EncodingStatsToJson(const EncodingStats& stats);
+    void _WriteEncodingReport();
+    // encoding
     std::thread mEncodingThread;
+    int mEncodingVideoQueueSize {8};        // max composed video frames waiting for encoder
+    int mEncodingAudioQueueSize {32};       // max mixed audio blocks waiting for encoder
     bool mIsEncoding {false};
     bool mQuitEncoding {false};
+    std::atomic<bool> mPauseEncoding {false};   // composing stops while set, the encoders drain and wait
     bool mEncodingInRange {false};
     int64_t mEncodingStart {0};
     int64_t mEncodingEnd {0};
     std::string mEncodeProcErrMsg;
+    std::string mEncodeNoticeMsg;           // not an error, like smart render finding no source it can copy
     float mEncodingProgress {0};
     float mEncodingDuration {0};
     std::mutex mEncodingMutex;
@@ -1319,7 +1571,43 @@ struct TimeLine
     ImGui::ImMat mEncodingAFrame;
     ImTextureID mEncodingPreviewTexture {nullptr};  // encoding preview texture
 
+    // Audio scope analysis runs on its own thread, fed with the mixed blocks by the pcm producer. Results are computed
+    // into the 'mAudioScope*' working buffers and copied to 'AudioAttribute::channel_data' for the UI only when its
+    // 'audio_mutex' is free, so neither the audio path nor the analysis ever waits on drawing.
+    struct AudioScopeJob
+    {
+        int64_t trackId;                            // -1 for the main audio out
+        ImGui::ImMat frame;
+    };
+    static constexpr size_t MAX_AUDIO_SCOPE_JOBS = 16;
+    std::list<AudioScopeJob> mAudioScopeJobs;
+    std::mutex mAudioScopeJobLock;
+    std::condition_variable mAudioScopeJobCv;
+    std::thread mAudioScopeThread;
+    bool mQuitAudioScope {false};
+    MEC::AudioScopeWorkspace mAudioScopeWork;
+    std::vector<MEC::SpectrogramRing> mAudioScopeSpectrograms;     // per channel, one row added on each block
+    uint32_t mAudioScopeSpectrogramLut[256];
+    float mAudioScopeSpectrogramLutLight {-1};             // 'mAudioSpectrogramLight' the LUT was built for
+    MEC::VectorScopeImage mAudioScopeVector;                // faded and redrawn on each block
+    // The scope thread never touches the tracks. 'SyncAudioTrackScopes()' on the UI thread hands over the channel count
+    // of each audio track and takes the levels computed since the last call.
+    struct AudioTrackScope
+    {
+        int channels {0};
+        bool updated {false};                               // 'decibels' are not taken by the UI yet
+        std::vector<float> decibels;
+    };
+    std::unordered_map<int64_t, AudioTrackScope> mAudioTrackScopes;    // track id -> scope state
+    std::mutex mAudioTrackScopeLock;
+    MEC::AudioScopeWorkspace mAudioTrackScopeWork;          // only used by the audio scope thread
+    void StartAudioScopeThread();
+    void StopAudioScopeThread();
+    void PostAudioScopeJob(int64_t trackId, const ImGui::ImMat& frame);
+    void AudioScopeProc();
     void CalculateAudioScopeData(ImGui::ImMat& mat);
+    void CalculateTrackAudioScopeData(int64_t trackId, ImGui::ImMat& mat);
+    void SyncAudioTrackScopes();
 
     int64_t attract_docking_pixels {20};    // clip attract docking sucking in pixels range
     int disattract_docking_rate {5};        // pulling range is 1/5
@@ -1345,6 +1633,7 @@ struct TimeLine
     bool bTransitionOutputPreview = true;   // project saved
     bool bSelectLinked = true;              // project saved
     bool bMovingAttract = true;             // project saved
+    int mSelectedClipCount {0};             // clips with 'bSelected' set, kept by 'MediaTrack::SelectClip()', 'Click()' and 'DeleteClip()'
 
     // Add By Jimmy: Start
     uint32_t mSortMethod {0};
@@ -1369,9 +1658,94 @@ struct TimeLine
     PlayerClock::time_point mPlayTriggerTp;
     std::unordered_set<int64_t> mNeedUpdateTrackIds;
 
+    // render-ahead preview cache, composes frames ahead of the playhead in background
+    bool mRenderAheadEnabled {false};
+    int mRenderAheadWorkerCount {1};
+    int64_t mRenderAheadMaxBytes {256LL*1024*1024};
+    MEC::RenderAheadCache::Holder mhRenderAheadCache;
+    bool mRenderAheadDirty {true};          // timeline is changed, the cache is bypassed until the changed ranges are invalidated
+    bool mRenderAheadFullDiff {true};       // compare all the tracks, otherwise only the ones in 'mRenderAheadDirtyTrackIds'
+    std::unordered_set<int64_t> mRenderAheadDirtyTrackIds;
+    PlayerClock::time_point mRenderAheadEditTp;
+    struct RenderAheadItemState
+    {
+        int64_t start;
+        int64_t end;
+        int64_t startOffset;
+    };
+    struct RenderAheadTrackState
+    {
+        int order {0};
+        uint32_t type {0};
+        bool view {true};
+        std::unordered_map<int64_t, RenderAheadItemState> items;  // clip or overlap id -> state
+    };
+    std::unordered_map<int64_t, RenderAheadTrackState> mRenderAheadTrackStates;
+    void MarkRenderAheadDirty(const std::unordered_set<int64_t>& trackIds);
+
+    // adaptive preview resolution
+    int mPreviewAdaptiveLevel {0};          // index in the preview scale steps, 0 is the full preview scale
+    bool mPreviewAdaptiveRestore {false};   // go back to the full preview scale on the next preview frame
+    bool mPreviewAdaptiveStepDown {false};  // lower the preview scale one step on the next preview frame
+    bool mPreviewZoomApplied {false};       // 'bPreviewZoom' of the applied scale, the preview window cap is lifted while magnifying
+    int mPreviewAdaptiveFrames {0};         // frames shown in the current measuring window
+    int mPreviewAdaptiveLateFrames {0};     // frames in the current measuring window that missed their time
+    PlayerClock::time_point mPreviewAdaptiveWindowTp;
+    ImVec2 mPreviewViewportSize {0, 0};     // on-screen size of the preview in pixels, caps the preview resolution
+    PlayerClock::time_point mPreviewViewportChangeTp;
+    bool mPreviewViewportChanged {false};
+    void SetPreviewViewportSize(const ImVec2& size);
+    float CalcAppliedPreviewScale(float previewScale, const MatUtils::Size2i& videoSize);
+    void UpdateAdaptivePreview();
+    void MeasureAdaptivePreview(const std::vector<MediaCore::CorrelativeFrame>& frames, int64_t composeUs);
+
+    // render in-to-out cache, the marked range is rendered into intra-frame files and played while the clips are unchanged
+    struct RenderCacheChunk
+    {
+        int64_t startFrameIndex;
+        int64_t endFrameIndex;
+        uint64_t key {0};                   // hash of the clip states in the chunk, recalculated after edits
+        bool rendered {false};              // a file with 'key' is in the render cache
+    };
+    MEC::ExportSegmentCache::Holder mhRenderCache;
+    std::vector<RenderCacheChunk> mRenderCacheChunks;   // grid aligned chunks of the rendered range, sorted
+    std::mutex mRenderCacheLock;
+    std::map<int64_t, MediaCore::MediaReader::Holder> mRenderCacheReaders; // chunk start frame index -> reader of the chunk file
+    std::thread mRenderCacheThread;
+    std::atomic<bool> mIsRenderingCache {false};
+    std::atomic<bool> mQuitRenderCache {false};
+    std::atomic<float> mRenderCacheProgress {0};
+    std::mutex mRenderCacheErrLock;
+    std::string mRenderCacheErrMsg;                     // guarded by 'mRenderCacheErrLock'
+    std::thread mRenderCacheOpenThread;                 // opens the chunk files, so the UI thread doesn't wait for them
+    std::atomic<bool> mIsOpeningRenderCache {false};
+    bool mRenderCacheKeysDirty {false};
+    int64_t mRenderCacheMaxBytes {8LL*1024*1024*1024};   // least recently used files beyond it are removed after each render
+    bool StartRenderInToOut(std::string& errMsg);
+    void StopRenderInToOut();
+    void ClearRenderInToOut();
+    bool ReadRenderCacheFrame(int64_t frameIndex, ImGui::ImMat& vmat);
+    void UpdateRenderCacheKeys();
+    uint64_t CalcRenderCacheKey(int64_t startFrameIndex, int64_t endFrameIndex);
+    int64_t GetRenderCacheChunkFrames();
+    void _RenderCacheProc(MediaCore::MultiTrackVideoReader::Holder hReader, VideoEncoderParams vidEncParams, std::vector<RenderCacheChunk> chunks);
+    void _OpenRenderCacheReadersProc(std::vector<RenderCacheChunk> chunks, std::vector<MediaCore::MediaReader::Holder> staleReaders);
+    void UpdateRenderAhead();
+    void InvalidateChangedRenderAheadRanges();
+
     bool mIsCutting {false};
     std::list<imgui_json::value> mOngoingActions;
     std::list<imgui_json::value> mUiActions;
+    std::unordered_set<int64_t> mSyncDirtyTracks;   // tracks touched by the performed actions, checked by 'SyncDataLayer()'
+    bool mSyncAllTracks {false};                    // an action didn't tell its tracks, 'SyncDataLayer()' checks all
+    // transitions set to data layer overlaps by 'SyncDataLayer()', by overlap ID, with the blueprint they're made of
+    struct SyncedTransition
+    {
+        MediaCore::VideoTransition::Holder hVideoTransition;
+        MediaCore::AudioTransition::Holder hAudioTransition;
+        std::string strBluePrint;
+    };
+    std::unordered_map<int64_t, SyncedTransition> mSyncedTransitions;
     void PrintActionList(const std::string& title, const std::list<imgui_json::value>& actionList);
     void PrintActionList(const std::string& title, const imgui_json::array& actionList);
     void PerformUiActions();
@@ -1380,11 +1754,17 @@ struct TimeLine
     void PerformImageAction(imgui_json::value& action);
     void PerformTextAction(imgui_json::value& action);
 
+    // Audio device stream. A producer thread mixes ahead into a single-producer single-consumer ring of pcm bytes,
+    // so 'Read()' on the device thread only copies out of it and never waits on the mixing.
     class SimplePcmStream : public MediaCore::AudioRender::ByteStream
     {
     public:
-        SimplePcmStream(TimeLine* owner) : m_owner(owner) {}
-        void SetAudioReader(MediaCore::MultiTrackAudioReader::Holder areader) { m_areader = areader; }
+        SimplePcmStream(TimeLine* owner) : m_owner(owner), m_ring(PCM_RING_SIZE) {}
+        ~SimplePcmStream() { StopProducer(); }
+        void SetAudioReader(MediaCore::MultiTrackAudioReader::Holder areader);
+        // stop and restart the mixing around a change of the audio reader settings
+        void StopProducer();
+        void StartProducer();
         uint32_t Read(uint8_t* buff, uint32_t buffSize, bool blocking) override;
         void Flush() override;
         bool GetTimestampMs(int64_t& ts) override
@@ -1399,13 +1779,44 @@ struct TimeLine
         }
 
     private:
+        void ProducerProc();
+        bool IsRingFull() const;
+        void WakeProducer();
+
+    private:
+        static constexpr uint32_t PCM_RING_SIZE = 1<<21;
+        static constexpr uint32_t PCM_MARK_COUNT = 256;
+        static constexpr int64_t PCM_AHEAD_MS = 120;   // how far the producer mixes ahead of the device
+        // position of a mixed block in the ring, to map a read position to its timestamp
+        struct PcmMark
+        {
+            uint64_t bytePos;
+            int64_t timestampMs;
+            uint32_t blockSize;
+            int64_t blockDurMs;
+        };
         TimeLine* m_owner;
         MediaCore::MultiTrackAudioReader::Holder m_areader;
-        ImGui::ImMat m_amat;
-        uint32_t m_readPosInAmat{0};
-        bool m_tsValid{false};
-        int64_t m_timestampMs{0};
-        std::mutex m_amatLock;
+        std::vector<uint8_t> m_ring;
+        std::atomic<uint64_t> m_writePos{0};        // total bytes written, only changed by the producer
+        std::atomic<uint64_t> m_readPos{0};         // total bytes read, only changed by the consumer
+        PcmMark m_marks[PCM_MARK_COUNT];
+        std::atomic<uint64_t> m_markWriteIdx{0};
+        std::atomic<uint64_t> m_markReadIdx{0};
+        uint32_t m_maxFillSize{PCM_RING_SIZE/2};
+        // 'Flush()' comes from another thread, the consumer drops everything written before 'm_flushWritePos'
+        std::mutex m_produceLock;
+        std::atomic<uint32_t> m_flushEpoch{0};
+        std::atomic<uint64_t> m_flushWritePos{0};
+        uint32_t m_readEpoch{0};
+        std::thread m_producer;
+        std::atomic<bool> m_quitProducer{false};
+        // the producer sleeps on 'm_spaceCv' while the ring is full, 'Read()' only takes the lock to wake it when it waits
+        std::mutex m_spaceLock;
+        std::condition_variable m_spaceCv;
+        std::atomic<bool> m_producerWaiting{false};
+        std::atomic<bool> m_tsValid{false};
+        std::atomic<int64_t> m_timestampMs{0};
     };
     SimplePcmStream mPcmStream;
 
@@ -1463,8 +1874,8 @@ struct TimeLine
             const ImRect &titleRect, const ImRect &clippingTitleRect, const ImRect &legendRect, const ImRect &clippingRect, const ImRect &legendClippingRect,
             int64_t mouse_time, bool is_moving, bool enable_select, bool is_updated, std::list<imgui_json::value>* pActionList);
     
-    std::vector<MediaCore::CorrelativeFrame> GetPreviewFrame(bool blocking = false);
-    bool UpdatePreviewTexture(bool blocking = false);
+    std::vector<MediaCore::CorrelativeFrame> GetPreviewFrame(bool blocking = false, bool useRenderAhead = false);
+    bool UpdatePreviewTexture(bool blocking = false, bool useRenderAhead = false);
     float GetAudioLevel(int channel);
     void SetAudioLevel(int channel, float level);
 
@@ -1480,7 +1891,8 @@ struct TimeLine
     void RefreshTrackView(const std::unordered_set<int64_t>& trackIds);
     int64_t ValidDuration();
 
-    MediaCore::AudioRender* mAudioRender {nullptr};                // audio render(SDL)
+    MediaCore::AudioRender* mAudioRender {nullptr};                // audio render(SDL), null for a headless timeline
+    const bool mHeadless;
 
     MediaItem* FindMediaItemByName(std::string name);   // Find media from bank by name
     MediaItem* FindMediaItemByID(int64_t id);           // Find media from bank by ID
@@ -1527,8 +1939,9 @@ struct TimeLine
     void UpdateVideoSettings(MediaCore::SharedSettings::Holder hSettings, float previewScale);
     void UpdateAudioSettings(MediaCore::SharedSettings::Holder hSettings, MediaCore::AudioRender::PcmFormat pcmFormat);
 
-    std::list<imgui_json::value> mHistoryRecords;
-    std::list<imgui_json::value>::iterator mRecordIter;
+    MEC::UndoHistory::Holder mhUndoHistory;
+    int mHistoryMaxRecords {1000};          // oldest undo records beyond it are dropped
+    int mHistoryMemoryLimit {64};           // MB of packed undo records kept in memory, older ones are spilled to the cache dir
     void AddNewRecord(imgui_json::value& record);
     bool UndoOneRecord();
     bool RedoOneRecord();
@@ -1536,6 +1949,8 @@ struct TimeLine
     int64_t AddNewClip(int64_t media_id, uint32_t media_type, int64_t track_id, int64_t start, int64_t start_offset, int64_t end, int64_t end_offset, int64_t group_id, int64_t clip_id = -1, std::list<imgui_json::value>* pActionList = nullptr);
 };
 
+// Append the encoder options of a json object {name: value} to 'aOpts', false if 'jnOpts' is not an object
+bool LoadEncoderExtraOptions(const imgui_json::value& jnOpts, std::vector<MediaCore::MediaEncoder::Option>& aOpts);
 bool DrawTimeLine(TimeLine *timeline, bool *expanded, bool& need_save, bool editable = true);
 bool DrawClipTimeLine(TimeLine* main_timeline, BaseEditingClip * editingClip, int header_height, int custom_height, bool& show_BP, bool& changed);
 bool DrawOverlapTimeLine(BaseEditingOverlap * overlap, int64_t CurrentTime, int header_height, int custom_height);
@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <Logger.h>
+#include <ThreadUtils.h>
+#include "RenderAheadCache.h"
+
+using namespace std;
+using namespace Logger;
+
+namespace MEC
+{
+static const int64_t RENDER_AHEAD_CHUNK_FRAMES = 8;     // frames rendered in one go by a worker, so its reader decodes sequentially
+static const int64_t BEHIND_PLAYHEAD_DISTANCE = numeric_limits<int64_t>::max()/4;
+
+RenderAheadCache::Holder RenderAheadCache::CreateInstance(int iWorkerCount, int64_t i64MaxBytes)
+{
+    if (iWorkerCount < 1)
+        iWorkerCount = 1;
+    return Holder(new RenderAheadCache(iWorkerCount, i64MaxBytes));
+}
+
+RenderAheadCache::RenderAheadCache(int iWorkerCount, int64_t i64MaxBytes)
+    : m_aWorkers(iWorkerCount), m_i64MaxBytes(i64MaxBytes)
+{
+    for (int i = 0; i < iWorkerCount; i++)
+    {
+        m_aWorkers[i].thWorker = thread(&RenderAheadCache::WorkerProc, this, i);
+        SysUtils::SetThreadName(m_aWorkers[i].thWorker, "TL-RndAhead"+to_string(i));
+    }
+}
+
+RenderAheadCache::~RenderAheadCache()
+{
+    {
+        lock_guard<mutex> lk(m_mtxFrames);
+        m_bQuit = true;
+    }
+    m_cvWork.notify_all();
+    for (auto& worker : m_aWorkers)
+    {
+        if (worker.thWorker.joinable())
+            worker.thWorker.join();
+    }
+}
+
+void RenderAheadCache::SetReaders(const vector<MediaCore::MultiTrackVideoReader::Holder>& aReaders)
+{
+    {
+        lock_guard<mutex> lk(m_mtxFrames);
+        for (size_t i = 0; i < m_aWorkers.size(); i++)
+            m_aWorkers[i].hReader = i < aReaders.size() ? aReaders[i] : nullptr;
+        m_bReadersValid = aReaders.size() >= m_aWorkers.size();
+        m_aFailedFrames.clear();
+        m_u32Epoch++;
+    }
+    m_cvWork.notify_all();
+}
+
+void RenderAheadCache::SetPlayhead(int64_t i64FrameIndex, bool bForward, int64_t i64EndFrameIndex, bool bSuspend)
+{
+    {
+        lock_guard<mutex> lk(m_mtxFrames);
+        if (m_i64Playhead == i64FrameIndex && m_bForward == bForward && m_i64EndFrameIndex == i64EndFrameIndex && m_bSuspended == bSuspend)
+            return;
+        m_i64Playhead = i64FrameIndex;
+        m_bForward = bForward;
+        m_i64EndFrameIndex = i64EndFrameIndex;
+        m_bSuspended = bSuspend;
+    }
+    m_cvWork.notify_all();
+}
+
+bool RenderAheadCache::GetFrame(int64_t i64FrameIndex, ImGui::ImMat& vmat)
+{
+    lock_guard<mutex> lk(m_mtxFrames);
+    auto iter = m_aFrames.find(i64FrameIndex);
+    if (iter == m_aFrames.end())
+        return false;
+    vmat = iter->second;
+    return true;
+}
+
+void RenderAheadCache::Invalidate(int64_t i64StartFrameIndex, int64_t i64EndFrameIndex)
+{
+    lock_guard<mutex> lk(m_mtxFrames);
+    auto itBegin = m_aFrames.lower_bound(i64StartFrameIndex);
+    auto itEnd = m_aFrames.lower_bound(i64EndFrameIndex);
+    for (auto iter = itBegin; iter != itEnd; iter++)
+        m_i64CachedBytes -= iter->second.total()*iter->second.elemsize;
+    m_aFrames.erase(itBegin, itEnd);
+    m_aFailedFrames.erase(m_aFailedFrames.lower_bound(i64StartFrameIndex), m_aFailedFrames.lower_bound(i64EndFrameIndex));
+    // the worker readers still hold the old timeline, wait for 'SetReaders()'
+    m_bReadersValid = false;
+    m_u32Epoch++;
+}
+
+void RenderAheadCache::Clear()
+{
+    lock_guard<mutex> lk(m_mtxFrames);
+    m_aFrames.clear();
+    m_aFailedFrames.clear();
+    m_i64CachedBytes = 0;
+    m_i64FrameBytes = 0;
+    m_u32Epoch++;
+}
+
+void RenderAheadCache::SetMaxBytes(int64_t i64MaxBytes)
+{
+    {
+        lock_guard<mutex> lk(m_mtxFrames);
+        m_i64MaxBytes = i64MaxBytes;
+        while (m_i64CachedBytes > m_i64MaxBytes && !m_aFrames.empty())
+        {
+            auto iter = Distance(m_aFrames.begin()->first) > Distance(m_aFrames.rbegin()->first) ? m_aFrames.begin() : prev(m_aFrames.end());
+            m_i64CachedBytes -= iter->second.total()*iter->second.elemsize;
+            m_aFrames.erase(iter);
+        }
+    }
+    m_cvWork.notify_all();
+}
+
+int64_t RenderAheadCache::GetCachedBytes()
+{
+    lock_guard<mutex> lk(m_mtxFrames);
+    return m_i64CachedBytes;
+}
+
+void RenderAheadCache::GetCachedRanges(vector<pair<int64_t, int64_t>>& aRanges)
+{
+    aRanges.clear();
+    lock_guard<mutex> lk(m_mtxFrames);
+    for (const auto& elem : m_aFrames)
+    {
+        if (!aRanges.empty() && aRanges.back().second == elem.first)
+            aRanges.back().second++;
+        else
+            aRanges.push_back({elem.first, elem.first+1});
+    }
+}
+
+int64_t RenderAheadCache::Distance(int64_t i64FrameIndex) const
+{
+    if (m_bForward)
+        return i64FrameIndex >= m_i64Playhead ? i64FrameIndex-m_i64Playhead : BEHIND_PLAYHEAD_DISTANCE+m_i64Playhead-i64FrameIndex;
+    else
+        return i64FrameIndex <= m_i64Playhead ? m_i64Playhead-i64FrameIndex : BEHIND_PLAYHEAD_DISTANCE+i64FrameIndex-m_i64Playhead;
+}
+
+bool RenderAheadCache::MakeRoom(int64_t i64FrameIndex, int64_t i64Bytes)
+{
+    // the farthest frame is always at one end of the map, the behind ones count as farther than any ahead
+    while (m_i64CachedBytes+i64Bytes > m_i64MaxBytes)
+    {
+        if (m_aFrames.empty())
+            return false;
+        auto iter = Distance(m_aFrames.begin()->first) > Distance(m_aFrames.rbegin()->first) ? m_aFrames.begin() : prev(m_aFrames.end());
+        if (Distance(iter->first) <= Distance(i64FrameIndex))
+            return false;
+        m_i64CachedBytes -= iter->second.total()*iter->second.elemsize;
+        m_aFrames.erase(iter);
+    }
+    return true;
+}
+
+bool RenderAheadCache::PickChunk(int64_t& i64StartFrameIndex, int64_t& i64EndFrameIndex)
+{
+    if (m_bSuspended || !m_bReadersValid || m_i64EndFrameIndex <= 0)
+        return false;
+    // keep a quarter of the budget for the frames just played, so a short step back is still cached
+    int64_t i64WindowFrames = RENDER_AHEAD_CHUNK_FRAMES;
+    if (m_i64FrameBytes > 0)
+        i64WindowFrames = max(i64WindowFrames, m_i64MaxBytes*3/4/m_i64FrameBytes);
+    auto isAvailable = [this] (int64_t idx) {
+        if (m_aFrames.find(idx) != m_aFrames.end() || m_aFailedFrames.find(idx) != m_aFailedFrames.end())
+            return false;
+        auto iter = m_aRendering.upper_bound(idx);
+        if (iter == m_aRendering.begin())
+            return true;
+        iter--;
+        return idx >= iter->second;
+    };
+    const int64_t i64Step = m_bForward ? 1 : -1;
+    const int64_t i64WindowEnd = m_bForward ? min(m_i64EndFrameIndex, m_i64Playhead+i64WindowFrames) : max((int64_t)-1, m_i64Playhead-i64WindowFrames);
+    int64_t idx = m_i64Playhead;
+    while (idx != i64WindowEnd && !isAvailable(idx))
+        idx += i64Step;
+    if (idx == i64WindowEnd)
+        return false;
+    // with the budget used up by frames nearer than this one, rendering it would only be dropped again
+    if (m_i64FrameBytes > 0 && m_i64CachedBytes+m_i64FrameBytes > m_i64MaxBytes && !m_aFrames.empty())
+    {
+        const int64_t i64Farthest = max(Distance(m_aFrames.begin()->first), Distance(m_aFrames.rbegin()->first));
+        if (i64Farthest <= Distance(idx))
+            return false;
+    }
+    int64_t i64Last = idx;
+    while (i64Last+i64Step != i64WindowEnd && (i64Last-idx)*i64Step+1 < RENDER_AHEAD_CHUNK_FRAMES && isAvailable(i64Last+i64Step))
+        i64Last += i64Step;
+    i64StartFrameIndex = min(idx, i64Last);
+    i64EndFrameIndex = max(idx, i64Last)+1;
+    m_aRendering[i64StartFrameIndex] = i64EndFrameIndex;
+    return true;
+}
+
+void RenderAheadCache::WorkerProc(int iWorkerIdx)
+{
+    Log(DEBUG) << "Enter RenderAheadCache::WorkerProc(" << iWorkerIdx << ")..." << endl;
+    while (true)
+    {
+        int64_t i64StartFrameIndex, i64EndFrameIndex;
+        MediaCore::MultiTrackVideoReader::Holder hReader;
+        uint32_t u32Epoch;
+        {
+            unique_lock<mutex> lk(m_mtxFrames);
+            m_cvWork.wait(lk, [&] { return m_bQuit || PickChunk(i64StartFrameIndex, i64EndFrameIndex); });
+            if (m_bQuit)
+                break;
+            hReader = m_aWorkers[iWorkerIdx].hReader;
+            u32Epoch = m_u32Epoch;
+        }
+        // render the chunk in ascending order, also when playing backward
+        for (int64_t idx = i64StartFrameIndex; idx < i64EndFrameIndex; idx++)
+        {
+            ImGui::ImMat vmat;
+            const bool bRead = hReader->ReadVideoFrameByIdx(idx, vmat);
+            if (!bRead)
+                Log(WARN) << "RenderAheadCache: FAILED to read frame #" << idx << "! " << hReader->GetError() << endl;
+            lock_guard<mutex> lk(m_mtxFrames);
+            if (m_bQuit || u32Epoch != m_u32Epoch)
+                break;
+            if (!bRead || vmat.empty())
+            {
+                // keep the worker from picking it over and over
+                m_aFailedFrames.insert(idx);
+                if (!bRead)
+                    break;
+                continue;
+            }
+            const int64_t i64Bytes = vmat.total()*vmat.elemsize;
+            m_i64FrameBytes = i64Bytes;
+            if (m_aFrames.find(idx) != m_aFrames.end() || !MakeRoom(idx, i64Bytes))
+                continue;
+            m_aFrames[idx] = vmat;
+            m_i64CachedBytes += i64Bytes;
+        }
+        {
+            lock_guard<mutex> lk(m_mtxFrames);
+            m_aRendering.erase(i64StartFrameIndex);
+        }
+        m_cvWork.notify_all();
+    }
+    Log(DEBUG) << "Leave RenderAheadCache::WorkerProc(" << iWorkerIdx << ")." << endl;
+}
+}
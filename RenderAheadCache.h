@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <immat.h>
+#include "MultiTrackVideoReader.h"
+
+namespace MEC
+{
+    // RAM bounded cache of composed preview frames. Worker threads, each owning a clone of the preview reader, render the
+    // frames ahead of the playhead in the play direction, so sections with heavy effects can play after a short pre-roll.
+    // Frames behind the playhead are evicted first when the byte budget is exceeded.
+    class RenderAheadCache
+    {
+    public:
+        using Holder = std::shared_ptr<RenderAheadCache>;
+        static Holder CreateInstance(int iWorkerCount, int64_t i64MaxBytes);
+        ~RenderAheadCache();
+
+        // Replace the worker readers after the timeline is changed, 'aReaders' must have one reader per worker.
+        // Rendering is suspended by 'Invalidate()' until new readers are set.
+        void SetReaders(const std::vector<MediaCore::MultiTrackVideoReader::Holder>& aReaders);
+        void SetPlayhead(int64_t i64FrameIndex, bool bForward, int64_t i64EndFrameIndex, bool bSuspend);
+        bool GetFrame(int64_t i64FrameIndex, ImGui::ImMat& vmat);
+        // Drop the frames in [i64StartFrameIndex, i64EndFrameIndex)
+        void Invalidate(int64_t i64StartFrameIndex, int64_t i64EndFrameIndex);
+        void Clear();
+        void SetMaxBytes(int64_t i64MaxBytes);
+        int64_t GetCachedBytes();
+        // Contiguous cached frame ranges as [start, end) pairs, for drawing the render bar
+        void GetCachedRanges(std::vector<std::pair<int64_t, int64_t>>& aRanges);
+        int GetWorkerCount() const { return (int)m_aWorkers.size(); }
+
+    private:
+        RenderAheadCache(int iWorkerCount, int64_t i64MaxBytes);
+        void WorkerProc(int iWorkerIdx);
+        bool PickChunk(int64_t& i64StartFrameIndex, int64_t& i64EndFrameIndex);
+        bool MakeRoom(int64_t i64FrameIndex, int64_t i64Bytes);
+        int64_t Distance(int64_t i64FrameIndex) const;
+
+    private:
+        struct Worker
+        {
+            std::thread thWorker;
+            MediaCore::MultiTrackVideoReader::Holder hReader;
+        };
+        std::vector<Worker> m_aWorkers;
+        std::map<int64_t, ImGui::ImMat> m_aFrames;              // frame index -> composed frame
+        std::map<int64_t, int64_t> m_aRendering;                // start frame index -> end frame index of the chunks being rendered
+        std::set<int64_t> m_aFailedFrames;                      // frames failed to read or empty, not picked again until the readers change
+        int64_t m_i64CachedBytes {0};
+        int64_t m_i64MaxBytes;
+        int64_t m_i64FrameBytes {0};                            // size of the last rendered frame, to size the render-ahead window
+        int64_t m_i64Playhead {0};
+        int64_t m_i64EndFrameIndex {0};
+        bool m_bForward {true};
+        bool m_bSuspended {true};
+        bool m_bReadersValid {false};
+        uint32_t m_u32Epoch {0};                                // increased on each invalidation, frames rendered in an earlier epoch are dropped
+        bool m_bQuit {false};
+        std::mutex m_mtxFrames;
+        std::condition_variable m_cvWork;
+    };
+}
@@ -0,0 +1,556 @@
+#include <cstring>
+#include <chrono>
+#include <sstream>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <Logger.h>
+#include <FileSystemUtils.h>
+#include "UndoHistory.h"
+
+using namespace std;
+using namespace Logger;
+
+namespace MEC
+{
+static const size_t PACK_MIN_MATCH = 4;     // shortest match coded as a back reference
+static const int PACK_HASH_BITS = 16;
+
+static void WriteVarint(string& strOut, uint64_t u64Value)
+{
+    while (u64Value >= 0x80)
+    {
+        strOut.push_back((char)(uint8_t)(u64Value|0x80));
+        u64Value >>= 7;
+    }
+    strOut.push_back((char)(uint8_t)u64Value);
+}
+
+static bool ReadVarint(const string& strIn, size_t& szPos, uint64_t& u64Value)
+{
+    u64Value = 0;
+    for (int iShift = 0; iShift < 64; iShift += 7)
+    {
+        if (szPos >= strIn.size())
+            return false;
+        const uint8_t u8Byte = (uint8_t)strIn[szPos++];
+        u64Value |= (uint64_t)(u8Byte&0x7f) << iShift;
+        if ((u8Byte&0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+static uint32_t HashBytes4(const char* pData)
+{
+    uint32_t u32Value;
+    memcpy(&u32Value, pData, sizeof(u32Value));
+    return (u32Value*2654435761U) >> (32-PACK_HASH_BITS);
+}
+
+void UndoHistory::Pack(const string& strIn, string& strOut)
+{
+    // greedy LZ77: [literal count, literals, match length - PACK_MIN_MATCH, match distance]..., ending with literals
+    const size_t szInSize = strIn.size();
+    strOut.clear();
+    strOut.reserve(szInSize/3+16);
+    WriteVarint(strOut, szInSize);
+    vector<int64_t> aTable(1<<PACK_HASH_BITS, -1);
+    const char* pIn = strIn.data();
+    size_t szAnchor = 0, i = 0;
+    while (i+PACK_MIN_MATCH <= szInSize)
+    {
+        const uint32_t u32Hash = HashBytes4(pIn+i);
+        const int64_t i64Candidate = aTable[u32Hash];
+        aTable[u32Hash] = (int64_t)i;
+        if (i64Candidate < 0 || memcmp(pIn+i64Candidate, pIn+i, PACK_MIN_MATCH) != 0)
+        {
+            i++;
+            continue;
+        }
+        size_t szMatch = PACK_MIN_MATCH;
+        while (i+szMatch < szInSize && pIn[i64Candidate+szMatch] == pIn[i+szMatch])
+            szMatch++;
+        WriteVarint(strOut, i-szAnchor);
+        strOut.append(pIn+szAnchor, i-szAnchor);
+        WriteVarint(strOut, szMatch-PACK_MIN_MATCH);
+        WriteVarint(strOut, i-(size_t)i64Candidate);
+        const size_t szMatchEnd = i+szMatch;
+        for (i++; i < szMatchEnd && i+PACK_MIN_MATCH <= szInSize; i++)
+            aTable[HashBytes4(pIn+i)] = (int64_t)i;
+        i = szAnchor = szMatchEnd;
+    }
+    WriteVarint(strOut, szInSize-szAnchor);
+    strOut.append(pIn+szAnchor, szInSize-szAnchor);
+}
+
+bool UndoHistory::Unpack(const string& strIn, string& strOut)
+{
+    size_t szPos = 0;
+    uint64_t u64OutSize, u64Literals, u64Match, u64Distance;
+    if (!ReadVarint(strIn, szPos, u64OutSize) || u64OutSize > strIn.size()*1024ULL+64)
+        return false;
+    strOut.clear();
+    strOut.reserve(u64OutSize);
+    while (true)
+    {
+        if (!ReadVarint(strIn, szPos, u64Literals) || u64Literals > strIn.size()-szPos || strOut.size()+u64Literals > u64OutSize)
+            return false;
+        strOut.append(strIn, szPos, u64Literals);
+        szPos += u64Literals;
+        if (strOut.size() == u64OutSize)
+            break;
+        if (!ReadVarint(strIn, szPos, u64Match) || !ReadVarint(strIn, szPos, u64Distance))
+            return false;
+        u64Match += PACK_MIN_MATCH;
+        if (u64Distance == 0 || u64Distance > strOut.size() || strOut.size()+u64Match > u64OutSize)
+            return false;
+        // the match can overlap its own output, so it's copied byte by byte
+        size_t szFrom = strOut.size()-u64Distance;
+        for (uint64_t j = 0; j < u64Match; j++)
+            strOut.push_back(strOut[szFrom+j]);
+    }
+    return szPos == strIn.size();
+}
+
+static bool JsonEqual(const imgui_json::value& jnA, const imgui_json::value& jnB)
+{
+    if (jnA.type() != jnB.type())
+        return false;
+    switch (jnA.type())
+    {
+    case imgui_json::type_t::object:
+    {
+        const auto& objA = jnA.get<imgui_json::object>();
+        const auto& objB = jnB.get<imgui_json::object>();
+        if (objA.size() != objB.size())
+            return false;
+        for (auto itA = objA.begin(), itB = objB.begin(); itA != objA.end(); ++itA, ++itB)
+        {
+            if (itA->first != itB->first || !JsonEqual(itA->second, itB->second))
+                return false;
+        }
+        return true;
+    }
+    case imgui_json::type_t::array:
+    {
+        const auto& arrA = jnA.get<imgui_json::array>();
+        const auto& arrB = jnB.get<imgui_json::array>();
+        if (arrA.size() != arrB.size())
+            return false;
+        for (size_t i = 0; i < arrA.size(); i++)
+        {
+            if (!JsonEqual(arrA[i], arrB[i]))
+                return false;
+        }
+        return true;
+    }
+    case imgui_json::type_t::string:
+        return jnA.get<imgui_json::string>() == jnB.get<imgui_json::string>();
+    case imgui_json::type_t::number:
+        return jnA.get<imgui_json::number>() == jnB.get<imgui_json::number>();
+    case imgui_json::type_t::boolean:
+        return jnA.get<imgui_json::boolean>() == jnB.get<imgui_json::boolean>();
+    default:
+        return true;
+    }
+}
+
+// A diff is an object with the members
+//   "=": the new value, replacing the old one
+//   "set": object members or array elements (by index) added or replaced
+//   "del": names of the removed object members
+//   "sub": diffs of the object members or array elements (by index) which are changed inside
+//   "splice": [index, count, [values]], array elements replacing 'count' ones from 'index'
+static bool DiffValue(const imgui_json::value& jnFrom, const imgui_json::value& jnTo, imgui_json::value& jnDiff)
+{
+    const bool bContainer = jnFrom.is_object() || jnFrom.is_array();
+    if (jnFrom.type() != jnTo.type() || !bContainer)
+    {
+        if (JsonEqual(jnFrom, jnTo))
+            return false;
+        jnDiff = imgui_json::value(imgui_json::object());
+        jnDiff["="] = jnTo;
+        return true;
+    }
+
+    imgui_json::object set, sub;
+    imgui_json::array del;
+    auto diffMember = [&] (const string& strKey, const imgui_json::value& jnFromMember, const imgui_json::value& jnToMember) {
+        imgui_json::value jnMemberDiff;
+        if (!DiffValue(jnFromMember, jnToMember, jnMemberDiff))
+            return;
+        if (jnMemberDiff.contains("="))
+            set[strKey] = jnMemberDiff["="];
+        else
+            sub[strKey] = std::move(jnMemberDiff);
+    };
+    bool bSpliced = false;
+    jnDiff = imgui_json::value(imgui_json::object());
+    if (jnFrom.is_object())
+    {
+        const auto& objFrom = jnFrom.get<imgui_json::object>();
+        const auto& objTo = jnTo.get<imgui_json::object>();
+        for (const auto& item : objTo)
+        {
+            auto iter = objFrom.find(item.first);
+            if (iter == objFrom.end())
+                set[item.first] = item.second;
+            else
+                diffMember(item.first, iter->second, item.second);
+        }
+        for (const auto& item : objFrom)
+        {
+            if (objTo.find(item.first) == objTo.end())
+                del.push_back(imgui_json::string(item.first));
+        }
+    }
+    else
+    {
+        const auto& arrFrom = jnFrom.get<imgui_json::array>();
+        const auto& arrTo = jnTo.get<imgui_json::array>();
+        if (arrFrom.size() == arrTo.size())
+        {
+            for (size_t i = 0; i < arrTo.size(); i++)
+                diffMember(to_string(i), arrFrom[i], arrTo[i]);
+        }
+        else
+        {
+            // elements are inserted or removed, only the range between the unchanged head and tail is stored
+            const size_t szMin = min(arrFrom.size(), arrTo.size());
+            size_t szHead = 0, szTail = 0;
+            while (szHead < szMin && JsonEqual(arrFrom[szHead], arrTo[szHead]))
+                szHead++;
+            while (szTail < szMin-szHead && JsonEqual(arrFrom[arrFrom.size()-1-szTail], arrTo[arrTo.size()-1-szTail]))
+                szTail++;
+            imgui_json::array splice;
+            splice.push_back(imgui_json::number(szHead));
+            splice.push_back(imgui_json::number(arrFrom.size()-szHead-szTail));
+            splice.push_back(imgui_json::array(arrTo.begin()+szHead, arrTo.end()-szTail));
+            jnDiff["splice"] = std::move(splice);
+            bSpliced = true;
+        }
+    }
+    const bool bChanged = bSpliced || !set.empty() || !del.empty() || !sub.empty();
+    if (!set.empty())
+        jnDiff["set"] = std::move(set);
+    if (!del.empty())
+        jnDiff["del"] = std::move(del);
+    if (!sub.empty())
+        jnDiff["sub"] = std::move(sub);
+    return bChanged;
+}
+
+imgui_json::value UndoHistory::Diff(const imgui_json::value& jnFrom, const imgui_json::value& jnTo)
+{
+    imgui_json::value jnDiff;
+    if (!DiffValue(jnFrom, jnTo, jnDiff))
+        jnDiff = imgui_json::value(imgui_json::object());
+    return jnDiff;
+}
+
+imgui_json::value UndoHistory::Patch(const imgui_json::value& jnFrom, const imgui_json::value& jnDiff)
+{
+    if (!jnDiff.is_object())
+        return jnFrom;
+    if (jnDiff.contains("="))
+        return jnDiff["="];
+    imgui_json::value jnResult = jnFrom;
+    if (jnResult.is_object())
+    {
+        auto& objResult = jnResult.get<imgui_json::object>();
+        if (jnDiff.contains("del"))
+        {
+            for (const auto& jnKey : jnDiff["del"].get<imgui_json::array>())
+                objResult.erase(jnKey.get<imgui_json::string>());
+        }
+        if (jnDiff.contains("set"))
+        {
+            for (const auto& item : jnDiff["set"].get<imgui_json::object>())
+                objResult[item.first] = item.second;
+        }
+        if (jnDiff.contains("sub"))
+        {
+            for (const auto& item : jnDiff["sub"].get<imgui_json::object>())
+            {
+                auto iter = objResult.find(item.first);
+                if (iter != objResult.end())
+                    iter->second = Patch(iter->second, item.second);
+            }
+        }
+    }
+    else if (jnResult.is_array())
+    {
+        auto& arrResult = jnResult.get<imgui_json::array>();
+        if (jnDiff.contains("splice"))
+        {
+            const auto& splice = jnDiff["splice"].get<imgui_json::array>();
+            const size_t szIndex = min((size_t)splice[0].get<imgui_json::number>(), arrResult.size());
+            const size_t szCount = min((size_t)splice[1].get<imgui_json::number>(), arrResult.size()-szIndex);
+            const auto& values = splice[2].get<imgui_json::array>();
+            arrResult.erase(arrResult.begin()+szIndex, arrResult.begin()+szIndex+szCount);
+            arrResult.insert(arrResult.begin()+szIndex, values.begin(), values.end());
+        }
+        auto patchElements = [&] (const char* pName, bool bReplace) {
+            if (!jnDiff.contains(pName))
+                return;
+            for (const auto& item : jnDiff[pName].get<imgui_json::object>())
+            {
+                const size_t szIndex = (size_t)stoull(item.first);
+                if (szIndex < arrResult.size())
+                    arrResult[szIndex] = bReplace ? item.second : Patch(arrResult[szIndex], item.second);
+            }
+        };
+        patchElements("set", true);
+        patchElements("sub", false);
+    }
+    return jnResult;
+}
+
+UndoHistory::Holder UndoHistory::CreateInstance(int iMaxRecords, int64_t i64MaxMemBytes)
+{
+    return Holder(new UndoHistory(iMaxRecords, i64MaxMemBytes));
+}
+
+UndoHistory::~UndoHistory()
+{
+    CloseSpillFile();
+}
+
+void UndoHistory::Push(const imgui_json::value& jnRecord)
+{
+    // truncate the records which could be redone
+    DropBack();
+
+    Entry entry;
+    Pack(jnRecord.dump(), entry.strPacked);
+    m_i64MemBytes += entry.strPacked.size();
+    m_aEntries.push_back(std::move(entry));
+    m_szCursor = m_aEntries.size();
+    EnforceBudget();
+}
+
+bool UndoHistory::Undo(imgui_json::value& jnRecord)
+{
+    if (m_szCursor == 0)
+        return false;
+    m_szCursor--;
+    if (!LoadEntry(m_szCursor, jnRecord))
+    {
+        // the older records can't be undone without this one
+        Log(WARN) << "FAILED to load undo record #" << m_szCursor << ", the " << m_szCursor+1 << " oldest records are dropped." << endl;
+        while (m_szCursor > 0)
+            DropFront();
+        DropFront();
+        return false;
+    }
+    return true;
+}
+
+bool UndoHistory::Redo(imgui_json::value& jnRecord)
+{
+    if (m_szCursor >= m_aEntries.size())
+        return false;
+    if (!LoadEntry(m_szCursor, jnRecord))
+    {
+        Log(WARN) << "FAILED to load redo record #" << m_szCursor << ", the records to redo are dropped." << endl;
+        DropBack();
+        return false;
+    }
+    m_szCursor++;
+    return true;
+}
+
+void UndoHistory::Clear()
+{
+    m_aEntries.clear();
+    m_szCursor = 0;
+    m_szFirstInMemory = 0;
+    m_i64MemBytes = 0;
+    CloseSpillFile();
+}
+
+void UndoHistory::SetBudget(int iMaxRecords, int64_t i64MaxMemBytes)
+{
+    m_iMaxRecords = iMaxRecords;
+    m_i64MaxMemBytes = i64MaxMemBytes;
+    EnforceBudget();
+}
+
+void UndoHistory::SetSpillDir(const string& strSpillDir)
+{
+    // the records already spilled stay in the file opened before
+    m_strSpillDir = strSpillDir;
+    if (!strSpillDir.empty())
+        RemoveStaleSpillFiles(strSpillDir);
+}
+
+void UndoHistory::RemoveStaleSpillFiles(const string& strSpillDir)
+{
+    // a crash leaves the spill file behind, so the directory is cleaned the first time it's used in this process.
+    // The file of another running instance is kept open by it, which either makes the deletion fail or only unlinks
+    // the name while the open file stays readable.
+    static mutex s_mtxCleaned;
+    static set<string> s_aCleanedDirs;
+    {
+        lock_guard<mutex> lk(s_mtxCleaned);
+        if (!s_aCleanedDirs.insert(strSpillDir).second)
+            return;
+    }
+    if (!SysUtils::IsDirectory(strSpillDir))
+        return;
+    auto hFileIter = SysUtils::FileIterator::CreateInstance(strSpillDir);
+    hFileIter->SetFilterPattern("UndoHistory_.+\\.bin", true);
+    hFileIter->StartParsing();
+    int iRemoved = 0;
+    for (const auto& strPath : hFileIter->GetAllFilePaths())
+    {
+        if (SysUtils::DeleteFileAt(strPath))
+            iRemoved++;
+    }
+    if (iRemoved > 0)
+        Log(DEBUG) << "Removed " << iRemoved << " stale undo history file(s) from '" << strSpillDir << "'." << endl;
+}
+
+void UndoHistory::EnforceBudget()
+{
+    // only the records which can be undone are dropped, the ones to redo depend on them
+    while ((int)m_aEntries.size() > m_iMaxRecords && m_szCursor > 0)
+        DropFront();
+    while (m_i64MemBytes > m_i64MaxMemBytes && m_szFirstInMemory < m_aEntries.size())
+    {
+        if (SpillEntry(m_szFirstInMemory))
+            continue;
+        if (m_szCursor == 0)
+            break;
+        DropFront();
+    }
+}
+
+void UndoHistory::DropFront()
+{
+    if (m_aEntries.empty())
+        return;
+    m_i64MemBytes -= m_aEntries.front().strPacked.size();
+    m_aEntries.pop_front();
+    if (m_szCursor > 0)
+        m_szCursor--;
+    if (m_szFirstInMemory > 0)
+        m_szFirstInMemory--;
+    // no spilled record is left, the file is written again from its start
+    if (m_szFirstInMemory == 0)
+        m_i64SpillEnd = 0;
+}
+
+void UndoHistory::DropBack()
+{
+    while (m_aEntries.size() > m_szCursor)
+    {
+        auto& entry = m_aEntries.back();
+        m_i64MemBytes -= entry.strPacked.size();
+        // spilled records are in order, the file space of the last ones is reused
+        if (entry.i64FileOffset >= 0)
+            m_i64SpillEnd = entry.i64FileOffset;
+        m_aEntries.pop_back();
+    }
+    m_szFirstInMemory = min(m_szFirstInMemory, m_aEntries.size());
+}
+
+bool UndoHistory::SpillEntry(size_t szIndex)
+{
+    if (m_strSpillDir.empty() && !m_fsSpill.is_open())
+        return false;
+    if (!m_fsSpill.is_open())
+    {
+        if (!SysUtils::IsDirectory(m_strSpillDir) && !SysUtils::CreateDirectoryAt(m_strSpillDir, true))
+        {
+            Log(WARN) << "FAILED to create undo history directory '" << m_strSpillDir << "', old records are dropped instead." << endl;
+            m_strSpillDir.clear();
+            return false;
+        }
+        ostringstream oss;
+        oss << "UndoHistory_" << hex << (uintptr_t)this << "_" << chrono::steady_clock::now().time_since_epoch().count() << ".bin";
+        m_strSpillPath = SysUtils::JoinPath(m_strSpillDir, oss.str());
+        m_fsSpill.open(m_strSpillPath, ios::in|ios::out|ios::binary|ios::trunc);
+        if (!m_fsSpill.is_open())
+        {
+            Log(WARN) << "FAILED to create undo history file '" << m_strSpillPath << "', old records are dropped instead." << endl;
+            m_strSpillDir.clear();
+            return false;
+        }
+        m_i64SpillEnd = 0;
+    }
+
+    // the records dropped from the head of the file leave a gap, the spilled ones are moved to the file start once
+    // the gap is larger than them
+    if (szIndex > 0 && m_aEntries[0].i64FileOffset > m_i64SpillEnd-m_aEntries[0].i64FileOffset)
+    {
+        string strBuffer;
+        int64_t i64WritePos = 0;
+        for (size_t i = 0; i < szIndex; i++)
+        {
+            auto& entry = m_aEntries[i];
+            strBuffer.resize(entry.u32FileSize);
+            m_fsSpill.seekg(entry.i64FileOffset);
+            m_fsSpill.read(&strBuffer[0], strBuffer.size());
+            m_fsSpill.seekp(i64WritePos);
+            m_fsSpill.write(strBuffer.data(), strBuffer.size());
+            entry.i64FileOffset = i64WritePos;
+            i64WritePos += entry.u32FileSize;
+        }
+        m_i64SpillEnd = i64WritePos;
+    }
+
+    auto& entry = m_aEntries[szIndex];
+    m_fsSpill.seekp(m_i64SpillEnd);
+    m_fsSpill.write(entry.strPacked.data(), entry.strPacked.size());
+    m_fsSpill.flush();
+    if (!m_fsSpill.good())
+    {
+        Log(WARN) << "FAILED to write undo history file '" << m_strSpillPath << "', old records are dropped instead." << endl;
+        m_fsSpill.clear();
+        m_strSpillDir.clear();
+        return false;
+    }
+    entry.i64FileOffset = m_i64SpillEnd;
+    entry.u32FileSize = (uint32_t)entry.strPacked.size();
+    m_i64SpillEnd += entry.u32FileSize;
+    m_i64MemBytes -= entry.strPacked.size();
+    string().swap(entry.strPacked);
+    m_szFirstInMemory = szIndex+1;
+    return true;
+}
+
+bool UndoHistory::LoadEntry(size_t szIndex, imgui_json::value& jnRecord)
+{
+    const auto& entry = m_aEntries[szIndex];
+    string strSpilled;
+    if (entry.i64FileOffset >= 0)
+    {
+        strSpilled.resize(entry.u32FileSize);
+        m_fsSpill.clear();
+        m_fsSpill.seekg(entry.i64FileOffset);
+        if (!m_fsSpill.read(&strSpilled[0], strSpilled.size()))
+        {
+            m_fsSpill.clear();
+            return false;
+        }
+    }
+    string strText;
+    if (!Unpack(entry.i64FileOffset >= 0 ? strSpilled : entry.strPacked, strText))
+        return false;
+    jnRecord = imgui_json::value::parse(strText);
+    return !jnRecord.is_discarded();
+}
+
+void UndoHistory::CloseSpillFile()
+{
+    if (m_fsSpill.is_open())
+    {
+        m_fsSpill.close();
+        SysUtils::DeleteFileAt(m_strSpillPath);
+    }
+    m_strSpillPath.clear();
+    m_i64SpillEnd = 0;
+}
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <imgui_json.h>
+
+namespace MEC
+{
+    // Undo history of the timeline. Each record is kept as its compact json text packed by a small LZ77 coder, the
+    // oldest records beyond the memory budget are spilled to a file under the cache directory and read back when they
+    // are undone, the ones beyond the record budget are dropped. Undo and redo only unpack the one record they return,
+    // so their latency doesn't depend on the history length.
+    class UndoHistory
+    {
+    public:
+        using Holder = std::shared_ptr<UndoHistory>;
+        static Holder CreateInstance(int iMaxRecords, int64_t i64MaxMemBytes);
+        ~UndoHistory();
+
+        // Append 'jnRecord' at the current position, the records which could be redone are dropped
+        void Push(const imgui_json::value& jnRecord);
+        // Step back and return the record to undo, false if there is none
+        bool Undo(imgui_json::value& jnRecord);
+        // Return the record to redo and step forward, false if there is none
+        bool Redo(imgui_json::value& jnRecord);
+        void Clear();
+        void SetBudget(int iMaxRecords, int64_t i64MaxMemBytes);
+        // Records over the memory budget are dropped instead of spilled while the directory is empty or can't be written.
+        // The spill files left in the directory by a former run are removed the first time it's set.
+        void SetSpillDir(const std::string& strSpillDir);
+        const std::string& GetSpillDir() const { return m_strSpillDir; }
+        int GetRecordCount() const { return (int)m_aEntries.size(); }
+        int64_t GetMemoryBytes() const { return m_i64MemBytes; }
+
+        // Structural diff of two json values, 'Patch(jnFrom, Diff(jnFrom, jnTo))' gives back 'jnTo'.
+        // Unchanged object members and array elements are not stored in the diff. It's up to the caller what is diffed,
+        // the history itself stores each record as a whole.
+        static imgui_json::value Diff(const imgui_json::value& jnFrom, const imgui_json::value& jnTo);
+        static imgui_json::value Patch(const imgui_json::value& jnFrom, const imgui_json::value& jnDiff);
+        static void Pack(const std::string& strIn, std::string& strOut);
+        static bool Unpack(const std::string& strIn, std::string& strOut);
+
+    private:
+        UndoHistory(int iMaxRecords, int64_t i64MaxMemBytes) : m_iMaxRecords(iMaxRecords), m_i64MaxMemBytes(i64MaxMemBytes) {}
+        void EnforceBudget();
+        void DropFront();
+        // drop the records from the cursor to the end
+        void DropBack();
+        bool SpillEntry(size_t szIndex);
+        bool LoadEntry(size_t szIndex, imgui_json::value& jnRecord);
+        void CloseSpillFile();
+        static void RemoveStaleSpillFiles(const std::string& strSpillDir);
+
+    private:
+        struct Entry
+        {
+            std::string strPacked;          // empty if the record is spilled
+            int64_t i64FileOffset {-1};     // position in the spill file, -1 if the record is in memory
+            uint32_t u32FileSize {0};
+        };
+        std::deque<Entry> m_aEntries;       // from the oldest record
+        size_t m_szCursor {0};              // index of the record to redo, records before it are the ones to undo
+        int m_iMaxRecords;
+        int64_t m_i64MaxMemBytes;
+        int64_t m_i64MemBytes {0};
+        std::string m_strSpillDir;
+        std::string m_strSpillPath;
+        std::fstream m_fsSpill;
+        int64_t m_i64SpillEnd {0};
+        size_t m_szFirstInMemory {0};       // entries before it are spilled
+    };
+}
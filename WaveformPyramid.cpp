@@ -0,0 +1,95 @@
+#include <cfloat>
+#include <algorithm>
+#include "WaveformPyramid.h"
+
+using namespace std;
+
+namespace MEC
+{
+static const int FIRST_LEVEL_SAMPLES = 4;       // waveform samples per entry of level 0
+static const int MIN_ENTRIES_PER_PIXEL = 4;     // finer level picked, so a span boundary is off by less than 1/4 pixel
+
+WaveformPyramid::Holder WaveformPyramid::CreateInstance(const vector<vector<float>>& aPcm)
+{
+    Holder hPyramid(new WaveformPyramid());
+    hPyramid->m_i64SampleCount = aPcm.empty() ? 0 : (int64_t)aPcm[0].size();
+    hPyramid->m_aChannels.resize(aPcm.size());
+    for (size_t ch = 0; ch < aPcm.size(); ch++)
+    {
+        const auto& aSamples = aPcm[ch];
+        auto& aLevels = hPyramid->m_aChannels[ch];
+        const size_t szCount = (aSamples.size()+FIRST_LEVEL_SAMPLES-1)/FIRST_LEVEL_SAMPLES;
+        if (szCount < 2)
+            continue;
+        aLevels.emplace_back();
+        auto& first = aLevels.back();
+        first.aMin.resize(szCount);
+        first.aMax.resize(szCount);
+        for (size_t i = 0; i < szCount; i++)
+        {
+            const auto itBegin = aSamples.begin()+i*FIRST_LEVEL_SAMPLES;
+            const auto itEnd = aSamples.begin()+min(aSamples.size(), (i+1)*FIRST_LEVEL_SAMPLES);
+            const auto minmax = minmax_element(itBegin, itEnd);
+            first.aMin[i] = *minmax.first;
+            first.aMax[i] = *minmax.second;
+        }
+        // each next level halves the previous one, until it has a single entry
+        while (aLevels.back().aMin.size() > 1)
+        {
+            const auto& prev = aLevels.back();
+            Level next;
+            const size_t szPrev = prev.aMin.size();
+            const size_t szNext = (szPrev+1)/2;
+            next.aMin.resize(szNext);
+            next.aMax.resize(szNext);
+            for (size_t i = 0; i < szNext; i++)
+            {
+                const size_t j = min(i*2+1, szPrev-1);
+                next.aMin[i] = min(prev.aMin[i*2], prev.aMin[j]);
+                next.aMax[i] = max(prev.aMax[i*2], prev.aMax[j]);
+            }
+            aLevels.push_back(move(next));
+        }
+    }
+    return hPyramid;
+}
+
+bool WaveformPyramid::Resample(int iChannel, int iStartSample, int iSamplesPerPixel, int iPixels, float* pMax, float* pMin) const
+{
+    if (iChannel < 0 || iChannel >= (int)m_aChannels.size())
+        return false;
+    const auto& aLevels = m_aChannels[iChannel];
+    // the coarsest level which still has 'MIN_ENTRIES_PER_PIXEL' entries per pixel
+    int iLevel = -1;
+    int64_t i64EntrySamples = FIRST_LEVEL_SAMPLES;
+    while (iLevel+1 < (int)aLevels.size() && i64EntrySamples*MIN_ENTRIES_PER_PIXEL <= iSamplesPerPixel)
+    {
+        iLevel++;
+        i64EntrySamples <<= 1;
+    }
+    if (iLevel < 0)
+        return false;
+    i64EntrySamples >>= 1;
+    const auto& level = aLevels[iLevel];
+    const int64_t i64Entries = (int64_t)level.aMin.size();
+    for (int i = 0; i < iPixels; i++)
+    {
+        const int64_t i64SpanStart = (int64_t)iStartSample+(int64_t)i*iSamplesPerPixel;
+        float fMax = -FLT_MAX;
+        float fMin = FLT_MAX;
+        if (i64SpanStart < m_i64SampleCount)
+        {
+            const int64_t i64First = i64SpanStart/i64EntrySamples;
+            const int64_t i64Last = min(i64Entries, (i64SpanStart+iSamplesPerPixel+i64EntrySamples-1)/i64EntrySamples);
+            for (int64_t j = i64First; j < i64Last; j++)
+            {
+                if (fMax < level.aMax[j]) fMax = level.aMax[j];
+                if (fMin > level.aMin[j]) fMin = level.aMin[j];
+            }
+        }
+        pMax[i] = fMax;
+        pMin[i] = fMin;
+    }
+    return true;
+}
+}
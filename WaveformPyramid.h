@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <memory>
+
+namespace MEC
+{
+    // Min/max peaks of an overview waveform at power-of-2 reductions. Level i holds one min/max pair per 4<<i samples,
+    // so all levels together take as much memory as the waveform itself. Resampling for display reads the level with
+    // a few entries per pixel, it costs O(pixels) at any zoom instead of O(samples in view).
+    class WaveformPyramid
+    {
+    public:
+        using Holder = std::shared_ptr<WaveformPyramid>;
+        static Holder CreateInstance(const std::vector<std::vector<float>>& aPcm);
+
+        // Fill 'pMax'/'pMin' with the peaks of 'iPixels' spans of 'iSamplesPerPixel' waveform samples, starting at
+        // 'iStartSample'. Spans beyond the end get -FLT_MAX/FLT_MAX, as when resampling the raw waveform.
+        // Returns false if 'iSamplesPerPixel' is too small for the first level, the raw waveform should be used then.
+        bool Resample(int iChannel, int iStartSample, int iSamplesPerPixel, int iPixels, float* pMax, float* pMin) const;
+        int GetChannelCount() const { return (int)m_aChannels.size(); }
+        int64_t GetSampleCount() const { return m_i64SampleCount; }
+
+    private:
+        WaveformPyramid() = default;
+
+    private:
+        struct Level
+        {
+            std::vector<float> aMin;
+            std::vector<float> aMax;
+        };
+        std::vector<std::vector<Level>> m_aChannels;            // channel -> levels, from the finest
+        int64_t m_i64SampleCount {0};
+    };
+}
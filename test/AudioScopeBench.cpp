@@ -0,0 +1,213 @@
+// Micro-benchmark of the audio scope analysis done on every mixed audio block. It compares the per-block allocating
+// implementation TimeLine::CalculateAudioScopeData() used before with the preallocated workspace and the kernels of
+// AudioScopeKernels.cpp, including the copy into the mats read by the UI. Returns 1 if the speedup is less than 5x, the
+// kernel results are checked by audio_scope_kernels_test.
+#include <imgui.h>
+#include <imgui_internal.h>
+#include <imgui_fft.h>
+#include <immat.h>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include "AudioScopeKernels.h"
+
+struct ScopeChannel
+{
+    ImGui::ImMat m_wave;
+    ImGui::ImMat m_fft;
+    ImGui::ImMat m_db;
+    ImGui::ImMat m_DBShort;
+    ImGui::ImMat m_DBLong;
+    ImGui::ImMat m_Spectrogram;
+    int m_SpectrogramRow {0};
+    float m_decibel {0};
+    int m_DBMaxIndex {-1};
+};
+
+// the implementation before the scope workspace, LISSAJOUS vectorscope
+static void LegacyScope(const ImGui::ImMat& mat_in, std::vector<ScopeChannel>& channels, ImGui::ImMat& vector)
+{
+    const int fft_size = mat_in.w  > 256 ? 256 : mat_in.w > 128 ? 128 : 64;
+    const int ch = mat_in.c;
+    ImGui::ImMat mat;
+    mat.create_type(fft_size, 1, ch, IM_DT_FLOAT32);
+    float** ppDstPtrs = new float*[ch];
+    for (int i = 0; i < ch; i++)
+        ppDstPtrs[i] = (float*)mat.data+mat.w*i;
+    if (mat_in.type == IM_DT_FLOAT32)
+    {
+        const float* pSrcPtr = (const float*)mat_in.data;
+        for (int i = 0; i < fft_size; i++)
+            for (int j = 0; j < ch; j++)
+                *ppDstPtrs[j]++ = *pSrcPtr++;
+    }
+    else
+    {
+        const int16_t* pSrcPtr = (const int16_t*)mat_in.data;
+        for (int i = 0; i < fft_size; i++)
+            for (int j = 0; j < ch; j++)
+                *ppDstPtrs[j]++ = (float)(*pSrcPtr++)/INT16_MAX;
+    }
+    delete [] ppDstPtrs;
+
+    for (int i = 0; i < mat.c; i++)
+    {
+        auto & channel_data = channels[i];
+        channel_data.m_wave.clone_from(mat.channel(i));
+        channel_data.m_fft.clone_from(mat.channel(i));
+        ImGui::ImRFFT((float *)channel_data.m_fft.data, channel_data.m_fft.w, true);
+        channel_data.m_db.create_type((mat.w >> 1) + 1, IM_DT_FLOAT32);
+        channel_data.m_DBMaxIndex = ImGui::ImReComposeDB((float*)channel_data.m_fft.data, (float *)channel_data.m_db.data, mat.w, false);
+        channel_data.m_DBShort.create_type(20, IM_DT_FLOAT32);
+        ImGui::ImReComposeDBShort((float*)channel_data.m_fft.data, (float*)channel_data.m_DBShort.data, mat.w);
+        channel_data.m_DBLong.create_type(76, IM_DT_FLOAT32);
+        ImGui::ImReComposeDBLong((float*)channel_data.m_fft.data, (float*)channel_data.m_DBLong.data, mat.w);
+        channel_data.m_decibel = ImGui::ImDoDecibel((float*)channel_data.m_fft.data, mat.w);
+        if (channel_data.m_Spectrogram.w != (mat.w >> 1) + 1)
+            channel_data.m_Spectrogram.create_type((mat.w >> 1) + 1, 256, 4, IM_DT_INT8);
+        auto w = channel_data.m_Spectrogram.w;
+        auto c = channel_data.m_Spectrogram.c;
+        memmove(channel_data.m_Spectrogram.data, (char *)channel_data.m_Spectrogram.data + w * c, channel_data.m_Spectrogram.total() - w * c);
+        uint32_t * last_line = (uint32_t *)channel_data.m_Spectrogram.row_c<uint8_t>(255);
+        for (int n = 0; n < w; n++)
+        {
+            float value = channel_data.m_db.at<float>(n) * M_SQRT2 + 64;
+            value = ImClamp(value, -64.f, 63.f);
+            float light = (value + 64) / 127.f;
+            value = (int)((value + 64) + 170) % 255;
+            auto hue = value / 255.f;
+            auto color = ImColor::HSV(hue, 1.0, light);
+            last_line[n] = color;
+        }
+    }
+    if (vector.empty())
+    {
+        vector.create_type(256, 256, 4, IM_DT_INT8);
+        vector.fill((int8_t)0);
+        vector.elempack = 4;
+    }
+    float hw = vector.w / 2;
+    float hh = vector.h / 2;
+    vector -= 64;
+    for (int n = 0; n < mat.w; n++)
+    {
+        float s1 = channels[0].m_wave.at<float>(n, 0);
+        float s2 = channels[1].m_wave.at<float>(n, 0);
+        int x = ((s2 - s1) / 2 + 1) * hw;
+        int y = (1.0 - (s1 + s2) / 2) * hh;
+        x = ImClamp(x, 0, vector.w - 1);
+        y = ImClamp(y, 0, vector.h - 1);
+        uint8_t r = ImClamp(vector.at<uint8_t>(x, y, 0) + 30, 0, 255);
+        uint8_t g = ImClamp(vector.at<uint8_t>(x, y, 1) + 50, 0, 255);
+        uint8_t b = ImClamp(vector.at<uint8_t>(x, y, 2) + 30, 0, 255);
+        vector.set_pixel(x, y, ImPixel(r / 255.0, g / 255.0, b / 255.0, 1.f));
+    }
+}
+
+static void CopyScopeMat(const ImGui::ImMat& src, ImGui::ImMat& dst)
+{
+    if (dst.empty() || dst.dims != src.dims || dst.w != src.w || dst.h != src.h || dst.c != src.c || dst.type != src.type)
+        dst = src.clone();
+    else
+        memcpy(dst.data, src.data, src.total()*src.elemsize);
+}
+
+static void WorkspaceScope(const ImGui::ImMat& mat_in, MEC::AudioScopeWorkspace& ws, std::vector<MEC::SpectrogramRing>& spectrograms,
+        const uint32_t* spectrogramLut, MEC::VectorScopeImage& vector, std::vector<ScopeChannel>& channels, ImGui::ImMat& vectorOut)
+{
+    const int fft_size = mat_in.w  > 256 ? 256 : mat_in.w > 128 ? 128 : 64;
+    const int ch = mat_in.c;
+    ws.Prepare(ch, fft_size);
+    MEC::PcmToPlanarFloat(mat_in, ch, fft_size, ws.aWavePtrs.data());
+    for (int i = 0; i < ch; i++)
+    {
+        float* pFft = (float*)ws.aFfts[i].data;
+        memcpy(pFft, ws.aWavePtrs[i], fft_size*sizeof(float));
+        ImGui::ImRFFT(pFft, fft_size, true);
+        ws.aDbMaxIndices[i] = ImGui::ImReComposeDB(pFft, (float *)ws.aDbs[i].data, fft_size, false);
+        ImGui::ImReComposeDBShort(pFft, (float*)ws.aDbShorts[i].data, fft_size);
+        ImGui::ImReComposeDBLong(pFft, (float*)ws.aDbLongs[i].data, fft_size);
+        ws.aDecibels[i] = ImGui::ImDoDecibel(pFft, fft_size);
+        spectrograms[i].AddRow((const float*)ws.aDbs[i].data, (fft_size >> 1) + 1, 0.f, spectrogramLut);
+    }
+    vector.Fade(64);
+    vector.Accumulate(ws.aWavePtrs[0], ws.aWavePtrs[1], fft_size, 0, 1.f, 256, 256, ws.aVectorOffsets);
+    // publish as the timeline does, with the UI taking every image
+    for (int i = 0; i < ch; i++)
+    {
+        CopyScopeMat(ws.aWaves[i], channels[i].m_wave);
+        CopyScopeMat(ws.aFfts[i], channels[i].m_fft);
+        CopyScopeMat(ws.aDbs[i], channels[i].m_db);
+        CopyScopeMat(ws.aDbShorts[i], channels[i].m_DBShort);
+        CopyScopeMat(ws.aDbLongs[i], channels[i].m_DBLong);
+        spectrograms[i].CopyRowsTo(channels[i].m_Spectrogram, channels[i].m_SpectrogramRow);
+    }
+    vector.CopyTo(vectorOut);
+}
+
+template <typename Func>
+static double MeasureUsPerBlock(const std::vector<ImGui::ImMat>& blocks, int iterations, Func&& func)
+{
+    // warm up, so the allocations of the first blocks don't count for the workspace path
+    for (auto& block : blocks)
+        func(block);
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        func(blocks[i%blocks.size()]);
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now()-t0;
+    return elapsed.count()/iterations;
+}
+
+int main(int argc, char** argv)
+{
+    const int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+    const int samples = 1024, channels = 2;
+    bool allPassed = true;
+    for (auto type : {IM_DT_FLOAT32, IM_DT_INT16})
+    {
+        // interleaved blocks of noise, as mixed by the preview audio reader
+        std::vector<ImGui::ImMat> blocks(16);
+        for (auto& block : blocks)
+        {
+            block.create_type(samples, 1, channels, type);
+            block.elempack = channels;
+            for (int i = 0; i < samples*channels; i++)
+            {
+                const float v = (float)rand()/RAND_MAX*2-1;
+                if (type == IM_DT_FLOAT32)
+                    ((float*)block.data)[i] = v;
+                else
+                    ((int16_t*)block.data)[i] = (int16_t)(v*INT16_MAX);
+            }
+        }
+
+        std::vector<ScopeChannel> legacyChannels(channels);
+        ImGui::ImMat legacyVector;
+        const double legacyUs = MeasureUsPerBlock(blocks, iterations, [&] (const ImGui::ImMat& block) {
+            LegacyScope(block, legacyChannels, legacyVector);
+        });
+
+        MEC::AudioScopeWorkspace ws;
+        std::vector<MEC::SpectrogramRing> spectrograms(channels);
+        uint32_t spectrogramLut[256];
+        MEC::BuildSpectrogramLut(1.f, spectrogramLut);
+        std::vector<ScopeChannel> uiChannels(channels);
+        MEC::VectorScopeImage vector;
+        ImGui::ImMat uiVector;
+        const double workspaceUs = MeasureUsPerBlock(blocks, iterations, [&] (const ImGui::ImMat& block) {
+            WorkspaceScope(block, ws, spectrograms, spectrogramLut, vector, uiChannels, uiVector);
+        });
+
+        const double speedup = legacyUs/workspaceUs;
+        const bool passed = speedup >= 5;
+        allPassed &= passed;
+        std::cout << (type == IM_DT_FLOAT32 ? "float32" : "int16  ") << " stereo " << samples << " samples: legacy "
+                << std::fixed << std::setprecision(2) << legacyUs << "us/block, workspace " << workspaceUs << "us/block, speedup "
+                << speedup << "x " << (passed ? "PASS" : "FAIL") << std::endl;
+    }
+    return allPassed ? 0 : 1;
+}
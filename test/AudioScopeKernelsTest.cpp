@@ -0,0 +1,264 @@
+// Checks the kernels of AudioScopeKernels.cpp, which have SSE2 and NEON paths, against plain scalar references.
+// Block sizes are chosen so that both the vector loops and their scalar tails run. Returns 1 if any check fails.
+#include <imgui.h>
+#include <immat.h>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <vector>
+#include "AudioScopeKernels.h"
+
+static int g_iFailures = 0;
+
+static void Check(bool bPassed, const std::string& strName)
+{
+    if (!bPassed)
+    {
+        g_iFailures++;
+        std::cout << "FAIL " << strName << std::endl;
+    }
+}
+
+static float RandomSample()
+{
+    return (float)rand()/RAND_MAX*2-1;
+}
+
+static void TestPcmToPlanarFloat()
+{
+    for (auto type : {IM_DT_FLOAT32, IM_DT_INT16})
+    for (int channels : {1, 2, 3})
+    for (bool interleaved : {true, false})
+    for (int samples : {1, 7, 64, 67})
+    {
+        ImGui::ImMat pcm;
+        pcm.create_type(samples, 1, channels, type);
+        pcm.elempack = interleaved ? channels : 1;
+        std::vector<std::vector<float>> expected(channels, std::vector<float>(samples));
+        for (int j = 0; j < channels; j++)
+        {
+            for (int i = 0; i < samples; i++)
+            {
+                // interleaved is sample major, planar is channel major
+                const int idx = interleaved ? i*channels+j : j*samples+i;
+                const float v = RandomSample();
+                if (type == IM_DT_FLOAT32)
+                {
+                    ((float*)pcm.data)[idx] = v;
+                    expected[j][i] = v;
+                }
+                else
+                {
+                    const int16_t s = (int16_t)(v*INT16_MAX);
+                    ((int16_t*)pcm.data)[idx] = s;
+                    expected[j][i] = (float)s/INT16_MAX;
+                }
+            }
+        }
+        std::vector<std::vector<float>> planar(channels, std::vector<float>(samples, -2.f));
+        std::vector<float*> ptrs(channels);
+        for (int j = 0; j < channels; j++)
+            ptrs[j] = planar[j].data();
+        bool passed = MEC::PcmToPlanarFloat(pcm, channels, samples, ptrs.data());
+        for (int j = 0; j < channels && passed; j++)
+            for (int i = 0; i < samples && passed; i++)
+                passed = fabsf(planar[j][i]-expected[j][i]) <= 1e-6f;
+        Check(passed, std::string("PcmToPlanarFloat ")+(type == IM_DT_FLOAT32 ? "float32 " : "int16 ")+std::to_string(channels)+
+                (interleaved ? " interleaved " : " planar ")+std::to_string(samples));
+    }
+    ImGui::ImMat pcm;
+    pcm.create_type(16, 1, 2, IM_DT_INT32);
+    float dummy[16];
+    float* ptrs[2] = {dummy, dummy};
+    Check(!MEC::PcmToPlanarFloat(pcm, 2, 16, ptrs), "PcmToPlanarFloat rejects int32");
+}
+
+// pixel offset of one sample pair, as the vectorscope of the timeline maps it
+static int32_t ReferenceVectorScopeOffset(float s1, float s2, int iMode, float fZoom, int iWidth, int iHeight)
+{
+    const float hw = iWidth / 2;
+    const float hh = iHeight / 2;
+    float x, y;
+    if (iMode == 0)
+    {
+        x = ((s2 - s1) * fZoom / 2 + 1) * hw;
+        y = (1.0f - (s1 + s2) * fZoom / 2) * hh;
+    }
+    else if (iMode == 1)
+    {
+        x = (s2 * fZoom + 1) * hw;
+        y = (s1 * fZoom + 1) * hh;
+    }
+    else
+    {
+        const float sx = s2 * fZoom;
+        const float sy = s1 * fZoom;
+        const float cx = sx * sqrtf(1 - 0.5f * sy * sy);
+        const float cy = sy * sqrtf(1 - 0.5f * sx * sx);
+        const float sign = cx + cy < 0 ? -1.f : cx + cy > 0 ? 1.f : 0.f;
+        x = hw + hw * sign * (cx - cy) * .7f;
+        y = iHeight - iHeight * fabsf(cx + cy) * .7f;
+    }
+    if (!(x > 0)) x = 0;
+    if (!(y > 0)) y = 0;
+    x = std::min(x, (float)(iWidth - 1));
+    y = std::min(y, (float)(iHeight - 1));
+    return (int32_t)y * iWidth + (int32_t)x;
+}
+
+static void TestAccumulateVectorScope()
+{
+    const int width = 256, height = 256;
+    for (int mode : {0, 1, 2})
+    for (float zoom : {1.f, 2.5f})
+    for (int samples : {3, 64, 67})
+    {
+        std::vector<float> left(samples), right(samples);
+        for (int i = 0; i < samples; i++)
+        {
+            left[i] = RandomSample()*1.5f;
+            right[i] = RandomSample()*1.5f;
+        }
+        // out of range, silent and NaN samples end up clamped
+        left[0] = 0; right[0] = 0;
+        if (samples > 2)
+        {
+            left[1] = std::numeric_limits<float>::quiet_NaN();
+            right[2] = -4.f;
+        }
+        std::vector<uint8_t> image(width*height*4), expected(width*height*4);
+        for (size_t i = 0; i < image.size(); i++)
+            image[i] = expected[i] = (uint8_t)(rand()&0xff);
+        for (int i = 0; i < samples; i++)
+        {
+            uint8_t* pPixel = expected.data() + ReferenceVectorScopeOffset(left[i], right[i], mode, zoom, width, height) * 4;
+            pPixel[0] = (uint8_t)std::min(pPixel[0] + 30, 255);
+            pPixel[1] = (uint8_t)std::min(pPixel[1] + 50, 255);
+            pPixel[2] = (uint8_t)std::min(pPixel[2] + 30, 255);
+            pPixel[3] = 255;
+        }
+        std::vector<int32_t> offsets;
+        MEC::AccumulateVectorScope(left.data(), right.data(), samples, mode, zoom, image.data(), width, height, offsets);
+        Check(image == expected, "AccumulateVectorScope mode "+std::to_string(mode)+" zoom "+std::to_string(zoom)+" "+std::to_string(samples));
+    }
+}
+
+static void TestVectorScopeImage()
+{
+    const int samples = 256;
+    for (int amount : {64, 5})
+    {
+        MEC::VectorScopeImage image;
+        ImGui::ImMat dst;
+        std::vector<uint8_t> faded;                 // the whole image faded on each block, as the timeline did before
+        std::vector<float> left(samples), right(samples);
+        std::vector<int32_t> offsets;
+        bool imagePassed = true, litPassed = true, copyPassed = true;
+        for (int n = 0; n < 200 && imagePassed; n++)
+        {
+            // the size changes once, which clears the image
+            const int width = n < 20 ? 128 : 256, height = n < 20 ? 64 : 256;
+            if (n == 0 || n == 20)
+                faded.assign((size_t)width*height*4, 0);
+            for (int i = 0; i < samples; i++)
+            {
+                left[i] = RandomSample();
+                right[i] = RandomSample();
+            }
+            image.Fade((uint8_t)amount);
+            for (auto& v : faded)
+                v = (uint8_t)std::max((int)v-amount, 0);
+            image.Accumulate(left.data(), right.data(), samples, n%3, 1.f, width, height, offsets);
+            MEC::AccumulateVectorScope(left.data(), right.data(), samples, n%3, 1.f, faded.data(), width, height, offsets);
+            imagePassed = memcmp(image.mImage.data, faded.data(), faded.size()) == 0;
+
+            size_t lit = 0;
+            for (size_t i = 0; i < faded.size(); i += 4)
+                lit += (faded[i] | faded[i+1] | faded[i+2] | faded[i+3]) != 0;
+            litPassed = litPassed && lit == image.aLitPixels.size();
+            // long gaps between the copies, as while the UI doesn't take the images, let the dark pixels overflow into a full copy
+            if (n%11 == 0 || (n > 100 && n < 150) || n == 199)
+            {
+                image.CopyTo(dst);
+                copyPassed = copyPassed && memcmp(dst.data, faded.data(), faded.size()) == 0;
+            }
+        }
+        const std::string name = "VectorScopeImage fade by "+std::to_string(amount);
+        Check(imagePassed, name+" matches the faded image");
+        Check(litPassed, name+" lit pixels");
+        Check(copyPassed, name+" copies");
+    }
+}
+
+static void TestSpectrogramLut()
+{
+    // integer levels hit the LUT exactly, they must give the colors of the original per-pixel HSV conversion
+    uint32_t lut[256];
+    MEC::BuildSpectrogramLut(1.f, lut);
+    bool passed = true;
+    for (int level = 0; level <= 127 && passed; level++)
+    {
+        const float value = (float)level;
+        const float light = value / 127.f;
+        const float hue = (int)((value + 170)) % 255 / 255.f;
+        passed = lut[level*2] == (uint32_t)ImColor::HSV(hue, 1.0, light);
+    }
+    Check(passed, "BuildSpectrogramLut matches HSV");
+}
+
+static void TestSpectrogramRing()
+{
+    const int bins = 129;
+    const float offset = 3.f;
+    uint32_t lut[256];
+    MEC::BuildSpectrogramLut(0.8f, lut);
+    MEC::SpectrogramRing ring;
+    // the scrolling image the ring replaces, the newest row at the bottom
+    std::vector<uint32_t> scrolling((size_t)bins*MEC::SpectrogramRing::ROWS, 0);
+    ImGui::ImMat dst;
+    int dstWriteRow = 0;
+    bool passed = true;
+    std::vector<float> db(bins);
+    for (int n = 0; n < 300 && passed; n++)
+    {
+        for (auto& v : db)
+            v = RandomSample()*80;
+        ring.AddRow(db.data(), bins, offset, lut);
+        memmove(scrolling.data(), scrolling.data()+bins, (scrolling.size()-bins)*sizeof(uint32_t));
+        uint32_t* lastRow = scrolling.data()+scrolling.size()-bins;
+        for (int i = 0; i < bins; i++)
+        {
+            // (clamp(db * sqrt2 + 64 + offset, -64, 63) + 64) * 2
+            const float idx = (db[i] * (float)M_SQRT2 + 128 + offset) * 2;
+            lastRow[i] = lut[idx > 0 ? (int)std::min(idx, 254.f) : 0];
+        }
+        // copy at uneven intervals, so both the partial and the full copies run
+        if (n%7 != 3 && n != 299)
+            continue;
+        ring.CopyRowsTo(dst, dstWriteRow);
+        for (int row = 0; row < MEC::SpectrogramRing::ROWS && passed; row++)
+        {
+            const int ringRow = (dstWriteRow + row) % MEC::SpectrogramRing::ROWS;
+            passed = memcmp((const uint32_t*)dst.data + (size_t)ringRow*bins, scrolling.data() + (size_t)row*bins, bins*sizeof(uint32_t)) == 0;
+        }
+    }
+    Check(passed, "SpectrogramRing matches the scrolling image");
+}
+
+int main(int argc, char** argv)
+{
+    srand(1);
+    TestPcmToPlanarFloat();
+    TestAccumulateVectorScope();
+    TestVectorScopeImage();
+    TestSpectrogramLut();
+    TestSpectrogramRing();
+    if (g_iFailures > 0)
+        std::cout << g_iFailures << " audio scope kernel check(s) FAILED" << std::endl;
+    else
+        std::cout << "All audio scope kernel checks passed" << std::endl;
+    return g_iFailures > 0 ? 1 : 0;
+}
@@ -0,0 +1,147 @@
+// Round trips of the packing and the json diff of UndoHistory.cpp, and a history spilling to the directory given as
+// the first argument, the current one by default. Returns 1 if any check fails.
+#include <imgui_json.h>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <FileSystemUtils.h>
+#include "UndoHistory.h"
+
+using MEC::UndoHistory;
+
+static int g_iFailures = 0;
+
+static void Check(bool bPassed, const std::string& strName)
+{
+    if (!bPassed)
+    {
+        g_iFailures++;
+        std::cout << "FAIL " << strName << std::endl;
+    }
+}
+
+static void CheckPackRoundTrip(const std::string& strIn, const std::string& strName, size_t szMaxPacked)
+{
+    std::string strPacked, strOut;
+    UndoHistory::Pack(strIn, strPacked);
+    Check(UndoHistory::Unpack(strPacked, strOut) && strOut == strIn, strName + " round trip");
+    Check(strPacked.size() <= szMaxPacked, strName + " packed size " + std::to_string(strPacked.size()));
+    // a truncated input must be refused, not read past its end
+    if (!strPacked.empty())
+        Check(!UndoHistory::Unpack(strPacked.substr(0, strPacked.size()-1), strOut), strName + " truncated");
+}
+
+static void TestPack()
+{
+    CheckPackRoundTrip("", "empty", 8);
+    CheckPackRoundTrip("abc", "shorter than a match", 8);
+
+    // random bytes have no matches, the output is the literals plus their count
+    std::string strRandom(4096, '\0');
+    for (auto& c : strRandom)
+        c = (char)(rand()&0xff);
+    CheckPackRoundTrip(strRandom, "incompressible", strRandom.size()+16);
+
+    // a match longer than its distance copies its own output
+    std::string strRepeat;
+    for (int i = 0; i < 1000; i++)
+        strRepeat += "ab";
+    CheckPackRoundTrip(strRepeat, "overlapping match", 32);
+    CheckPackRoundTrip(std::string(5000, 'x'), "single byte run", 32);
+
+    std::string strJson;
+    for (int i = 0; i < 200; i++)
+        strJson += "{\"ID\":" + std::to_string(1000+i) + ",\"Type\":\"Clip\",\"Start\":" + std::to_string(i*40) + "},";
+    CheckPackRoundTrip(strJson, "json text", strJson.size()*2/3);
+}
+
+static void CheckDiffRoundTrip(const std::string& strFrom, const std::string& strTo, const std::string& strName)
+{
+    const auto jnFrom = imgui_json::value::parse(strFrom);
+    const auto jnTo = imgui_json::value::parse(strTo);
+    const auto jnDiff = UndoHistory::Diff(jnFrom, jnTo);
+    const auto jnPatched = UndoHistory::Patch(jnFrom, jnDiff);
+    Check(jnPatched.dump() == jnTo.dump(), strName + " patched " + jnPatched.dump() + " from diff " + jnDiff.dump());
+}
+
+static void TestDiff()
+{
+    CheckDiffRoundTrip("{\"a\":1,\"b\":[1,2]}", "{\"a\":1,\"b\":[1,2]}", "unchanged");
+    const auto jnSame = imgui_json::value::parse("{\"a\":1,\"b\":[1,2]}");
+    const auto jnEmptyDiff = UndoHistory::Diff(jnSame, jnSame);
+    Check(jnEmptyDiff.is_object() && jnEmptyDiff.get<imgui_json::object>().empty(), "unchanged diff is empty");
+
+    CheckDiffRoundTrip("{\"a\":1,\"b\":2}", "{\"a\":1,\"b\":2,\"c\":3}", "member added");
+    CheckDiffRoundTrip("{\"a\":1,\"b\":2}", "{\"a\":1}", "member deleted");
+    CheckDiffRoundTrip("{\"a\":1,\"b\":2}", "{\"a\":5,\"c\":{\"d\":true}}", "member added, deleted and replaced");
+    CheckDiffRoundTrip("{\"o\":{\"p\":1,\"q\":[1,2,3]}}", "{\"o\":{\"p\":2,\"q\":[1,7,3]}}", "nested change");
+
+    CheckDiffRoundTrip("[1,2,3,4,5]", "[1,2,9,9,4,5]", "array insert and replace");
+    CheckDiffRoundTrip("[1,2,3,4,5]", "[1,5]", "array remove");
+    CheckDiffRoundTrip("[1,2,3]", "[]", "array cleared");
+    CheckDiffRoundTrip("[]", "[1,2]", "array filled");
+    CheckDiffRoundTrip("[1,1,1]", "[1,1,1,1]", "array of equal elements grown");
+    CheckDiffRoundTrip("{\"n\":[{\"id\":1},{\"id\":2}]}", "{\"n\":[{\"id\":1},{\"id\":3},{\"id\":2}]}", "array of objects spliced");
+
+    CheckDiffRoundTrip("{\"x\":[1,2]}", "{\"x\":\"s\"}", "array to string");
+    CheckDiffRoundTrip("{\"x\":{\"y\":1}}", "{\"x\":[1]}", "object to array");
+    CheckDiffRoundTrip("{\"x\":null}", "{\"x\":2}", "null to number");
+    CheckDiffRoundTrip("1", "{\"a\":1}", "number to object");
+    CheckDiffRoundTrip("[1]", "\"s\"", "array to string at the top");
+}
+
+static void TestHistory(const std::string& strSpillDir)
+{
+    // a small memory budget spills most records, the record budget drops the oldest ones
+    auto hHistory = UndoHistory::CreateInstance(50, 4096);
+    hHistory->SetSpillDir(strSpillDir);
+    auto makeRecord = [] (int i) {
+        std::string strText = "{\"time\":" + std::to_string(i) + ",\"actions\":[{\"action\":\"MOVE_CLIP\",\"clip_id\":" + std::to_string(i) + ",\"payload\":\"";
+        for (int j = 0; j < 64; j++)
+            strText += (char)('a'+(rand()%26));
+        return imgui_json::value::parse(strText + "\"}]}");
+    };
+    std::vector<std::string> aRecords;
+    for (int i = 0; i < 80; i++)
+    {
+        auto jnRecord = makeRecord(i);
+        aRecords.push_back(jnRecord.dump());
+        hHistory->Push(jnRecord);
+    }
+    Check(hHistory->GetRecordCount() == 50, "record budget");
+    Check(hHistory->GetMemoryBytes() <= 4096, "memory budget");
+
+    imgui_json::value jnRecord;
+    bool bUndone = true;
+    for (int i = 79; i >= 60; i--)
+        bUndone = hHistory->Undo(jnRecord) && jnRecord.dump() == aRecords[i] && bUndone;
+    Check(bUndone, "undo");
+    bool bRedone = true;
+    for (int i = 60; i < 70; i++)
+        bRedone = hHistory->Redo(jnRecord) && jnRecord.dump() == aRecords[i] && bRedone;
+    Check(bRedone, "redo");
+
+    // a new record drops the ones to redo
+    auto jnNew = makeRecord(1000);
+    hHistory->Push(jnNew);
+    Check(!hHistory->Redo(jnRecord), "no redo after a push");
+    Check(hHistory->Undo(jnRecord) && jnRecord.dump() == jnNew.dump(), "undo after a push");
+    bUndone = true;
+    for (int i = 69; i >= 30; i--)
+        bUndone = hHistory->Undo(jnRecord) && jnRecord.dump() == aRecords[i] && bUndone;
+    Check(bUndone, "undo spilled records");
+}
+
+int main(int argc, char** argv)
+{
+    srand(1);
+    TestPack();
+    TestDiff();
+    TestHistory(SysUtils::JoinPath(argc > 1 ? argv[1] : ".", "UndoHistoryTest"));
+    if (g_iFailures > 0)
+        std::cout << g_iFailures << " undo history check(s) FAILED" << std::endl;
+    else
+        std::cout << "All undo history checks passed" << std::endl;
+    return g_iFailures > 0 ? 1 : 0;
+}